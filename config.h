@@ -0,0 +1,61 @@
+/* config.h -- configuration parameters for slowtty program.
+ * This file generated automatically from config.mk, so
+ * please don't edit.
+ * Author: Luis Colorado <luiscoloradourcola@gmail.com>
+ * Date: Sat Oct 17 01:22:09 UTC 2026
+ * Copyright: (c) 2015-2025 Luis Colorado.  All rights reserved.
+ */
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#define PROGRAM_NAME              "slowtty"
+#define BUILD_DATE                "Sat Oct 17 01:22:09 UTC 2026"
+#define DOC_DATE                  "Oct 2026"
+#define PACKAGE                   "slowtty"
+#define AUTHOR_NAME               "Luis Colorado"
+#define AUTHOR_EMAIL              "luiscoloradourcola@gmail.com"
+#define COPYRIGHT_YEARS           "2015-2025"
+#define PROGRAM_NAME_UC           "SLOWTTY"
+#define AUTHOR_CORP               "N.A."
+#define AUTHOR_SITE               "https://github.com/mojadita/slowtty"
+#define UQ_VERSION                0.9.1
+#define VERSION                   "0.9.1"
+#define VERSION_DATE              "Fri Apr 11 19:11:36 EEST 2025"
+#define OPERATING_SYSTEM          "UNIX"
+#define prefix                    "/usr/local"
+#define exec_prefix               "/usr/local"
+#define bindir                    "/usr/local/bin"
+#define sbindir                   "/usr/local/sbin"
+#define datarootdir               "/usr/local/share"
+#define pkgdatadir                "/usr/local/share/slowtty"
+#define mandir                    "/usr/local/share/man"
+#define man1dir                   "/usr/local/share/man/man1"
+#define docdir                    "/usr/local/share/doc/slowtty"
+#define vardir                    "/usr/local/var"
+#define logdir                    "/usr/local/var/log"
+#define UQ_HAS_PTY_H              1
+#define UQ_PATH_MAX               1024
+#define UQ_HAS_LIBUTIL_H          0
+#define UQ_HAS_EPOLL              0
+#define UQ_HAS_SPLICE             0
+#define UQ_HAS_TERMIOS2           0
+#define UQ_HAS_MEMFD              0
+#define UQ_MAX_PTY_NAME           64
+#define UQ_DEFAULT_BUFSIZ         64
+#define UQ_DEFAULT_FLAGS          (FLAG_DOWINCH)
+#define UQ_DEFAULT_BURST_MSEC     100
+#define UQ_USE_COLORS             1
+#define UQ_USE_LOCUS              1
+#define UQ_USE_DEB                1
+#define UQ_USE_INF                1
+#define UQ_USE_WRN                1
+#define UQ_USE_ERR                1
+#define UQ_USE_CRT                1
+#define UQ_NSTACK                 200000
+#define UQ_NPROG                  2000
+#define UQ_NFRAME                 100000
+#define UQ_TAB_SIZE               4
+#define UQ_LAST_TOKENS_SZ         64
+#define UQ_DEFAULT_LOGLEVEL       0
+
+#endif /* CONFIG_H */
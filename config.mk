@@ -34,10 +34,25 @@ logdir                   ?= $(vardir)/log
 UQ_HAS_PTY_H             ?=  0
 UQ_PATH_MAX              ?=  1024
 UQ_HAS_LIBUTIL_H         ?=  1
+# set to 1 on systems with epoll(7) and timerfd(2) (linux),
+# ppoll(2) is used otherwise.
+UQ_HAS_EPOLL             ?=  0
+# set to 1 on systems with splice(2) (linux), to move data from
+# input to output without copying it to user space.
+UQ_HAS_SPLICE            ?=  0
+# set to 1 on systems with termios2 (linux), to get line speeds
+# that have no Bxxx constant.
+UQ_HAS_TERMIOS2          ?=  0
+# set to 1 on systems with memfd_create(2), to map the large
+# ring buffers twice, back to back (no wraparound).
+UQ_HAS_MEMFD             ?=  0
 
 UQ_MAX_PTY_NAME          ?= 64
 UQ_DEFAULT_BUFSIZ        ?= 64
 UQ_DEFAULT_FLAGS         ?= (FLAG_DOWINCH)
+# milliseconds of chars a line can send at once, to catch up
+# with the ticks it has been woken up late for (-B).
+UQ_DEFAULT_BURST_MSEC    ?= 100
 
 UQ_USE_COLORS            ?=  1
 UQ_USE_LOCUS             ?=  1
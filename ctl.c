@@ -0,0 +1,350 @@
+/* ctl.c -- control socket of a session.
+ * Author: Luis Colorado <luiscoloradourcola@gmail.com>
+ * Copyright: (C) 2015-2025 LUIS COLORADO.  All rights reserved.
+ * License: BSD.
+ */
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "main.h"
+#include "ctl.h"
+#include "delay.h"
+#include "listen.h"
+
+#define CTL_ARGS            (4)     /* words of a command, at most */
+
+/* a client connected to the socket */
+struct ctl_conn {
+    struct loop_src  src;
+    struct ctl      *ctl;
+    char             in[CTL_LINE_MAX];
+                                /* command being read ... */
+    size_t           in_len;    /* ... its length */
+    char            *out;       /* answers not written yet ... */
+    size_t           out_len,   /* ... their length, ... */
+                     out_off,   /* ... the part written ... */
+                     out_cap;   /* ... and the size of out */
+    int              dead;      /* to close when possible */
+    struct ctl_conn *next,      /* list of clients of the socket */
+                   **pprev;
+};
+
+static const char ctl_help[] =
+    "rate [in|out] baud\n"
+    "frame [in|out] 8N1\n"
+    "pause [in|out]\n"
+    "resume [in|out]\n"
+    "flush [in|out]\n"
+    "stats\n"
+    "help\n";
+
+/* add to the answers of the client */
+static void
+ctl_printf(
+        struct ctl_conn    *cn,
+        const char         *fmt,
+        ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    int n = vsnprintf(NULL, 0, fmt, args);
+    va_end(args);
+    if (n < 0 || cn->dead)
+        return;
+    if (cn->out_len + n >= CTL_OUT_MAX) {
+        /* the client doesn't read the answers */
+        cn->dead = TRUE;
+        return;
+    }
+    if (cn->out_len + n + 1 > cn->out_cap) {
+        size_t cap = cn->out_cap ? cn->out_cap : CTL_LINE_MAX;
+        while (cap < cn->out_len + n + 1)
+            cap *= 2;
+        char *out = realloc(cn->out, cap);
+        if (!out) {
+            cn->dead = TRUE;
+            return;
+        }
+        cn->out     = out;
+        cn->out_cap = cap;
+    }
+    va_start(args, fmt);
+    vsnprintf(cn->out + cn->out_len, n + 1, fmt, args);
+    va_end(args);
+    cn->out_len += n;
+} /* ctl_printf */
+
+/* print the state and the counters of a channel */
+static void
+ctl_stats(
+        struct ctl_conn        *cn,
+        struct pthread_info    *pi)
+{
+    char   *buf = NULL;
+    size_t  len = 0;
+    FILE   *f   = open_memstream(&buf, &len);
+
+    ctl_printf(cn, "%s: baud=%lu bits=%d buffered=%zu inflight=%zu%s%s%s\n",
+        pi->name,
+        pi->line.baud,
+        delay_bits(&pi->line),
+        RB_SIZE(&pi->b),
+        pi->lag.len,
+        PI_TST(pi, PIFLG_PAUSE) ? " paused" : "",
+        PI_TST(pi, PIFLG_OSTOP | PIFLG_XOFF) ? " stopped" : "",
+        PI_TST(pi, PIFLG_DIFF)  ? " diffing" : "");
+    if (!f)
+        return;
+    stats_report(f, pi->st, "\n");
+    fclose(f);
+    ctl_printf(cn, "%s", buf);
+    free(buf);
+} /* ctl_stats */
+
+/* run a command line.
+ * @return NULL on success, or the reason of the error. */
+static const char *
+ctl_command(
+        struct ctl_conn    *cn,
+        char               *line)
+{
+    struct ctl          *c = cn->ctl;
+    struct pthread_info *pis[2] = { c->chan[0], c->chan[1] };
+    char                *av[CTL_ARGS + 1], *save;
+    int                  ac = 0;
+
+    for (char *w = strtok_r(line, " \t\r", &save);
+            w && ac <= CTL_ARGS;
+            w = strtok_r(NULL, " \t\r", &save))
+        av[ac++] = w;
+    if (ac == 0)
+        return NULL; /* empty line */
+    if (ac > CTL_ARGS)
+        return "too many arguments";
+
+    /* the direction, if given */
+    if (ac > 1 && (!strcmp(av[1], "in") || !strcmp(av[1], "out"))) {
+        int out = !strcmp(av[1], "out");
+
+        if (!pis[out])
+            return "no such direction";
+        pis[!out] = NULL;
+        memmove(av + 1, av + 2, (--ac - 1) * sizeof av[0]);
+    }
+
+    const char *cmd = av[0];
+    if (!strcmp(cmd, "rate") || !strcmp(cmd, "frame")) {
+        struct line_params lp;
+        unsigned long      baud  = 0;
+        tcflag_t           cflag = 0;
+
+        if (ac != 2)
+            return "usage: rate|frame [in|out] value";
+        if (cmd[0] == 'r') {
+            char *end;
+            baud = strtoul(av[1], &end, 10);
+            if (baud == 0 || *end != '\0')
+                return "invalid baudrate";
+        } else if (delay_frame(&lp, 0, av[1]) < 0) {
+            return "invalid frame, use something like 8N1";
+        } else {
+            cflag = lp.cflag;
+        }
+        for (int i = 0; i < 2; i++)
+            if (pis[i])
+                pi_override(pis[i], baud, cflag);
+    } else if (!strcmp(cmd, "pause") || !strcmp(cmd, "resume")) {
+        if (ac != 1)
+            return "usage: pause|resume [in|out]";
+        for (int i = 0; i < 2; i++)
+            if (pis[i])
+                pi_pause(pis[i], cmd[0] == 'p');
+    } else if (!strcmp(cmd, "flush")) {
+        if (ac != 1)
+            return "usage: flush [in|out]";
+        for (int i = 0; i < 2; i++)
+            if (pis[i])
+                ctl_printf(cn, "%s: %zu bytes discarded\n",
+                    pis[i]->name, pi_discard(pis[i]));
+    } else if (!strcmp(cmd, "stats")) {
+        if (ac != 1)
+            return "usage: stats [in|out]";
+        for (int i = 0; i < 2; i++)
+            if (pis[i])
+                ctl_stats(cn, pis[i]);
+    } else if (!strcmp(cmd, "help")) {
+        ctl_printf(cn, "%s", ctl_help);
+    } else {
+        return "unknown command, try help";
+    }
+    return NULL;
+} /* ctl_command */
+
+static void
+ctl_conn_close(
+        struct ctl_conn    *cn)
+{
+    loop_del(cn->ctl->loop, &cn->src);
+    close(cn->src.fd);
+    if ((*cn->pprev = cn->next) != NULL)
+        cn->next->pprev = cn->pprev;
+    free(cn->out);
+    free(cn);
+} /* ctl_conn_close */
+
+/* the client sent commands, or can take our answers */
+static void
+ctl_conn_ready(
+        struct loop_src    *src,
+        int                 events)
+{
+    struct ctl_conn *cn = src->data;
+
+    if (events & (LOOP_IN | LOOP_ERR)) {
+        ssize_t res = read(src->fd, cn->in + cn->in_len,
+                sizeof cn->in - cn->in_len);
+        if (res == 0 || (res < 0 && errno != EAGAIN && errno != EINTR)) {
+            ctl_conn_close(cn);
+            return;
+        }
+        if (res > 0)
+            cn->in_len += res;
+
+        /* the complete lines */
+        char *line = cn->in, *nl;
+        while ((nl = memchr(line, '\n', cn->in + cn->in_len - line))) {
+            *nl = '\0';
+            const char *err = ctl_command(cn, line);
+            if (err)
+                ctl_printf(cn, "error: %s\n", err);
+            else
+                ctl_printf(cn, "ok\n");
+            line = nl + 1;
+        }
+        cn->in_len -= line - cn->in;
+        memmove(cn->in, line, cn->in_len);
+        if (cn->in_len == sizeof cn->in) {
+            ctl_printf(cn, "error: line too long\n");
+            cn->dead = TRUE;
+        }
+    }
+
+    if (cn->out_off < cn->out_len) {
+        ssize_t res = send(src->fd, cn->out + cn->out_off,
+                cn->out_len - cn->out_off, MSG_NOSIGNAL);
+        if (res < 0 && errno != EAGAIN && errno != EINTR) {
+            ctl_conn_close(cn);
+            return;
+        }
+        if (res > 0)
+            cn->out_off += res;
+        if (cn->out_off == cn->out_len)
+            cn->out_off = cn->out_len = 0;
+    }
+    if (cn->dead && cn->out_len == 0) {
+        ctl_conn_close(cn);
+        return;
+    }
+    loop_mod(cn->ctl->loop, src,
+        cn->out_len > 0 ? LOOP_IN | LOOP_OUT : LOOP_IN);
+} /* ctl_conn_ready */
+
+/* a client connects */
+static void
+ctl_accept(
+        struct loop_src    *src,
+        int                 events)
+{
+    struct ctl *c = src->data;
+    char        name[16];
+    int         fd = listen_accept(src->fd, name, sizeof name);
+
+    if (fd < 0) {
+        if (errno != EAGAIN && errno != EINTR) {
+            WARN("%s: accept" ERRNO "\r\n", c->path, EPMTS);
+        }
+        return;
+    }
+
+    struct ctl_conn *cn = calloc(1, sizeof *cn);
+    if (!cn) {
+        WARN("%s: calloc" ERRNO "\r\n", c->path, EPMTS);
+        close(fd);
+        return;
+    }
+    cn->ctl        = c;
+    cn->src.fd     = fd;
+    cn->src.events = LOOP_IN;
+    cn->src.cb     = ctl_conn_ready;
+    cn->src.data   = cn;
+    if (loop_add(c->loop, &cn->src) < 0) {
+        WARN("%s: loop_add" ERRNO "\r\n", c->path, EPMTS);
+        close(fd);
+        free(cn);
+        return;
+    }
+    if ((cn->next = c->conns) != NULL)
+        c->conns->pprev = &cn->next;
+    cn->pprev = &c->conns;
+    c->conns  = cn;
+    LOG("%s: client connected\r\n", c->path);
+} /* ctl_accept */
+
+int
+ctl_open(
+        struct ctl             *c,
+        const char             *path,
+        struct loop            *l,
+        struct pthread_info    *in,
+        struct pthread_info    *out)
+{
+    char addr[CTL_LINE_MAX];
+
+    if (snprintf(addr, sizeof addr, "unix:%s", path) >= sizeof addr) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memset(c, 0, sizeof *c);
+    c->src.fd = listen_open(addr);
+    if (c->src.fd < 0)
+        return -1;
+    c->path       = strdup(path);
+    c->loop       = l;
+    c->chan[0]    = in;
+    c->chan[1]    = out;
+    c->src.events = LOOP_IN;
+    c->src.cb     = ctl_accept;
+    c->src.data   = c;
+    if (!c->path || loop_add(l, &c->src) < 0) {
+        int saved_errno = errno;
+        close(c->src.fd);
+        unlink(path);
+        free(c->path);
+        c->path = NULL;
+        errno = saved_errno;
+        return -1;
+    }
+    return 0;
+} /* ctl_open */
+
+void
+ctl_close(
+        struct ctl     *c)
+{
+    if (!c->path)
+        return;
+    while (c->conns)
+        ctl_conn_close(c->conns);
+    loop_del(c->loop, &c->src);
+    close(c->src.fd);
+    unlink(c->path);
+    free(c->path);
+    c->path = NULL;
+} /* ctl_close */
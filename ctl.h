@@ -0,0 +1,76 @@
+/* ctl.h -- control socket of a session.  A unix domain socket
+ * where programs can connect to change the line of a running
+ * session, stop it or read its counters, with a line protocol.
+ * Author: Luis Colorado <luiscoloradourcola@gmail.com>
+ * Copyright: (C) 2015-2025 LUIS COLORADO.  All rights reserved.
+ * License: BSD.
+ *
+ * Each line sent is a command, with its words separated by
+ * blanks.  The direction, in (the input of the command) or out
+ * (its output), is optional, and the command applies to both if
+ * it is not given:
+ *
+ *   rate [in|out] baud     set the speed of the line
+ *   frame [in|out] 8N1     set the frame format of the line
+ *   pause [in|out]         stop passing data
+ *   resume [in|out]        restart it
+ *   flush [in|out]         discard the data not yet sent
+ *   stats                  print the counters of the channels
+ *   help                   print the commands
+ *
+ * The answer is the output of the command, if any, followed by a
+ * line "ok", or a line "error: " and the reason.  The changes are
+ * made on the emitter loop of the session, and the line gets them
+ * from its next tick on.  The socket is just another source of
+ * the loop, so it costs nothing to the channels while nobody
+ * talks to it.
+ */
+#ifndef _CTL_H
+#define _CTL_H
+
+#include "loop.h"
+#include "slowtty.h"
+
+#define CTL_LINE_MAX        (256)       /* longest command */
+#define CTL_OUT_MAX         (1 << 16)   /* answers not read by the
+                                         * client, at most */
+
+struct ctl_conn;
+
+struct ctl {
+    char           *path;       /* of the socket, NULL if closed */
+    struct loop    *loop;       /* emitter loop of the channels */
+    struct loop_src src;        /* listening socket */
+    struct pthread_info
+                   *chan[2];    /* in and out (or NULL) */
+    struct ctl_conn*conns;      /* clients connected */
+};
+
+/* Create the control socket of a session, and listen on it on
+ * the emitter loop of its channels.  An old socket left at path
+ * is removed.
+ *
+ * @param c the control socket.
+ * @param path where to create it.
+ * @param l the emitter loop of the channels.
+ * @param in the input channel (or NULL, as in filter mode).
+ * @param out the output channel.
+ * @return 0 on success, -1 and errno set on error. */
+int
+ctl_open(
+        struct ctl             *c,
+        const char             *path,
+        struct loop            *l,
+        struct pthread_info    *in,
+        struct pthread_info    *out);
+
+/* Close the control socket and its clients, and remove it.
+ * Nothing is done if it is not open.  Must be called from the
+ * thread of the loop.
+ *
+ * @param c the control socket. */
+void
+ctl_close(
+        struct ctl     *c);
+
+#endif /* _CTL_H */
@@ -1,4 +1,4 @@
-/* delay.c -- routine to delay for amount 0.04s (25 updates/s.)and
+/* delay.c -- routine to schedule the next tick of a channel and
  * calculate the number of characters that can be output in that time,
  * based on the baudrate used in the tty device.
  * Author: Luis Colorado <luiscoloradourcola@gmail.com>
@@ -7,9 +7,10 @@
  * Disclaimer: (C) 2015-2025 Luis Colorado.  All rights reserved.
  * License: BSD
  *
- * We consider the time divided in tics of 0.04s (25 frames/sec)
- * and, to be precise, we stick on 0.04s tic marks, so that value
- * is, indeed, fixed as a constant (not configurable).
+ * We consider the time divided in tics, whose length is selected by
+ * a scheduler (see below) from the character rate of the line.  The
+ * length of a tic is a rational number of seconds (pn/pd) so we can
+ * stick exactly on the tic marks, whatever the length is.
  *
  * Based on the baudrate (we check if baudrate, char size, stopbits or
  * parity has changed and only do this calculation in case of a
@@ -21,7 +22,14 @@
  * enough time to send another full character, and accumulate that
  * fraction, based on the amount resultant, so we get an exact number
  * of characters to be written to the output device, rounded to one
- * char. */
+ * char.  The same is done with the fraction of nanosecond of the tic
+ * length, so the tic marks don't drift.
+ *
+ * The chars are tokens in a bucket: each tic passed (on the monotonic
+ * clock, see LOOP_CLOCK) credits its window, even if we are woken up
+ * late, and the bucket holds at most burst_msecs of chars (-B option),
+ * so a late wakeup is caught up with a burst, but a long stall is
+ * not. */
 
 #include <errno.h>
 #include <stdio.h>
@@ -42,11 +50,123 @@
 #include "slowtty.h"
 #include "main.h"
 #include "delay.h"
+#include "trace.h"
+
+#define NSEC_PER_SEC        (1000000000ULL)
+
+/* limits of the adaptive scheduler, in chars per second. */
+#define SCHED_CHAR_MAX_CPS  (250)   /* one char per tic below this */
+#define SCHED_100HZ_MAX_CPS (2000)
+#define SCHED_50HZ_MAX_CPS  (12000)
+#define SCHED_25HZ_MAX_CPS  (50000)
+
+/* A scheduler selects the tic length (*pn/ *pd seconds) to use for
+ * a line of baud bauds and bits bits per character. */
+struct sched {
+    const char     *name;
+    void          (*period)(
+                        unsigned long  baud,
+                        int            bits,
+                        unsigned long *pn,
+                        unsigned long *pd);
+};
+
+static void
+sched_fixed(
+        unsigned long  baud,
+        int            bits,
+        unsigned long *pn,
+        unsigned long *pd)
+{
+    /* the classic 1/25th s. tic */
+    *pn = 1;
+    *pd = TICS_PER_SEC;
+} /* sched_fixed */
+
+static void
+sched_char(
+        unsigned long  baud,
+        int            bits,
+        unsigned long *pn,
+        unsigned long *pd)
+{
+    if (baud == 0) { /* line hung up, nothing to pace */
+        sched_fixed(baud, bits, pn, pd);
+        return;
+    }
+    /* one tic per character frame */
+    *pn = bits;
+    *pd = baud;
+} /* sched_char */
+
+static void
+sched_adaptive(
+        unsigned long  baud,
+        int            bits,
+        unsigned long *pn,
+        unsigned long *pd)
+{
+    unsigned long cps = baud / bits;
+    unsigned long hz;
+
+    if (cps <= SCHED_CHAR_MAX_CPS) {
+        /* each char at its exact frame time */
+        sched_char(baud, bits, pn, pd);
+        return;
+    }
+
+    /* the faster the line, the larger the chunks and the fewer
+     * the wakeups. */
+         if (cps <= SCHED_100HZ_MAX_CPS) hz = 100;
+    else if (cps <= SCHED_50HZ_MAX_CPS)  hz = 50;
+    else if (cps <= SCHED_25HZ_MAX_CPS)  hz = 25;
+    else                                 hz = 10;
 
-/* Get the integer number of bits per second from the c_lflag field
- * @param t struct termios pointer where to get the output baudrate.
+    /* but two windows must fit in the largest ring buffer */
+    if (hz < (cps + RB_MAX_SIZE/2 - 1) / (RB_MAX_SIZE/2))
+        hz = (cps + RB_MAX_SIZE/2 - 1) / (RB_MAX_SIZE/2);
+
+    *pn = 1;
+    *pd = hz;
+} /* sched_adaptive */
+
+static const struct sched scheds[] = {
+    { "adaptive", sched_adaptive, },
+    { "fixed",    sched_fixed,    },
+    { "char",     sched_char,     },
+    { NULL,       NULL,           },
+};
+
+static const struct sched *sched = scheds; /* adaptive by default */
+
+int
+delay_set_sched(
+        const char *name)
+{
+    const struct sched *p;
+
+    for (p = scheds; p->name; p++) {
+        if (strcmp(p->name, name) == 0) {
+            sched = p;
+            return 0;
+        }
+    }
+    return -1;
+} /* delay_set_sched */
+
+const char *
+delay_sched_name(
+        int i)
+{
+    return i >= 0 && i < sizeof scheds / sizeof scheds[0]
+        ? scheds[i].name
+        : NULL;
+} /* delay_sched_name */
+
+/* Get the integer number of bits per second from a speed_t
+ * @param s the speed, as cfgetospeed(3) or cfgetispeed(3) return.
  * @return the baudrate as an integer. */
-static unsigned long getthebr(struct termios *t)
+static unsigned long getthebr(speed_t s)
 {
 
 #define B(_n) case B##_n: do {                    \
@@ -54,49 +174,129 @@ static unsigned long getthebr(struct termios *t)
         return (_n);                              \
     } while(0)
 
-    speed_t s = cfgetospeed(t);
     switch(s) {
         B(50); B(75); B(110);
         B(134); B(150); B(200); B(300);
         B(600); B(1200); B(1800); B(2400);
         B(4800); B(9600); B(19200); B(38400);
         B(57600); B(115200); B(230400);
+#ifdef B460800
+        B(460800);
+#endif
+#ifdef B921600
+        B(921600);
+#endif
+#ifdef B1000000
+        B(500000); B(576000); B(1000000); B(1152000);
+        B(1500000); B(2000000); B(2500000); B(3000000);
+        B(3500000); B(4000000);
+#endif
         default: return B9600 == 9600 ? s : 0;
     } /* switch */
 #undef B
 } /* getthebr */
 
-unsigned long delay(struct pthread_info *pi)
+void
+delay_line(
+        struct line_params    *lp,
+        const struct termios  *t,
+        int                    input)
+{
+    speed_t s = input ? cfgetispeed(t) : B0;
+
+    if (s == B0) /* zero input speed means the same as output */
+        s = cfgetospeed(t);
+    lp->baud  = getthebr(s);
+    lp->iflag = t->c_iflag;
+    lp->cflag = t->c_cflag;
+    lp->lflag = t->c_lflag;
+    memcpy(lp->cc, t->c_cc, sizeof lp->cc);
+} /* delay_line */
+
+int
+delay_frame(
+        struct line_params    *lp,
+        unsigned long          baud,
+        const char            *frame)
+{
+    static const tcflag_t sizes[] = { CS5, CS6, CS7, CS8 };
+
+    if (       strlen(frame) != 3
+            || frame[0] < '5' || frame[0] > '8'
+            || !strchr("NEOneo", frame[1])
+            || frame[2] < '1' || frame[2] > '2')
+        return -1;
+
+    memset(lp, 0, sizeof *lp);
+    lp->baud  = baud;
+    lp->cflag = sizes[frame[0] - '5'] | CREAD | CLOCAL;
+    switch (frame[1]) {
+    case 'E': case 'e': lp->cflag |= PARENB; break;
+    case 'O': case 'o': lp->cflag |= PARENB | PARODD; break;
+    }
+    if (frame[2] == '2')
+        lp->cflag |= CSTOPB;
+    return 0;
+} /* delay_frame */
+
+int
+delay_bits(
+        const struct line_params *lp)
 {
-    int res;
+    int bits;
+
+    switch (lp->cflag & CSIZE) { /* character size */
+    default:
+    case CS8: bits = 10; break; /* START,8 DATA,STOP */
+    case CS7: bits = 9; break; /* START,7 DATA,STOP */
+    case CS6: bits = 8; break; /* START,6 DATA,STOP */
+    case CS5: bits = 7; break; /* START,5 DATA,STOP */
+    } /* switch */
+    if (lp->cflag & PARENB) bits++; /* PARITY bit */
+    if (lp->cflag & CSTOPB) bits++; /* 2ND_STOP */
+    return bits;
+} /* delay_bits */
+
+/* advance pi->tic to the next tic mark */
+static void
+delay_next(
+        struct pthread_info *pi)
+{
+    unsigned long long nsec = pi->tic.tv_nsec + pi->tic_q;
+    pi->tic_acc += pi->tic_r;
+    if (pi->tic_acc >= pi->tic_d) { /* carry */
+        nsec++;
+        pi->tic_acc -= pi->tic_d;
+    }
+    pi->tic.tv_sec  += nsec / NSEC_PER_SEC;
+    pi->tic.tv_nsec  = nsec % NSEC_PER_SEC;
+} /* delay_next */
 
+unsigned long delay(
+        struct pthread_info    *pi,
+        const struct timespec  *now)
+{
     /* the recalculation of delay times depends on the change of termios
      * parameters.  Only when a change in termios parameters is made we
      * calculate the new values for the number of characters to output
      * and * the delay time.  We initialize it to all zeros, so in the
-     * first time we get an update. */
-    if ((res = tcgetattr(ptym, &saved_tty)) < 0) {
-        ERR("%s: tcgetattr " ERRNO "\r\n", pi->name, EPMTS);
-    }
-
-    speed_t new_baudrate = getthebr(&saved_tty);
-    tcflag_t  new_cflag = saved_tty.c_cflag;
+     * first time we get an update.  The parameters are not read from
+     * the pty here, but from the copy the channel has in pi->line. */
+    speed_t new_baudrate = pi->line.baud;
+    tcflag_t  new_cflag = pi->line.cflag;
 
     if (   pi->svd_bauds != new_baudrate
-        || pi->svd_cflag != new_cflag) { /* changed parameters */
-
-        int bits_per_char;
-        switch (new_cflag & CSIZE) { /* character size */
-        case CS8: bits_per_char = 10; break; /* START,8 DATA,STOP */
-        case CS7: bits_per_char = 9; break; /* START,7 DATA,STOP */
-        case CS6: bits_per_char = 8; break; /* START,6 DATA,STOP */
-        case CS5: bits_per_char = 7; break; /* START,5 DATA,STOP */
-        } /* switch */
-        if (saved_tty.c_cflag & PARENB) bits_per_char++; /* PARITY bit */
-        if (saved_tty.c_cflag & CSTOPB) bits_per_char++; /* 2ND_STOP */
-
-        pi->num = new_baudrate;
-        pi->den = bits_per_char * TICS_PER_SEC;  /* ticks/sec. */
+        || pi->svd_cflag != new_cflag
+        || pi->tic_d == 0) { /* changed parameters */
+
+        int bits_per_char = delay_bits(&pi->line);
+
+        unsigned long pn, pd;
+        sched->period(new_baudrate, bits_per_char, &pn, &pd);
+
+        /* chars per tic = (baud / bits) * (pn / pd) */
+        pi->num = new_baudrate * pn;
+        pi->den = bits_per_char * pd;
         long common_div = gdc(pi->num, pi->den);
         if (common_div > 1) {
             pi->num /= common_div;
@@ -104,33 +304,76 @@ unsigned long delay(struct pthread_info *pi)
         }
         pi->acc = pi->den / 2; /* round to half a tic */
 
-        LOG("%s: num==%ld, den=%ld, acc=%ld\r\n",
-                pi->name, pi->num, pi->den, pi->acc);
+        /* the credit of the tics we are late for is limited to
+         * burst_msecs of chars, but at least one window */
+        unsigned long window = (pi->num + pi->den - 1) / pi->den;
+        pi->burst = (unsigned long long) new_baudrate * burst_msecs
+                  / (bits_per_char * 1000ULL);
+        if (pi->burst < window)
+            pi->burst = window;
+        if (pi->tokens > pi->burst)
+            pi->tokens = pi->burst;
+
+        /* the ring buffer has to hold the burst and the next
+         * window, and no more are read from the source (see
+         * pi_room()), fast lines need larger buffers.  The
+         * ingestion side resizes it. */
+        rb_want(&pi->b, pi->burst + window);
+        __atomic_store_n(&pi->in_max, pi->burst + window,
+            __ATOMIC_SEQ_CST);
+
+        /* nsecs per tic = pn * NSEC_PER_SEC / pd */
+        pi->tic_q   = pn * NSEC_PER_SEC / pd;
+        pi->tic_r   = pn * NSEC_PER_SEC % pd;
+        pi->tic_d   = pd;
+        pi->tic_acc = 0;
+
+        LOG("%s: sched=%s, tic=%lu/%lu s, "
+                "num==%ld, den=%ld, acc=%ld, burst=%lu\r\n",
+                pi->name, sched->name, pn, pd,
+                pi->num, pi->den, pi->acc, pi->burst);
         pi->svd_bauds = new_baudrate;
         pi->svd_cflag = new_cflag;
+        STATS_SET(pi->st, baud, new_baudrate);
+        STATS_SET(pi->st, bits, bits_per_char);
     }
 
-    /* now, update */
-    pi->acc += pi->num % pi->den;
-    pi->ctw  = pi->num / pi->den;
-    if (pi->acc >= pi->den) { /* carry */
-        pi->ctw++;
-        pi->acc -= pi->den;
-    }
-    LOG("%s: pi->acc==%ld, pi->den==%ld, pi->ctw==%ld\r\n",
-        pi->name, pi->acc, pi->den, pi->ctw);
-
-    /* add the tic delay */
-    pi->tic.tv_nsec += TIC_DELAY;
-    pi->tic.tv_nsec -= pi->tic.tv_nsec % TIC_DELAY;
-    if (pi->tic.tv_nsec >= 1000000000) { /* carry */
-        pi->tic.tv_sec++;
-        pi->tic.tv_nsec -= 1000000000;
+    /* now, credit the window of each tic passed, as the timer
+     * could have expired late (or the destination not accepted
+     * what we wrote), so the chars are not lost, and the line
+     * sends exactly num/den chars per tic in the long run. */
+    unsigned long credit = 0;
+    if (!pi->busy) {
+        /* the line gets active, the time it is busy counts from
+         * the first tick credited (see pi_busy()) */
+        pi->busy    = TRUE;
+        pi->busy_at = *now;
     }
-    res = clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &pi->tic, NULL);
-    if (res < 0) {
-        ERR("%s: clock_gettime" ERRNO "\r\n", pi->name, EPMTS);
+    do {
+        pi->acc += pi->num % pi->den;
+        pi->ctw  = pi->num / pi->den;
+        if (pi->acc >= pi->den) { /* carry */
+            pi->ctw++;
+            pi->acc -= pi->den;
+        }
+        credit += pi->ctw;
+
+        /* add the tic delay, the caller has to wait until then
+         * to call us again. */
+        delay_next(pi);
+    } while (  loop_ts_cmp(now, &pi->tic) >= 0
+            && pi->tokens + credit < pi->burst);
+
+    pi->tokens += credit;
+    if (pi->tokens > pi->burst)
+        pi->tokens = pi->burst;
+    if (loop_ts_cmp(now, &pi->tic) >= 0) {
+        /* too late, more than the burst, the time of the rest
+         * of the tics is lost.  We restart the tic marks. */
+        pi->tic = *now;
+        delay_next(pi);
     }
+    TRACE(TRC_DELAY, pi, credit, pi->tokens, pi->burst);
 
-    return pi->ctw;
+    return credit;
 } /* delay */
@@ -7,17 +7,78 @@
 #ifndef _DELAY_H
 #define _DELAY_H
 
-/* This routine makes a delay according to the struct termios passed
- * and return the number of characters allowed to be output for the
- * next round.  It's based on a delay between MIN_DELAY and 2*MIN_DELAY
- * and the change of the termios structure against the last value.
+/* This routine calculates, according to the line parameters of
+ * the channel (t->line), the number of characters allowed to be
+ * output in the tics passed up to now, adds them to t->tokens (no
+ * more than t->burst) and advances t->tic to the time of the next
+ * round.  It doesn't wait, the caller has to program a timer
+ * to call it again at t->tic.
  *
- * @param t is the thread info, with parameters of one direction
+ * @param t is the channel info, with parameters of one direction
  *          in the communications link
- * @return  The value of the window (the number or characters
- *          that can be sent in one delay tic) */
+ * @param now is the current time, on LOOP_CLOCK.
+ * @return  The number of characters credited (one window per
+ *          tic passed) */
 extern unsigned long
 delay(
-        struct pthread_info *t);
+        struct pthread_info   *t,
+        const struct timespec *now);
+
+/* Fill the line parameters from a struct termios.
+ *
+ * @param lp    the line parameters to fill.
+ * @param t     the termios settings of the line.
+ * @param input nonzero for the input direction of the line, that
+ *              goes at the input speed (or at the output speed, if
+ *              it is zero), zero for the output direction. */
+extern void
+delay_line(
+        struct line_params    *lp,
+        const struct termios  *t,
+        int                    input);
+
+/* Fill the line parameters of a line not attached to a tty,
+ * from its baudrate and frame format.  The frame format is the
+ * usual data bits, parity and stop bits string, as 8N1 or 7E2.
+ *
+ * @param lp    the line parameters to fill.
+ * @param baud  the baudrate of the line.
+ * @param frame the frame format.
+ * @return 0 on success, -1 if the frame format is not valid. */
+extern int
+delay_frame(
+        struct line_params    *lp,
+        unsigned long          baud,
+        const char            *frame);
+
+/* Get the bits a char takes on the line: start bit, data
+ * bits, parity bit and stop bits.
+ *
+ * @param lp    the line parameters.
+ * @return the number of bits. */
+extern int
+delay_bits(
+        const struct line_params *lp);
+
+/* Select the scheduler used to calculate the tic length from
+ * the line settings.  Available schedulers are:
+ *   "adaptive" one char per tic at low speeds, and larger
+ *              chunks in less frequent tics as speed grows.
+ *   "fixed"    1/TICS_PER_SEC s. tics, whatever the speed.
+ *   "char"     one char per tic, whatever the speed.
+ *
+ * @param name  the name of the scheduler.
+ * @return 0 on success, -1 if no scheduler has that name. */
+extern int
+delay_set_sched(
+        const char *name);
+
+/* Get the name of the i-th scheduler available.
+ *
+ * @param i the index of the scheduler.
+ * @return the name, or NULL if there are no more. */
+extern const char *
+delay_sched_name(
+        int i);
 
 #endif /* _DELAY_H */
@@ -0,0 +1,226 @@
+/* lag.c -- propagation delay of a line.
+ * Author: Luis Colorado <luiscoloradourcola@gmail.com>
+ * Copyright: (C) 2015-2025 LUIS COLORADO.  All rights reserved.
+ * License: BSD.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lag.h"
+
+#define NSEC_PER_SEC    (1000000000ULL)
+#define NSEC_PER_MSEC   (1000000ULL)
+
+void
+lag_init(
+        struct lag             *l,
+        const struct lag_conf  *conf)
+{
+    memset(l, 0, sizeof *l);
+    l->lat_ns = conf->msecs  * NSEC_PER_MSEC;
+    l->jit_ns = conf->jitter * NSEC_PER_MSEC;
+    l->rnd    = (uintptr_t) l | 1; /* never zero */
+} /* lag_init */
+
+void
+lag_destroy(
+        struct lag     *l)
+{
+    struct lag_conf conf = {
+        l->lat_ns / NSEC_PER_MSEC,
+        l->jit_ns / NSEC_PER_MSEC,
+    };
+
+    free(l->buf);
+    free(l->q);
+    lag_init(l, &conf);
+} /* lag_destroy */
+
+/* the next random number (xorshift64*) */
+static uint64_t
+lag_random(
+        struct lag     *l)
+{
+    l->rnd ^= l->rnd >> 12;
+    l->rnd ^= l->rnd << 25;
+    l->rnd ^= l->rnd >> 27;
+    return l->rnd * 0x2545f4914f6cdd1dULL;
+} /* lag_random */
+
+/* make room for n more chars, doubling the buffer */
+static int
+lag_grow(
+        struct lag     *l,
+        size_t          n)
+{
+    size_t cap = l->cap ? l->cap : LAG_MIN_SIZE;
+
+    while (cap < l->len + n)
+        cap *= 2;
+    if (cap == l->cap)
+        return 0;
+
+    char *buf = malloc(cap);
+    if (!buf)
+        return -1;
+    /* the chars are left at the beginning, not wrapped */
+    size_t first = l->cap - l->head;
+    if (first > l->len)
+        first = l->len;
+    if (l->len > 0) {
+        memcpy(buf, l->buf + l->head, first);
+        memcpy(buf + first, l->buf, l->len - first);
+    }
+    free(l->buf);
+    l->buf  = buf;
+    l->cap  = cap;
+    l->head = 0;
+    return 0;
+} /* lag_grow */
+
+/* make room for another chunk, doubling the queue */
+static int
+lag_grow_q(
+        struct lag     *l)
+{
+    if (l->q_len < l->q_cap)
+        return 0;
+
+    size_t cap = l->q_cap ? 2 * l->q_cap : LAG_MIN_CHUNKS;
+    struct lag_chunk *q = malloc(cap * sizeof *q);
+    if (!q)
+        return -1;
+    for (size_t i = 0; i < l->q_len; i++)
+        q[i] = l->q[(l->q_head + i) % l->q_cap];
+    free(l->q);
+    l->q      = q;
+    l->q_cap  = cap;
+    l->q_head = 0;
+    return 0;
+} /* lag_grow_q */
+
+int
+lag_put(
+        struct lag             *l,
+        const struct iovec     *iov,
+        int                     niov,
+        const struct timespec  *now)
+{
+    size_t n = 0;
+
+    for (int i = 0; i < niov; i++)
+        n += iov[i].iov_len;
+    if (n == 0)
+        return 0;
+    if (lag_grow(l, n) < 0 || lag_grow_q(l) < 0) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    /* the chars */
+    size_t tail = (l->head + l->len) % l->cap;
+    for (int i = 0; i < niov; i++) {
+        const char *p    = iov[i].iov_base;
+        size_t      left = iov[i].iov_len;
+
+        while (left > 0) {
+            size_t m = l->cap - tail;
+            if (m > left)
+                m = left;
+            memcpy(l->buf + tail, p, m);
+            tail  = (tail + m) % l->cap;
+            p    += m;
+            left -= m;
+        }
+    }
+    l->len += n;
+
+    /* when they get there, never before the chars sent before */
+    unsigned long long nsec = now->tv_nsec + l->lat_ns;
+    if (l->jit_ns)
+        nsec += lag_random(l) % (l->jit_ns + 1);
+
+    struct timespec when;
+    when.tv_sec  = now->tv_sec + nsec / NSEC_PER_SEC;
+    when.tv_nsec = nsec % NSEC_PER_SEC;
+    if (l->q_len > 0) {
+        struct lag_chunk *last =
+                l->q + (l->q_head + l->q_len - 1) % l->q_cap;
+
+        if (       when.tv_sec  <  last->when.tv_sec
+                || (when.tv_sec == last->when.tv_sec
+                 && when.tv_nsec <= last->when.tv_nsec))
+        {
+            last->len += n; /* they get there with the last */
+            return 0;
+        }
+    }
+    struct lag_chunk *c = l->q + (l->q_head + l->q_len) % l->q_cap;
+    c->when = when;
+    c->len  = n;
+    l->q_len++;
+    return 0;
+} /* lag_put */
+
+const struct timespec *
+lag_next(
+        const struct lag       *l)
+{
+    return l->q_len > 0
+        ? &l->q[l->q_head].when
+        : NULL;
+} /* lag_next */
+
+int
+lag_due(
+        const struct lag       *l,
+        const struct timespec  *now,
+        struct iovec            iov[2])
+{
+    size_t n = 0;
+
+    for (size_t i = 0; i < l->q_len; i++) {
+        const struct lag_chunk *c = l->q + (l->q_head + i) % l->q_cap;
+
+        if (       c->when.tv_sec  >  now->tv_sec
+                || (c->when.tv_sec == now->tv_sec
+                 && c->when.tv_nsec > now->tv_nsec))
+            break;
+        n += c->len;
+    }
+    if (n == 0)
+        return 0;
+
+    size_t first = l->cap - l->head;
+    iov[0].iov_base = l->buf + l->head;
+    iov[0].iov_len  = n < first ? n : first;
+    if (n <= first)
+        return 1;
+    iov[1].iov_base = l->buf; /* they wrap around */
+    iov[1].iov_len  = n - first;
+    return 2;
+} /* lag_due */
+
+void
+lag_consume(
+        struct lag             *l,
+        size_t                  n)
+{
+    if (n == 0)
+        return;
+    l->head  = (l->head + n) % l->cap;
+    l->len  -= n;
+    while (n > 0) {
+        struct lag_chunk *c = l->q + l->q_head;
+
+        if (c->len > n) {
+            c->len -= n; /* the rest gets there at the same time */
+            break;
+        }
+        n        -= c->len;
+        l->q_head = (l->q_head + 1) % l->q_cap;
+        l->q_len--;
+    }
+} /* lag_consume */
@@ -0,0 +1,121 @@
+/* lag.h -- propagation delay of a line.  The chars the line
+ * sends are kept in flight for its latency (plus some jitter)
+ * before they get to the destination, as on a satellite link.
+ * Author: Luis Colorado <luiscoloradourcola@gmail.com>
+ * Copyright: (C) 2015-2025 LUIS COLORADO.  All rights reserved.
+ * License: BSD.
+ *
+ * As the chars of a line never overtake each other, the chunks in
+ * flight get to the destination in the order they were sent, so
+ * the queue is a FIFO, and both queueing a chunk and releasing it
+ * are O(1), whatever the number of chunks in flight.  The chars
+ * are stored in a byte ring and the chunks in a ring of
+ * descriptors, both growing by doubling when full, so there is no
+ * allocation per chunk (let alone per char), and only one timer
+ * per line, for the first chunk.
+ */
+#ifndef _LAG_H
+#define _LAG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include <time.h>
+
+#define LAG_MIN_SIZE        (4096)  /* initial capacity, in bytes */
+#define LAG_MIN_CHUNKS      (64)    /* initial capacity, in chunks */
+
+/* latency of a direction of the line (-y option) */
+struct lag_conf {
+    unsigned long   msecs;      /* one way latency */
+    unsigned long   jitter;     /* plus up to this, at random */
+};
+
+/* a chunk of chars sent at once */
+struct lag_chunk {
+    struct timespec when;       /* it gets to the destination */
+    size_t          len;
+};
+
+struct lag {
+    unsigned long long
+                    lat_ns,     /* the latency, or 0 if none */
+                    jit_ns;     /* the jitter */
+    uint64_t        rnd;        /* state of the jitter generator */
+
+    char           *buf;        /* the chars in flight ... */
+    size_t          cap,        /* ... the capacity of buf, ... */
+                    head,       /* ... where they begin, ... */
+                    len;        /* ... and how many */
+
+    struct lag_chunk
+                   *q;          /* the chunks in flight, ... */
+    size_t          q_cap,      /* ... the capacity of q, ... */
+                    q_head,     /* ... the first, ... */
+                    q_len;      /* ... and how many */
+};
+
+/* Initialize the propagation delay of a line.  A line with no
+ * latency (and no jitter) just doesn't use it.
+ *
+ * @param l the delay to initialize.
+ * @param conf the latency of the line. */
+void
+lag_init(
+        struct lag             *l,
+        const struct lag_conf  *conf);
+
+/* Release the memory of the chars in flight (they are lost).
+ * The delay is left as lag_init() leaves it.
+ *
+ * @param l the delay. */
+void
+lag_destroy(
+        struct lag     *l);
+
+/* Send chars through the line.
+ *
+ * @param l the delay.
+ * @param iov the chars, in pieces.
+ * @param niov the number of pieces.
+ * @param now the time they are sent, on LOOP_CLOCK.
+ * @return 0 on success, -1 and errno set if there's no memory to
+ *         hold them. */
+int
+lag_put(
+        struct lag             *l,
+        const struct iovec     *iov,
+        int                     niov,
+        const struct timespec  *now);
+
+/* Get the time the next chunk gets to the destination.
+ *
+ * @param l the delay.
+ * @return the time, or NULL if there are no chars in flight. */
+const struct timespec *
+lag_next(
+        const struct lag       *l);
+
+/* Get the chars that have already got to the destination, as
+ * they are to be written.
+ *
+ * @param l the delay.
+ * @param now the time now.
+ * @param iov where to store the pieces of the chars.
+ * @return the number of pieces stored in iov[] (0 if none). */
+int
+lag_due(
+        const struct lag       *l,
+        const struct timespec  *now,
+        struct iovec            iov[2]);
+
+/* Remove chars got with lag_due() (that were written).
+ *
+ * @param l the delay.
+ * @param n the number of chars. */
+void
+lag_consume(
+        struct lag             *l,
+        size_t                  n);
+
+#endif /* _LAG_H */
@@ -0,0 +1,176 @@
+/* listen.c -- listening sockets (TCP or unix domain) to serve
+ * throttled sessions over the network.
+ * Author: Luis Colorado <luiscoloradourcola@gmail.com>
+ * Copyright: (C) 2015-2025 LUIS COLORADO.  All rights reserved.
+ * License: BSD.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "main.h"
+#include "session.h"
+#include "listen.h"
+
+/* set the flags we want on all our sockets */
+static int
+listen_setfd(
+        int fd)
+{
+    if (       set_nonblock(fd) < 0
+            || fcntl(fd, F_SETFD, FD_CLOEXEC) < 0)
+    {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return -1;
+    }
+    return fd;
+} /* listen_setfd */
+
+static int
+listen_unix(
+        const char *path)
+{
+    struct sockaddr_un sun;
+    struct stat st;
+
+    if (strlen(path) >= sizeof sun.sun_path) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memset(&sun, 0, sizeof sun);
+    sun.sun_family = AF_UNIX;
+    strcpy(sun.sun_path, path);
+
+    /* a socket left by a previous run is removed, but nothing
+     * else. */
+    if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    if (       bind(fd, (struct sockaddr *)&sun, sizeof sun) < 0
+            || listen(fd, SOMAXCONN) < 0)
+    {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return -1;
+    }
+    return listen_setfd(fd);
+} /* listen_unix */
+
+static int
+listen_tcp(
+        const char *addr)
+{
+    char             host[256];
+    const char      *port = strrchr(addr, ':');
+    struct addrinfo  hints, *res, *p;
+    int              fd = -1, err;
+
+    if (port) {
+        size_t len = port - addr;
+        port++;
+        if (len > 1 && addr[0] == '[' && addr[len - 1] == ']') {
+            addr++;
+            len -= 2;
+        }
+        if (len >= sizeof host) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        memcpy(host, addr, len);
+        host[len] = '\0';
+    } else {
+        port    = addr;
+        host[0] = '\0';
+    }
+
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags    = AI_PASSIVE;
+    err = getaddrinfo(host[0] ? host : NULL, port, &hints, &res);
+    if (err != 0) {
+        WARN("%s: %s\n", addr, gai_strerror(err));
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (p = res; p; p = p->ai_next) {
+        int one = 1;
+
+        fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+        if (fd < 0)
+            continue;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+        if (       bind(fd, p->ai_addr, p->ai_addrlen) == 0
+                && listen(fd, SOMAXCONN) == 0)
+            break;
+        err = errno;
+        close(fd);
+        errno = err;
+        fd = -1;
+    }
+    freeaddrinfo(res);
+
+    return fd < 0 ? -1 : listen_setfd(fd);
+} /* listen_tcp */
+
+int
+listen_open(
+        const char *addr)
+{
+    if (strncmp(addr, "unix:", 5) == 0)
+        return listen_unix(addr + 5);
+    if (strchr(addr, '/'))
+        return listen_unix(addr);
+    return listen_tcp(addr);
+} /* listen_open */
+
+int
+listen_accept(
+        int     lfd,
+        char   *name,
+        size_t  namesz)
+{
+    struct sockaddr_storage ss;
+    socklen_t               sslen = sizeof ss;
+    char                    host[NI_MAXHOST], serv[NI_MAXSERV];
+
+    int fd = accept(lfd, (struct sockaddr *)&ss, &sslen);
+    if (fd < 0)
+        return -1;
+
+    if (ss.ss_family == AF_INET || ss.ss_family == AF_INET6) {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+        if (getnameinfo((struct sockaddr *)&ss, sslen,
+                    host, sizeof host, serv, sizeof serv,
+                    NI_NUMERICHOST | NI_NUMERICSERV) == 0)
+        {
+            snprintf(name, namesz,
+                ss.ss_family == AF_INET6 ? "[%s]:%s" : "%s:%s",
+                host, serv);
+        } else {
+            snprintf(name, namesz, "tcp");
+        }
+    } else {
+        snprintf(name, namesz, "unix");
+    }
+    return listen_setfd(fd);
+} /* listen_accept */
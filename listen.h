@@ -0,0 +1,40 @@
+/* listen.h -- listening sockets (TCP or unix domain) to serve
+ * throttled sessions over the network.
+ * Author: Luis Colorado <luiscoloradourcola@gmail.com>
+ * Copyright: (C) 2015-2025 LUIS COLORADO.  All rights reserved.
+ * License: BSD.
+ */
+#ifndef _LISTEN_H
+#define _LISTEN_H
+
+#include <sys/types.h>
+
+/* Open a listening socket on the address passed.  The address
+ * is a path (it must have a slash, e.g. ./socket) or unix:path
+ * for a unix domain socket, or [host:]port for a TCP socket (an
+ * IPv6 host address must go in brackets, as in [::1]:2323).
+ * The socket is nonblocking and close on exec.
+ *
+ * @param addr the address to listen on.
+ * @return the socket descriptor, or -1 and errno set on
+ *         error. */
+int
+listen_open(
+        const char *addr);
+
+/* Accept a connection on a listening socket.  The new socket
+ * is nonblocking and close on exec, and has the Nagle
+ * algorithm disabled, as we write small chunks at the pace of
+ * the line.
+ *
+ * @param lfd the listening socket.
+ * @param name buffer to return the name of the peer.
+ * @param namesz size of the buffer.
+ * @return the new socket, or -1 and errno set on error. */
+int
+listen_accept(
+        int     lfd,
+        char   *name,
+        size_t  namesz);
+
+#endif /* _LISTEN_H */
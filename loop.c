@@ -0,0 +1,596 @@
+/* loop.c -- event loop implementation.  We use epoll(7) and a
+ * single timerfd(2) per loop where available, and ppoll(2)
+ * elsewhere.  Timers are kept in a binary heap, so only the
+ * nearest one is programmed in the kernel, and no wakeup at all
+ * happens when no timer is armed and no descriptor gets ready.
+ * Author: Luis Colorado <luiscoloradourcola@gmail.com>
+ * Copyright: (C) 2015-2025 LUIS COLORADO.  All rights reserved.
+ * License: BSD.
+ */
+#define _GNU_SOURCE     /* for ppoll(2) in glibc */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "config.h"
+
+#ifndef   UQ_HAS_EPOLL /* {{ */
+#warning  UQ_HAS_EPOLL should be defined in config.mk
+#define   UQ_HAS_EPOLL  (0)
+#endif /* UQ_HAS_EPOLL    }} */
+
+#if UQ_HAS_EPOLL
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#endif
+
+#include "loop.h"
+
+#define LOOP_MAX_EVENTS     (64)
+
+int
+loop_ts_cmp(
+        const struct timespec *a,
+        const struct timespec *b)
+{
+    if (a->tv_sec != b->tv_sec)
+        return a->tv_sec < b->tv_sec ? -1 : 1;
+    if (a->tv_nsec != b->tv_nsec)
+        return a->tv_nsec < b->tv_nsec ? -1 : 1;
+    return 0;
+} /* loop_ts_cmp */
+
+/* HEAP HANDLING.  heap_ix is kept one based, so zero means
+ * the timer is not in the heap. */
+
+static void
+heap_set(
+        struct loop       *l,
+        size_t             ix,
+        struct loop_timer *tim)
+{
+    l->heap[ix]  = tim;
+    tim->heap_ix = ix + 1;
+} /* heap_set */
+
+static void
+heap_up(
+        struct loop *l,
+        size_t       ix)
+{
+    struct loop_timer *tim = l->heap[ix];
+
+    while (ix > 0) {
+        size_t parent = (ix - 1) / 2;
+        if (loop_ts_cmp(&l->heap[parent]->when, &tim->when) <= 0)
+            break;
+        heap_set(l, ix, l->heap[parent]);
+        ix = parent;
+    }
+    heap_set(l, ix, tim);
+} /* heap_up */
+
+static void
+heap_down(
+        struct loop *l,
+        size_t       ix)
+{
+    struct loop_timer *tim = l->heap[ix];
+
+    for (;;) {
+        size_t child = 2 * ix + 1;
+        if (child >= l->heap_n)
+            break;
+        if (child + 1 < l->heap_n
+                && loop_ts_cmp(&l->heap[child + 1]->when,
+                          &l->heap[child]->when) < 0)
+            child++;
+        if (loop_ts_cmp(&tim->when, &l->heap[child]->when) <= 0)
+            break;
+        heap_set(l, ix, l->heap[child]);
+        ix = child;
+    }
+    heap_set(l, ix, tim);
+} /* heap_down */
+
+/* reprograms the kernel timer (if any) to the nearest
+ * expiration time. */
+static void
+loop_program(
+        struct loop *l)
+{
+#if UQ_HAS_EPOLL
+    struct itimerspec its;
+
+    memset(&its, 0, sizeof its);
+    if (l->heap_n > 0) {
+        its.it_value = l->heap[0]->when;
+        /* a zero time would disarm it, but it has expired */
+        if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0)
+            its.it_value.tv_nsec = 1;
+    }
+    if (loop_ts_cmp(&its.it_value, &l->tfd_when) == 0)
+        return; /* already there */
+    l->tfd_when = its.it_value;
+    timerfd_settime(l->tfd, TFD_TIMER_ABSTIME, &its, NULL);
+#else
+    (void) l; /* ppoll(2) calculates its timeout each time */
+#endif
+} /* loop_program */
+
+void
+loop_timer_arm(
+        struct loop           *l,
+        struct loop_timer     *tim,
+        const struct timespec *when)
+{
+    tim->when = *when;
+    if (tim->heap_ix == 0) {
+        if (l->heap_n == l->heap_cap) {
+            size_t new_cap = l->heap_cap ? 2 * l->heap_cap : 16;
+            struct loop_timer **new_heap = realloc(
+                    l->heap, new_cap * sizeof *new_heap);
+            if (!new_heap)
+                abort(); /* cannot continue without timers */
+            l->heap     = new_heap;
+            l->heap_cap = new_cap;
+        }
+        heap_set(l, l->heap_n++, tim);
+    }
+    heap_up(l, tim->heap_ix - 1);
+    heap_down(l, tim->heap_ix - 1);
+    loop_program(l);
+} /* loop_timer_arm */
+
+void
+loop_timer_disarm(
+        struct loop           *l,
+        struct loop_timer     *tim)
+{
+    if (tim->heap_ix == 0)
+        return;
+
+    size_t ix = tim->heap_ix - 1;
+    tim->heap_ix = 0;
+    if (ix != --l->heap_n) {
+        struct loop_timer *last = l->heap[l->heap_n];
+        heap_set(l, ix, last);
+        heap_up(l, ix);
+        heap_down(l, last->heap_ix - 1);
+    }
+    loop_program(l);
+} /* loop_timer_disarm */
+
+/* run all the expired timers. */
+static int
+loop_expire(
+        struct loop *l)
+{
+    int n = 0;
+
+    clock_gettime(LOOP_CLOCK, &l->now);
+    while (l->heap_n > 0 && loop_ts_cmp(&l->heap[0]->when, &l->now) <= 0) {
+        struct loop_timer *tim = l->heap[0];
+        loop_timer_disarm(l, tim);
+        tim->cb(tim);
+        n++;
+    }
+    return n;
+} /* loop_expire */
+
+#if UQ_HAS_EPOLL
+static void
+loop_tfd_cb(
+        struct loop_src *src,
+        int              events)
+{
+    struct loop *l = src->data;
+    uint64_t     expirations;
+
+    (void) events;
+    /* the timer is not periodic, we have to reprogram it
+     * after the read. */
+    read(l->tfd, &expirations, sizeof expirations);
+    memset(&l->tfd_when, 0, sizeof l->tfd_when);
+    loop_expire(l);
+    loop_program(l);
+} /* loop_tfd_cb */
+#endif
+
+/* call the posts queued from other threads */
+static void
+loop_posts_ready(
+        struct loop_src *src,
+        int              events)
+{
+    struct loop      *l = src->data;
+    struct loop_post *p, *next;
+    char              buf[64];
+
+    (void) events;
+    while (read(l->post_fd[0], buf, sizeof buf) > 0)
+        continue;
+
+    pthread_mutex_lock(&l->post_mtx);
+    p             = l->posts;
+    l->posts      = NULL;
+    l->posts_tail = &l->posts;
+    pthread_mutex_unlock(&l->post_mtx);
+
+    /* once a post is not pending, it can be queued again (and
+     * its next field changed) so we get it first. */
+    for (; p; p = next) {
+        next = p->next;
+        pthread_mutex_lock(&l->post_mtx);
+        p->pending = 0;
+        pthread_mutex_unlock(&l->post_mtx);
+        p->cb(p);
+    }
+} /* loop_posts_ready */
+
+void
+loop_post(
+        struct loop      *l,
+        struct loop_post *p)
+{
+    int wake;
+
+    pthread_mutex_lock(&l->post_mtx);
+    if (p->pending) {
+        pthread_mutex_unlock(&l->post_mtx);
+        return;
+    }
+    p->pending     = 1;
+    p->next        = NULL;
+    *l->posts_tail = p;
+    l->posts_tail  = &p->next;
+    wake           = l->posts == p; /* the queue was empty */
+    pthread_mutex_unlock(&l->post_mtx);
+
+    /* if the pipe is full, the loop is awake anyway */
+    if (wake)
+        write(l->post_fd[1], "", 1);
+} /* loop_post */
+
+static void *
+loop_body(
+        void *arg)
+{
+    struct loop *l = arg;
+
+    for (;;) {
+        if (loop_once(l, NULL) < 0 && errno != EINTR)
+            abort(); /* cannot happen, the loop is private */
+    }
+    return NULL;
+} /* loop_body */
+
+int
+loop_spawn(
+        struct loop *l)
+{
+    pthread_t id;
+    sigset_t  all, old;
+    int       res;
+
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    res = pthread_create(&id, NULL, loop_body, l);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (res != 0) {
+        errno = res;
+        return -1;
+    }
+    pthread_detach(id);
+    return 0;
+} /* loop_spawn */
+
+int
+loop_init(
+        struct loop *l)
+{
+    memset(l, 0, sizeof *l);
+    l->fd = l->tfd = -1;
+    l->post_fd[0] = l->post_fd[1] = -1;
+    l->posts_tail = &l->posts;
+    pthread_mutex_init(&l->post_mtx, NULL);
+
+#if UQ_HAS_EPOLL
+    l->fd = epoll_create1(EPOLL_CLOEXEC);
+    if (l->fd < 0)
+        return -1;
+    l->tfd = timerfd_create(LOOP_CLOCK, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (l->tfd < 0) {
+        close(l->fd);
+        return -1;
+    }
+    l->tsrc.fd     = l->tfd;
+    l->tsrc.events = LOOP_IN;
+    l->tsrc.cb     = loop_tfd_cb;
+    l->tsrc.data   = l;
+    if (loop_add(l, &l->tsrc) < 0) {
+        loop_destroy(l);
+        return -1;
+    }
+#endif
+    if (pipe(l->post_fd) < 0) {
+        loop_destroy(l);
+        return -1;
+    }
+    for (int i = 0; i < 2; i++) {
+        fcntl(l->post_fd[i], F_SETFD, FD_CLOEXEC);
+        fcntl(l->post_fd[i], F_SETFL,
+            fcntl(l->post_fd[i], F_GETFL) | O_NONBLOCK);
+    }
+    l->post_src.fd     = l->post_fd[0];
+    l->post_src.events = LOOP_IN;
+    l->post_src.cb     = loop_posts_ready;
+    l->post_src.data   = l;
+    if (loop_add(l, &l->post_src) < 0) {
+        loop_destroy(l);
+        return -1;
+    }
+    return 0;
+} /* loop_init */
+
+void
+loop_destroy(
+        struct loop *l)
+{
+    if (l->tfd >= 0)
+        close(l->tfd);
+    if (l->fd >= 0)
+        close(l->fd);
+    if (l->post_fd[0] >= 0) {
+        close(l->post_fd[0]);
+        close(l->post_fd[1]);
+    }
+    pthread_mutex_destroy(&l->post_mtx);
+    free(l->heap);
+    free(l->pfds);
+    free(l->psrcs);
+    memset(l, 0, sizeof *l);
+    l->fd = l->tfd = -1;
+    l->post_fd[0] = l->post_fd[1] = -1;
+} /* loop_destroy */
+
+#if UQ_HAS_EPOLL
+static int
+epoll_events(
+        int events)
+{
+    return (events & LOOP_IN  ? EPOLLIN  : 0)
+         | (events & LOOP_OUT ? EPOLLOUT : 0);
+} /* epoll_events */
+#endif
+
+int
+loop_add(
+        struct loop     *l,
+        struct loop_src *src)
+{
+#if UQ_HAS_EPOLL
+    struct epoll_event ev = {
+        .events   = epoll_events(src->events),
+        .data.ptr = src,
+    };
+    src->nopoll = 0;
+    if (src->events
+            && epoll_ctl(l->fd, EPOLL_CTL_ADD, src->fd, &ev) < 0)
+    {
+        if (errno != EPERM)
+            return -1;
+        /* regular files cannot be added to an epoll set, but
+         * they are always ready, as poll(2) reports. */
+        src->nopoll = 1;
+        l->n_nopoll++;
+    }
+#endif
+    if ((src->next = l->srcs) != NULL)
+        src->next->pprev = &src->next;
+    src->pprev = &l->srcs;
+    l->srcs    = src;
+    l->n_srcs++;
+    return 0;
+} /* loop_add */
+
+int
+loop_mod(
+        struct loop     *l,
+        struct loop_src *src,
+        int              events)
+{
+    if (src->events == events)
+        return 0; /* nothing to do */
+#if UQ_HAS_EPOLL
+    /* EPOLLHUP and EPOLLERR are always reported, even if we
+     * are not interested in any event, so a silent source has
+     * to be taken out of the epoll set. */
+    struct epoll_event ev = {
+        .events   = epoll_events(events),
+        .data.ptr = src,
+    };
+    int op = !events      ? EPOLL_CTL_DEL
+           : !src->events ? EPOLL_CTL_ADD
+           :                EPOLL_CTL_MOD;
+    if (src->nopoll) {
+        if (!events)
+            l->n_nopoll--;
+        else if (!src->events)
+            l->n_nopoll++;
+    } else if (epoll_ctl(l->fd, op, src->fd, &ev) < 0) {
+        if (op != EPOLL_CTL_ADD || errno != EPERM)
+            return -1;
+        src->nopoll = 1; /* see loop_add() */
+        l->n_nopoll++;
+    }
+#endif
+    src->events = events;
+    return 0;
+} /* loop_mod */
+
+int
+loop_del(
+        struct loop     *l,
+        struct loop_src *src)
+{
+    if (!src->pprev)
+        return 0; /* not registered */
+
+    if ((*src->pprev = src->next) != NULL)
+        src->next->pprev = src->pprev;
+    src->next  = NULL;
+    src->pprev = NULL;
+    l->n_srcs--;
+#if UQ_HAS_EPOLL
+    /* in case we are called from a callback, don't let
+     * loop_once() dispatch events to it anymore. */
+    struct epoll_event *evs = l->batch;
+    for (int i = 0; i < l->batch_n; i++)
+        if (evs[i].data.ptr == src)
+            evs[i].data.ptr = NULL;
+    if (src->nopoll) {
+        if (src->events)
+            l->n_nopoll--;
+    } else if (src->events
+            && epoll_ctl(l->fd, EPOLL_CTL_DEL, src->fd, NULL) < 0)
+    {
+        return -1;
+    }
+#else
+    for (size_t i = 0; i < l->pfds_cap; i++)
+        if (l->psrcs[i] == src)
+            l->psrcs[i] = NULL;
+#endif
+    return 0;
+} /* loop_del */
+
+#if UQ_HAS_EPOLL
+int
+loop_once(
+        struct loop    *l,
+        const sigset_t *mask)
+{
+    struct epoll_event evs[LOOP_MAX_EVENTS];
+
+    /* don't wait if there are sources always ready */
+    int n = epoll_pwait(l->fd, evs, LOOP_MAX_EVENTS,
+            l->n_nopoll ? 0 : -1, mask);
+    if (n < 0)
+        return -1;
+
+    l->batch   = evs;
+    l->batch_n = n;
+    for (int i = 0; i < n; i++) {
+        struct loop_src *src = evs[i].data.ptr;
+        if (!src)
+            continue; /* unregistered by a previous callback */
+        int events = (evs[i].events & EPOLLIN  ? LOOP_IN  : 0)
+                   | (evs[i].events & EPOLLOUT ? LOOP_OUT : 0)
+                   | (evs[i].events & (EPOLLERR | EPOLLHUP)
+                                    ? LOOP_ERR : 0);
+        src->cb(src, events);
+    }
+    l->batch   = NULL;
+    l->batch_n = 0;
+
+    if (l->n_nopoll) {
+        /* callbacks can unregister sources, so we collect them
+         * first, and check they are still registered before
+         * calling them. */
+        struct loop_src *ready[LOOP_MAX_EVENTS], *src;
+        int n_ready = 0;
+
+        for (src = l->srcs; src && n_ready < LOOP_MAX_EVENTS;
+                src = src->next)
+        {
+            if (src->nopoll && src->events)
+                ready[n_ready++] = src;
+        }
+        for (int i = 0; i < n_ready; i++) {
+            src = ready[i];
+            if (src->pprev && src->events)
+                src->cb(src, src->events);
+        }
+        n += n_ready;
+    }
+    return n;
+} /* loop_once */
+#else
+int
+loop_once(
+        struct loop    *l,
+        const sigset_t *mask)
+{
+    struct timespec  tmo, *ptmo = NULL;
+    struct loop_src *src;
+    size_t           i, n;
+
+    if (l->pfds_cap < l->n_srcs) {
+        struct pollfd *new_pfds = realloc(l->pfds,
+                l->n_srcs * sizeof *new_pfds);
+        if (!new_pfds)
+            return -1;
+        l->pfds = new_pfds;
+        struct loop_src **new_psrcs = realloc(l->psrcs,
+                l->n_srcs * sizeof *new_psrcs);
+        if (!new_psrcs)
+            return -1;
+        l->psrcs    = new_psrcs;
+        l->pfds_cap = l->n_srcs;
+    }
+    memset(l->psrcs, 0, l->pfds_cap * sizeof *l->psrcs);
+    for (i = 0, src = l->srcs; src; i++, src = src->next) {
+        l->psrcs[i]        = src;
+        l->pfds[i].fd      = src->events ? src->fd : -1;
+        l->pfds[i].events  = (src->events & LOOP_IN  ? POLLIN  : 0)
+                           | (src->events & LOOP_OUT ? POLLOUT : 0);
+        l->pfds[i].revents = 0;
+    }
+    n = i;
+
+    if (l->heap_n > 0) {
+        struct timespec now;
+        clock_gettime(LOOP_CLOCK, &now);
+        tmo.tv_sec  = l->heap[0]->when.tv_sec  - now.tv_sec;
+        tmo.tv_nsec = l->heap[0]->when.tv_nsec - now.tv_nsec;
+        if (tmo.tv_nsec < 0) {
+            tmo.tv_sec--;
+            tmo.tv_nsec += 1000000000;
+        }
+        if (tmo.tv_sec < 0)
+            tmo.tv_sec = tmo.tv_nsec = 0;
+        ptmo = &tmo;
+    }
+
+    int res = ppoll(l->pfds, n, ptmo, mask);
+    if (res < 0)
+        return -1;
+
+    /* callbacks can unregister sources, so we cannot follow
+     * the list, loop_del() clears the entries in psrcs. */
+    int dispatched = 0;
+    for (i = 0; i < n && res > 0; i++) {
+        struct pollfd *p = l->pfds + i;
+        if (!p->revents)
+            continue;
+        res--;
+        if (!(src = l->psrcs[i]))
+            continue; /* unregistered by a previous callback */
+        src->cb(src,
+                  (p->revents & POLLIN  ? LOOP_IN  : 0)
+                | (p->revents & POLLOUT ? LOOP_OUT : 0)
+                | (p->revents & (POLLERR | POLLHUP | POLLNVAL)
+                                        ? LOOP_ERR : 0));
+        dispatched++;
+    }
+    return dispatched + loop_expire(l);
+} /* loop_once */
+#endif
@@ -0,0 +1,217 @@
+/* loop.h -- event loop definitions.  A loop waits for file
+ * descriptors to become ready and for timers to expire, and
+ * calls the callbacks registered for them.
+ * Author: Luis Colorado <luiscoloradourcola@gmail.com>
+ * Copyright: (C) 2015-2025 LUIS COLORADO.  All rights reserved.
+ * License: BSD.
+ */
+#ifndef _LOOP_H
+#define _LOOP_H
+
+#include <pthread.h>
+#include <signal.h>
+#include <stddef.h>
+#include <time.h>
+
+/* the clock used for all the timers in the loop.  It must not
+ * jump when the date is set, as the channels are paced with it. */
+#define LOOP_CLOCK      CLOCK_MONOTONIC
+
+/* events we can wait for on a file descriptor */
+#define LOOP_IN         (1 << 0)
+#define LOOP_OUT        (1 << 1)
+#define LOOP_ERR        (1 << 2) /* only reported, never requested */
+
+struct loop_src;
+struct loop_timer;
+struct loop_post;
+
+typedef void (*loop_src_cb)(struct loop_src *src, int events);
+typedef void (*loop_timer_cb)(struct loop_timer *tim);
+typedef void (*loop_post_cb)(struct loop_post *p);
+
+struct loop_src {
+    int              fd;        /* file descriptor watched */
+    int              events;    /* events we are interested in */
+    loop_src_cb      cb;        /* callback to call on events */
+    void            *data;      /* user data */
+    int              nopoll;    /* fd cannot be polled (a regular
+                                 * file), it is always ready */
+
+    struct loop_src *next,      /* list of sources in the loop */
+                   **pprev;
+};
+
+struct loop_timer {
+    struct timespec  when;      /* absolute time of expiration */
+    size_t           heap_ix;   /* position in the heap + 1,
+                                 * 0 when the timer is not armed. */
+    loop_timer_cb    cb;        /* callback to call on expiration */
+    void            *data;      /* user data */
+};
+
+/* a call to be done from the loop, requested from another
+ * thread (see loop_post()) */
+struct loop_post {
+    loop_post_cb      cb;       /* callback to call */
+    void             *data;     /* user data */
+    int               pending;  /* queued and not called yet */
+    struct loop_post *next;     /* queue of posts of the loop */
+};
+
+struct loop {
+    int              fd;        /* epoll(7) descriptor (or -1) */
+    int              tfd;       /* timerfd(2) descriptor (or -1) */
+    struct timespec  tfd_when;  /* what tfd has been armed to */
+    struct timespec  now;       /* when the expired timers were
+                                 * checked, the timer callbacks
+                                 * can use it instead of reading
+                                 * the clock again. */
+    struct loop_src  tsrc;      /* source of the timerfd */
+
+    struct loop_timer
+                   **heap;      /* armed timers, as a binary heap
+                                 * ordered by expiration time. */
+    size_t           heap_n,
+                     heap_cap;
+
+    struct loop_src *srcs;      /* list of registered sources */
+    size_t           n_srcs;
+    size_t           n_nopoll;  /* nopoll sources waiting events */
+    void            *batch;     /* events being dispatched, so */
+    int              batch_n;   /* loop_del() can cancel them. */
+    struct pollfd   *pfds;      /* poll(2) backend only */
+    struct loop_src**psrcs;     /* sources of each pfds entry */
+    size_t           pfds_cap;
+
+    pthread_mutex_t  post_mtx;  /* protects the fields below */
+    struct loop_post*posts,     /* posts queued */
+                   **posts_tail;
+    int              post_fd[2];/* pipe to wake up the loop */
+    struct loop_src  post_src;  /* read side of post_fd */
+};
+
+/* Compare two times, as the timers of the loop do.
+ *
+ * @param a the first time.
+ * @param b the second one.
+ * @return <0, 0 or >0 as a is before, the same as or after b. */
+int
+loop_ts_cmp(
+        const struct timespec *a,
+        const struct timespec *b);
+
+/* Initialize a loop.
+ *
+ * @param l the loop to be initialized.
+ * @return 0 on success, -1 and errno set on error. */
+int
+loop_init(
+        struct loop *l);
+
+/* Release all the resources allocated to a loop.  The
+ * sources registered are not closed.
+ *
+ * @param l the loop to be destroyed. */
+void
+loop_destroy(
+        struct loop *l);
+
+/* Register a source on the loop.  src->fd, src->events
+ * and src->cb must be set before calling this routine.
+ * This and all the other routines of the loop must be called
+ * from the thread that runs it, except loop_post().
+ *
+ * @param l the loop.
+ * @param src the source to register.
+ * @return 0 on success, -1 and errno set on error. */
+int
+loop_add(
+        struct loop     *l,
+        struct loop_src *src);
+
+/* Change the set of events we wait for on a source.  Passing
+ * 0 in events makes the source silent, but still registered.
+ *
+ * @param l the loop.
+ * @param src the source to modify.
+ * @param events the new set of events.
+ * @return 0 on success, -1 and errno set on error. */
+int
+loop_mod(
+        struct loop     *l,
+        struct loop_src *src,
+        int              events);
+
+/* Unregister a source from the loop.  Nothing is done if the
+ * source is not registered.
+ *
+ * @param l the loop.
+ * @param src the source to unregister.
+ * @return 0 on success, -1 and errno set on error. */
+int
+loop_del(
+        struct loop     *l,
+        struct loop_src *src);
+
+/* Arm (or rearm) a timer to expire at absolute time when,
+ * as measured by LOOP_CLOCK.
+ *
+ * @param l the loop.
+ * @param tim the timer.
+ * @param when the absolute time of expiration. */
+void
+loop_timer_arm(
+        struct loop           *l,
+        struct loop_timer     *tim,
+        const struct timespec *when);
+
+/* Disarm a timer.  Nothing happens if the timer was not
+ * armed.
+ *
+ * @param l the loop.
+ * @param tim the timer. */
+void
+loop_timer_disarm(
+        struct loop           *l,
+        struct loop_timer     *tim);
+
+/* Request the loop to call p->cb(p), from any thread.  The
+ * calls are done in the same order they are posted.  Posting
+ * again a post that has not been called yet does nothing, so
+ * the callback must check what is to be done, and not rely on
+ * the number of calls.  p->cb and p->data must be set before
+ * calling this routine.
+ *
+ * @param l the loop.
+ * @param p the post. */
+void
+loop_post(
+        struct loop      *l,
+        struct loop_post *p);
+
+/* Run a loop forever, in a new thread.  All signals are
+ * blocked in the thread, so they go to the other threads.
+ *
+ * @param l the loop, already initialized.
+ * @return 0 on success, -1 and errno set on error. */
+int
+loop_spawn(
+        struct loop *l);
+
+/* Wait once for events and dispatch them to the callbacks.
+ * If no timer is armed and no source gets ready, this routine
+ * blocks until a signal is received.
+ *
+ * @param l the loop.
+ * @param mask the signal mask to use while waiting, so the
+ *        signals blocked outside can be delivered while we
+ *        are waiting (see ppoll(2)).  NULL to not change it.
+ * @return the number of events dispatched, or -1 and errno
+ *        set on error (EINTR when a signal was received). */
+int
+loop_once(
+        struct loop    *l,
+        const sigset_t *mask);
+
+#endif /* _LOOP_H */
@@ -6,24 +6,33 @@
  * License: BSD
  */
 
+#include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
-#include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/resource.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <termios.h>
 #include <time.h>
 #include <unistd.h>
-#include <pwd.h>
 
 #include "config.h"
 #include "slowtty.h"
+#include "delay.h"
+#include "session.h"
+#include "pool.h"
+#include "listen.h"
+#include "ctl.h"
+#include "play.h"
+#include "rec.h"
+#include "stats.h"
+#include "trace.h"
 #include "main.h"
 
 #ifndef   UQ_HAS_PTY_H /* {{ */
@@ -59,17 +68,62 @@
 #define   UQ_DEFAULT_FLAGS (FLAG_DOWINCH)
 #endif /* UQ_DEFAULT_FLAGS    }} */
 
-#ifndef   UQ_PATH_MAX /* {{ */
-#warning  UQ_PATH_MAX should be defined in config.mk
-#define   UQ_PATH_MAX (1024)
-#endif /* UQ_PATH_MAX    }} */
+#ifndef   UQ_DEFAULT_BURST_MSEC /* {{ */
+#warning  UQ_DEFAULT_BURST_MSEC should be defined in config.mk
+#define   UQ_DEFAULT_BURST_MSEC (100)
+#endif /* UQ_DEFAULT_BURST_MSEC    }} */
 
-#define DO_FINISH_ITER  6 /* six reads without data */
+#define MIN(_a, _b) ((_a)<(_b) ? (_a) : (_b))
 
 volatile int flags = UQ_DEFAULT_FLAGS;
 
+unsigned long burst_msecs = UQ_DEFAULT_BURST_MSEC;
+
+unsigned long baud_override = 0;
+unsigned long ibaud_override = 0;
+
+struct lag_conf lag_out, lag_in;
+
+const char *ctl_path = NULL;
+
+unsigned long screen_msecs = 0;
+
 struct winsize saved_window_size;
-struct termios saved_tty;
+
+/* the settings of the terminal, to restore them at exit.  They
+ * are never changed once read. */
+static struct termios saved_tty;
+
+static volatile sig_atomic_t child_exited = FALSE;
+static volatile sig_atomic_t winsz_changed = FALSE;
+
+/* parse a latency, msecs[:jitter], of the -y option.
+ * @return the end of it. */
+static char *
+parse_lag(
+        char            *s,
+        struct lag_conf *conf)
+{
+    conf->msecs  = strtoul(s, &s, 10);
+    conf->jitter = *s == ':' ? strtoul(s + 1, &s, 10) : 0;
+    return s;
+} /* parse_lag */
+
+/* parse a number of milliseconds, all digits.
+ * @return 0 on success, -1 if s is not a number or too large. */
+static int
+parse_msecs(
+        const char      *s,
+        unsigned long   *msecs)
+{
+    char *end;
+
+    errno  = 0;
+    *msecs = strtoul(s, &end, 10);
+    if (!isdigit((unsigned char) *s) || *end != '\0' || errno == ERANGE)
+        return -1;
+    return 0;
+} /* parse_msecs */
 
 static struct pthread_info*
 init_pthread_info(
@@ -77,14 +131,21 @@ init_pthread_info(
         struct pthread_info    *other,
         int                     from_fd,
         int                     to_fd,
-        char                   *name)
+        int                     line_fd,
+        char                   *name,
+        struct loop            *loop,
+        struct loop            *in_loop)
 {
+    memset(pi, 0, sizeof *pi);
     pi->from_fd     = from_fd;
     pi->to_fd       = to_fd;
+    pi->line_fd     = line_fd;
     pi->name        = name;
     pi->other       = other;
     pi->flags       = 0;
     pi->do_finish   = 0;
+    pi->loop        = loop;
+    pi->in_loop     = in_loop;
     rb_init(&pi->b);
 
     return pi;
@@ -136,8 +197,565 @@ pass_winsz(int sig)
     }
     LOG("Changed window size to (r=%d, c=%d)\r\n",
         ws.ws_row, ws.ws_col);
+    winsz_changed = TRUE; /* the output channel gets it */
+    if (rec_enabled()) {
+        char buf[32];
+        int  n = snprintf(buf, sizeof buf, "%dx%d",
+                ws.ws_col, ws.ws_row);
+        rec_put(REC_RESIZE, buf, n);
+    }
 } /* pass_winsz */
 
+static void
+sigchld_handler(int sig)
+{
+    child_exited = TRUE;
+} /* sigchld_handler */
+
+/* drain the notification pipe of the pool */
+static void
+pool_notified(
+        struct loop_src *src,
+        int              events)
+{
+    char buf[64];
+
+    while (read(src->fd, buf, sizeof buf) > 0)
+        continue;
+} /* pool_notified */
+
+/* the listening socket of server mode */
+struct listener {
+    struct loop_src     src;
+    struct loop_timer   retry;  /* to retry when out of descriptors */
+    struct loop        *loop;
+    struct termios      tty;    /* initial settings of the sessions */
+};
+
+/* we run out of descriptors, don't accept for some time */
+#define LISTEN_RETRY_SECS   (1)
+
+static void
+listener_retry(
+        struct loop_timer *t)
+{
+    struct listener *lst = t->data;
+
+    LOG("accepting connections again\n");
+    loop_mod(lst->loop, &lst->src, LOOP_IN);
+} /* listener_retry */
+
+/* accept all the connections pending, creating a session on
+ * each */
+static void
+listener_ready(
+        struct loop_src *src,
+        int              events)
+{
+    struct listener *lst = src->data;
+
+    for (;;) {
+        char name[SESSION_NAME_MAX];
+        int  fd = listen_accept(src->fd, name, sizeof name);
+
+        if (fd < 0) {
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS
+                    || errno == ENOMEM)
+            {
+                struct timespec when;
+
+                WARN("accept" ERRNO ", stop accepting for %d s\n",
+                    EPMTS, LISTEN_RETRY_SECS);
+                loop_mod(lst->loop, src, 0);
+                clock_gettime(LOOP_CLOCK, &when);
+                when.tv_sec += LISTEN_RETRY_SECS;
+                loop_timer_arm(lst->loop, &lst->retry, &when);
+                return;
+            } else if (errno == ECONNABORTED || errno == EINTR) {
+                continue;
+            } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                WARN("accept" ERRNO "\n", EPMTS);
+            }
+            return;
+        }
+
+        struct session *s = session_new(fd, fd, &lst->tty, NULL);
+        if (!s) {
+            WARN("%s: session_new" ERRNO "\n", name, EPMTS);
+            close(fd);
+            continue;
+        }
+        snprintf(s->name, sizeof s->name, "%s", name);
+        LOG("session %d: pid=%d, connection from %s\n",
+            s->id, s->pid, s->name);
+        pool_add(s);
+    }
+} /* listener_ready */
+
+/* Server mode.  n_sessions sessions are created, each with the
+ * child's pty throttled to a new front end pty, whose name is
+ * printed on stdout, and a session is created for each
+ * connection on listen_addr (if not NULL).  Sessions are
+ * distributed on a pool of worker threads.  Without a listening
+ * socket, we exit when all the sessions are done.
+ *
+ * @param n_sessions the number of pty sessions to create.
+ * @param listen_addr the address to listen on (or NULL).
+ * @param oldmask signal mask to use while waiting.
+ */
+static void
+run_server(
+        int              n_sessions,
+        const char      *listen_addr,
+        const sigset_t  *oldmask)
+{
+    struct loop     loop;
+    struct loop_src notify_src;
+    struct listener lst;
+    struct rlimit   rl;
+    int             notify[2];
+
+    /* each session uses two or three descriptors, so raise the
+     * limit as much as we can. */
+    if (       getrlimit(RLIMIT_NOFILE, &rl) == 0
+            && rl.rlim_cur < rl.rlim_max)
+    {
+        rl.rlim_cur = rl.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &rl) < 0) {
+            WARN("setrlimit(RLIMIT_NOFILE)" ERRNO "\n", EPMTS);
+        }
+    }
+
+    /* a peer closing its connection must not kill us */
+    signal(SIGPIPE, SIG_IGN);
+
+    if (       pipe(notify) < 0
+            || set_nonblock(notify[0]) < 0
+            || set_nonblock(notify[1]) < 0)
+    {
+        ERR("pipe" ERRNO "\n", EPMTS);
+    }
+    fcntl(notify[0], F_SETFD, FD_CLOEXEC);
+    fcntl(notify[1], F_SETFD, FD_CLOEXEC);
+
+    if (loop_init(&loop) < 0) {
+        ERR("loop_init" ERRNO "\n", EPMTS);
+    }
+    notify_src.fd     = notify[0];
+    notify_src.events = LOOP_IN;
+    notify_src.cb     = pool_notified;
+    notify_src.data   = NULL;
+    if (loop_add(&loop, &notify_src) < 0) {
+        ERR("loop_add" ERRNO "\n", EPMTS);
+    }
+
+    if (pool_init(0, notify[1]) < 0) {
+        ERR("pool_init" ERRNO "\n", EPMTS);
+    }
+
+    if (listen_addr) {
+        memset(&lst, 0, sizeof lst);
+        lst.src.fd     = listen_open(listen_addr);
+        if (lst.src.fd < 0) {
+            ERR("%s: listen" ERRNO "\n", listen_addr, EPMTS);
+        }
+        lst.src.events = LOOP_IN;
+        lst.src.cb     = listener_ready;
+        lst.src.data   = &lst;
+        lst.retry.cb   = listener_retry;
+        lst.retry.data = &lst;
+        lst.loop       = &loop;
+        if (isatty(0) && tcgetattr(0, &lst.tty) == 0) {
+            LOG("sessions get the settings of stdin\n");
+        } else {
+            session_tty_defaults(&lst.tty);
+        }
+        if (loop_add(&loop, &lst.src) < 0) {
+            ERR("loop_add" ERRNO "\n", EPMTS);
+        }
+        LOG("listening on %s\n", listen_addr);
+    }
+
+    for (int i = 0; i < n_sessions; i++) {
+        int             fm, fs;
+        char            name[SESSION_NAME_MAX];
+        struct termios  t, raw;
+
+        /* the front end pty.  Its initial settings are passed
+         * to the child's pty, and it is put in raw mode, so it
+         * passes everything as we do with our tty in single
+         * session mode. */
+        if (openpty(&fm, &fs, name, NULL, NULL) < 0) {
+            ERR("openpty" ERRNO "\n", EPMTS);
+        }
+        if (tcgetattr(fs, &t) < 0) {
+            ERR("tcgetattr(%s)" ERRNO "\n", name, EPMTS);
+        }
+        raw = t;
+        cfmakeraw(&raw);
+        if (tcsetattr(fs, TCSANOW, &raw) < 0) {
+            ERR("tcsetattr(%s)" ERRNO "\n", name, EPMTS);
+        }
+        fcntl(fm, F_SETFD, FD_CLOEXEC);
+        fcntl(fs, F_SETFD, FD_CLOEXEC);
+        if (set_nonblock(fm) < 0) {
+            ERR("fcntl(%s)" ERRNO "\n", name, EPMTS);
+        }
+
+        struct session *s = session_new(fm, fm, &t, NULL);
+        if (!s) {
+            ERR("session_new" ERRNO "\n", EPMTS);
+        }
+        s->front_aux = fs; /* so the front end never gets EIO */
+        snprintf(s->name, sizeof s->name, "%s", name);
+
+        printf("%d %d %s\n", s->id, s->pid, s->name);
+        fflush(stdout);
+
+        pool_add(s);
+    }
+
+    /* wait for all the sessions to end (forever, if listening),
+     * reaping the children as they die. */
+    while (listen_addr || pool_active() > 0) {
+        if (loop_once(&loop, oldmask) < 0 && errno != EINTR) {
+            ERR("loop_once" ERRNO "\n", EPMTS);
+        }
+        while (waitpid(-1, NULL, WNOHANG) > 0)
+            continue;
+    }
+    LOG("all sessions done, exit(EXIT_SUCCESS);\n");
+    exit(EXIT_SUCCESS);
+} /* run_server */
+
+/* Filter mode.  stdin is throttled to stdout, with the line
+ * parameters passed, no pty, no child and no tty settings
+ * changed.  We exit when all of stdin has been written.
+ *
+ * @param baud the baudrate of the line.
+ * @param frame the frame format (as 8N1).
+ * @param oldmask signal mask to use while waiting.
+ */
+static void
+run_filter(
+        unsigned long    baud,
+        const char      *frame,
+        const sigset_t  *oldmask)
+{
+    struct pthread_info pi;
+    struct loop         loop, in_loop;
+    struct ctl          ctl = { 0 };
+
+    if (       loop_init(&loop) < 0
+            || loop_init(&in_loop) < 0
+            || loop_spawn(&in_loop) < 0)
+    {
+        ERR("loop_init" ERRNO "\n", EPMTS);
+    }
+    /* descriptors are left in blocking mode, as they can be
+     * shared with other processes of a pipeline.  We only read
+     * when stdin is ready, and a blocked write on stdout just
+     * means that the reader is slower than the line. */
+    init_pthread_info(&pi, NULL, 0, 1, -1, "FILTER",
+        &loop, &in_loop);
+    lag_init(&pi.lag, &lag_out);
+    if (rec_enabled())
+        pi.rec_ev = REC_OUTPUT;
+    if (delay_frame(&pi.line, baud, frame) < 0) {
+        ERR("%s: invalid frame format, use something like 8N1\n",
+            frame);
+    }
+    pi_start(&pi);
+    if (ctl_path && ctl_open(&ctl, ctl_path, &loop, NULL, &pi) < 0) {
+        ERR("%s: control socket" ERRNO "\n", ctl_path, EPMTS);
+    }
+
+    while (!(pi.flags & PIFLG_DONE)) {
+        if (loop_once(&loop, oldmask) < 0 && errno != EINTR) {
+            ERR("loop_once" ERRNO "\n", EPMTS);
+        }
+    }
+    ctl_close(&ctl);
+    if (stats_enabled())
+        stats_report(stderr, pi.st, "\n");
+    /* the loops are not destroyed, the ingestion thread could
+     * still use them until we exit. */
+    exit(EXIT_SUCCESS);
+} /* run_filter */
+
+/* PLAYBACK MODE (-P) */
+
+/* the keys move the playback this time */
+#define PLAYER_SKIP_SECS    (10)
+
+/* a file being played back, see run_play() */
+struct player {
+    struct play         p;
+    unsigned long       cps;    /* chars per second of the line, or
+                                 * 0 to play at the recorded times */
+    struct pthread_info pi;     /* only for the pacing, with cps */
+    double              scale;  /* the recorded times are divided
+                                 * by this */
+    struct timespec     base;   /* when the recorded time t0 ...*/
+    uint64_t            t0;     /* ... is (or was) played */
+    int                 paused;
+    struct loop        *loop;
+    struct loop_timer   tim;
+    struct loop_src     keys;
+};
+
+static struct player player; /* too large for the stack */
+
+/* the time to play a recorded time at */
+static void
+player_when(
+        struct player   *pl,
+        uint64_t         t,
+        struct timespec *when)
+{
+    unsigned long long nsec = t > pl->t0
+        ? (t - pl->t0) / pl->scale
+        : 0;
+
+    nsec += pl->base.tv_nsec;
+    when->tv_sec  = pl->base.tv_sec + nsec / 1000000000;
+    when->tv_nsec = nsec % 1000000000;
+} /* player_when */
+
+/* the recorded time being played now */
+static uint64_t
+player_now(
+        struct player   *pl)
+{
+    struct timespec now;
+
+    if (pl->paused)
+        return pl->t0;
+    clock_gettime(LOOP_CLOCK, &now);
+    return pl->t0 + ((now.tv_sec  - pl->base.tv_sec) * 1000000000LL
+                   +  now.tv_nsec - pl->base.tv_nsec) * pl->scale;
+} /* player_now */
+
+/* write all the data passed to stdout */
+static void
+player_write(
+        struct player   *pl,
+        const char      *data,
+        size_t           n)
+{
+    while (n > 0) {
+        ssize_t res = write(1, data, n);
+        if (res < 0) {
+            if (errno == EINTR)
+                continue;
+            ERR("write" ERRNO "\r\n", EPMTS);
+        }
+        play_consume(&pl->p, res);
+        data += res;
+        n    -= res;
+    }
+} /* player_write */
+
+static void
+player_tick(
+        struct loop_timer *tim)
+{
+    struct player  *pl = tim->data;
+    const char     *data;
+    size_t          n;
+    uint64_t        t;
+    struct timespec when;
+
+    if (pl->cps) {
+        /* at the pace of the line */
+        delay(&pl->pi, &pl->loop->now);
+        while (       pl->pi.tokens > 0
+                && (n = play_data(&pl->p, &data, NULL)) > 0)
+        {
+            n = MIN(n, pl->pi.tokens);
+            player_write(pl, data, n);
+            pl->pi.tokens -= n;
+        }
+        when = pl->pi.tic;
+    } else {
+        /* at the recorded times */
+        while ((n = play_data(&pl->p, &data, &t)) > 0) {
+            player_when(pl, t, &when);
+            if (loop_ts_cmp(&when, &pl->loop->now) > 0)
+                break;
+            player_write(pl, data, n);
+        }
+    }
+    if (play_data(&pl->p, &data, NULL) == 0)
+        exit(EXIT_SUCCESS); /* all played */
+    loop_timer_arm(pl->loop, &pl->tim, &when);
+} /* player_tick */
+
+/* begin to play from where the player is, now */
+static void
+player_restart(
+        struct player   *pl,
+        uint64_t         t0)
+{
+    clock_gettime(LOOP_CLOCK, &pl->base);
+    pl->t0        = t0;
+    pl->pi.tic    = pl->base;
+    pl->pi.tokens = 0;
+    if (!pl->paused)
+        loop_timer_arm(pl->loop, &pl->tim, &pl->base);
+} /* player_restart */
+
+/* seek the player from where it plays now */
+static void
+player_skip(
+        struct player   *pl,
+        int              secs)
+{
+    if (pl->cps) {
+        long long pos = pl->p.pos + (long long) secs * pl->cps;
+        play_seek(&pl->p, pos > 0 ? pos : 0);
+        player_restart(pl, 0);
+    } else {
+        long long t = player_now(pl) + secs * 1000000000LL;
+        play_seek_time(&pl->p, t > 0 ? t : 0);
+        player_restart(pl, t > 0 ? t : 0);
+    }
+} /* player_skip */
+
+/* the keys of the user: space pauses, < and > move back and
+ * forth, and q quits. */
+static void
+player_key(
+        struct loop_src *src,
+        int              events)
+{
+    struct player *pl = src->data;
+    char           buf[64];
+    ssize_t        n = read(src->fd, buf, sizeof buf);
+
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+        loop_del(pl->loop, src); /* no more keys */
+        return;
+    }
+    for (ssize_t i = 0; i < n; i++) {
+        switch (buf[i]) {
+        case 'q': case 'Q':
+            exit(EXIT_SUCCESS);
+        case ' ':
+            if (!pl->paused) {
+                pl->t0     = player_now(pl);
+                pl->paused = TRUE;
+                loop_timer_disarm(pl->loop, &pl->tim);
+            } else {
+                pl->paused = FALSE;
+                player_restart(pl, pl->t0);
+            }
+            break;
+        case '<': case ',':
+            player_skip(pl, -PLAYER_SKIP_SECS);
+            break;
+        case '>': case '.':
+            player_skip(pl, PLAYER_SKIP_SECS);
+            break;
+        }
+    }
+} /* player_key */
+
+/* Playback mode.  A file (a recording made with -R, or any
+ * other) is played on stdout, at the line speed or at the times
+ * it was recorded.  We exit when all of it has been played.
+ *
+ * @param path the file to play.
+ * @param baud the baudrate of the line, or 0 to play a
+ *        recording at its times.
+ * @param frame the frame format (as 8N1).
+ * @param scale the recorded times are played this times faster.
+ * @param seek where to begin, a byte of the data, or the time
+ *        (seconds, followed by an s) of the line, or of the
+ *        recording.
+ * @param oldmask signal mask to use while waiting.
+ */
+static void
+run_play(
+        const char      *path,
+        unsigned long    baud,
+        const char      *frame,
+        double           scale,
+        const char      *seek,
+        const sigset_t  *oldmask)
+{
+    struct player  *pl = &player;
+    struct loop     loop;
+
+    if (play_open(&pl->p, path) < 0) {
+        ERR("%s" ERRNO "\n", path, EPMTS);
+    }
+    if (!pl->p.cast && !baud) {
+        ERR("%s: not a recording, it needs a baudrate (-r)\n", path);
+    }
+    if (loop_init(&loop) < 0) {
+        ERR("loop_init" ERRNO "\n", EPMTS);
+    }
+    pl->loop  = &loop;
+    pl->scale = scale;
+    init_pthread_info(&pl->pi, NULL, -1, 1, -1, "PLAYER", &loop, NULL);
+    pl->pi.st = &pl->pi.st_own;
+    if (delay_frame(&pl->pi.line, baud, frame) < 0) {
+        ERR("%s: invalid frame format, use something like 8N1\n",
+            frame);
+    }
+    if (baud)
+        pl->cps = baud / delay_bits(&pl->pi.line);
+
+    uint64_t t0 = 0;
+    if (seek) {
+        char  *end;
+        double n = strtod(seek, &end);
+
+        if (end == seek || n < 0 || (*end && strcmp(end, "s"))) {
+            ERR("-j %s: invalid position, use bytes, "
+                "or seconds followed by s\n", seek);
+        }
+        if (*end != 's')
+            play_seek(&pl->p, n);
+        else if (pl->cps)
+            play_seek(&pl->p, n * pl->cps);
+        else
+            play_seek_time(&pl->p, t0 = n * 1000000000.0);
+    }
+
+    /* the keys, if we have a terminal.  We only need them char
+     * by char, the output is processed as usual. */
+    if (isatty(0) && tcgetattr(0, &saved_tty) == 0) {
+        struct termios t = saved_tty;
+
+        t.c_lflag &= ~(ICANON | ECHO);
+        t.c_cc[VMIN]  = 1;
+        t.c_cc[VTIME] = 0;
+        atexit(atexit_handler);
+        if (tcsetattr(0, TCSADRAIN, &t) < 0) {
+            ERR("tcsetattr" ERRNO "\n", EPMTS);
+        }
+        pl->keys.fd     = 0;
+        pl->keys.events = LOOP_IN;
+        pl->keys.cb     = player_key;
+        pl->keys.data   = pl;
+        if (loop_add(&loop, &pl->keys) < 0) {
+            ERR("loop_add" ERRNO "\n", EPMTS);
+        }
+    }
+
+    pl->tim.cb   = player_tick;
+    pl->tim.data = pl;
+    player_restart(pl, t0);
+
+    for (;;) {
+        if (loop_once(&loop, oldmask) < 0 && errno != EINTR) {
+            ERR("loop_once" ERRNO "\n", EPMTS);
+        }
+    }
+} /* run_play */
+
 int
 main(
         int argc,
@@ -148,13 +766,82 @@ main(
     pid_t  child_pid;
     char   pty_name[UQ_MAX_PTY_NAME];
     size_t bufsz;
+    int    n_sessions = 0;
+    char  *listen_addr = NULL;
+    int    filter = FALSE;
+    char  *frame = "8N1";
+    char  *stats_path = NULL;
+    char  *trace_path = NULL;
+    char  *rec_path = NULL;
+    char  *play_path = NULL;
+    char  *play_seek = NULL;
+    double play_scale = 1.0;
+    struct sigaction sa;
+    sigset_t sigs, oldmask;
 
-    while ((opt = getopt(argc, argv, "dltws:")) != EOF) {
+    while ((opt = getopt(argc, argv, "dfltwB:c:C:D:j:L:Op:P:r:R:s:S:T:u:x:y:")) != EOF) {
         switch (opt) {
         case 'd': flags ^=  FLAG_VERBOSE; break;
+        case 'f': filter = TRUE;          break;
         case 'l': flags ^=  FLAG_LOGIN;   break;
         case 't': flags ^=  FLAG_NOTCSET; break;
         case 'w': flags ^=  FLAG_DOWINCH; break;
+        case 'B': if (parse_msecs(optarg, &burst_msecs) < 0) {
+                ERR("-B %s: invalid burst, use msecs\n", optarg);
+            } break;
+        case 'c': frame = optarg;         break;
+        case 'C': ctl_path = optarg;      break;
+        case 'r': {
+                /* output[,input], the same for both if only one */
+                char *end;
+                baud_override = ibaud_override
+                              = strtoul(optarg, &end, 10);
+                if (*end == ',')
+                    ibaud_override = strtoul(end + 1, &end, 10);
+                if (baud_override == 0 || ibaud_override == 0
+                        || *end != '\0') {
+                    ERR("-r %s: invalid baudrate\n", optarg);
+                }
+            } break;
+        case 'D': n_sessions = atoi(optarg);
+            if (n_sessions <= 0) {
+                ERR("-D %s: invalid number of sessions\n", optarg);
+            } break;
+        case 'j': play_seek = optarg; break;
+        case 'L': listen_addr = optarg; break;
+        case 'O': flags ^=  FLAG_OPTIMIZE; break;
+        case 'P': play_path = optarg; break;
+        case 'R': rec_path = optarg; break;
+        case 'S': stats_path = optarg; break;
+        case 'T': trace_path = optarg; break;
+        case 'u': if (parse_msecs(optarg, &screen_msecs) < 0
+                    || screen_msecs == 0) {
+                ERR("-u %s: invalid backlog, use msecs\n", optarg);
+            } break;
+        case 'y': {
+                /* output[,input], the same for both if only one */
+                char *end = parse_lag(optarg, &lag_out);
+                lag_in = lag_out;
+                if (*end == ',')
+                    end = parse_lag(end + 1, &lag_in);
+                if (*end != '\0') {
+                    ERR("-y %s: invalid latency, use "
+                        "msecs[:jitter][,msecs[:jitter]]\n", optarg);
+                }
+            } break;
+        case 'x': play_scale = strtod(optarg, NULL);
+            if (play_scale <= 0) {
+                ERR("-x %s: invalid scale\n", optarg);
+            } break;
+        case 'p': if (delay_set_sched(optarg) < 0) {
+                const char *name;
+                fprintf(stderr, "%s: unknown scheduler, use one of:",
+                    optarg);
+                for (int i = 0; (name = delay_sched_name(i)) != NULL; i++)
+                    fprintf(stderr, " %s", name);
+                fprintf(stderr, "\n");
+                exit(EXIT_FAILURE);
+            } break;
         case 's': bufsz  =  atoi(optarg);
             if (bufsz <= 0 || bufsz >= UQ_DEFAULT_BUFSIZ) {
                 WARN("buffer size set to default(%d) due to "
@@ -169,6 +856,60 @@ main(
     argc -= optind;
     argv += optind;
 
+    if (play_path && (filter || rec_path || ctl_path
+                || n_sessions > 0 || listen_addr)) {
+        ERR("playback (-P) cannot be used with -f, -C, -R, -D or -L\n");
+    }
+    if (filter && !baud_override) {
+        ERR("filter mode (-f) needs a baudrate (-r)\n");
+    }
+
+    if (stats_path && stats_open(stats_path) < 0) {
+        ERR("%s: stats" ERRNO "\n", stats_path, EPMTS);
+    }
+    if (trace_path && trace_open(trace_path) < 0) {
+        ERR("%s: trace" ERRNO "\n", trace_path, EPMTS);
+    }
+    if (rec_path && (n_sessions > 0 || listen_addr)) {
+        ERR("-R only records a single session, not with -D or -L\n");
+    }
+
+    /* the command to execute in the child(s) */
+    if (!filter && !play_path)
+        session_cmd(argc, argv);
+
+    /* SIGCHLD and SIGWINCH are blocked, and only delivered while
+     * we wait for events in the loop, so we don't lose the child
+     * end between the check and the wait. */
+    memset(&sa, 0, sizeof sa);
+    sa.sa_handler = sigchld_handler;
+    sigaction(SIGCHLD, &sa, NULL);
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGCHLD);
+    sigaddset(&sigs, SIGWINCH);
+    sigprocmask(SIG_BLOCK, &sigs, &oldmask);
+
+    if (play_path) {
+        run_play(play_path, baud_override, frame, play_scale,
+            play_seek, &oldmask);
+        /* NOTREACHED */
+    }
+    if (filter) {
+        struct winsize ws = { .ws_row = 24, .ws_col = 80 };
+
+        /* the size of the terminal we write to, if it is one */
+        ioctl(1, TIOCGWINSZ, &ws);
+        if (rec_path && rec_open(rec_path, ws.ws_col, ws.ws_row) < 0) {
+            ERR("%s: recording" ERRNO "\n", rec_path, EPMTS);
+        }
+        run_filter(baud_override, frame, &oldmask);
+        /* NOTREACHED */
+    }
+    if (n_sessions > 0 || listen_addr) {
+        run_server(n_sessions, listen_addr, &oldmask);
+        /* NOTREACHED */
+    }
+
     /* we obtain the tty settings from stdin . */
     LOG("tcgetattr(0, &saved_tty);\n");
     if ( tcgetattr(0, &saved_tty) < 0) {
@@ -197,50 +938,15 @@ main(
     } else if (child_pid == 0) {
 
         /* child process */
-        int res;
-
-        if (argc) {
-            int i;
-            LOG("execvp:");
-            for (i = 0; i < argc; i++) {
-                ADD(" [%s]", argv[i]);
-            }
-            ADD("\n");
-
-            execvp(argv[0], argv);
-
-            ERR("execvp: %s" ERRNO "\n", argv[0], EPMTS);
-            /* NOTREACHED */
-        } else {
-            char *shellenv = "SHELL";
-            char *shell = getenv(shellenv);
-            char cmd[UQ_PATH_MAX];
-            if (shell) {
-                LOG("Got shell from environment variable SHELL\n");
-            } else {
-                struct passwd *u = getpwnam(getlogin());
-                if (u) {
-                    shell = u->pw_shell;
-                    LOG("Got shell from /etc/passwd file\n");
-                }
-            } /* if */
-            snprintf(cmd, sizeof cmd, "%s%s",
-                flags & FLAG_LOGIN
-                    ? "-"
-                    : "",
-                shell);
-            LOG("execlp: %s\n", cmd);
-            execlp(shell, cmd, NULL);
-            ERR("execlp: %s" ERRNO "\n", shell, EPMTS);
-            /* NOTREACHED */
-        } /* if */
+        sigprocmask(SIG_SETMASK, &oldmask, NULL);
+        session_exec();
         /* NOTREACHED */
     } else { /* PARENT */
 
         struct pthread_info p_in, p_out;
-        struct timespec ts_now;
+        struct loop loop, in_loop;
+        struct ctl  ctl = { 0 };
         int res, exit_code = 0;
-        struct sigaction sa;
         struct termios stty_raw = saved_tty;
 
         LOG("forkpty: child_pid == %d, ptym=%d, "
@@ -296,6 +1002,14 @@ main(
                 ptym, res | O_NONBLOCK, res2, EPMTS);
         }
 
+        /* PUT ptym IN PACKET MODE, SO WE GET NOTIFIED OF THE
+         * CHANGES IN THE SLAVE SIDE */
+        int one = 1;
+        if (ioctl(ptym, TIOCPKT, &one) < 0) {
+            ERR("ioctl(ptym=%d, TIOCPKT)" ERRNO "\r\n",
+                ptym, EPMTS);
+        }
+
         /* INSTALL SIGNAL HANDLER FOR SIGWINCH */
         if (flags & FLAG_DOWINCH) {
             LOG("installing signal handler for SIGWINCH\r\n");
@@ -304,70 +1018,86 @@ main(
             sigaction(SIGWINCH, &sa, NULL);
         }
 
-        /* CREATE THE SUBTHREADS TO PROCESS INFO */
-        clock_gettime(CLOCK_REALTIME, &p_in.tic);
-        res = pthread_create(
-                &p_in.id,
-                NULL,
-                pthread_body_reader,
-                init_pthread_info(
-                    &p_in,
-                    &p_out,
-                    0, ptym,
-                    "READER"));
-        if (res < 0) {
-            ERR("pthread_create" ERRNO "\r\n", EPMTS);
-        }
-        LOG("pthread_create: id=%p, name=%s ==> res=%d\r\n",
-                p_in.id, p_in.name, res);
+        /* RECORD THE SESSION, IF ASKED */
+        if (rec_path) {
+            struct winsize ws = saved_window_size;
 
-        p_out.tic = p_in.tic;
+            if (ws.ws_col == 0 || ws.ws_row == 0) {
+                ws.ws_col = 80;
+                ws.ws_row = 24;
+            }
+            if (rec_open(rec_path, ws.ws_col, ws.ws_row) < 0) {
+                ERR("%s: recording" ERRNO "\r\n", rec_path, EPMTS);
+            }
+        }
 
-        /* ADVANCE THE TIC, SO IT AWAKES HALF A TICK LATER */
-        p_out.tic.tv_nsec += TIC_DELAY / 2;
-        if (p_out.tic.tv_nsec >= 1000000000) {
-            p_out.tic.tv_sec++;
-            p_out.tic.tv_nsec -= 1000000000;
+        /* CREATE THE EVENT LOOPS AND THE CHANNELS ON THEM.  The
+         * input is read on its own thread (see pi_start()) */
+        if (       loop_init(&loop) < 0
+                || loop_init(&in_loop) < 0
+                || loop_spawn(&in_loop) < 0)
+        {
+            ERR("loop_init" ERRNO "\r\n", EPMTS);
         }
-        res = pthread_create(
-                &p_out.id,
-                NULL,
-                pthread_body_writer,
-                init_pthread_info(
+        init_pthread_info(
+                    &p_in,
+                    &p_out,
+                    0, ptym, ptym,
+                    "READER",
+                    &loop, &in_loop);
+        p_in.flags |= PIFLG_INTR;
+        lag_init(&p_in.lag, &lag_in);
+        if (rec_enabled())
+            p_in.rec_ev = REC_INPUT;
+        pi_start(&p_in);
+        init_pthread_info(
                     &p_out,
                     &p_in,
-                    ptym, 1,
-                    "WRITER"));
-        if (res < 0) {
-            ERR("pthread_create" ERRNO "\r\n", EPMTS);
+                    ptym, 1, ptym,
+                    "WRITER",
+                    &loop, &in_loop);
+        p_out.flags |= PIFLG_PKT;
+        lag_init(&p_out.lag, &lag_out);
+        if (rec_enabled())
+            p_out.rec_ev = REC_OUTPUT;
+        pi_start(&p_out);
+        if (       ctl_path
+                && ctl_open(&ctl, ctl_path, &loop, &p_in, &p_out) < 0)
+        {
+            ERR("%s: control socket" ERRNO "\r\n", ctl_path, EPMTS);
+        }
+
+        /* RUN THE LOOP UNTIL ALL THE OUTPUT OF THE CHILD HAS
+         * BEEN WRITTEN */
+        while (!(p_out.flags & PIFLG_DONE)) {
+            if (loop_once(&loop, &oldmask) < 0 && errno != EINTR) {
+                ERR("loop_once" ERRNO "\r\n", EPMTS);
+            }
+            if (winsz_changed) {
+                winsz_changed = FALSE;
+                pi_resize(&p_out);
+            }
+            if (child_exited && !p_out.do_finish) {
+                LOG("SIGCHLD received, finishing.\r\n");
+                pi_finish(&p_out);
+            }
+        }
+        ctl_close(&ctl);
+        /* the loops are not destroyed, the ingestion thread
+         * could still use them until we exit. */
+        if (stats_enabled()) {
+            stats_report(stderr, p_in.st,  "\r\n");
+            stats_report(stderr, p_out.st, "\r\n");
         }
-        LOG("pthread_create: id=%p, name=%s ==> res=%d\r\n",
-                p_out.id, p_out.name, res);
 
         /* wait for subprocess to terminate */
-        while ((res = wait(&exit_code)) < 0
+        while ((res = waitpid(child_pid, &exit_code, 0)) < 0
                 && errno == EINTR)
         {
             LOG("Interrupt received, retry.\r\n");
         }
         LOG("wait(&exit_code == %d);\r\n", exit_code);
 
-        /* WAIT FOR THE READING END */
-        p_in.do_finish = DO_FINISH_ITER;
-        res = pthread_join(p_in.id, NULL);
-        if (res < 0) {
-            LOG("pthread_join[%s]" ERRNO "\r\n",
-                p_in.name, EPMTS);
-        }
-
-        /* WAIT FOR THE WRITING END */
-        p_out.do_finish = TRUE;
-        res = pthread_join(p_out.id, NULL);
-        if (res < 0) {
-            LOG("pthread_join[%s]" ERRNO "\r\n",
-                p_out.name, EPMTS);
-        }
-
         /* exit with the subprocess exit code */
         LOG("exit(%d);\r\n", WEXITSTATUS(exit_code));
         exit(WEXITSTATUS(exit_code));
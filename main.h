@@ -7,13 +7,21 @@
 #ifndef MAIN_H
 #define MAIN_H
 
+#include "lag.h"
+
 #define FLAG_VERBOSE   (1 << 0)
 #define FLAG_LOGIN     (1 << 1)
 #define FLAG_NOTCSET   (1 << 2)
 #define FLAG_DOWINCH   (1 << 3)
+#define FLAG_OPTIMIZE  (1 << 4)
 
 extern volatile int flags;
+extern unsigned long baud_override; /* line speed (-r), or 0 */
+extern unsigned long ibaud_override; /* input speed (-r), or 0 */
 extern size_t bufsz;
-extern struct termios saved_tty;
-
+extern unsigned long burst_msecs; /* burst of the lines (-B) */
+extern struct lag_conf lag_out, lag_in; /* latency of the lines (-y) */
+extern const char *ctl_path; /* control socket (-C), or NULL */
+extern unsigned long screen_msecs; /* backlog to send screen diffs
+                                    * (-u), or 0 */
 #endif /* MAIN_H */
@@ -0,0 +1,681 @@
+/* opt.c -- optimizer of the output of a line.
+ * Author: Luis Colorado <luiscoloradourcola@gmail.com>
+ * Copyright: (C) 2015-2025 LUIS COLORADO.  All rights reserved.
+ * License: BSD.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "opt.h"
+
+#define ESC                 '\033'
+#define OPT_RESERVE         (4 * OPT_SEQ_MAX)   /* room in the output
+                                                 * to feed a byte */
+
+/* states of the parser */
+#define S_TEXT              (0)
+#define S_ESC               (1)     /* ESC */
+#define S_ESC_INT           (2)     /* ESC and intermediates */
+#define S_CSI               (3)     /* ESC [ and params */
+#define S_CSI_PASS          (4)     /* too long, passed as is */
+#define S_STR               (5)     /* OSC, DCS... passed as is */
+#define S_STR_ESC           (6)     /* ESC in OSC, DCS... */
+
+/* DEC private modes that move the cursor, save it with the
+ * attributes or change the meaning of the positionings */
+static const int opt_modes[] = { 3, 6, 47, 69, 1047, 1048, 1049 };
+
+/* bits of o->margins, what can make the relative moves go
+ * elsewhere than the absolute ones */
+#define M_REGION            (1 << 0)    /* scroll region (DECSTBM) */
+#define M_ORIGIN            (1 << 1)    /* origin mode (DECOM, ?6) */
+#define M_LEFT_RIGHT        (1 << 2)    /* left and right margins
+                                         * (DECLRMM, ?69) */
+
+/* nothing is known of the cursor and the attributes */
+static void
+opt_forget(
+        struct opt     *o)
+{
+    o->row = o->col = -1;
+    o->last_len     = -1;
+} /* opt_forget */
+
+static void
+opt_put(
+        struct opt     *o,
+        const char     *p,
+        size_t          n)
+{
+    memcpy(o->out + o->out_len, p, n);
+    o->out_len += n;
+} /* opt_put */
+
+/* ESC [ n f, n omitted if it is one */
+static int
+opt_csi_n(
+        char   *buf,
+        int     n,
+        int     f)
+{
+    return n == 1
+        ? sprintf(buf, "\033[%c", f)
+        : sprintf(buf, "\033[%d%c", n, f);
+} /* opt_csi_n */
+
+/* the shortest way to move the cursor to (r, c) */
+static int
+opt_move(
+        const struct opt   *o,
+        int                 r,
+        int                 c,
+        char               *buf)
+{
+    int n;
+
+    if (r == 0 && c == 0)
+        n = sprintf(buf, "\033[H");
+    else if (c == 0)
+        n = sprintf(buf, "\033[%dH", r + 1);
+    else if (r == 0)
+        n = sprintf(buf, "\033[;%dH", c + 1);
+    else
+        n = sprintf(buf, "\033[%d;%dH", r + 1, c + 1);
+    if (o->row < 0 || o->col < 0 || o->margins)
+        return n;
+
+    /* relative to where the cursor is */
+    char rel[4 * 16];
+    int  m  = 0,
+         dr = r - o->row,
+         dc = c - o->col;
+
+    if (dr != 0)
+        m += opt_csi_n(rel + m, abs(dr), dr < 0 ? 'A' : 'B');
+    if (dc != 0 && c == 0) {
+        rel[m++] = '\r';
+    } else if (dc < 0 && dc >= -2) {
+        while (dc++ < 0)
+            rel[m++] = '\b';
+    } else if (dc != 0) {
+        m += opt_csi_n(rel + m, abs(dc), dc < 0 ? 'D' : 'C');
+    }
+    if (m < n) {
+        memcpy(buf, rel, m);
+        n = m;
+    }
+    return n;
+} /* opt_move */
+
+/* write the positioning and the SGR held */
+static void
+opt_release(
+        struct opt     *o)
+{
+    char buf[OPT_SEQ_MAX + 4];
+    int  n;
+
+    if (o->mv_row >= 0) {
+        n = opt_move(o, o->mv_row, o->mv_col, buf);
+        opt_put(o, buf, n);
+        o->saved  += o->mv_orig - n;
+        if (o->rows && o->cols) {
+            o->row = o->mv_row;
+            o->col = o->mv_col;
+        }
+        o->mv_row  = o->mv_col = -1;
+        o->mv_orig = 0;
+    }
+    if (o->sgr_len >= 0) {
+        if (       o->last_len == o->sgr_len
+                && memcmp(o->last, o->sgr, o->sgr_len) == 0)
+        {
+            /* it sets what is already set */
+            o->saved += o->sgr_orig;
+        } else {
+            n = sprintf(buf, "\033[%.*sm", o->sgr_len, o->sgr);
+            opt_put(o, buf, n);
+            o->saved   += o->sgr_orig - n;
+            memcpy(o->last, o->sgr, o->sgr_len);
+            o->last_len = o->sgr_len;
+        }
+        o->sgr_len  = -1;
+        o->sgr_orig = 0;
+    }
+} /* opt_release */
+
+/* check that the extended colors (38, 48 and 58) of SGR params
+ * have all their values, as merging an incomplete one with the
+ * next would make it take the values of the next. */
+static int
+opt_sgr_complete(
+        const char *p,
+        int         len)
+{
+    const char *end  = p + len;
+    int         need = 0; /* values still to come */
+
+    while (p < end) {
+        const char *e = memchr(p, ';', end - p);
+        if (!e)
+            e = end;
+        int v = e > p && !memchr(p, ':', e - p) ? atoi(p) : -1;
+
+        if (need < 0) { /* the type of color */
+            need = v == 5 ? 1 : v == 2 ? 3 : 0;
+            if (need == 0)
+                return 0;
+        } else if (need > 0) {
+            need--;
+        } else if (v == 38 || v == 48 || v == 58) {
+            need = -1;
+        }
+        p = e + 1;
+    }
+    return need == 0;
+} /* opt_sgr_complete */
+
+/* an SGR sequence, held to merge it with the next */
+static void
+opt_sgr(
+        struct opt     *o,
+        const char     *p,
+        int             len)
+{
+    int complete = opt_sgr_complete(p, len);
+
+    if (o->sgr_len >= 0 && (len == 0 || (p[0] == '0'
+            && (len == 1 || p[1] == ';'))))
+    {
+        /* it resets the attributes, the held SGR does nothing */
+        o->saved  += o->sgr_orig;
+        o->sgr_len = -1;
+        o->sgr_orig = 0;
+    }
+    if (       o->sgr_len >= 0 && complete
+            && o->sgr_len + len + 3 <= OPT_SEQ_MAX
+            && opt_sgr_complete(o->sgr, o->sgr_len))
+    {
+        if (o->sgr_len == 0)
+            o->sgr[o->sgr_len++] = '0'; /* the reset, explicit */
+        o->sgr[o->sgr_len++] = ';';
+        if (len == 0)
+            o->sgr[o->sgr_len++] = '0';
+        memcpy(o->sgr + o->sgr_len, p, len);
+        o->sgr_len  += len;
+        o->sgr_orig += len + 3;
+        return;
+    }
+    opt_release(o);
+    memcpy(o->sgr, p, len);
+    o->sgr_len  = len;
+    o->sgr_orig = len + 3;
+} /* opt_sgr */
+
+/* a cursor positioning, held as the next could make it useless.
+ * @return 0 if its params are not row;col numbers. */
+static int
+opt_cup(
+        struct opt     *o,
+        const char     *p,
+        int             len)
+{
+    int v[2] = { 0, 0 }, i = 0;
+
+    for (const char *end = p + len; p < end; p++) {
+        if (*p == ';') {
+            if (++i > 1)
+                return 0;
+        } else if (*p >= '0' && *p <= '9' && v[i] < 100000) {
+            v[i] = v[i] * 10 + *p - '0';
+        } else {
+            return 0;
+        }
+    }
+    /* from 0, clamped to the screen, as the terminal does */
+    int r = v[0] > 0 ? v[0] - 1 : 0,
+        c = v[1] > 0 ? v[1] - 1 : 0;
+    if (o->rows && r >= o->rows)
+        r = o->rows - 1;
+    if (o->cols && c >= o->cols)
+        c = o->cols - 1;
+    o->mv_row   = r;
+    o->mv_col   = c;
+    o->mv_orig += len + 3;
+    return 1;
+} /* opt_cup */
+
+/* the cursor is saved (DECSC) or restored (DECRC), and origin
+ * mode with it */
+static void
+opt_saved(
+        struct opt     *o,
+        int             save)
+{
+    if (save)
+        o->saved_origin = o->margins & M_ORIGIN;
+    else
+        o->margins = (o->margins & ~M_ORIGIN) | o->saved_origin;
+} /* opt_saved */
+
+/* DEC private modes set or reset: those of opt_modes make us
+ * forget the cursor, and origin mode and the left and right
+ * margins mode are followed in o->margins */
+static void
+opt_modes_set(
+        struct opt     *o,
+        const char     *p,
+        int             len,
+        int             set)
+{
+    const char *end = p + len;
+
+    while (p < end) {
+        int v = atoi(p);
+        for (int i = 0; i < sizeof opt_modes / sizeof opt_modes[0]; i++)
+            if (v == opt_modes[i])
+                opt_forget(o);
+        int m = v == 6 ? M_ORIGIN : v == 69 ? M_LEFT_RIGHT : 0;
+        if (set)
+            o->margins |= m;
+        else
+            o->margins &= ~m;
+        if (v == 1048 || v == 1049) /* as DECSC and DECRC */
+            opt_saved(o, set);
+        const char *e = memchr(p, ';', end - p);
+        if (!e)
+            break;
+        p = e + 1;
+    }
+} /* opt_modes_set */
+
+/* a scroll region is set (DECSTBM).  The whole screen is as none. */
+static void
+opt_region(
+        struct opt     *o,
+        const char     *p,
+        int             len)
+{
+    const char *semi = memchr(p, ';', len);
+    int         top  = len > 0 ? atoi(p) : 0,
+                bot  = semi ? atoi(semi + 1) : 0;
+
+    if (top <= 1 && (bot == 0 || (o->rows > 0 && bot >= o->rows)))
+        o->margins &= ~M_REGION;
+    else
+        o->margins |= M_REGION;
+} /* opt_region */
+
+/* a complete CSI sequence, in o->seq */
+static void
+opt_csi(
+        struct opt     *o)
+{
+    const char *p     = o->seq + 2;
+    int         len   = o->seq_len - 3,
+                final = o->seq[o->seq_len - 1],
+                priv  = len > 0 && strchr("<=>?", p[0]) != NULL,
+                inter = 0;
+
+    for (int i = 0; i < len; i++)
+        if (p[i] >= 0x20 && p[i] <= 0x2f)
+            inter = 1;
+    if (!priv && !inter && !o->u8_cut) {
+        /* (one that cuts a char is written as it is, so the
+         * terminal gets its ESC) */
+        if (final == 'm') {
+            opt_sgr(o, p, len);
+            return;
+        }
+        if ((final == 'H' || final == 'f') && opt_cup(o, p, len))
+            return;
+    }
+
+    opt_release(o);
+    opt_put(o, o->seq, o->seq_len);
+    if (priv && !inter && p[0] == '?' && (final == 'h' || final == 'l')) {
+        opt_modes_set(o, p + 1, len - 1, final == 'h');
+        return;
+    }
+    if (inter && !priv && len >= 1 && p[len - 1] == ' ' && final == 'q')
+        return; /* cursor shape (DECSCUSR) */
+    if (inter && !priv && len == 1 && p[0] == '!' && final == 'p')
+        o->margins = 0; /* soft reset (DECSTR) */
+    if (priv || inter) {
+        opt_forget(o);
+        return;
+    }
+    switch (final) {
+    case 'K': case 'J': case 'X': case '@': case 'P':
+        break; /* erase and insert, the cursor stays */
+    case 'r': /* scroll region, the cursor goes home */
+        opt_region(o, p, len);
+        o->row = o->col = -1;
+        break;
+    case 's': case 'u': /* SCOSC and SCORC */
+        if (len == 0 && !(o->margins & M_LEFT_RIGHT))
+            opt_saved(o, final == 's');
+        opt_forget(o);
+        break;
+    default:
+        opt_forget(o);
+        break;
+    }
+} /* opt_csi */
+
+/* a byte of text, or a control */
+static void
+opt_text(
+        struct opt     *o,
+        int             c)
+{
+    char ch = c;
+
+    opt_release(o);
+    opt_put(o, &ch, 1);
+    if (c < 0x80)
+        o->u8_need = 0;
+    else if ((c & 0xc0) != 0x80) /* the first byte */
+        o->u8_need = c >= 0xf0 ? 3 : c >= 0xe0 ? 2 : c >= 0xc2 ? 1 : 0;
+    else if (o->u8_need > 0)
+        o->u8_need--;
+    if (c >= 0x20 && c < 0x7f) {
+        /* at the last column, the next char wraps the line,
+         * depending on the terminal, so a char where the column
+         * is not known can go to another line */
+        if (o->col < 0)
+            o->row = -1;
+        else if (++o->col >= o->cols)
+            o->col = -1;
+    } else if (c >= 0x80) {
+        /* UTF-8 chars can be wide, or combine, and wrap too */
+        o->row = o->col = -1;
+    } else if (c == '\t') {
+        o->col = -1;
+    } else if (c == '\r') {
+        if (o->cols)
+            o->col = 0;
+    } else if (c == '\n' || c == '\v' || c == '\f') {
+        if (o->row >= 0 && !o->margins && o->row < o->rows - 1)
+            o->row++; /* at the bottom, the screen scrolls */
+        else if (o->margins)
+            o->row = -1;
+        if (o->col != 0)
+            o->col = -1; /* it could be written as CR LF */
+    } else if (c == '\b') {
+        if (o->col > 0)
+            o->col--;
+    }
+} /* opt_text */
+
+/* write the sequence parsed as it is, it is not understood */
+static void
+opt_abort(
+        struct opt     *o)
+{
+    opt_release(o);
+    opt_put(o, o->seq, o->seq_len);
+    o->seq_len = 0;
+    opt_forget(o);
+} /* opt_abort */
+
+static void
+opt_byte(
+        struct opt     *o,
+        int             c)
+{
+    for (;;) {
+        switch (o->st) {
+        case S_TEXT:
+            if (c == ESC) {
+                o->seq[0]  = c;
+                o->seq_len = 1;
+                o->st      = S_ESC;
+                o->u8_cut  = o->u8_need > 0;
+                o->u8_need = 0;
+            } else {
+                opt_text(o, c);
+            }
+            return;
+
+        case S_ESC:
+            if (c == '[') {
+                o->seq[o->seq_len++] = c;
+                o->st = S_CSI;
+                return;
+            }
+            if (c >= 0x20 && c <= 0x2f) {
+                o->seq[o->seq_len++] = c;
+                o->st = S_ESC_INT;
+                return;
+            }
+            if (c < 0x20 || c >= 0x7f) {
+                /* not an escape sequence */
+                opt_abort(o);
+                o->st = S_TEXT;
+                continue;
+            }
+            opt_release(o);
+            o->seq[o->seq_len++] = c;
+            opt_put(o, o->seq, o->seq_len);
+            o->seq_len = 0;
+            o->st      = S_TEXT;
+            if (strchr("]P_^X", c)) {
+                o->st = S_STR; /* passed up to its end */
+            } else if (!strchr("\\=>", c)) {
+                /* ESC 7, ESC 8, ESC M... */
+                opt_forget(o);
+                if (c == 'c') /* reset */
+                    o->margins = o->saved_origin = 0;
+                else if (c == '7' || c == '8')
+                    opt_saved(o, c == '7');
+            }
+            return;
+
+        case S_ESC_INT:
+            if (c >= 0x20 && c <= 0x2f && o->seq_len < OPT_SEQ_MAX - 1) {
+                o->seq[o->seq_len++] = c;
+                return;
+            }
+            if (c < 0x30 || c >= 0x7f) {
+                opt_abort(o);
+                o->st = S_TEXT;
+                continue;
+            }
+            o->seq[o->seq_len++] = c;
+            int charset = strchr("()*+-./", o->seq[1]) != NULL;
+            opt_release(o);
+            opt_put(o, o->seq, o->seq_len);
+            o->seq_len = 0;
+            o->st      = S_TEXT;
+            if (!charset)
+                opt_forget(o);
+            return;
+
+        case S_CSI:
+            if (c >= 0x40 && c <= 0x7e) {
+                o->seq[o->seq_len++] = c;
+                opt_csi(o);
+                o->seq_len = 0;
+                o->st      = S_TEXT;
+                return;
+            }
+            if (c >= 0x20 && c <= 0x3f) {
+                if (o->seq_len < OPT_SEQ_MAX - 1) {
+                    o->seq[o->seq_len++] = c;
+                } else {
+                    /* too long, we pass it */
+                    opt_abort(o);
+                    o->st = S_CSI_PASS;
+                    continue;
+                }
+                return;
+            }
+            opt_abort(o);
+            o->st = S_TEXT;
+            continue;
+
+        case S_CSI_PASS:
+            if (c == ESC) {
+                o->st = S_TEXT;
+                continue;
+            }
+            {
+                char ch = c;
+                opt_put(o, &ch, 1);
+            }
+            if (c >= 0x40 && c <= 0x7e)
+                o->st = S_TEXT;
+            return;
+
+        case S_STR:
+            if (c == ESC) {
+                o->st = S_STR_ESC;
+                return;
+            }
+            {
+                char ch = c;
+                opt_put(o, &ch, 1);
+            }
+            if (c == '\a' || c == 0x18 || c == 0x1a)
+                o->st = S_TEXT;
+            return;
+
+        case S_STR_ESC:
+            /* ESC \ ends it, and so does the ESC of another
+             * sequence, but that one can be held or dropped, so
+             * the end is written as ESC \ anyway */
+            opt_put(o, "\033\\", 2);
+            o->st = S_TEXT;
+            if (c == '\\')
+                return;
+            o->saved  -= 2;
+            o->seq[0]  = ESC;
+            o->seq_len = 1;
+            o->st      = S_ESC;
+            o->u8_cut  = 0;
+            continue;
+        }
+    }
+} /* opt_byte */
+
+void
+opt_init(
+        struct opt     *o)
+{
+    memset(o, 0, sizeof *o);
+    o->st      = S_TEXT;
+    o->sgr_len = -1;
+    o->mv_row  = o->mv_col = -1;
+    opt_forget(o);
+} /* opt_init */
+
+void
+opt_discard(
+        struct opt     *o)
+{
+    o->out_len = o->out_off = 0;
+    o->seq_len = 0;
+    o->st      = S_TEXT;
+    o->sgr_len = -1;
+    o->mv_row  = o->mv_col = -1;
+    o->sgr_orig = o->mv_orig = 0;
+    opt_forget(o);
+    o->margins      = M_REGION | M_ORIGIN | M_LEFT_RIGHT;
+    o->saved_origin = M_ORIGIN; /* what was discarded could set them */
+} /* opt_discard */
+
+void
+opt_size(
+        struct opt     *o,
+        int             rows,
+        int             cols)
+{
+    if (rows == o->rows && cols == o->cols)
+        return;
+    o->rows = rows;
+    o->cols = cols;
+    o->row  = o->col = -1; /* the lines can be reflowed */
+} /* opt_size */
+
+/* make room in the output for a byte */
+static int
+opt_room(
+        struct opt     *o)
+{
+    if (OPT_OUT - o->out_len >= OPT_RESERVE)
+        return 1;
+    memmove(o->out, o->out + o->out_off, o->out_len - o->out_off);
+    o->out_len -= o->out_off;
+    o->out_off  = 0;
+    return OPT_OUT - o->out_len >= OPT_RESERVE;
+} /* opt_room */
+
+size_t
+opt_feed(
+        struct opt             *o,
+        const struct iovec     *iov,
+        int                     niov)
+{
+    size_t used = 0;
+
+    for (int i = 0; i < niov; i++) {
+        const unsigned char *p = iov[i].iov_base;
+
+        for (size_t j = 0; j < iov[i].iov_len; j++) {
+            if (!opt_room(o))
+                return used;
+            opt_byte(o, p[j]);
+            used++;
+        }
+    }
+    return used;
+} /* opt_feed */
+
+void
+opt_flush(
+        struct opt     *o,
+        int             all)
+{
+    if (!opt_room(o))
+        return;
+    opt_release(o);
+    if (all && o->st == S_STR_ESC) {
+        opt_put(o, "\033", 1);
+        o->st = S_TEXT;
+    }
+    if (all && o->seq_len > 0) {
+        opt_abort(o);
+        o->st = S_TEXT;
+    }
+} /* opt_flush */
+
+size_t
+opt_pending(
+        const struct opt   *o)
+{
+    return o->out_len - o->out_off
+        + (o->mv_row >= 0 || o->sgr_len >= 0);
+} /* opt_pending */
+
+size_t
+opt_peek(
+        struct opt     *o,
+        struct iovec   *iov)
+{
+    iov->iov_base = o->out + o->out_off;
+    iov->iov_len  = o->out_len - o->out_off;
+    return iov->iov_len;
+} /* opt_peek */
+
+void
+opt_consume(
+        struct opt     *o,
+        size_t          n)
+{
+    o->out_off += n;
+    if (o->out_off == o->out_len)
+        o->out_off = o->out_len = 0;
+} /* opt_consume */
@@ -0,0 +1,163 @@
+/* opt.h -- optimizer of the output of a line.  It parses the
+ * VT100/xterm escape sequences of the output and rewrites them
+ * into an equivalent shorter stream, so a slow line spends less
+ * of its speed in moving the cursor and changing attributes.
+ * Author: Luis Colorado <luiscoloradourcola@gmail.com>
+ * Copyright: (C) 2015-2025 LUIS COLORADO.  All rights reserved.
+ * License: BSD.
+ *
+ * These are the rewrites:
+ *
+ *  - consecutive SGR sequences (ESC [ ... m) are merged in one,
+ *    and one that sets the same as the last sent is dropped, as
+ *    SGR only sets attributes, so applying it again does nothing.
+ *  - consecutive cursor positionings (ESC [ row ; col H) are
+ *    merged, the last wins, and they are written in their
+ *    shortest form, or as a relative move (CR, BS, or ESC [ n A,
+ *    B, C or D) if the position of the cursor is known and it's
+ *    shorter.  A positioning to where the cursor is is dropped.
+ *
+ * The position of the cursor is followed through the ASCII text,
+ * CR, LF and BS, and forgotten on anything else that moves it
+ * (tabs, UTF-8 text, a line wrap, the sequences not known), and
+ * relative moves are only written if the size of the terminal is
+ * known and no scroll region has been set.  SGR and positionings
+ * are held until something that depends on them arrives, so they
+ * can be merged.  The optimizer looks no further than the data
+ * fed to it, and opt_flush() writes what it holds when there's no
+ * more, so no data is delayed past the tick it arrived in.
+ */
+#ifndef _OPT_H
+#define _OPT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#define OPT_OUT             (1 << 16)   /* optimized bytes waiting
+                                         * to be sent */
+#define OPT_SEQ_MAX         (64)        /* longest escape sequence
+                                         * rewritten, longer ones are
+                                         * passed as they are */
+
+struct opt {
+    /* PARSER */
+    int             st;         /* state */
+    char            seq[OPT_SEQ_MAX];
+                                /* sequence being parsed ... */
+    size_t          seq_len;    /* ... its length */
+    int             u8_need,    /* bytes of a UTF-8 char still to
+                                 * come, ... */
+                    u8_cut;     /* ... and nonzero if the sequence
+                                 * parsed cut one (the terminal
+                                 * writes a replacement char) */
+
+    /* THE TERMINAL, AS IT WILL BE AFTER THE OUTPUT */
+    int             rows, cols; /* its size, 0 if not known */
+    int             row, col;   /* the cursor, from 0, -1 if not
+                                 * known */
+    int             margins;    /* a scroll region, the origin mode
+                                 * or left and right margins can
+                                 * be set (bits, see opt.c) */
+    int             saved_origin;
+                                /* ... and the origin mode saved
+                                 * with the cursor (DECSC) */
+    char            last[OPT_SEQ_MAX];
+                                /* params of the last SGR sent ... */
+    int             last_len;   /* ... their length, -1 if not known
+                                 * (other sequence sent since) */
+
+    /* HELD */
+    char            sgr[OPT_SEQ_MAX];
+                                /* params of the SGR held ... */
+    int             sgr_len;    /* ... their length, -1 if none ... */
+    size_t          sgr_orig;   /* ... and the bytes it replaces */
+    int             mv_row,     /* cursor positioning held, ... */
+                    mv_col;     /* ... -1 if none ... */
+    size_t          mv_orig;    /* ... and the bytes it replaces */
+
+    /* OUTPUT */
+    char            out[OPT_OUT];
+    size_t          out_len,    /* bytes in out, ... */
+                    out_off;    /* ... and already sent */
+    uint64_t        saved;      /* bytes saved */
+};
+
+/* Initialize an optimizer, nothing known of the terminal.
+ *
+ * @param o the optimizer. */
+void
+opt_init(
+        struct opt     *o);
+
+/* Discard the output not yet sent, and all that is held.  As
+ * the terminal doesn't get it, nothing is known of it after this.
+ *
+ * @param o the optimizer. */
+void
+opt_discard(
+        struct opt     *o);
+
+/* Set the size of the terminal, when it changes.
+ *
+ * @param o the optimizer.
+ * @param rows the number of rows (0 if not known).
+ * @param cols the number of columns (0 if not known). */
+void
+opt_size(
+        struct opt     *o,
+        int             rows,
+        int             cols);
+
+/* Optimize data, as much as fits in the output.
+ *
+ * @param o the optimizer.
+ * @param iov the data, in pieces.
+ * @param niov the number of pieces.
+ * @return the bytes of data consumed. */
+size_t
+opt_feed(
+        struct opt             *o,
+        const struct iovec     *iov,
+        int                     niov);
+
+/* Write what's held to the output, as no more data follows for
+ * now.  An incomplete escape sequence is kept (the terminal would
+ * do nothing with it), unless all is set (there's no more data).
+ *
+ * @param o the optimizer.
+ * @param all nonzero to write the incomplete sequence too. */
+void
+opt_flush(
+        struct opt     *o,
+        int             all);
+
+/* The bytes waiting to be sent (or something held, if not zero),
+ * so the line is not idle.
+ *
+ * @param o the optimizer.
+ * @return the number of bytes. */
+size_t
+opt_pending(
+        const struct opt   *o);
+
+/* Get the output to send.
+ *
+ * @param o the optimizer.
+ * @param iov where to return it.
+ * @return the number of bytes. */
+size_t
+opt_peek(
+        struct opt     *o,
+        struct iovec   *iov);
+
+/* Consume output got with opt_peek() (it was sent).
+ *
+ * @param o the optimizer.
+ * @param n the number of bytes. */
+void
+opt_consume(
+        struct opt     *o,
+        size_t          n);
+
+#endif /* _OPT_H */
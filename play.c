@@ -0,0 +1,449 @@
+/* play.c -- files to play back.  Other files are played as they
+ * are, recordings are parsed an event at a time, and the data of
+ * their output events decoded to a buffer of fixed size, so only
+ * the part of the file being played is in memory.  The index of
+ * a recording is built as it is parsed for the first time.
+ * Author: Luis Colorado <luiscoloradourcola@gmail.com>
+ * Copyright: (C) 2015-2025 LUIS COLORADO.  All rights reserved.
+ * License: BSD.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "play.h"
+#include "rec.h"
+
+#define NSEC_PER_SEC    (1000000000ULL)
+#define MIN(_a, _b)     ((_a)<(_b) ? (_a) : (_b))
+
+/* skip the blanks in [s, end) */
+static const char *
+play_blanks(
+        const char *s,
+        const char *end)
+{
+    while (s < end && (*s == ' ' || *s == '\t'))
+        s++;
+    return s;
+} /* play_blanks */
+
+/* find a key in the header line [s, nl), and return where its
+ * value begins (or NULL) */
+static const char *
+play_key(
+        const char *s,
+        const char *nl,
+        const char *key)
+{
+    size_t n = strlen(key);
+
+    for (const char *k = s; k + n < nl; k++) {
+        if (memcmp(k, key, n) == 0) {
+            k = play_blanks(k + n, nl);
+            if (k == nl || *k != ':')
+                return NULL;
+            return play_blanks(k + 1, nl);
+        }
+    }
+    return NULL;
+} /* play_key */
+
+/* check that the file begins with an asciicast v2 header, and
+ * return where the events begin (or NULL).  p->raw is set if we
+ * wrote it (see rec.h). */
+static const char *
+play_header(
+        struct play    *p,
+        const char     *s,
+        const char     *end)
+{
+    const char *nl = memchr(s, '\n', end - s), *v;
+
+    if (!nl || s == end || *s != '{')
+        return NULL;
+    v = play_key(s, nl, "\"version\"");
+    if (!v || v == nl || *v != '2')
+        return NULL;
+    v = play_key(s, nl, "\"" REC_RAW "\"");
+    p->raw = v && nl - v >= 4 && memcmp(v, "true", 4) == 0;
+    return nl + 1;
+} /* play_header */
+
+/* release the pages of the file already played */
+static void
+play_release(
+        struct play    *p)
+{
+    if (p->off - p->released >= PLAY_RELEASE) {
+        size_t pg = sysconf(_SC_PAGESIZE);
+        size_t to = p->off / pg * pg;
+
+        madvise((char *) p->map + p->released, to - p->released,
+            MADV_DONTNEED);
+        p->released = to;
+    }
+} /* play_release */
+
+/* add a mark to the index, if it is far enough from the last */
+static void
+play_mark(
+        struct play    *p,
+        size_t          off)
+{
+    if (       p->n_idx > 0
+            && off - p->idx[p->n_idx - 1].off < p->idx_step)
+        return;
+    if (p->n_idx == PLAY_INDEX) {
+        /* full, keep one of each two */
+        for (int i = 0; i < PLAY_INDEX / 2; i++)
+            p->idx[i] = p->idx[2 * i];
+        p->n_idx     = PLAY_INDEX / 2;
+        p->idx_step *= 2;
+    }
+    p->idx[p->n_idx].off = off;
+    p->idx[p->n_idx].t   = p->t;
+    p->idx[p->n_idx].pos = p->pos;
+    p->n_idx++;
+} /* play_mark */
+
+/* parse the event line at p->off.  If it is an output event,
+ * p->off is left at its data.
+ * @return 1 for an output event, 0 for other lines (skipped) and
+ *         -1 at the end of the file. */
+static int
+play_event(
+        struct play    *p)
+{
+    const char *s   = p->map + p->off,
+               *end = p->map + p->size;
+    size_t      line = p->off;
+
+    if (s == end)
+        return -1;
+
+    const char *nl  = memchr(s, '\n', end - s);
+    const char *eol = nl ? nl : end;
+    p->off = eol - p->map + (nl != NULL); /* skipped, by default */
+
+    /* [time, "o", "data"] */
+    s = play_blanks(s, eol);
+    if (s == eol || *s++ != '[')
+        return 0;
+    s = play_blanks(s, eol);
+
+    char num[32];
+    int  n = 0;
+    while (       s < eol && n < (int) sizeof num - 1
+            && ((*s >= '0' && *s <= '9') || strchr(".eE+-", *s)))
+        num[n++] = *s++;
+    num[n] = '\0';
+    if (n == 0)
+        return 0;
+    double secs = strtod(num, NULL);
+
+    s = play_blanks(s, eol);
+    if (s == eol || *s++ != ',')
+        return 0;
+    s = play_blanks(s, eol);
+    if (eol - s < 3 || s[0] != '"' || s[2] != '"')
+        return 0;
+    int type = s[1];
+    s = play_blanks(s + 3, eol);
+    if (s == eol || *s++ != ',')
+        return 0;
+    s = play_blanks(s, eol);
+    if (s == eol || *s++ != '"' || type != REC_OUTPUT)
+        return 0;
+
+    p->t = secs > 0 ? secs * NSEC_PER_SEC + 0.5 : 0;
+    if (line >= p->idx_end) {
+        /* first time here */
+        play_mark(p, line);
+        p->idx_end = line + 1;
+    }
+    p->off   = s - p->map;
+    p->in_ev = 1;
+    return 1;
+} /* play_event */
+
+/* the value of four hex digits at s, or -1 */
+static long
+play_hex(
+        const char *s,
+        const char *end)
+{
+    long u = 0;
+
+    if (end - s < 4)
+        return -1;
+    for (int i = 0; i < 4; i++) {
+        int c = s[i];
+        u <<= 4;
+        if      (c >= '0' && c <= '9') u |= c - '0';
+        else if (c >= 'a' && c <= 'f') u |= c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') u |= c - 'A' + 10;
+        else return -1;
+    }
+    return u;
+} /* play_hex */
+
+/* decode the next data of the output event at p->off to p->buf,
+ * as much as fits.  The \u escapes are encoded in UTF-8, but in
+ * our recordings those below U+0100 are bytes, as the recorder
+ * writes them (see rec.h). */
+static void
+play_decode(
+        struct play    *p)
+{
+    const char *s    = p->map + p->off,
+               *end  = p->map + p->size;
+    char       *d    = p->buf,
+               *dend = p->buf + sizeof p->buf - 4; /* a char */
+
+    while (s < end && d < dend) {
+        /* the chars that are not escaped, at once */
+        size_t n = MIN(end - s, dend - d), i;
+        for (i = 0; i < n && s[i] != '"' && s[i] != '\\'
+                && s[i] != '\n'; i++)
+            continue;
+        memcpy(d, s, i);
+        d += i;
+        s += i;
+        if (i == n)
+            continue;
+
+        if (*s != '\\') {
+            /* the end of the data, we skip the rest of the line */
+            const char *nl = memchr(s, '\n', end - s);
+            s = nl ? nl + 1 : end;
+            p->in_ev = 0;
+            break;
+        }
+        if (end - s < 2) {
+            s = end; /* the file ends in the escape */
+            break;
+        }
+        s += 2;
+        switch (s[-1]) {
+        case 'b': *d++ = '\b'; break;
+        case 'f': *d++ = '\f'; break;
+        case 'n': *d++ = '\n'; break;
+        case 'r': *d++ = '\r'; break;
+        case 't': *d++ = '\t'; break;
+        case 'u': {
+                long u = play_hex(s, end), lo;
+
+                if (u < 0)
+                    break; /* not valid, skipped */
+                s += 4;
+                if (u < 0x80 || (u < 0x100 && p->raw)) {
+                    *d++ = u;
+                    break;
+                }
+                if (       u >= 0xd800 && u < 0xdc00
+                        && end - s >= 6 && s[0] == '\\' && s[1] == 'u'
+                        && (lo = play_hex(s + 2, end)) >= 0xdc00
+                        && lo < 0xe000)
+                {
+                    /* a surrogate pair */
+                    u  = 0x10000 + ((u - 0xd800) << 10) + (lo - 0xdc00);
+                    s += 6;
+                }
+                if (u < 0x800) {
+                    *d++ = 0xc0 | u >> 6;
+                } else if (u < 0x10000) {
+                    *d++ = 0xe0 | u >> 12;
+                    *d++ = 0x80 | (u >> 6 & 0x3f);
+                } else {
+                    *d++ = 0xf0 | u >> 18;
+                    *d++ = 0x80 | (u >> 12 & 0x3f);
+                    *d++ = 0x80 | (u >> 6 & 0x3f);
+                }
+                *d++ = 0x80 | (u & 0x3f);
+            } break;
+        default: *d++ = s[-1]; break; /* " \ and / */
+        }
+    }
+    if (s >= end)
+        p->in_ev = 0; /* the file ends before the event */
+    p->off     = s - p->map;
+    p->buf_len = d - p->buf;
+    p->buf_off = 0;
+} /* play_decode */
+
+int
+play_open(
+        struct play    *p,
+        const char     *path)
+{
+    struct stat st;
+    int         fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0)
+        return -1;
+    memset(p, 0, sizeof *p);
+    if (fstat(fd, &st) < 0) {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return -1;
+    }
+    p->size = st.st_size;
+    if (p->size > 0) {
+        void *m = mmap(NULL, p->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (m == MAP_FAILED) {
+            int saved_errno = errno;
+            close(fd);
+            errno = saved_errno;
+            return -1;
+        }
+        p->map = m;
+        madvise(m, p->size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    const char *ev = p->size > 0
+        ? play_header(p, p->map, p->map + p->size)
+        : NULL;
+    if (ev) {
+        p->cast  = 1;
+        p->start = ev - p->map;
+    }
+    p->off      = p->start;
+    p->idx_step = PLAY_INDEX_STEP;
+    return 0;
+} /* play_open */
+
+void
+play_close(
+        struct play    *p)
+{
+    if (p->map)
+        munmap((void *) p->map, p->size);
+    p->map = NULL;
+} /* play_close */
+
+size_t
+play_data(
+        struct play    *p,
+        const char    **data,
+        uint64_t       *t)
+{
+    if (!p->cast) {
+        *data = p->map + p->off;
+        if (t)
+            *t = 0;
+        return p->size - p->off;
+    }
+    while (p->buf_off == p->buf_len) {
+        if (p->in_ev)
+            play_decode(p);
+        else if (play_event(p) < 0)
+            return 0;
+    }
+    *data = p->buf + p->buf_off;
+    if (t)
+        *t = p->t;
+    return p->buf_len - p->buf_off;
+} /* play_data */
+
+void
+play_consume(
+        struct play    *p,
+        size_t          n)
+{
+    p->pos += n;
+    if (p->cast)
+        p->buf_off += n;
+    else
+        p->off     += n;
+    play_release(p);
+} /* play_consume */
+
+/* go to a mark (or the beginning, if NULL) */
+static void
+play_goto(
+        struct play            *p,
+        const struct play_mark *m)
+{
+    size_t pg = sysconf(_SC_PAGESIZE);
+
+    p->off     = m ? m->off : p->start;
+    p->pos     = m ? m->pos : 0;
+    p->t       = m ? m->t   : 0;
+    p->in_ev   = 0;
+    p->buf_len = p->buf_off = 0;
+    if (p->released > p->off)
+        p->released = p->off / pg * pg;
+} /* play_goto */
+
+void
+play_seek(
+        struct play    *p,
+        uint64_t        pos)
+{
+    if (!p->cast) {
+        play_goto(p, NULL);
+        p->off = p->pos = MIN(pos, p->size);
+        return;
+    }
+
+    /* the last mark before pos */
+    int lo = 0, hi = p->n_idx;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (p->idx[mid].pos <= pos)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    const struct play_mark *m = lo > 0 ? p->idx + lo - 1 : NULL;
+
+    /* we continue from where we are if it's nearer */
+    if (pos < p->pos || (m && m->pos > p->pos))
+        play_goto(p, m);
+
+    const char *data;
+    size_t      n;
+    while (p->pos < pos && (n = play_data(p, &data, NULL)) > 0)
+        play_consume(p, MIN(n, pos - p->pos));
+} /* play_seek */
+
+int
+play_seek_time(
+        struct play    *p,
+        uint64_t        t)
+{
+    if (!p->cast) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* the last mark before t.  Events at t could be before a
+     * mark at t. */
+    int lo = 0, hi = p->n_idx;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (p->idx[mid].t < t)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    const struct play_mark *m = lo > 0 ? p->idx + lo - 1 : NULL;
+
+    if (t <= p->t || (m && m->t > p->t))
+        play_goto(p, m);
+
+    const char *data;
+    size_t      n;
+    uint64_t    et;
+    while ((n = play_data(p, &data, &et)) > 0 && et < t)
+        play_consume(p, n);
+    return 0;
+} /* play_seek_time */
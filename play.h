@@ -0,0 +1,129 @@
+/* play.h -- files to play back: a recording of a session (see
+ * rec.h) or any other file.  The file is mapped in memory, and
+ * the pages already played are released, so the memory used
+ * doesn't depend on the size of the file.
+ * Author: Luis Colorado <luiscoloradourcola@gmail.com>
+ * Copyright: (C) 2015-2025 LUIS COLORADO.  All rights reserved.
+ * License: BSD.
+ */
+#ifndef _PLAY_H
+#define _PLAY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PLAY_BUF            (1 << 16)   /* data of a recording
+                                         * decoded at once */
+#define PLAY_INDEX          (4096)      /* marks in the index */
+#define PLAY_INDEX_STEP     (1 << 16)   /* initial bytes of the
+                                         * file between marks */
+#define PLAY_RELEASE        (1 << 23)   /* bytes played before
+                                         * releasing their pages */
+
+/* A point of a recording where playing can begin.  Marks are
+ * taken on the first pass over the file, each step bytes, and
+ * when the index gets full, one of each two is dropped and the
+ * step doubled, so the index never grows. */
+struct play_mark {
+    size_t          off;        /* of the event line in the file */
+    uint64_t        t;          /* time of the event, nsecs */
+    uint64_t        pos;        /* bytes of data before it */
+};
+
+struct play {
+    const char     *map;        /* the file, mapped */
+    size_t          size;       /* its size */
+    int             cast;       /* it's a recording (asciicast) */
+    int             raw;        /* ... of ours, its \u00XX escapes
+                                 * are bytes (see rec.h) */
+    size_t          start;      /* of the data (after the header
+                                 * line, for recordings) */
+    size_t          off;        /* next byte of the file to play
+                                 * (or to parse, for recordings) */
+    size_t          released;   /* pages released up to here */
+    uint64_t        pos;        /* bytes of data played */
+
+    /* RECORDINGS */
+    uint64_t        t;          /* time of the current event */
+    int             in_ev;      /* off is inside the data of an
+                                 * output event */
+    char            buf[PLAY_BUF]; /* data decoded ... */
+    size_t          buf_len,    /* ... its length, and ... */
+                    buf_off;    /* ... the bytes of it played */
+
+    /* INDEX */
+    struct play_mark
+                    idx[PLAY_INDEX];
+    int             n_idx;
+    size_t          idx_step;   /* bytes of the file between marks */
+    size_t          idx_end;    /* the marks cover the file up to
+                                 * here */
+};
+
+/* Open a file to play, from its beginning.
+ *
+ * @param p the player.
+ * @param path the file.  It's a recording if it begins with an
+ *        asciicast v2 header line.
+ * @return 0 on success, -1 and errno set on error. */
+int
+play_open(
+        struct play    *p,
+        const char     *path);
+
+/* Release the resources of the player (the mapping).
+ *
+ * @param p the player. */
+void
+play_close(
+        struct play    *p);
+
+/* Get the next data to play, without consuming it.  For
+ * recordings, only the output events are played, and the data
+ * comes from one event, the one at *t (zero for other files).
+ *
+ * @param p the player.
+ * @param data where to return the data.
+ * @param t where to return its time (or NULL).
+ * @return the length of the data, 0 at the end of the file. */
+size_t
+play_data(
+        struct play    *p,
+        const char    **data,
+        uint64_t       *t);
+
+/* Consume data got with play_data().
+ *
+ * @param p the player.
+ * @param n the bytes consumed, no more than play_data()
+ *        returned. */
+void
+play_consume(
+        struct play    *p,
+        size_t          n);
+
+/* Go to a byte of the data (of the output, for recordings).
+ * Recordings are parsed from the nearest mark of the index (or
+ * the last one) on, building the index as they go.
+ *
+ * @param p the player.
+ * @param pos the number of bytes of data before the point to
+ *        go to.  If it is past the end, the player ends there. */
+void
+play_seek(
+        struct play    *p,
+        uint64_t        pos);
+
+/* Go to the first output event of a recording at or after a
+ * time, as play_seek() does.
+ *
+ * @param p the player.
+ * @param t the time, in nsecs since the beginning.
+ * @return 0 on success, -1 and errno set to EINVAL if the file
+ *        is not a recording. */
+int
+play_seek_time(
+        struct play    *p,
+        uint64_t        t);
+
+#endif /* _PLAY_H */
@@ -0,0 +1,188 @@
+/* pool.c -- pool of worker threads, each one running an event
+ * loop with many sessions on it.  Sessions are passed to the
+ * workers through a mailbox (a list protected by a mutex, and a
+ * pipe to wake the worker up) and each new session goes to the
+ * worker that has less sessions running.  Each worker has a
+ * second thread, with the loop where its sessions read their
+ * input (see pi_start()).
+ * Author: Luis Colorado <luiscoloradourcola@gmail.com>
+ * Copyright: (C) 2015-2025 LUIS COLORADO.  All rights reserved.
+ * License: BSD.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "main.h"
+#include "loop.h"
+#include "slowtty.h"
+#include "session.h"
+#include "pool.h"
+
+struct worker {
+    pthread_t        id;
+    int              ix;        /* worker number */
+    struct loop      loop;      /* the loop of the worker */
+    struct loop      in_loop;   /* its ingestion loop */
+    int              pipe[2];   /* to wake up the worker */
+    struct loop_src  src;       /* read side of pipe */
+    pthread_mutex_t  mtx;       /* protects inbox */
+    struct session  *inbox;     /* sessions to start */
+    int              n_sessions;/* sessions running (atomic) */
+};
+
+static struct worker *workers;
+static int            n_workers;
+static int            n_active;     /* atomic */
+static int            pool_notify_fd = -1;
+
+/* a session has been released, free it */
+static void
+worker_session_released(
+        struct session *s)
+{
+    struct worker  *w = s->worker;
+
+    session_free(s);
+    __atomic_sub_fetch(&w->n_sessions, 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&n_active, 1, __ATOMIC_RELEASE);
+    if (pool_notify_fd >= 0)
+        write(pool_notify_fd, "", 1);
+} /* worker_session_released */
+
+/* a session is done, it has to be released before freeing it
+ * (its ingestion side runs on other thread) */
+static void
+worker_session_done(
+        struct session *s)
+{
+    session_release(s, worker_session_released);
+} /* worker_session_done */
+
+/* start the sessions in the mailbox */
+static void
+worker_inbox(
+        struct loop_src *src,
+        int              events)
+{
+    struct worker  *w = src->data;
+    struct session *list;
+    char            buf[64];
+
+    while (read(w->pipe[0], buf, sizeof buf) > 0)
+        continue;
+
+    pthread_mutex_lock(&w->mtx);
+    list     = w->inbox;
+    w->inbox = NULL;
+    pthread_mutex_unlock(&w->mtx);
+
+    while (list) {
+        struct session *s = list;
+        list = s->next;
+        s->next = NULL;
+        LOG("worker %d: starting session %d\n", w->ix, s->id);
+        session_start(s, &w->loop, &w->in_loop,
+            worker_session_done);
+    }
+} /* worker_inbox */
+
+static void *
+worker_body(
+        void *arg)
+{
+    struct worker *w = arg;
+
+    LOG("worker %d: START\n", w->ix);
+    for (;;) {
+        if (loop_once(&w->loop, NULL) < 0 && errno != EINTR) {
+            ERR("worker %d: loop_once" ERRNO "\n", w->ix, EPMTS);
+        }
+    }
+    return NULL;
+} /* worker_body */
+
+int
+pool_init(
+        int n,
+        int notify_fd)
+{
+    sigset_t all, old;
+
+    if (n <= 0)
+        n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n <= 0)
+        n = 1;
+
+    workers = calloc(n, sizeof *workers);
+    if (!workers)
+        return -1;
+    pool_notify_fd = notify_fd;
+
+    /* all signals go to the main thread */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+
+    for (n_workers = 0; n_workers < n; n_workers++) {
+        struct worker *w = workers + n_workers;
+
+        w->ix = n_workers;
+        pthread_mutex_init(&w->mtx, NULL);
+        if (       loop_init(&w->loop) < 0
+                || loop_init(&w->in_loop) < 0
+                || loop_spawn(&w->in_loop) < 0
+                || pipe(w->pipe) < 0
+                || set_nonblock(w->pipe[0]) < 0
+                || set_nonblock(w->pipe[1]) < 0)
+            break;
+        fcntl(w->pipe[0], F_SETFD, FD_CLOEXEC);
+        fcntl(w->pipe[1], F_SETFD, FD_CLOEXEC);
+        w->src.fd     = w->pipe[0];
+        w->src.events = LOOP_IN;
+        w->src.cb     = worker_inbox;
+        w->src.data   = w;
+        if (       loop_add(&w->loop, &w->src) < 0
+                || pthread_create(&w->id, NULL, worker_body, w) != 0)
+            break;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (n_workers == 0)
+        return -1;
+    LOG("pool_init: %d workers\n", n_workers);
+    return n_workers;
+} /* pool_init */
+
+void
+pool_add(
+        struct session *s)
+{
+    struct worker *w = workers;
+
+    for (int i = 1; i < n_workers; i++) {
+        if (  __atomic_load_n(&workers[i].n_sessions, __ATOMIC_RELAXED)
+            < __atomic_load_n(&w->n_sessions, __ATOMIC_RELAXED))
+            w = workers + i;
+    }
+    __atomic_add_fetch(&w->n_sessions, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&n_active, 1, __ATOMIC_RELAXED);
+
+    s->worker = w;
+    pthread_mutex_lock(&w->mtx);
+    s->next  = w->inbox;
+    w->inbox = s;
+    pthread_mutex_unlock(&w->mtx);
+    write(w->pipe[1], "", 1);
+} /* pool_add */
+
+int
+pool_active(void)
+{
+    return __atomic_load_n(&n_active, __ATOMIC_ACQUIRE);
+} /* pool_active */
@@ -0,0 +1,40 @@
+/* pool.h -- pool of worker threads, each one running an event
+ * loop with many sessions on it.
+ * Author: Luis Colorado <luiscoloradourcola@gmail.com>
+ * Copyright: (C) 2015-2025 LUIS COLORADO.  All rights reserved.
+ * License: BSD.
+ */
+#ifndef _POOL_H
+#define _POOL_H
+
+#include "session.h"
+
+/* Create the worker threads.
+ *
+ * @param n number of workers.  If zero or negative, one per
+ *        online cpu is created.
+ * @param notify_fd descriptor where a byte is written each time
+ *        a session ends (or -1).
+ * @return the number of workers created, or -1 and errno set
+ *        on error. */
+int
+pool_init(
+        int n,
+        int notify_fd);
+
+/* Pass a session to the least loaded worker, that starts it.
+ * After this call, the session belongs to the worker and it is
+ * freed by it when done.
+ *
+ * @param s the session. */
+void
+pool_add(
+        struct session *s);
+
+/* Get the number of sessions running on the pool.
+ *
+ * @return the number of sessions. */
+int
+pool_active(void);
+
+#endif /* _POOL_H */
@@ -0,0 +1,567 @@
+/* rec.c -- recording of the session in the asciicast v2 format.
+ * The channels only copy their events to a ring in memory.  A
+ * thread takes them from there in batches, formats them and
+ * writes them with a single writev(2), so the paced path never
+ * waits for the disk.  The ring has a fixed size, if the disk
+ * gets behind, the events that don't fit are lost (and counted),
+ * but the memory used never grows.
+ * Author: Luis Colorado <luiscoloradourcola@gmail.com>
+ * Copyright: (C) 2015-2025 LUIS COLORADO.  All rights reserved.
+ * License: BSD.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "rec.h"
+
+#define REC_OUT_BUFS    (16)        /* pieces of a writev(2) */
+#define REC_OUT_SIZE    (1 << 14)   /* bytes of each piece */
+
+/* an event in the ring, followed by its data.  Events begin at
+ * multiples of its size, and never wrap around the end of the
+ * ring (a padding event, of type 0, fills the space left) */
+struct rec_hdr {
+    uint64_t        t;          /* nsecs since rec_open() */
+    uint32_t        len;        /* of the data */
+    uint32_t        type;       /* REC_OUTPUT, ..., or 0, and ... */
+};
+#define REC_BUSY    (1U << 31)  /* ... its length is not known yet
+                                 * (see rec_begin()), the writer
+                                 * waits for it */
+
+#define REC_ALIGN(_n) (((_n) + sizeof(struct rec_hdr) - 1) \
+        / sizeof(struct rec_hdr) * sizeof(struct rec_hdr))
+
+/* the bytes of an incomplete UTF-8 sequence at the end of an
+ * event, they are written with the next event of the type */
+struct rec_carry {
+    unsigned char   b[4];
+    int             n;
+};
+
+/* SHARED, with rec_mtx held */
+static char            *rec_ring;   /* REC_RING bytes */
+static size_t           rec_head,   /* bytes taken by the writer */
+                        rec_tail,   /* bytes given by the channels */
+                        rec_lost;   /* bytes of data lost since the
+                                     * last marker */
+static int              rec_closing,
+                        rec_sleeping; /* the writer waits for
+                                       * rec_cond */
+static pthread_mutex_t  rec_mtx  = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   rec_cond = PTHREAD_COND_INITIALIZER;
+
+static int              rec_on;
+static int              rec_fd = -1;
+static struct timespec  rec_t0;
+static pthread_t        rec_thread;
+
+/* WRITER THREAD (or rec_open()/rec_close() while it doesn't run) */
+static char             rec_out[REC_OUT_BUFS][REC_OUT_SIZE];
+static struct iovec     rec_iov[REC_OUT_BUFS];
+static int              rec_n;      /* pieces of rec_iov in use */
+static int              rec_errno;  /* of the first write failed */
+static struct rec_carry rec_carry_o,
+                        rec_carry_i;
+static uint64_t         rec_last;   /* time of the last event */
+
+static uint64_t
+rec_now(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now); /* no syscall, vdso(7) */
+    return (now.tv_sec  - rec_t0.tv_sec) * 1000000000ULL
+         +  now.tv_nsec - rec_t0.tv_nsec;
+} /* rec_now */
+
+/* write the pieces filled, as much as we can */
+static void
+rec_flush(void)
+{
+    int i = 0;
+
+    while (i < rec_n && !rec_errno) {
+        ssize_t res = writev(rec_fd, rec_iov + i, rec_n - i);
+
+        if (res < 0) {
+            if (errno != EINTR)
+                rec_errno = errno;
+            continue;
+        }
+        /* skip what has been written */
+        while (i < rec_n && (size_t) res >= rec_iov[i].iov_len)
+            res -= rec_iov[i++].iov_len;
+        if (i < rec_n) {
+            rec_iov[i].iov_base  = (char *) rec_iov[i].iov_base + res;
+            rec_iov[i].iov_len  -= res;
+        }
+    }
+    rec_n = 0;
+} /* rec_flush */
+
+/* add bytes to the output, flushing it when it's full */
+static void
+rec_write(
+        const void *s,
+        size_t      n)
+{
+    const char *p = s;
+
+    while (n > 0) {
+        struct iovec *v = rec_iov + rec_n - 1;
+
+        if (rec_n == 0 || v->iov_len == REC_OUT_SIZE) {
+            if (rec_n == REC_OUT_BUFS)
+                rec_flush();
+            v = rec_iov + rec_n;
+            v->iov_base = rec_out[rec_n++];
+            v->iov_len  = 0;
+        }
+        size_t room = REC_OUT_SIZE - v->iov_len;
+        if (room > n)
+            room = n;
+        memcpy((char *) v->iov_base + v->iov_len, p, room);
+        v->iov_len += room;
+        p          += room;
+        n          -= room;
+    }
+} /* rec_write */
+
+/* write a byte escaped, as a JSON string char */
+static void
+rec_escape(
+        unsigned char c)
+{
+    char buf[8];
+    int  n = 2;
+
+    buf[0] = '\\';
+    switch (c) {
+    case '"':  buf[1] = '"';  break;
+    case '\\': buf[1] = '\\'; break;
+    case '\b': buf[1] = 'b';  break;
+    case '\f': buf[1] = 'f';  break;
+    case '\n': buf[1] = 'n';  break;
+    case '\r': buf[1] = 'r';  break;
+    case '\t': buf[1] = 't';  break;
+    default:   n = snprintf(buf, sizeof buf, "\\u%04x", c); break;
+    }
+    rec_write(buf, n);
+} /* rec_escape */
+
+/* length of the UTF-8 sequence at p, 0 if the n bytes there are
+ * the beginning of a valid one, or -1 if it is not valid. */
+static int
+rec_utf8(
+        const unsigned char *p,
+        size_t               n)
+{
+    unsigned char lo = 0x80, hi = 0xbf; /* of the second byte */
+    int           len;
+
+    if (p[0] < 0x80)
+        return 1;
+    if (p[0] < 0xc2) {
+        return -1; /* continuation, or overlong */
+    } else if (p[0] < 0xe0) {
+        len = 2;
+    } else if (p[0] < 0xf0) {
+        len = 3;
+        if (p[0] == 0xe0) lo = 0xa0; /* overlong */
+        if (p[0] == 0xed) hi = 0x9f; /* surrogates */
+    } else if (p[0] < 0xf5) {
+        len = 4;
+        if (p[0] == 0xf0) lo = 0x90; /* overlong */
+        if (p[0] == 0xf4) hi = 0x8f; /* beyond U+10FFFF */
+    } else {
+        return -1;
+    }
+    for (int i = 1; i < len; i++) {
+        if ((size_t) i >= n)
+            return 0;
+        if (p[i] < lo || p[i] > hi)
+            return -1;
+        lo = 0x80;
+        hi = 0xbf;
+    }
+    return len;
+} /* rec_utf8 */
+
+/* write the data of an event, as a JSON string, keeping an
+ * incomplete UTF-8 sequence at its end in cy (if not NULL) */
+static void
+rec_string(
+        const unsigned char *p,
+        size_t               n,
+        struct rec_carry    *cy)
+{
+    size_t i = 0, from = 0;
+
+    if (cy && cy->n > 0) {
+        /* the sequence begun in the last event */
+        unsigned char seq[8];
+        size_t        m = n < 4 ? n : 4;
+
+        memcpy(seq, cy->b, cy->n);
+        memcpy(seq + cy->n, p, m);
+        int len = rec_utf8(seq, cy->n + m);
+        if (len > 0) {
+            rec_write(seq, len);
+            i = from = len - cy->n;
+        } else {
+            /* they are continuation bytes after the first, not
+             * valid by themselves */
+            for (int j = 0; j < cy->n; j++)
+                rec_escape(cy->b[j]);
+        }
+        cy->n = 0;
+    }
+    while (i < n) {
+        unsigned char c = p[i];
+
+        if (c >= 0x20 && c < 0x7f && c != '"' && c != '\\') {
+            i++;
+            continue;
+        }
+        int len = c >= 0x80 ? rec_utf8(p + i, n - i) : -1;
+        if (len > 0) {
+            i += len;
+            continue;
+        }
+        rec_write(p + from, i - from);
+        if (len == 0 && cy) {
+            memcpy(cy->b, p + i, n - i);
+            cy->n = n - i;
+            return;
+        }
+        rec_escape(c);
+        from = ++i;
+    }
+    rec_write(p + from, i - from);
+} /* rec_string */
+
+/* write the beginning of an event line */
+static void
+rec_line(
+        uint64_t    t,
+        int         type)
+{
+    char buf[64];
+    int  len = snprintf(buf, sizeof buf, "[%llu.%06llu, \"%c\", \"",
+            (unsigned long long) t / 1000000000,
+            (unsigned long long) t % 1000000000 / 1000, type);
+
+    rec_write(buf, len);
+} /* rec_line */
+
+/* write an event line */
+static void
+rec_event(
+        uint64_t             t,
+        int                  type,
+        const unsigned char *p,
+        size_t               n)
+{
+    struct rec_carry *cy = type == REC_OUTPUT ? &rec_carry_o
+                         : type == REC_INPUT  ? &rec_carry_i
+                         : NULL;
+
+    if (cy && cy->n + n < sizeof cy->b) {
+        /* all of it could be a sequence not complete yet */
+        unsigned char seq[sizeof cy->b];
+
+        memcpy(seq, cy->b, cy->n);
+        memcpy(seq + cy->n, p, n);
+        if (cy->n + n == 0 || rec_utf8(seq, cy->n + n) == 0) {
+            memcpy(cy->b, seq, cy->n + n);
+            cy->n += n;
+            return;
+        }
+    }
+    rec_line(t, type);
+    rec_string(p, n, cy);
+    rec_write("\"]\n", 3);
+} /* rec_event */
+
+/* write the incomplete sequence left at the end of the session,
+ * escaped, as it will not be completed */
+static void
+rec_uncarry(
+        int               type,
+        struct rec_carry *cy)
+{
+    if (cy->n > 0) {
+        rec_line(rec_last, type);
+        for (int i = 0; i < cy->n; i++)
+            rec_escape(cy->b[i]);
+        rec_write("\"]\n", 3);
+        cy->n = 0;
+    }
+} /* rec_uncarry */
+
+/* the end of the events ready to be written, the first event
+ * still busy, or rec_tail.  Called with rec_mtx held. */
+static size_t
+rec_ready(void)
+{
+    size_t pos = rec_head;
+
+    while (pos != rec_tail) {
+        struct rec_hdr *h = (struct rec_hdr *) (rec_ring + pos % REC_RING);
+
+        if (h->type & REC_BUSY)
+            break;
+        pos += REC_ALIGN(sizeof *h + h->len);
+    }
+    return pos;
+} /* rec_ready */
+
+static void *
+rec_writer(
+        void *arg)
+{
+    for (;;) {
+        pthread_mutex_lock(&rec_mtx);
+        while (rec_ready() == rec_head && !rec_lost && !rec_closing) {
+            rec_sleeping = 1;
+            pthread_cond_wait(&rec_cond, &rec_mtx);
+            rec_sleeping = 0;
+        }
+        int closing = rec_closing;
+        pthread_mutex_unlock(&rec_mtx);
+
+        if (!closing) {
+            /* let more events come, to write them together */
+            struct timespec batch = { 0, REC_BATCH_MSEC * 1000000L };
+            nanosleep(&batch, NULL);
+        }
+
+        pthread_mutex_lock(&rec_mtx);
+        size_t head = rec_head,
+               tail = rec_ready(),
+               lost = rec_lost;
+        rec_lost = 0;
+        pthread_mutex_unlock(&rec_mtx);
+
+        /* the events between head and tail are ours until we
+         * move rec_head, the channels don't touch them anymore */
+        while (head != tail) {
+            struct rec_hdr *h = (struct rec_hdr *)
+                    (rec_ring + head % REC_RING);
+
+            if (h->type) {
+                rec_event(h->t, h->type,
+                    (unsigned char *) (h + 1), h->len);
+                rec_last = h->t;
+            }
+            head += REC_ALIGN(sizeof *h + h->len);
+        }
+        if (lost) {
+            char buf[64];
+            int  n = snprintf(buf, sizeof buf, "%zu bytes lost", lost);
+            /* with the time of the last event, not of the loss,
+             * so times never go back */
+            rec_event(rec_last, REC_MARKER, (unsigned char *) buf, n);
+        }
+        rec_flush();
+
+        pthread_mutex_lock(&rec_mtx);
+        rec_head = head;
+        /* an event still busy at exit(3) is never ended */
+        int done = closing && rec_ready() == rec_head && !rec_lost;
+        pthread_mutex_unlock(&rec_mtx);
+        if (done)
+            return NULL;
+    }
+} /* rec_writer */
+
+/* write the rest of the events and close the file, at exit(3) */
+static void
+rec_close(void)
+{
+    if (!rec_on)
+        return;
+    pthread_mutex_lock(&rec_mtx);
+    rec_closing = 1;
+    pthread_cond_signal(&rec_cond);
+    pthread_mutex_unlock(&rec_mtx);
+    pthread_join(rec_thread, NULL);
+    rec_on = 0;
+
+    rec_uncarry(REC_OUTPUT, &rec_carry_o);
+    rec_uncarry(REC_INPUT,  &rec_carry_i);
+    rec_flush();
+    if (rec_errno)
+        fprintf(stderr, "recording: write: %s\r\n", strerror(rec_errno));
+    close(rec_fd);
+    rec_fd = -1;
+} /* rec_close */
+
+int
+rec_open(
+        const char *path,
+        int         cols,
+        int         rows)
+{
+    char        buf[128];
+    const char *term = getenv("TERM");
+    sigset_t    all, old;
+
+    rec_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (rec_fd < 0)
+        return -1;
+    rec_ring = malloc(REC_RING);
+    if (!rec_ring)
+        goto fail;
+    clock_gettime(CLOCK_MONOTONIC, &rec_t0);
+
+    /* the header, written now, so the file is valid even if
+     * there are no events */
+    int n = snprintf(buf, sizeof buf,
+            "{\"version\": 2, \"width\": %d, \"height\": %d, "
+            "\"timestamp\": %lld, \"" REC_RAW "\": true",
+            cols, rows, (long long) time(NULL));
+    rec_write(buf, n);
+    if (term) {
+        rec_write(", \"env\": {\"TERM\": \"", 19);
+        rec_string((const unsigned char *) term, strlen(term), NULL);
+        rec_write("\"}", 2);
+    }
+    rec_write("}\n", 2);
+    rec_flush();
+    if (rec_errno) {
+        errno = rec_errno;
+        goto fail;
+    }
+
+    /* signals are for the other threads */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int res = pthread_create(&rec_thread, NULL, rec_writer, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (res != 0) {
+        errno = res;
+        goto fail;
+    }
+    rec_on = 1;
+    atexit(rec_close);
+    return 0;
+
+fail:;
+    int saved_errno = errno;
+    close(rec_fd);
+    rec_fd = -1;
+    free(rec_ring);
+    rec_ring = NULL;
+    errno = saved_errno;
+    return -1;
+} /* rec_open */
+
+int
+rec_enabled(void)
+{
+    return rec_on;
+} /* rec_enabled */
+
+long
+rec_begin(
+        int                 type,
+        const struct iovec *iov,
+        int                 niov)
+{
+    size_t len = 0;
+
+    for (int i = 0; i < niov; i++)
+        len += iov[i].iov_len;
+
+    pthread_mutex_lock(&rec_mtx);
+
+    size_t need = REC_ALIGN(sizeof(struct rec_hdr) + len),
+           pos  = rec_tail % REC_RING,
+           pad  = pos + need > REC_RING ? REC_RING - pos : 0;
+
+    if (rec_closing || rec_tail + pad + need - rec_head > REC_RING) {
+        pthread_mutex_unlock(&rec_mtx);
+        return -1; /* lost, counted by rec_end() */
+    }
+
+    struct rec_hdr *h = (struct rec_hdr *) (rec_ring + pos);
+    if (pad) {
+        /* the space left at the end is not enough */
+        h->type   = 0;
+        h->len    = pad - sizeof *h;
+        rec_tail += pad;
+        h         = (struct rec_hdr *) rec_ring;
+    }
+    /* the space is taken now, but the writer doesn't go past the
+     * event until rec_end() */
+    h->t      = rec_now();
+    h->len    = len;
+    h->type   = type | REC_BUSY;
+    rec_tail += need;
+    char *p = (char *) (h + 1);
+    for (int i = 0; i < niov; i++) {
+        memcpy(p, iov[i].iov_base, iov[i].iov_len);
+        p += iov[i].iov_len;
+    }
+    pthread_mutex_unlock(&rec_mtx);
+
+    return (char *) h - rec_ring;
+} /* rec_begin */
+
+void
+rec_end(
+        long    ev,
+        size_t  len)
+{
+    pthread_mutex_lock(&rec_mtx);
+    if (ev >= 0) {
+        struct rec_hdr *h = (struct rec_hdr *) (rec_ring + ev);
+
+        if (len > h->len)
+            len = h->len;
+        if (len == 0) {
+            /* all the space taken is padding */
+            h->type = 0;
+        } else {
+            /* and the space of the data not written */
+            size_t used = REC_ALIGN(sizeof *h + len),
+                   rest = REC_ALIGN(sizeof *h + h->len) - used;
+
+            if (rest > 0) {
+                struct rec_hdr *pad = (struct rec_hdr *)
+                        ((char *) h + used);
+                pad->type = 0;
+                pad->len  = rest - sizeof *pad;
+            }
+            h->len   = len;
+            h->type &= ~REC_BUSY;
+        }
+        if (rec_sleeping)
+            pthread_cond_signal(&rec_cond);
+    } else if (!rec_closing) {
+        rec_lost += len;
+    }
+    pthread_mutex_unlock(&rec_mtx);
+} /* rec_end */
+
+void
+rec_put(
+        int         type,
+        const void *data,
+        size_t      len)
+{
+    struct iovec iov = { (void *) data, len };
+
+    rec_end(rec_begin(type, &iov, 1), len);
+} /* rec_put */
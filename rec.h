@@ -0,0 +1,112 @@
+/* rec.h -- recording of the session, as it is paced, in the
+ * asciicast v2 format of asciinema(1).  The channels only copy
+ * the data to a ring in memory, a thread formats it and writes
+ * it to the file, so the recording never delays the pacing.
+ * Author: Luis Colorado <luiscoloradourcola@gmail.com>
+ * Copyright: (C) 2015-2025 LUIS COLORADO.  All rights reserved.
+ * License: BSD.
+ *
+ * The file is a line with the header, a JSON object:
+ *
+ *   {"version": 2, "width": 80, "height": 24, "timestamp": 1700000000,
+ *    "slowtty_raw": true, "env": {"TERM": "xterm"}}
+ *
+ * followed by a line per event, a JSON array with the time in
+ * seconds since the start (on the monotonic clock), the type of
+ * event and its data:
+ *
+ *   [0.123456, "o", "output written to the terminal"]
+ *   [0.234567, "i", "input written to the child"]
+ *   [1.345678, "r", "132x43"]
+ *   [2.456789, "m", "1234 bytes lost"]
+ *
+ * The data is in UTF-8.  Bytes that are not part of a valid UTF-8
+ * sequence are written as \u00XX escapes with their value, as are
+ * the control chars, and as valid sequences are never escaped, a
+ * player that knows this (as -P, see play.h) gets the exact bytes
+ * back.  The "slowtty_raw" key of the header (REC_RAW) tells
+ * that, for other recordings \u00XX is a char, to be encoded in
+ * UTF-8.  "m" (marker) events tell that the ring got full (the
+ * disk was slower than the line) and some events were lost.
+ */
+#ifndef _REC_H
+#define _REC_H
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+#define REC_RING            (1 << 20)   /* bytes of events waiting
+                                         * to be written, a power
+                                         * of two */
+#define REC_BATCH_MSEC      (20)        /* the writer waits this
+                                         * for more events before
+                                         * writing */
+
+/* the key of the header of our recordings, see above */
+#define REC_RAW             "slowtty_raw"
+
+/* types of event */
+#define REC_OUTPUT          'o'
+#define REC_INPUT           'i'
+#define REC_RESIZE          'r'
+#define REC_MARKER          'm'
+
+/* Create the recording file, write its header and start the
+ * writer thread.  The rest of the events are written at exit(3).
+ *
+ * @param path the file to create (it is truncated if it exists).
+ * @param cols the width of the terminal.
+ * @param rows the height of the terminal.
+ * @return 0 on success, -1 and errno set on error. */
+int
+rec_open(
+        const char *path,
+        int         cols,
+        int         rows);
+
+/* Check if the session is being recorded.
+ *
+ * @return nonzero if rec_open() succeeded. */
+int
+rec_enabled(void);
+
+/* Begin an event whose length is only known later, copying its
+ * data, so data can be recorded before it is written (and lost
+ * from its buffer).  No lock is held until rec_end(), the writer
+ * thread waits for the event, but the other channels don't.
+ *
+ * @param type the type of event (REC_OUTPUT, ...).
+ * @param iov the data, in pieces.
+ * @param niov the number of pieces.
+ * @return the event, to pass to rec_end(), or -1 if it didn't
+ *         fit in the ring. */
+long
+rec_begin(
+        int                 type,
+        const struct iovec *iov,
+        int                 niov);
+
+/* End an event begun with rec_begin().
+ *
+ * @param ev the event, as returned by rec_begin() (-1 counts the
+ *        data as lost).
+ * @param len the bytes of data that are actually part of the
+ *        event (the bytes the destination accepted), no more than
+ *        were passed to rec_begin().  Zero drops the event. */
+void
+rec_end(
+        long    ev,
+        size_t  len);
+
+/* Record an event.
+ *
+ * @param type the type of event.
+ * @param data the data of the event.
+ * @param len its length. */
+void
+rec_put(
+        int         type,
+        const void *data,
+        size_t      len);
+
+#endif /* _REC_H */
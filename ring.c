@@ -4,18 +4,97 @@
  * Copyright: (C) 2019 LUIS COLORADO.  All rights reserved.
  * License: BSD.
  */
+#define _GNU_SOURCE     /* for splice(2) and pipe2(2) */
+
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include "config.h"
+
+#ifndef   UQ_HAS_SPLICE /* {{ */
+#warning  UQ_HAS_SPLICE should be defined in config.mk
+#define   UQ_HAS_SPLICE     (0)
+#endif /* UQ_HAS_SPLICE  * }} */
+
 #include "ring.h"
 #include "slowtty.h"
+#include "trace.h"
+
+#ifndef   UQ_HAS_MEMFD /* {{ */
+#warning  UQ_HAS_MEMFD should be defined in config.mk
+#define   UQ_HAS_MEMFD      (0)
+#endif /* UQ_HAS_MEMFD  * }} */
+
+#if UQ_HAS_MEMFD
+#include <sys/mman.h>
+#endif
 
 #ifndef F
 #define F(_fmt) "%s:%d:%s: "_fmt,__FILE__,__LINE__,__func__
 #endif
 
+/* Allocate a buffer of cap bytes mapped twice, back to back,
+ * so the data that goes past the end of the buffer appears at
+ * its beginning, and no transfer has to be split in two.
+ * cap must be a multiple of the page size.
+ *
+ * @param cap the capacity of the buffer.
+ * @return the buffer (2 * cap bytes of address space), or NULL
+ *          if it cannot be done. */
+static char *
+rb_mirror_alloc(
+        size_t cap)
+{
+#if UQ_HAS_MEMFD /* {{ */
+    char *p   = MAP_FAILED;
+    int   fd  = memfd_create("slowtty-ring", MFD_CLOEXEC);
+
+    if (fd < 0)
+        return NULL;
+    if (ftruncate(fd, cap) < 0)
+        goto end;
+
+    /* reserve the address space for both copies, and then map
+     * the pages of the memfd on each half. */
+    p = mmap(NULL, 2 * cap, PROT_NONE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        goto end;
+    if (       mmap(p, cap, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED
+            || mmap(p + cap, cap, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+    {
+        munmap(p, 2 * cap);
+        p = MAP_FAILED;
+    }
+end:
+    close(fd); /* the mappings keep the memory */
+    return p == MAP_FAILED ? NULL : p;
+#else /* UQ_HAS_MEMFD }{ */
+    return NULL;
+#endif /* UQ_HAS_MEMFD }} */
+} /* rb_mirror_alloc */
+
+/* release the buffer memory, if it's not rb_small */
+static void
+rb_free(
+        struct ring_buffer *rb)
+{
+#if UQ_HAS_MEMFD /* {{ */
+    if (rb->rb_mirror) {
+        munmap(rb->rb_buffer, 2 * rb->rb_cap);
+        return;
+    }
+#endif /* UQ_HAS_MEMFD }} */
+    if (rb->rb_buffer != rb->rb_small)
+        free(rb->rb_buffer);
+} /* rb_free */
+
 static ssize_t
 rb_io(
         struct ring_buffer
@@ -31,18 +110,23 @@ rb_io(
                 const struct iovec
                             *iov,   /* struct iovec array */
                 int          niov), /* number of array elements. */
-        char        *fname) /* function name to call (for error
+        char        *fname, /* function name to call (for error
                              * messages) */
+        struct iovec
+                    *pre)   /* iovec to do io before the ring
+                             * buffer (or NULL) */
 {
-    struct iovec iov[2],
+    struct iovec iov[3],
                 *piov  = iov;
     char *const  start = rb->rb_buffer,
          *const  end   = rb->rb_end;
     char        *ph    = *rph;
 
+    if (pre)
+        *piov++ = *pre;
     piov->iov_base  = ph;
                 ph += nio;
-    if (ph >= end) {
+    if (ph >= end && !rb->rb_mirror) {
         /* bytes left to process */
         size_t n = ph - end;
 
@@ -57,81 +141,498 @@ rb_io(
     }
     ssize_t res = io_op(fd, iov, piov - iov);
 
-#if 0
-    /* THIS LOG IS TOO HEAVY TO USE IN PRODUCTION */
-    fprintf(stderr, F("%s(fd=%d, {"), fname, fd);
-    char *sep = "";
-    for (struct iovec *p = iov; p < piov; p++) {
-        fprintf(stderr,
-            "%s{.iov_base=%p, .iov_len=%zu}",
-            sep, p->iov_base, p->iov_len);
-        sep = ",";
-    }
-    fprintf(stderr, "%zu) => %zd\n",
-          (piov - iov), res);
-#endif
-
-    if (res < 0) {
-#if 0
-        /* AND THIS ONE ALSO */
-        fprintf(stderr,
-            F("%s: ERROR" ERRNO "\n"),
-            fname, EPMTS);
-#endif
+    TRACE(TRC_IO, rb, fd, piov - iov, res);
+    if (res < 0)
         return res;
+    if (pre) {
+        if (res < (ssize_t) pre->iov_len)
+            return 0; /* nothing went to the ring buffer */
+        res -= pre->iov_len;
     }
     *rph += res;
     if (*rph >= end)
-        *rph -= RB_BUFFER_SIZE;
+        *rph -= rb->rb_cap;
 
     return res;
 } /* rb_io */
 
+#if UQ_HAS_SPLICE /* {{ */
+/* leave the splice path, moving the data in the pipe (if any) to
+ * the buffer memory.  Only from the producer side, with the
+ * consumer not touching the buffer (see rb_sync()) */
+static void
+rb_splice_off(
+        struct ring_buffer *rb)
+{
+    size_t n = rb->rb_size, moved = 0;
+
+    rb->rb_head = rb->rb_tail = rb->rb_buffer;
+    while (moved < n) {
+        ssize_t res = rb_io(rb, rb->rb_pipe[0], n - moved,
+                &rb->rb_tail, readv, "readv", NULL);
+        if (res <= 0)
+            break; /* cannot happen, the data is there */
+        moved += res;
+    }
+    close(rb->rb_pipe[0]);
+    close(rb->rb_pipe[1]);
+    rb->rb_pipe[0] = rb->rb_pipe[1] = -1;
+    __atomic_store_n(&rb->rb_size, moved, __ATOMIC_RELEASE);
+} /* rb_splice_off */
+
+/* check if there is no room in the pipe */
+static int
+rb_pipe_full(
+        struct ring_buffer *rb)
+{
+    struct pollfd pfd = {
+        .fd     = rb->rb_pipe[1],
+        .events = POLLOUT,
+    };
+    return poll(&pfd, 1, 0) == 0;
+} /* rb_pipe_full */
+#endif /* UQ_HAS_SPLICE }} */
+
+void
+rb_want(
+        struct ring_buffer *rb,
+        size_t cap)
+{
+    __atomic_store_n(&rb->rb_want, cap, __ATOMIC_RELEASE);
+} /* rb_want */
+
+void
+rb_sync(
+        struct ring_buffer *rb)
+{
+    size_t want = __atomic_load_n(&rb->rb_want, __ATOMIC_ACQUIRE);
+    size_t size = RB_SIZE(rb);
+
+#if UQ_HAS_SPLICE /* {{ */
+    int unsplice = __atomic_load_n(&rb->rb_unsplice, __ATOMIC_ACQUIRE);
+
+    /* the consumer doesn't touch the buffer while it waits for
+     * us, or if it is empty. */
+    if (unsplice & RB_UNSPLICE_OUT || (unsplice && size == 0)) {
+        rb_splice_off(rb);
+        __atomic_store_n(&rb->rb_unsplice, 0, __ATOMIC_RELEASE);
+    }
+#endif /* UQ_HAS_SPLICE }} */
+
+    /* a new request can arrive meanwhile, so it's only cleared
+     * if it's the same */
+    if (       want && size == 0
+            && __atomic_compare_exchange_n(&rb->rb_want, &want, 0,
+                    FALSE, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+    {
+        rb_resize(rb, want); /* if it fails, we go on as we are */
+    }
+} /* rb_sync */
+
 ssize_t
 rb_read(
         struct ring_buffer *rb,
         int fd,
         size_t n)
 {
-    if (n > RB_BUFFER_SIZE - rb->rb_size)
-        n = RB_BUFFER_SIZE - rb->rb_size;
+    rb_sync(rb);
+
+    size_t room = rb->rb_cap - RB_SIZE(rb);
+    if (n > room)
+        n = room;
+
+#if UQ_HAS_SPLICE /* {{ */
+    if (rb->rb_unsplice) {
+        /* the consumer has to empty the pipe first */
+        errno = ENOSPC;
+        return -1;
+    }
+    if (rb->rb_pipe[0] >= 0) {
+        ssize_t res = splice(fd, NULL, rb->rb_pipe[1], NULL, n,
+                SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+        if (res > 0) {
+            __atomic_add_fetch(&rb->rb_size, res, __ATOMIC_SEQ_CST);
+            return res;
+        }
+        /* EINVAL means that fd doesn't support splice(2).  And
+         * the pipe holds a page per splice(2), whatever the
+         * amount of data, so it can get full before the buffer
+         * does, when the data comes in small chunks.  We would
+         * never read the source then, so we get back to the copy
+         * path, which suits better small chunks, anyway. */
+        if (       res == 0
+                || !(errno == EINVAL
+                  || (errno == EAGAIN && rb_pipe_full(rb))))
+            return res;
+        __atomic_or_fetch(&rb->rb_unsplice, RB_UNSPLICE_IN,
+                __ATOMIC_RELEASE);
+        rb_sync(rb);
+        if (rb->rb_unsplice) {
+            errno = ENOSPC;
+            return -1;
+        }
+    }
+#endif /* UQ_HAS_SPLICE }} */
 
     ssize_t res = rb_io(rb, fd, n,
-            &rb->rb_tail, readv, "readv");
+            &rb->rb_tail, readv, "readv", NULL);
 
     if (res > 0)
-        rb->rb_size += res;
+        __atomic_add_fetch(&rb->rb_size, res, __ATOMIC_SEQ_CST);
 
     return res;
 } /* rb_read */
 
+ssize_t
+rb_read_pkt(
+        struct ring_buffer *rb,
+        int fd,
+        size_t n,
+        unsigned char *ctl)
+{
+    struct iovec pre = {
+        .iov_base = ctl,
+        .iov_len  = sizeof *ctl,
+    };
+
+    rb_sync(rb);
+
+    size_t room = rb->rb_cap - RB_SIZE(rb);
+    if (n > room)
+        n = room;
+
+    *ctl = 0;
+    ssize_t res = rb_io(rb, fd, n,
+            &rb->rb_tail, readv, "readv", &pre);
+
+    if (res > 0)
+        __atomic_add_fetch(&rb->rb_size, res, __ATOMIC_SEQ_CST);
+
+    return res;
+} /* rb_read_pkt */
+
+ssize_t
+rb_read_filter(
+        struct ring_buffer *rb,
+        int fd,
+        size_t n,
+        size_t (*filter)(char *p, size_t n, void *arg),
+        void *arg,
+        size_t *kept)
+{
+    *kept = 0;
+    rb_sync(rb);
+
+    size_t room = rb->rb_cap - RB_SIZE(rb);
+    if (n > room)
+        n = room;
+
+    char   *p   = rb->rb_tail,  /* piece to filter */
+           *w   = p;            /* where the bytes kept go */
+    ssize_t res = rb_io(rb, fd, n,
+            &rb->rb_tail, readv, "readv", NULL);
+
+    if (res <= 0)
+        return res;
+
+    for (size_t left = res; left > 0;) {
+        size_t len = rb->rb_end - p;
+
+        if (len > left)
+            len = left;
+        size_t k = filter(p, len, arg);
+
+        /* w is behind p (or is p), move them there */
+        for (char *q = p; k > 0;) {
+            size_t c = rb->rb_end - w;
+
+            if (c > k)
+                c = k;
+            if (w != q)
+                memmove(w, q, c);
+            w += c; q += c; k -= c; *kept += c;
+            if (w == rb->rb_end)
+                w = rb->rb_buffer;
+        }
+        p    += len;
+        left -= len;
+        if (p == rb->rb_end)
+            p = rb->rb_buffer;
+    }
+    rb->rb_tail = w;
+    if (*kept > 0)
+        __atomic_add_fetch(&rb->rb_size, *kept, __ATOMIC_SEQ_CST);
+
+    return res;
+} /* rb_read_filter */
+
 ssize_t
 rb_write(
         struct ring_buffer *rb,
         int fd,
         size_t n)
 {
-    if (n > rb->rb_size)
-        n = rb->rb_size;
+    size_t size = RB_SIZE(rb);
+
+    if (n > size)
+        n = size;
+    if (n == 0)
+        return 0; /* and the buffer is not touched */
+
+#if UQ_HAS_SPLICE /* {{ */
+    if (__atomic_load_n(&rb->rb_unsplice, __ATOMIC_ACQUIRE)
+            & RB_UNSPLICE_OUT)
+    {
+        errno = ENOSPC; /* still waiting for rb_sync() */
+        return -1;
+    }
+    if (rb->rb_pipe[0] >= 0) {
+        /* the data is already in the pipe, so no SPLICE_F_NONBLOCK
+         * here, or we would not block on a blocking fd (as we
+         * would with writev(2)).  splice(2) returns as soon as
+         * something has been written, so we repeat it until all
+         * has gone, or the fd would block. */
+        ssize_t total = 0;
+        while (total < n) {
+            ssize_t res = splice(rb->rb_pipe[0], NULL, fd, NULL,
+                    n - total, SPLICE_F_MOVE);
+
+            if (res <= 0) {
+                if (total == 0 && res < 0 && errno == EINVAL) {
+                    /* fd doesn't support splice(2), the
+                     * producer has to move the data to the buffer
+                     * memory, we cannot do it from here. */
+                    __atomic_or_fetch(&rb->rb_unsplice,
+                            RB_UNSPLICE_OUT, __ATOMIC_RELEASE);
+                    errno = ENOSPC;
+                }
+                if (total == 0)
+                    return res;
+                break;
+            }
+            __atomic_sub_fetch(&rb->rb_size, res, __ATOMIC_SEQ_CST);
+            total += res;
+        }
+        return total;
+    }
+#endif /* UQ_HAS_SPLICE }} */
 
     ssize_t res = rb_io(
             rb, fd, n,
             &rb->rb_head,
-            writev, "writev");
+            writev, "writev", NULL);
 
     if (res > 0)
-        rb->rb_size -= res;
+        __atomic_sub_fetch(&rb->rb_size, res, __ATOMIC_SEQ_CST);
 
     return res;
 } /* rb_write */
 
+size_t
+rb_discard(
+        struct ring_buffer *rb,
+        size_t n)
+{
+    size_t size = RB_SIZE(rb);
+
+    if (n > size)
+        n = size;
+    if (n == 0)
+        return 0;
+
+#if UQ_HAS_SPLICE /* {{ */
+    if (__atomic_load_n(&rb->rb_unsplice, __ATOMIC_ACQUIRE)
+            & RB_UNSPLICE_OUT)
+        return 0; /* we cannot touch it until rb_sync() */
+    if (rb->rb_pipe[0] >= 0) {
+        char   buf[4096];
+        size_t total = 0;
+
+        while (total < n) {
+            ssize_t res = read(rb->rb_pipe[0], buf,
+                    n - total < sizeof buf ? n - total : sizeof buf);
+            if (res <= 0)
+                break; /* cannot happen, the data is there */
+            __atomic_sub_fetch(&rb->rb_size, res, __ATOMIC_SEQ_CST);
+            total += res;
+        }
+        return total;
+    }
+#endif /* UQ_HAS_SPLICE }} */
+
+    rb->rb_head += n;
+    if (rb->rb_head >= rb->rb_end)
+        rb->rb_head -= rb->rb_cap;
+    __atomic_sub_fetch(&rb->rb_size, n, __ATOMIC_SEQ_CST);
+
+    return n;
+} /* rb_discard */
+
 void
 rb_init(
         struct ring_buffer *rb)
 {
-    rb->rb_head = rb->rb_end
-                = rb->rb_tail
-                = rb->rb_buffer;
-    rb->rb_end += RB_BUFFER_SIZE;
-    rb->rb_size = 0;
+    rb->rb_buffer = rb->rb_small;
+    rb->rb_mirror = FALSE;
+    rb->rb_cap    = RB_BUFFER_SIZE;
+    rb->rb_head   = rb->rb_end
+                  = rb->rb_tail
+                  = rb->rb_buffer;
+    rb->rb_end   += rb->rb_cap;
+    rb->rb_size   = 0;
+    rb->rb_want   = 0;
+    rb->rb_unsplice = 0;
+    rb->rb_pipe[0] = rb->rb_pipe[1] = -1;
 } /* rb_init */
+
+void
+rb_destroy(
+        struct ring_buffer *rb)
+{
+    if (rb->rb_pipe[0] >= 0) {
+        close(rb->rb_pipe[0]);
+        close(rb->rb_pipe[1]);
+    }
+    rb_free(rb);
+    rb_init(rb);
+} /* rb_destroy */
+
+int
+rb_resize(
+        struct ring_buffer *rb,
+        size_t cap)
+{
+    size_t new_cap = RB_BUFFER_SIZE;
+
+    while (new_cap < cap && new_cap < RB_MAX_SIZE)
+        new_cap <<= 1;
+    while (new_cap < rb->rb_size)
+        new_cap <<= 1;
+    if (new_cap == rb->rb_cap)
+        return 0;
+
+#if UQ_HAS_SPLICE /* {{ */
+    if (rb->rb_pipe[0] >= 0) {
+        /* the data is in the pipe, which must be able to hold
+         * all the capacity, or the source would be always ready
+         * and we could not read from it. */
+        int res = fcntl(rb->rb_pipe[1], F_GETPIPE_SZ);
+        if (res < 0 || (size_t) res < new_cap) {
+            if (fcntl(rb->rb_pipe[1], F_SETPIPE_SZ, new_cap) < 0)
+                rb_splice_off(rb); /* continue on the copy path */
+        }
+    }
+#endif /* UQ_HAS_SPLICE }} */
+
+    /* the mirror needs whole pages, and if it cannot be done,
+     * we do with a plain buffer, splitting the transfers that
+     * cross its end. */
+    int   mirror  = FALSE;
+    char *new_buf = rb->rb_small;
+    if (new_cap > RB_BUFFER_SIZE) {
+        long pgsz = sysconf(_SC_PAGESIZE);
+        new_buf = NULL;
+        if (pgsz > 0 && new_cap % pgsz == 0)
+            new_buf = rb_mirror_alloc(new_cap);
+        if (new_buf)
+            mirror  = TRUE;
+        else
+            new_buf = malloc(new_cap);
+        if (!new_buf)
+            return -1;
+    }
+
+    /* copy the contents, linearized at the beginning (old and
+     * new buffers are never the same, as the capacity changes) */
+    size_t n = rb->rb_size;
+    if (rb->rb_pipe[0] < 0 && n > 0) {
+        size_t first = rb->rb_end - rb->rb_head;
+        if (first > n)
+            first = n;
+        memcpy(new_buf, rb->rb_head, first);
+        memcpy(new_buf + first, rb->rb_buffer, n - first);
+    }
+    rb_free(rb);
+    rb->rb_buffer = new_buf;
+    rb->rb_mirror = mirror;
+    rb->rb_cap    = new_cap;
+    rb->rb_head   = new_buf;
+    rb->rb_tail   = new_buf + (n % new_cap);
+    rb->rb_end    = new_buf + new_cap;
+    return 0;
+} /* rb_resize */
+
+char *
+rb_peek(
+        struct ring_buffer *rb,
+        size_t *n)
+{
+    size_t size = RB_SIZE(rb);
+
+    if (size == 0) {
+        *n = 0; /* the buffer can be changing */
+        return NULL;
+    }
+    size_t first = rb->rb_end - rb->rb_head;
+
+    *n = rb->rb_mirror || size <= first
+        ? size
+        : first;
+    return rb->rb_head;
+} /* rb_peek */
+
+int
+rb_peekv(
+        struct ring_buffer *rb,
+        struct iovec        iov[2],
+        size_t              n)
+{
+    size_t size = RB_SIZE(rb);
+    size_t first;
+
+    if (n > size)
+        n = size;
+    if (n == 0)
+        return 0;
+    iov[0].iov_base = rb_peek(rb, &first);
+    iov[0].iov_len  = n < first ? n : first;
+    if (n <= first)
+        return 1;
+    iov[1].iov_base = rb->rb_buffer; /* the data wraps around */
+    iov[1].iov_len  = n - first;
+    return 2;
+} /* rb_peekv */
+
+int
+rb_splice(
+        struct ring_buffer *rb)
+{
+#if UQ_HAS_SPLICE /* {{ */
+    if (rb->rb_pipe[0] >= 0)
+        return 0;
+    if (rb->rb_size > 0) {
+        errno = EBUSY;
+        return -1;
+    }
+    if (pipe2(rb->rb_pipe, O_NONBLOCK | O_CLOEXEC) < 0)
+        return -1;
+    /* the pipe must be able to hold all the capacity (see
+     * rb_resize()) */
+    int res = fcntl(rb->rb_pipe[1], F_GETPIPE_SZ);
+    if (       (res < 0 || (size_t) res < rb->rb_cap)
+            && fcntl(rb->rb_pipe[1], F_SETPIPE_SZ, rb->rb_cap) < 0)
+    {
+        int saved_errno = errno;
+        close(rb->rb_pipe[0]);
+        close(rb->rb_pipe[1]);
+        rb->rb_pipe[0] = rb->rb_pipe[1] = -1;
+        errno = saved_errno;
+        return -1;
+    }
+    return 0;
+#else /* UQ_HAS_SPLICE }{ */
+    errno = ENOSYS;
+    return -1;
+#endif /* UQ_HAS_SPLICE }} */
+} /* rb_splice */
@@ -10,15 +10,42 @@
 #include <unistd.h>
 #include <sys/uio.h>
 
-#define RB_BUFFER_SIZE      (1024)
+#define RB_BUFFER_SIZE      (1024)      /* initial capacity */
+#define RB_MAX_SIZE         (1 << 20)   /* maximum capacity */
+
+/* A ring buffer can be used from two threads without locks, one
+ * of them (the producer) only calling rb_read(), rb_read_pkt(),
+ * rb_read_filter() and rb_sync(), and the other (the consumer)
+ * only rb_write(), rb_discard(), rb_peek(), rb_peekv() and
+ * rb_want().  rb_size is the only field both change, with atomic
+ * operations, and the consumer has to read it with RB_SIZE().
+ * The producer is the owner of the buffer, the changes the
+ * consumer needs are only requested to it, and done with the
+ * buffer empty (the consumer doesn't touch the buffer then) */
+#define RB_SIZE(_rb) __atomic_load_n(&(_rb)->rb_size, __ATOMIC_SEQ_CST)
+
+/* values of rb_unsplice */
+#define RB_UNSPLICE_IN      (1)     /* the producer cannot splice */
+#define RB_UNSPLICE_OUT     (2)     /* the consumer cannot splice */
 
 struct ring_buffer {
-    char           *rb_head,
-                   *rb_tail,
+    char           *rb_head,    /* consumer side */
+                   *rb_tail,    /* producer side */
                    *rb_end;
-    size_t          rb_size;
+    size_t          rb_size;    /* bytes stored (atomic) */
+    size_t          rb_cap;     /* capacity of the buffer */
+    size_t          rb_want;    /* capacity requested by the
+                                 * consumer (atomic, or 0) */
+    int             rb_unsplice;/* the splice path has to be left,
+                                 * RB_UNSPLICE_* (atomic, or 0) */
+    char           *rb_buffer;  /* rb_small, or allocated if
+                                 * bigger (see rb_resize()) */
+    int             rb_mirror;  /* rb_buffer is mapped twice, so
+                                 * data never wraps around */
+    int             rb_pipe[2]; /* intermediate pipe of the splice
+                                 * path, or -1 if not in use */
 
-    char            rb_buffer[RB_BUFFER_SIZE];
+    char            rb_small[RB_BUFFER_SIZE];
 };
 
 /* Initialize a ring buffer.
@@ -28,16 +55,117 @@ void
 rb_init(
         struct ring_buffer *rb);
 
+/* Release the resources of a ring buffer (the pipe of the
+ * splice path, see rb_splice(), and the memory allocated by
+ * rb_resize()).  Its contents are lost, and it is left as
+ * rb_init() does.
+ *
+ * @param rb the ring buffer. */
+void
+rb_destroy(
+        struct ring_buffer *rb);
+
+/* Change the capacity of a ring buffer, keeping its contents.
+ * Used to hold the larger windows of fast lines.  Where possible
+ * (UQ_HAS_MEMFD), the new buffer is mapped twice back to back,
+ * so the data is always contiguous, whatever its position.
+ *
+ * @param rb the ring buffer.
+ * @param cap the new capacity, it's rounded up to a power of
+ *          two, and limited to the range RB_BUFFER_SIZE to
+ *          RB_MAX_SIZE, but never below the size of the data
+ *          stored.
+ * @return 0 on success, -1 and errno set on error (the ring
+ *          buffer is left unchanged).
+ */
+int
+rb_resize(
+        struct ring_buffer *rb,
+        size_t cap);
+
+/* Request a change of capacity from the consumer side.  The
+ * producer does it (see rb_sync()) as soon as the buffer gets
+ * empty.
+ *
+ * @param rb the ring buffer.
+ * @param cap the new capacity (see rb_resize()). */
+void
+rb_want(
+        struct ring_buffer *rb,
+        size_t cap);
+
+/* Do, from the producer side, the changes requested by the
+ * consumer, if they can be done (see rb_want()), and leave the
+ * splice path if it cannot be used anymore.  It's called on each
+ * read, but the producer has to call it also when the consumer
+ * asks for it, as rb_write() fails with ENOSPC while the data
+ * cannot be written.
+ *
+ * @param rb the ring buffer. */
+void
+rb_sync(
+        struct ring_buffer *rb);
+
+/* Get the data stored at the head of a ring buffer, as a
+ * contiguous span.  On mirrored buffers (see rb_resize()) the
+ * span covers all the data.  Not valid on the splice path.
+ *
+ * @param rb the ring buffer.
+ * @param n where to store the length of the span.
+ * @return the first byte of the span, or NULL if the buffer is
+ *          empty. */
+char *
+rb_peek(
+        struct ring_buffer *rb,
+        size_t *n);
+
+/* Get the first bytes stored in a ring buffer, in the order
+ * rb_write() would write them, without removing them.  Not valid
+ * on the splice path.
+ *
+ * @param rb the ring buffer.
+ * @param iov where to store the pieces of the data.
+ * @param n the number of bytes wanted (less if there are not
+ *          so many stored).
+ * @return the number of pieces stored in iov[], 0 if the buffer
+ *          is empty. */
+int
+rb_peekv(
+        struct ring_buffer *rb,
+        struct iovec        iov[2],
+        size_t              n);
+
+/* Switch a ring buffer to the splice path.  Data is moved
+ * with splice(2) through an intermediate pipe, instead of being
+ * copied to and from the buffer memory, so it never reaches
+ * user space.  rb->rb_size keeps accounting the bytes stored.
+ * The ring buffer falls back to the copy path by itself as soon
+ * as a descriptor doesn't support splice(2) (see rb_sync()).
+ * Only for empty buffers, and not usable with rb_read_pkt() or
+ * rb_read_filter().
+ *
+ * @param rb the ring buffer.
+ * @return 0 on success, -1 and errno set if the splice path is
+ *          not available (the buffer continues on the copy
+ *          path).
+ */
+int
+rb_splice(
+        struct ring_buffer *rb);
+
 /* Read bytes to a ring buffer.
  *
  * @param rb the ring buffer to be updated.
  * @param fd the file descriptor to be read from.
  * @param n the number of bytes to read.  It should
- *          be less than the buffer capacity, RB_BUFFER_SIZE
+ *          be less than the buffer capacity, rb->rb_cap
  *          minus the buffer size rb->rb_size, but a check is
  *          done inside the function and if you pass more bytes,
  *          the maximum available are read instead.
- * @return  The number of bytes actually read.
+ * @return  The number of bytes actually read, or -1 and errno
+ *          set on error.  ENOSPC means that nothing can be read
+ *          until the consumer empties the buffer (the splice
+ *          path is being left).
  */
 ssize_t
 rb_read(
@@ -45,6 +173,52 @@ rb_read(
         int fd,
         size_t n);
 
+/* Read bytes to a ring buffer from a pty master in packet
+ * mode (see TIOCPKT in tty(4)).  The control byte that precedes
+ * the data is stored in *ctl, not in the ring buffer.
+ *
+ * @param rb the ring buffer to be updated.
+ * @param fd the file descriptor to be read from.
+ * @param n the number of data bytes to read (see rb_read()).
+ * @param ctl where to store the control byte.  It is zero
+ *          (TIOCPKT_DATA) when data is returned or on EOF.
+ * @return  The number of data bytes actually read.  Zero is
+ *          returned with a nonzero *ctl when only status
+ *          information was read, and with zero *ctl on EOF.
+ */
+ssize_t
+rb_read_pkt(
+        struct ring_buffer *rb,
+        int fd,
+        size_t n,
+        unsigned char *ctl);
+
+/* Read bytes to a ring buffer, as rb_read() does, but let a
+ * filter look at them, and take some of them out, before the
+ * consumer can see them.  The filter is called on the bytes read
+ * (in two pieces, if they wrap around the end of the buffer), and
+ * moves those to keep to the beginning of the piece.  The pieces
+ * are joined again after it.  Not valid on the splice path.
+ *
+ * @param rb the ring buffer to be updated.
+ * @param fd the file descriptor to be read from.
+ * @param n the number of bytes to read (see rb_read()).
+ * @param filter the filter, it returns the number of bytes kept.
+ * @param arg passed to the filter.
+ * @param kept where to store the number of bytes kept, those
+ *          stored in the ring buffer.
+ * @return  The number of bytes actually read (some of them can
+ *          have been taken out), or -1 and errno set on error.
+ */
+ssize_t
+rb_read_filter(
+        struct ring_buffer *rb,
+        int fd,
+        size_t n,
+        size_t (*filter)(char *p, size_t n, void *arg),
+        void *arg,
+        size_t *kept);
+
 /* Write bytes to a ring buffer.
  *
  * @param rb the ring buffer to be updated.
@@ -53,7 +227,10 @@ rb_read(
  *          be less than the buffer size, rb->rb_size, but a check
  *          is done inside the function and if you pass more bytes,
  *          the maximum available are read instead.
- * @return  The number of bytes actually read.
+ * @return  The number of bytes actually written, or -1 and
+ *          errno set on error.  ENOSPC means the producer has to
+ *          call rb_sync() before anything can be written (the
+ *          splice path is being left).
  */
 ssize_t
 rb_write(
@@ -61,4 +238,17 @@ rb_write(
         int fd,
         size_t n);
 
+/* Discard the data stored at the head of a ring buffer, from
+ * the consumer side.
+ *
+ * @param rb the ring buffer to be updated.
+ * @param n the number of bytes to discard.  If there are less
+ *          stored, all are discarded.
+ * @return  The number of bytes discarded.
+ */
+size_t
+rb_discard(
+        struct ring_buffer *rb,
+        size_t n);
+
 #endif /* _RB_H */
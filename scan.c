@@ -0,0 +1,143 @@
+/* scan.c -- search of a set of chars in a buffer.
+ * Author: Luis Colorado <luiscoloradourcola@gmail.com>
+ * Copyright: (C) 2015-2025 LUIS COLORADO.  All rights reserved.
+ * License: BSD.
+ */
+
+#include <string.h>
+
+#include "scan.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SCAN_X86            (1)     /* AVX2 if the processor has it */
+#include <immintrin.h>
+#else
+#define SCAN_X86            (0)
+#endif
+
+typedef size_t scan_fn(
+        const struct scan_set  *s,
+        const char             *p,
+        size_t                  n);
+
+void
+scan_init(
+        struct scan_set    *s)
+{
+    memset(s, 0, sizeof *s);
+} /* scan_init */
+
+void
+scan_add(
+        struct scan_set    *s,
+        unsigned char       c)
+{
+    if (s->tab[c] || s->n == SCAN_SET_MAX)
+        return;
+    s->c[s->n++] = c;
+    s->tab[c]    = 1;
+} /* scan_add */
+
+/* byte by byte, for what's left after the vectors, or if there
+ * are none */
+static size_t
+scan_tab(
+        const struct scan_set  *s,
+        const char             *p,
+        size_t                  n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++)
+        if (s->tab[(unsigned char) p[i]])
+            break;
+    return i;
+} /* scan_tab */
+
+#if defined(__SSE2__) /* {{ */
+static size_t
+scan_sse2(
+        const struct scan_set  *s,
+        const char             *p,
+        size_t                  n)
+{
+    __m128i c[SCAN_SET_MAX];
+    size_t  i = 0;
+
+    for (int k = 0; k < s->n; k++)
+        c[k] = _mm_set1_epi8((char) s->c[k]);
+    for (; i + 16 <= n; i += 16) {
+        __m128i b = _mm_loadu_si128((const __m128i *) (p + i));
+        __m128i m = _mm_cmpeq_epi8(b, c[0]);
+
+        for (int k = 1; k < s->n; k++)
+            m = _mm_or_si128(m, _mm_cmpeq_epi8(b, c[k]));
+        unsigned mask = _mm_movemask_epi8(m);
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    return i + scan_tab(s, p + i, n - i);
+} /* scan_sse2 */
+#endif /* __SSE2__ }} */
+
+#if SCAN_X86 /* {{ */
+__attribute__((target("avx2")))
+static size_t
+scan_avx2(
+        const struct scan_set  *s,
+        const char             *p,
+        size_t                  n)
+{
+    __m256i c[SCAN_SET_MAX];
+    size_t  i = 0;
+
+    for (int k = 0; k < s->n; k++)
+        c[k] = _mm256_set1_epi8((char) s->c[k]);
+    for (; i + 32 <= n; i += 32) {
+        __m256i b = _mm256_loadu_si256((const __m256i *) (p + i));
+        __m256i m = _mm256_cmpeq_epi8(b, c[0]);
+
+        for (int k = 1; k < s->n; k++)
+            m = _mm256_or_si256(m, _mm256_cmpeq_epi8(b, c[k]));
+        unsigned mask = _mm256_movemask_epi8(m);
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    return i + scan_tab(s, p + i, n - i);
+} /* scan_avx2 */
+#endif /* SCAN_X86 }} */
+
+/* the best we have on this processor */
+static scan_fn *
+scan_pick(void)
+{
+#if SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return scan_avx2;
+#endif
+#if defined(__SSE2__)
+    return scan_sse2;
+#else
+    return scan_tab;
+#endif
+} /* scan_pick */
+
+size_t
+scan(
+        const struct scan_set  *s,
+        const char             *p,
+        size_t                  n)
+{
+    static scan_fn *best;
+    scan_fn        *f = __atomic_load_n(&best, __ATOMIC_RELAXED);
+
+    if (s->n == 0)
+        return n;
+    if (!f) {
+        /* if two threads get here, both pick the same */
+        f = scan_pick();
+        __atomic_store_n(&best, f, __ATOMIC_RELAXED);
+    }
+    return f(s, p, n);
+} /* scan */
@@ -0,0 +1,57 @@
+/* scan.h -- search of a set of chars in a buffer.  Used to find
+ * the chars of the user input the line discipline acts upon
+ * (VSTART, VSTOP, VINTR...), which are seldom there, so most of
+ * the time the whole buffer is scanned without finding any.
+ * Author: Luis Colorado <luiscoloradourcola@gmail.com>
+ * Copyright: (C) 2015-2025 LUIS COLORADO.  All rights reserved.
+ * License: BSD.
+ *
+ * On x86 the buffer is compared 16 bytes at a time (SSE2), or 32
+ * (AVX2) if the processor has it, which is checked on the first
+ * search.  Elsewhere, the bytes are looked up in a table, one by
+ * one.
+ */
+#ifndef _SCAN_H
+#define _SCAN_H
+
+#include <stddef.h>
+
+#define SCAN_SET_MAX        (8)     /* chars in a set, at most */
+
+struct scan_set {
+    int             n;          /* chars in the set ... */
+    unsigned char   c[SCAN_SET_MAX];
+                                /* ... the chars ... */
+    unsigned char   tab[256];   /* ... and nonzero for them */
+};
+
+/* Initialize an empty set.
+ *
+ * @param s the set. */
+void
+scan_init(
+        struct scan_set    *s);
+
+/* Add a char to a set.  Chars already there, and those that
+ * don't fit, are ignored.
+ *
+ * @param s the set.
+ * @param c the char. */
+void
+scan_add(
+        struct scan_set    *s,
+        unsigned char       c);
+
+/* Find the first char of a set in a buffer.
+ *
+ * @param s the set.
+ * @param p the buffer.
+ * @param n its length.
+ * @return the offset of the char found, or n if none. */
+size_t
+scan(
+        const struct scan_set  *s,
+        const char             *p,
+        size_t                  n);
+
+#endif /* _SCAN_H */
@@ -0,0 +1,1628 @@
+/* screen.c -- model of the screen of a terminal.
+ * Author: Luis Colorado <luiscoloradourcola@gmail.com>
+ * Copyright: (C) 2015-2025 LUIS COLORADO.  All rights reserved.
+ * License: BSD.
+ */
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "screen.h"
+
+#define ESC                 '\033'
+#define CAN                 (0x18)
+#define SUB                 (0x1a)
+#define SO                  (0x0e)
+#define SI                  (0x0f)
+#define NPARAM              (16)        /* params of a sequence */
+#define REPLACEMENT         (0xbdbfef)  /* U+FFFD, in UTF-8 */
+
+/* states of the parser */
+#define S_TEXT              (0)
+#define S_ESC               (1)     /* ESC */
+#define S_ESC_INT           (2)     /* ESC and intermediates */
+#define S_CSI               (3)     /* ESC [ and params */
+#define S_IGNORE            (4)     /* too long, up to its end */
+#define S_STR               (5)     /* OSC, DCS... */
+#define S_STR_ESC           (6)     /* ESC in a string */
+
+#define MIN(_a, _b) ((_a)<(_b) ? (_a) : (_b))
+#define MAX(_a, _b) ((_a)>(_b) ? (_a) : (_b))
+
+static const struct scr_cell scr_empty = { ' ', { 0, SCR_DEFAULT, SCR_DEFAULT } };
+
+static struct scr_cell *
+scr_cell(
+        const struct screen    *s,
+        int                     r,
+        int                     c)
+{
+    return s->g[s->alt] + (size_t) r * s->cols + c;
+} /* scr_cell */
+
+/* erase cells, to the background of the cursor, as xterm does */
+static void
+scr_blank(
+        struct screen      *s,
+        struct scr_cell    *p,
+        size_t              n)
+{
+    struct scr_cell b = scr_empty;
+
+    b.a.bg = s->cur.a.bg;
+    while (n--)
+        *p++ = b;
+} /* scr_blank */
+
+static void
+scr_clear(
+        struct screen  *s,
+        int             which)
+{
+    struct scr_cell *p = s->g[which];
+
+    for (size_t n = (size_t) s->rows * s->cols; n--; )
+        *p++ = scr_empty;
+    s->stale[which] = 0;
+} /* scr_clear */
+
+static void
+scr_home(
+        struct scr_cursor  *c)
+{
+    memset(c, 0, sizeof *c);
+    c->g[0] = c->g[1] = 'B';
+} /* scr_home */
+
+int
+scr_init(
+        struct screen  *s,
+        int             rows,
+        int             cols)
+{
+    memset(s, 0, sizeof *s);
+    scr_home(&s->cur);
+    s->saved = s->saved_alt = s->cur;
+    s->awm   = 1;
+    return scr_resize(s, rows, cols);
+} /* scr_init */
+
+void
+scr_destroy(
+        struct screen  *s)
+{
+    free(s->g[0]);
+    free(s->g[1]);
+    s->g[0] = s->g[1] = NULL;
+} /* scr_destroy */
+
+static void
+scr_clamp(
+        const struct screen    *s,
+        struct scr_cursor      *c)
+{
+    c->row = MIN(c->row, s->rows - 1);
+    c->col = MIN(c->col, s->cols - 1);
+} /* scr_clamp */
+
+int
+scr_resize(
+        struct screen  *s,
+        int             rows,
+        int             cols)
+{
+    struct scr_cell *g[2];
+    size_t           n = (size_t) rows * cols;
+
+    if (rows <= 0 || cols <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (int i = 0; i < 2; i++) {
+        if (!(g[i] = malloc(n * sizeof *g[i]))) {
+            if (i > 0)
+                free(g[0]);
+            errno = ENOMEM;
+            return -1;
+        }
+        for (size_t j = 0; j < n; j++)
+            g[i][j] = scr_empty;
+        if (!s->g[i])
+            continue;
+        /* the cells that fit */
+        for (int r = 0; r < MIN(rows, s->rows); r++)
+            memcpy(g[i] + (size_t) r * cols,
+                   s->g[i] + (size_t) r * s->cols,
+                   MIN(cols, s->cols) * sizeof *g[i]);
+    }
+    free(s->g[0]);
+    free(s->g[1]);
+    s->g[0]     = g[0];
+    s->g[1]     = g[1];
+    s->rows     = rows;
+    s->cols     = cols;
+    s->top      = 0;
+    s->bot      = rows - 1;
+    s->stale[0] = s->stale[1] = 1;
+    s->cur.wrap = 0;
+    scr_clamp(s, &s->cur);
+    scr_clamp(s, &s->saved);
+    scr_clamp(s, &s->saved_alt);
+    return 0;
+} /* scr_resize */
+
+int
+scr_copy(
+        struct screen          *dst,
+        const struct screen    *src)
+{
+    if (       (dst->rows != src->rows || dst->cols != src->cols)
+            && scr_resize(dst, src->rows, src->cols) < 0)
+        return -1;
+
+    struct scr_cell *g0 = dst->g[0],
+                    *g1 = dst->g[1];
+    size_t           n  = (size_t) src->rows * src->cols * sizeof *g0;
+
+    *dst      = *src;
+    dst->g[0] = g0;
+    dst->g[1] = g1;
+    memcpy(g0, src->g[0], n);
+    memcpy(g1, src->g[1], n);
+    return 0;
+} /* scr_copy */
+
+/* keep a sequence to pass, if it fits */
+static void
+scr_pass(
+        struct screen  *s,
+        const char     *p,
+        size_t          n)
+{
+    if (s->pass_len + n > SCR_PASS_MAX)
+        return;
+    memcpy(s->pass + s->pass_len, p, n);
+    s->pass_len += n;
+} /* scr_pass */
+
+/* keep a char of a string, the string is dropped if it's too long */
+static void
+scr_pass_str(
+        struct screen  *s,
+        int             c)
+{
+    if (s->pass_skip)
+        return;
+    if (s->pass_len == SCR_PASS_MAX) {
+        s->pass_len  = s->pass_mark;
+        s->pass_skip = 1;
+        return;
+    }
+    s->pass[s->pass_len++] = c;
+} /* scr_pass_str */
+
+void
+scr_passed(
+        struct screen  *s)
+{
+    s->pass_len = s->pass_mark = 0;
+    if (s->st == S_STR || s->st == S_STR_ESC)
+        s->pass_skip = 1; /* its beginning is gone */
+} /* scr_passed */
+
+int
+scr_ground(
+        const struct screen    *s)
+{
+    return s->st == S_TEXT && s->u8_len == 0;
+} /* scr_ground */
+
+/* SCROLLING */
+
+static void
+scr_scroll_up(
+        struct screen  *s,
+        int             top,
+        int             bot,
+        int             n)
+{
+    int h = bot - top + 1;
+
+    n = MIN(n, h);
+    if (n <= 0)
+        return;
+    struct scr_cell *p = scr_cell(s, top, 0);
+    memmove(p, p + (size_t) n * s->cols,
+        (size_t) (h - n) * s->cols * sizeof *p);
+    scr_blank(s, scr_cell(s, bot - n + 1, 0), (size_t) n * s->cols);
+} /* scr_scroll_up */
+
+static void
+scr_scroll_down(
+        struct screen  *s,
+        int             top,
+        int             bot,
+        int             n)
+{
+    int h = bot - top + 1;
+
+    n = MIN(n, h);
+    if (n <= 0)
+        return;
+    struct scr_cell *p = scr_cell(s, top, 0);
+    memmove(p + (size_t) n * s->cols, p,
+        (size_t) (h - n) * s->cols * sizeof *p);
+    scr_blank(s, p, (size_t) n * s->cols);
+} /* scr_scroll_down */
+
+/* line feed, the region scrolls at its bottom */
+static void
+scr_lf(
+        struct screen  *s)
+{
+    if (s->cur.row == s->bot)
+        scr_scroll_up(s, s->top, s->bot, 1);
+    else if (s->cur.row < s->rows - 1)
+        s->cur.row++;
+    s->cur.wrap = 0;
+} /* scr_lf */
+
+/* reverse index */
+static void
+scr_ri(
+        struct screen  *s)
+{
+    if (s->cur.row == s->top)
+        scr_scroll_down(s, s->top, s->bot, 1);
+    else if (s->cur.row > 0)
+        s->cur.row--;
+    s->cur.wrap = 0;
+} /* scr_ri */
+
+/* CURSOR */
+
+/* position the cursor, in the region if in origin mode */
+static void
+scr_goto(
+        struct screen  *s,
+        int             r,
+        int             c)
+{
+    int top = 0, bot = s->rows - 1;
+
+    if (s->cur.origin) {
+        r  += s->top;
+        top = s->top;
+        bot = s->bot;
+    }
+    s->cur.row  = MAX(top, MIN(r, bot));
+    s->cur.col  = MAX(0, MIN(c, s->cols - 1));
+    s->cur.wrap = 0;
+} /* scr_goto */
+
+/* move the cursor up or down, not out of the region if in it */
+static void
+scr_vmove(
+        struct screen  *s,
+        int             n)
+{
+    int r = s->cur.row + n;
+
+    if (n < 0)
+        r = MAX(r, s->cur.row >= s->top ? s->top : 0);
+    else
+        r = MIN(r, s->cur.row <= s->bot ? s->bot : s->rows - 1);
+    s->cur.row  = r;
+    s->cur.wrap = 0;
+} /* scr_vmove */
+
+/* the wrap pending is not saved */
+static void
+scr_save(
+        const struct screen    *s,
+        struct scr_cursor      *c)
+{
+    *c      = s->cur;
+    c->wrap = 0;
+} /* scr_save */
+
+static void
+scr_restore(
+        struct screen              *s,
+        const struct scr_cursor    *c)
+{
+    s->cur      = *c;
+    s->cur.wrap = 0;
+    scr_clamp(s, &s->cur);
+    if (s->cur.origin)
+        s->cur.row = MAX(s->top, MIN(s->cur.row, s->bot));
+} /* scr_restore */
+
+/* TEXT */
+
+/* the width of a unicode char: 0 for the combining ones, 2 for
+ * the East Asian wide ones. */
+static int
+scr_width(
+        uint32_t    cp)
+{
+    static const uint32_t zero[][2] = {
+        { 0x0300, 0x036f }, { 0x0483, 0x0489 }, { 0x0591, 0x05bd },
+        { 0x0610, 0x061a }, { 0x064b, 0x065f }, { 0x1ab0, 0x1aff },
+        { 0x1dc0, 0x1dff }, { 0x200b, 0x200f }, { 0x20d0, 0x20ff },
+        { 0xfe00, 0xfe0f }, { 0xfe20, 0xfe2f }, { 0xe0100, 0xe01ef },
+    };
+    static const uint32_t wide[][2] = {
+        { 0x1100, 0x115f }, { 0x2e80, 0x303e }, { 0x3041, 0x33ff },
+        { 0x3400, 0x4dbf }, { 0x4e00, 0x9fff }, { 0xa000, 0xa4cf },
+        { 0xac00, 0xd7a3 }, { 0xf900, 0xfaff }, { 0xfe30, 0xfe4f },
+        { 0xff00, 0xff60 }, { 0xffe0, 0xffe6 }, { 0x1f300, 0x1f64f },
+        { 0x1f900, 0x1f9ff }, { 0x20000, 0x2fffd }, { 0x30000, 0x3fffd },
+    };
+
+    for (size_t i = 0; i < sizeof zero / sizeof zero[0]; i++)
+        if (cp >= zero[i][0] && cp <= zero[i][1])
+            return 0;
+    for (size_t i = 0; i < sizeof wide / sizeof wide[0]; i++)
+        if (cp >= wide[i][0] && cp <= wide[i][1])
+            return 2;
+    return 1;
+} /* scr_width */
+
+/* erase the wide char cut at column c (its right half is there),
+ * as a wide char is not split. */
+static void
+scr_unwide(
+        struct screen  *s,
+        int             r,
+        int             c)
+{
+    if (c <= 0 || c >= s->cols)
+        return;
+
+    struct scr_cell *p = scr_cell(s, r, c);
+    if (p->ch == SCR_WIDE)
+        scr_blank(s, p - 1, 2);
+} /* scr_unwide */
+
+/* insert n blank cells at the cursor */
+static void
+scr_insert(
+        struct screen  *s,
+        int             n)
+{
+    struct scr_cell *p = scr_cell(s, s->cur.row, s->cur.col);
+
+    n = MIN(n, s->cols - s->cur.col);
+    scr_unwide(s, s->cur.row, s->cur.col);
+    scr_unwide(s, s->cur.row, s->cols - n);
+    memmove(p + n, p, (s->cols - s->cur.col - n) * sizeof *p);
+    scr_blank(s, p, n);
+    s->cur.wrap = 0;
+} /* scr_insert */
+
+/* delete n cells at the cursor */
+static void
+scr_delete(
+        struct screen  *s,
+        int             n)
+{
+    struct scr_cell *p = scr_cell(s, s->cur.row, s->cur.col);
+
+    n = MIN(n, s->cols - s->cur.col);
+    scr_unwide(s, s->cur.row, s->cur.col);
+    scr_unwide(s, s->cur.row, s->cur.col + n);
+    memmove(p, p + n, (s->cols - s->cur.col - n) * sizeof *p);
+    scr_blank(s, p + s->cols - s->cur.col - n, n);
+    s->cur.wrap = 0;
+} /* scr_delete */
+
+/* write a char at the cursor */
+static void
+scr_put(
+        struct screen  *s,
+        uint32_t        ch,
+        int             w)
+{
+    struct scr_cursor *c = &s->cur;
+
+    if (w == 0)
+        return; /* combining, not kept */
+    s->rep   = ch;
+    s->rep_w = w;
+    if (c->wrap) {
+        c->col = 0;
+        scr_lf(s);
+    }
+    if (w == 2 && c->col == s->cols - 1) {
+        if (!s->awm)
+            return;
+        c->col = 0; /* it doesn't fit */
+        scr_lf(s);
+    }
+    if (s->irm)
+        scr_insert(s, w);
+    scr_unwide(s, c->row, c->col);
+    scr_unwide(s, c->row, c->col + w);
+
+    struct scr_cell *p = scr_cell(s, c->row, c->col);
+    p->ch = ch;
+    p->a  = c->a;
+    if (c->g[c->shift] == '0' && ch < 0x80)
+        p->a.flags |= SCR_ACS;
+    if (w == 2) {
+        p[1].ch = SCR_WIDE;
+        p[1].a  = p->a;
+    }
+    c->col += w;
+    if (c->col >= s->cols) {
+        c->col  = s->cols - 1;
+        c->wrap = s->awm;
+    }
+} /* scr_put */
+
+/* the C0 controls */
+static void
+scr_control(
+        struct screen  *s,
+        int             ch)
+{
+    struct scr_cursor *c = &s->cur;
+
+    switch (ch) {
+    case '\a':
+        scr_pass(s, "\a", 1);
+        break;
+    case '\b':
+        if (c->col > 0)
+            c->col--;
+        c->wrap = 0;
+        break;
+    case '\t':
+        c->col  = MIN((c->col / 8 + 1) * 8, s->cols - 1);
+        c->wrap = 0;
+        break;
+    case '\n': case '\v': case '\f':
+        if (s->onlcr)
+            c->col = 0;
+        scr_lf(s);
+        break;
+    case '\r':
+        c->col  = 0;
+        c->wrap = 0;
+        break;
+    case SO:
+        c->shift = 1;
+        break;
+    case SI:
+        c->shift = 0;
+        break;
+    }
+} /* scr_control */
+
+/* SEQUENCES */
+
+/* the next param of a sequence, with its subparams (separated
+ * by colons).
+ * @return the number of values in v. */
+static int
+scr_param(
+        const char    **pp,
+        const char     *end,
+        int            *v,
+        int             max)
+{
+    const char *p = *pp;
+    int         n = 0;
+
+    v[0] = 0;
+    for (; p < end && *p != ';'; p++) {
+        if (*p == ':') {
+            if (n + 1 < max)
+                v[++n] = 0;
+        } else if (*p >= '0' && *p <= '9' && v[n] < 100000) {
+            v[n] = v[n] * 10 + *p - '0';
+        }
+    }
+    *pp = p + 1;
+    return n + 1;
+} /* scr_param */
+
+static void
+scr_sgr(
+        struct screen  *s,
+        const char     *p,
+        const char     *end)
+{
+    struct scr_attr *a = &s->cur.a;
+    static const uint32_t bits[10] = {
+        0, SCR_BOLD, SCR_DIM, SCR_ITALIC, SCR_UNDERLINE,
+        SCR_BLINK, SCR_BLINK, SCR_REVERSE, SCR_HIDDEN, SCR_STRIKE,
+    };
+
+    if (p == end) {
+        memset(a, 0, sizeof *a);
+        return;
+    }
+    while (p <= end) {
+        int v[8], n = scr_param(&p, end, v, 8), code = v[0];
+
+        if (code == 38 || code == 48 || code == 58) {
+            uint32_t color = SCR_DEFAULT;
+            int      w[8];
+
+            if (n > 1) { /* 38:5:n or 38:2:[cs:]r:g:b */
+                if (v[1] == 5 && n >= 3)
+                    color = (v[2] & 0xff) + 1;
+                else if (v[1] == 2 && n >= 5)
+                    color = SCR_RGB | (v[n-3] & 0xff) << 16
+                          | (v[n-2] & 0xff) << 8 | (v[n-1] & 0xff);
+            } else if (p <= end) { /* 38;5;n or 38;2;r;g;b */
+                scr_param(&p, end, w, 8);
+                if (w[0] == 5 && p <= end) {
+                    scr_param(&p, end, w, 8);
+                    color = (w[0] & 0xff) + 1;
+                } else if (w[0] == 2) {
+                    int rgb[3] = { 0, 0, 0 };
+                    for (int i = 0; i < 3 && p <= end; i++) {
+                        scr_param(&p, end, w, 8);
+                        rgb[i] = w[0] & 0xff;
+                    }
+                    color = SCR_RGB | rgb[0] << 16 | rgb[1] << 8 | rgb[2];
+                }
+            }
+            if (code == 38)
+                a->fg = color;
+            else if (code == 48)
+                a->bg = color;
+            continue;
+        }
+        if (code == 0)
+            memset(a, 0, sizeof *a);
+        else if (code < 10)
+            a->flags |= bits[code];
+        else if (code == 21)
+            a->flags |= SCR_UNDERLINE;
+        else if (code == 22)
+            a->flags &= ~(SCR_BOLD | SCR_DIM);
+        else if (code >= 23 && code <= 29 && code != 26)
+            a->flags &= ~bits[code - 20];
+        else if (code >= 30 && code <= 37)
+            a->fg = code - 30 + 1;
+        else if (code == 39)
+            a->fg = SCR_DEFAULT;
+        else if (code >= 40 && code <= 47)
+            a->bg = code - 40 + 1;
+        else if (code == 49)
+            a->bg = SCR_DEFAULT;
+        else if (code >= 90 && code <= 97)
+            a->fg = code - 90 + 8 + 1;
+        else if (code >= 100 && code <= 107)
+            a->bg = code - 100 + 8 + 1;
+    }
+} /* scr_sgr */
+
+/* set or reset modes, the ones not modeled are kept to pass */
+static void
+scr_modes(
+        struct screen  *s,
+        int             priv,
+        const int      *v,
+        int             nv,
+        int             set)
+{
+    char buf[SCR_SEQ_MAX + 16];
+    int  n = sprintf(buf, "\033[%s", priv ? "?" : ""),
+         passed = 0;
+
+    for (int i = 0; i < nv; i++) {
+        switch (priv ? v[i] : -v[i]) {
+        case -4:    /* IRM */
+            s->irm = set;
+            continue;
+        case 6:     /* DECOM */
+            s->cur.origin = set;
+            scr_goto(s, 0, 0);
+            continue;
+        case 7:     /* DECAWM */
+            s->awm = set;
+            if (!set)
+                s->cur.wrap = 0;
+            continue;
+        case 25:    /* DECTCEM */
+            s->hide = !set;
+            continue;
+        case 47:
+            s->alt = set;
+            continue;
+        case 1047:
+            if (!set && s->alt)
+                scr_clear(s, 1);
+            s->alt = set;
+            continue;
+        case 1048:
+            if (set)
+                scr_save(s, &s->saved);
+            else
+                scr_restore(s, &s->saved);
+            continue;
+        case 1049:
+            if (set && !s->alt) {
+                scr_save(s, &s->saved_alt);
+                s->alt       = 1;
+                scr_clear(s, 1);
+            } else if (!set && s->alt) {
+                s->alt = 0;
+                scr_restore(s, &s->saved_alt);
+            }
+            continue;
+        }
+        if (n < SCR_SEQ_MAX)
+            n += sprintf(buf + n, "%s%d", passed++ ? ";" : "", v[i]);
+    }
+    if (passed) {
+        buf[n++] = set ? 'h' : 'l';
+        scr_pass(s, buf, n);
+    }
+} /* scr_modes */
+
+/* a complete CSI sequence, in s->seq */
+static void
+scr_csi(
+        struct screen  *s)
+{
+    struct scr_cursor *c   = &s->cur;
+    const char        *p   = s->seq + 2,
+                      *end = s->seq + s->seq_len - 1;
+    int                final = *end,
+                       priv  = 0,
+                       inter = 0,
+                       v[NPARAM],
+                       nv    = 0;
+
+    if (p < end && strchr("<=>?", *p))
+        priv = *p++;
+    for (const char *q = p; q < end; q++) {
+        if (*q >= 0x20 && *q <= 0x2f)
+            inter = *q;
+    }
+    for (const char *q = p; q <= end && nv < NPARAM && p < end; ) {
+        int w[4];
+        scr_param(&q, end, w, 4);
+        v[nv++] = w[0];
+    }
+#define P(_i, _d) ((_i) < nv && v[_i] ? v[_i] : (_d))
+
+    if (inter) {
+        if (inter == '!' && final == 'p') { /* DECSTR */
+            memset(&c->a, 0, sizeof c->a);
+            c->g[0] = c->g[1] = 'B';
+            c->shift  = 0;
+            c->origin = 0;
+            s->top    = 0;
+            s->bot    = s->rows - 1;
+            s->awm    = 1;
+            s->irm    = 0;
+            s->hide   = 0;
+            scr_home(&s->saved);
+        } else {
+            scr_pass(s, s->seq, s->seq_len);
+        }
+        return;
+    }
+    if (priv) {
+        if (priv == '?' && (final == 'h' || final == 'l'))
+            scr_modes(s, 1, v, nv, final == 'h');
+        else
+            scr_pass(s, s->seq, s->seq_len);
+        return;
+    }
+
+    int n = P(0, 1);
+    switch (final) {
+    case 'A':
+        scr_vmove(s, -n);
+        break;
+    case 'B': case 'e':
+        scr_vmove(s, n);
+        break;
+    case 'C': case 'a':
+        c->col  = MIN(c->col + n, s->cols - 1);
+        c->wrap = 0;
+        break;
+    case 'D':
+        c->col  = MAX(c->col - n, 0);
+        c->wrap = 0;
+        break;
+    case 'E':
+        scr_vmove(s, n);
+        c->col = 0;
+        break;
+    case 'F':
+        scr_vmove(s, -n);
+        c->col = 0;
+        break;
+    case 'G': case '`':
+        c->col  = MIN(n - 1, s->cols - 1);
+        c->wrap = 0;
+        break;
+    case 'd':
+        scr_goto(s, n - 1, c->col);
+        break;
+    case 'H': case 'f':
+        scr_goto(s, n - 1, P(1, 1) - 1);
+        break;
+    case 'J':
+        scr_unwide(s, c->row, c->col);
+        scr_unwide(s, c->row, c->col + 1);
+        switch (nv ? v[0] : 0) {
+        case 0:
+            scr_blank(s, scr_cell(s, c->row, c->col),
+                (size_t) (s->rows - c->row) * s->cols - c->col);
+            break;
+        case 1:
+            scr_blank(s, scr_cell(s, 0, 0),
+                (size_t) c->row * s->cols + c->col + 1);
+            break;
+        case 2:
+            scr_blank(s, scr_cell(s, 0, 0), (size_t) s->rows * s->cols);
+            s->stale[s->alt] = 0;
+            break;
+        }
+        break;
+    case 'K':
+        scr_unwide(s, c->row, c->col);
+        scr_unwide(s, c->row, c->col + 1);
+        switch (nv ? v[0] : 0) {
+        case 0:
+            scr_blank(s, scr_cell(s, c->row, c->col), s->cols - c->col);
+            break;
+        case 1:
+            scr_blank(s, scr_cell(s, c->row, 0), c->col + 1);
+            break;
+        case 2:
+            scr_blank(s, scr_cell(s, c->row, 0), s->cols);
+            break;
+        }
+        break;
+    case 'L':
+        if (c->row >= s->top && c->row <= s->bot)
+            scr_scroll_down(s, c->row, s->bot, n);
+        c->col  = 0;
+        c->wrap = 0;
+        break;
+    case 'M':
+        if (c->row >= s->top && c->row <= s->bot)
+            scr_scroll_up(s, c->row, s->bot, n);
+        c->col  = 0;
+        c->wrap = 0;
+        break;
+    case '@':
+        scr_insert(s, n);
+        break;
+    case 'P':
+        scr_delete(s, n);
+        break;
+    case 'X':
+        n = MIN(n, s->cols - c->col);
+        scr_unwide(s, c->row, c->col);
+        scr_unwide(s, c->row, c->col + n);
+        scr_blank(s, scr_cell(s, c->row, c->col), n);
+        break;
+    case 'S':
+        scr_scroll_up(s, s->top, s->bot, n);
+        break;
+    case 'T':
+        if (nv > 1) /* mouse tracking */
+            scr_pass(s, s->seq, s->seq_len);
+        else
+            scr_scroll_down(s, s->top, s->bot, n);
+        break;
+    case 'b': /* REP */
+        for (n = MIN(n, s->rows * s->cols); n-- > 0 && s->rep; )
+            scr_put(s, s->rep, s->rep_w);
+        break;
+    case 'm':
+        scr_sgr(s, p, end);
+        break;
+    case 'r': {
+            int t = P(0, 1) - 1,
+                b = MIN(P(1, s->rows), s->rows) - 1;
+            if (t < b) {
+                s->top = t;
+                s->bot = b;
+                scr_goto(s, 0, 0);
+            }
+        } break;
+    case 's':
+        if (nv == 0)
+            scr_save(s, &s->saved);
+        else
+            scr_pass(s, s->seq, s->seq_len);
+        break;
+    case 'u':
+        scr_restore(s, &s->saved);
+        break;
+    case 'h': case 'l':
+        scr_modes(s, 0, v, nv, final == 'h');
+        break;
+    default: /* reports, window ops... */
+        scr_pass(s, s->seq, s->seq_len);
+        break;
+    }
+#undef P
+} /* scr_csi */
+
+/* ESC and a final char, or a charset designation */
+static void
+scr_esc(
+        struct screen  *s)
+{
+    struct scr_cursor *c = &s->cur;
+    int                f = s->seq[s->seq_len - 1];
+
+    if (s->seq_len > 3) { /* more intermediates, not modeled */
+        scr_pass(s, s->seq, s->seq_len);
+        return;
+    }
+    if (s->seq_len == 3) { /* with an intermediate */
+        switch (s->seq[1]) {
+        case '(':
+            c->g[0] = f;
+            return;
+        case ')':
+            c->g[1] = f;
+            return;
+        case '*': case '+':
+            return;
+        case '#':
+            if (f == '8') { /* DECALN */
+                struct scr_cell *p = scr_cell(s, 0, 0);
+                for (size_t n = (size_t) s->rows * s->cols; n--; p++) {
+                    *p    = scr_empty;
+                    p->ch = 'E';
+                }
+                s->top = 0;
+                s->bot = s->rows - 1;
+                scr_goto(s, 0, 0);
+                return;
+            }
+            break;
+        }
+        scr_pass(s, s->seq, s->seq_len);
+        return;
+    }
+    switch (f) {
+    case '7':
+        scr_save(s, &s->saved);
+        break;
+    case '8':
+        scr_restore(s, &s->saved);
+        break;
+    case 'c': /* RIS */
+        scr_clear(s, 0);
+        scr_clear(s, 1);
+        scr_home(&s->cur);
+        s->saved = s->saved_alt = s->cur;
+        s->alt  = 0;
+        s->top  = 0;
+        s->bot  = s->rows - 1;
+        s->awm  = 1;
+        s->irm  = 0;
+        s->hide = 0;
+        break;
+    case 'D':
+        scr_lf(s);
+        break;
+    case 'E':
+        c->col = 0;
+        scr_lf(s);
+        break;
+    case 'M':
+        scr_ri(s);
+        break;
+    case '\\':
+        break; /* a lone ST */
+    default: /* keypad modes... */
+        scr_pass(s, s->seq, s->seq_len);
+        break;
+    }
+} /* scr_esc */
+
+/* a byte of UTF-8 text */
+static void
+scr_utf8(
+        struct screen  *s,
+        int             ch)
+{
+    if (s->u8_len > 0 && (ch & 0xc0) == 0x80) {
+        s->u8[s->u8_len++] = ch;
+        if (s->u8_len < s->u8_need)
+            return;
+
+        /* complete */
+        uint32_t packed = 0, cp = s->u8[0] & (0x7f >> s->u8_need);
+        for (int i = 0; i < s->u8_len; i++) {
+            packed |= (uint32_t) (unsigned char) s->u8[i] << (8 * i);
+            if (i > 0)
+                cp = cp << 6 | (s->u8[i] & 0x3f);
+        }
+        s->u8_len = 0;
+        scr_put(s, packed, scr_width(cp));
+        return;
+    }
+    if (s->u8_len > 0) { /* incomplete */
+        s->u8_len = 0;
+        scr_put(s, REPLACEMENT, 1);
+    }
+    if (ch >= 0xc2 && ch <= 0xf4) {
+        s->u8[0]   = ch;
+        s->u8_len  = 1;
+        s->u8_need = ch >= 0xf0 ? 4 : ch >= 0xe0 ? 3 : 2;
+    } else if (ch >= 0x80) {
+        scr_put(s, REPLACEMENT, 1);
+    }
+} /* scr_utf8 */
+
+static void
+scr_byte(
+        struct screen  *s,
+        int             ch)
+{
+    if (s->u8_len > 0 && ch < 0x80) { /* the char is not complete */
+        s->u8_len = 0;
+        scr_put(s, REPLACEMENT, 1);
+    }
+
+    switch (s->st) {
+    case S_TEXT:
+        if (ch == ESC) {
+            s->seq[0]  = ch;
+            s->seq_len = 1;
+            s->st      = S_ESC;
+        } else if (ch >= 0x80) {
+            scr_utf8(s, ch);
+        } else if (ch >= 0x20 && ch < 0x7f) {
+            scr_put(s, ch, 1);
+        } else {
+            scr_control(s, ch);
+        }
+        return;
+
+    case S_ESC:
+    case S_ESC_INT:
+    case S_CSI:
+        if (ch == ESC) {
+            s->seq_len = 1; /* another one */
+            s->st      = S_ESC;
+            return;
+        }
+        if (ch == CAN || ch == SUB) {
+            s->st = S_TEXT;
+            return;
+        }
+        if (ch < 0x20) {
+            scr_control(s, ch); /* in the middle of it */
+            return;
+        }
+        if (s->seq_len >= SCR_SEQ_MAX - 1) {
+            s->st = S_IGNORE;
+            if (ch >= 0x40 && ch <= 0x7e)
+                s->st = S_TEXT;
+            return;
+        }
+        s->seq[s->seq_len++] = ch;
+        if (s->st == S_ESC && ch == '[') {
+            s->st = S_CSI;
+        } else if (s->st == S_ESC && strchr("]P_^X", ch)) {
+            s->pass_mark = s->pass_len;
+            s->pass_skip = 0;
+            scr_pass_str(s, ESC);
+            scr_pass_str(s, ch);
+            s->st = S_STR;
+        } else if (s->st != S_CSI && ch >= 0x20 && ch <= 0x2f) {
+            s->st = S_ESC_INT;
+        } else if (s->st == S_CSI && ch >= 0x40 && ch <= 0x7e) {
+            s->st = S_TEXT;
+            scr_csi(s);
+        } else if (s->st != S_CSI && ch >= 0x30 && ch <= 0x7e) {
+            s->st = S_TEXT;
+            scr_esc(s);
+        }
+        return;
+
+    case S_IGNORE:
+        if (ch >= 0x40 && ch <= 0x7e)
+            s->st = S_TEXT;
+        return;
+
+    case S_STR:
+        if (ch == ESC) {
+            s->st = S_STR_ESC;
+        } else if (ch == CAN || ch == SUB) {
+            if (!s->pass_skip)
+                s->pass_len = s->pass_mark;
+            s->st = S_TEXT;
+        } else {
+            scr_pass_str(s, ch);
+            if (ch == '\a')
+                s->st = S_TEXT;
+        }
+        return;
+
+    case S_STR_ESC:
+        scr_pass_str(s, ESC);
+        scr_pass_str(s, '\\');
+        s->st = S_TEXT;
+        if (ch != '\\') { /* ESC begins another sequence */
+            s->seq[0]  = ESC;
+            s->seq_len = 1;
+            s->st      = S_ESC;
+            scr_byte(s, ch);
+        }
+        return;
+    }
+} /* scr_byte */
+
+void
+scr_feed(
+        struct screen          *s,
+        const struct iovec     *iov,
+        int                     niov)
+{
+    for (int i = 0; i < niov; i++) {
+        const unsigned char *p = iov[i].iov_base;
+
+        for (size_t j = 0; j < iov[i].iov_len; j++)
+            scr_byte(s, p[j]);
+    }
+} /* scr_feed */
+
+/* DIFF */
+
+/* the terminal, as the diff is written */
+struct scr_out {
+    struct scr_buf *b;
+    int             err;
+    int             row, col;   /* the cursor, -1 if not known */
+    struct scr_attr a;          /* the attributes, ... */
+    int             a_known;    /* ... if known */
+    int             acs;        /* G0 is the special graphics, -1 if
+                                 * not known */
+    char            g1;         /* G1, 0 if not known */
+    uint32_t        rep;        /* last char written (for REP) ... */
+    int             rep_w;      /* ... and its width */
+};
+
+static void
+out_put(
+        struct scr_out *o,
+        const char     *p,
+        size_t          n)
+{
+    struct scr_buf *b = o->b;
+
+    if (o->err)
+        return;
+    if (b->len + n > b->cap) {
+        size_t cap = b->cap ? b->cap : 4096;
+        while (cap < b->len + n)
+            cap *= 2;
+        char *q = realloc(b->p, cap);
+        if (!q) {
+            o->err = 1;
+            return;
+        }
+        b->p   = q;
+        b->cap = cap;
+    }
+    memcpy(b->p + b->len, p, n);
+    b->len += n;
+} /* out_put */
+
+static void
+out_printf(
+        struct scr_out *o,
+        const char     *fmt,
+        ...)
+{
+    char    buf[SCR_SEQ_MAX];
+    va_list args;
+
+    va_start(args, fmt);
+    int n = vsnprintf(buf, sizeof buf, fmt, args);
+    va_end(args);
+    out_put(o, buf, MIN(n, (int) sizeof buf - 1));
+} /* out_printf */
+
+/* the bytes of a char */
+static int
+out_ch_len(
+        uint32_t    ch)
+{
+    int n = 1;
+
+    while (n < 4 && (ch >> (8 * n)) != 0)
+        n++;
+    return n;
+} /* out_ch_len */
+
+/* write a char, of width w */
+static void
+out_ch(
+        struct scr_out *o,
+        uint32_t        ch,
+        int             w)
+{
+    char buf[4];
+    int  n = out_ch_len(ch);
+
+    for (int i = 0; i < n; i++)
+        buf[i] = ch >> (8 * i);
+    out_put(o, buf, n);
+    o->rep   = ch;
+    o->rep_w = w;
+} /* out_ch */
+
+/* the terminal writes a char with attributes a as they are */
+static int
+out_same(
+        const struct scr_out   *o,
+        const struct scr_attr  *a)
+{
+    return o->a_known
+        && (a->flags & ~SCR_ACS) == (o->a.flags & ~SCR_ACS)
+        && a->fg == o->a.fg
+        && a->bg == o->a.bg
+        && !!(a->flags & SCR_ACS) == o->acs;
+} /* out_same */
+
+static int
+out_color(
+        char       *p,
+        uint32_t    c,
+        int         base)
+{
+    if (c == SCR_DEFAULT)
+        return 0;
+    if (c & SCR_RGB)
+        return sprintf(p, ";%d;2;%u;%u;%u", base + 8,
+            c >> 16 & 0xff, c >> 8 & 0xff, c & 0xff);
+    c--;
+    if (c < 8)
+        return sprintf(p, ";%u", base + c);
+    if (c < 16)
+        return sprintf(p, ";%u", base + 60 + c - 8);
+    return sprintf(p, ";%d;5;%u", base + 8, c);
+} /* out_color */
+
+static void
+out_attr(
+        struct scr_out         *o,
+        const struct scr_attr  *a)
+{
+    static const char codes[] = "123457890";
+    static const uint32_t bits[] = {
+        SCR_BOLD, SCR_DIM, SCR_ITALIC, SCR_UNDERLINE, SCR_BLINK,
+        SCR_REVERSE, SCR_HIDDEN, SCR_STRIKE,
+    };
+    int acs = !!(a->flags & SCR_ACS);
+
+    if (       !o->a_known
+            || (a->flags & ~SCR_ACS) != (o->a.flags & ~SCR_ACS)
+            || a->fg != o->a.fg || a->bg != o->a.bg)
+    {
+        char buf[SCR_SEQ_MAX];
+        int  n = sprintf(buf, "\033[0");
+
+        for (size_t i = 0; i < sizeof bits / sizeof bits[0]; i++)
+            if (a->flags & bits[i])
+                n += sprintf(buf + n, ";%c", codes[i]);
+        n += out_color(buf + n, a->fg, 30);
+        n += out_color(buf + n, a->bg, 40);
+        buf[n++] = 'm';
+        out_put(o, buf, n);
+        o->a       = *a;
+        o->a_known = 1;
+    }
+    if (acs != o->acs) {
+        out_put(o, acs ? "\033(0" : "\033(B", 3);
+        o->acs = acs;
+    }
+} /* out_attr */
+
+/* position the cursor, absolute */
+static void
+out_cup(
+        struct scr_out *o,
+        int             r,
+        int             c)
+{
+    if (r == 0 && c == 0)
+        out_printf(o, "\033[H");
+    else if (c == 0)
+        out_printf(o, "\033[%dH", r + 1);
+    else
+        out_printf(o, "\033[%d;%dH", r + 1, c + 1);
+    o->row = r;
+    o->col = c;
+} /* out_cup */
+
+/* move the cursor to (r, c) the shortest way we know.
+ * @param line the cells of the row, as they will be. */
+static void
+out_goto(
+        struct scr_out         *o,
+        const struct screen    *s,
+        int                     r,
+        int                     c,
+        const struct scr_cell  *line)
+{
+    char cup[SCR_SEQ_MAX];
+    int  n = sprintf(cup, "\033[%d;%dH", r + 1, c + 1);
+
+    if (o->row == r && o->col == c)
+        return;
+    if (o->row == r && c == 0) {
+        out_put(o, "\r", 1);
+    } else if (       o->row >= 0 && r == o->row + 1 && c == 0
+                && o->row != s->bot && o->row < s->rows - 1) {
+        out_put(o, "\r\n", 2);
+    } else if (o->row == r && o->col > c && o->col - c < n) {
+        for (int i = c; i < o->col; i++)
+            out_put(o, "\b", 1);
+    } else {
+        /* write again the chars up to it, if it's shorter */
+        int cost = 0, k = o->row == r ? o->col : -1;
+
+        if (k >= 0 && k < c) {
+            while (k < c && cost < n) {
+                const struct scr_cell *p = line + k;
+                int w = k + 1 < s->cols && p[1].ch == SCR_WIDE ? 2 : 1;
+
+                if (p->ch == SCR_WIDE || !out_same(o, &p->a) || k + w > c)
+                    break;
+                cost += out_ch_len(p->ch);
+                k    += w;
+            }
+        }
+        if (k == c && cost < n) {
+            for (k = o->col; k < c; k++)
+                if (line[k].ch != SCR_WIDE)
+                    out_ch(o, line[k].ch,
+                        k + 1 < s->cols && line[k + 1].ch == SCR_WIDE
+                            ? 2 : 1);
+        } else {
+            out_cup(o, r, c);
+        }
+    }
+    o->row = r;
+    o->col = c;
+} /* out_goto */
+
+/* position the cursor, and set origin mode as in c.
+ * @param top the top of the scroll region. */
+static void
+out_cursor(
+        struct scr_out             *o,
+        int                         top,
+        const struct scr_cursor    *c)
+{
+    if (c->origin) {
+        out_printf(o, "\033[?6h");
+        out_cup(o, c->row - top, c->col);
+        o->row = c->row;
+    } else if (o->row != c->row || o->col != c->col) {
+        out_cup(o, c->row, c->col);
+    }
+} /* out_cursor */
+
+/* set the scroll region of s, it moves the cursor home */
+static void
+out_region(
+        struct scr_out         *o,
+        const struct screen    *s)
+{
+    if (s->top == 0 && s->bot == s->rows - 1)
+        out_printf(o, "\033[r");
+    else
+        out_printf(o, "\033[%d;%dr", s->top + 1, s->bot + 1);
+    o->row = o->col = 0;
+} /* out_region */
+
+/* set the attributes and charsets as in c */
+static void
+out_state(
+        struct scr_out             *o,
+        const struct scr_cursor    *c)
+{
+    struct scr_attr a = c->a;
+
+    if (c->g[0] == '0')
+        a.flags |= SCR_ACS;
+    out_attr(o, &a);
+    if (c->g[0] != 'B' && c->g[0] != '0') {
+        out_printf(o, "\033(%c", c->g[0]);
+        o->acs = -1;
+    }
+    if (c->g[1] != o->g1) {
+        out_printf(o, "\033)%c", c->g[1]);
+        o->g1 = c->g[1];
+    }
+    if (c->shift)
+        out_put(o, "\016", 1);
+} /* out_state */
+
+/* undo what out_cursor() and out_state() set that changes how the
+ * cells are written */
+static void
+out_unset(
+        struct scr_out             *o,
+        const struct scr_cursor    *c)
+{
+    if (c->shift)
+        out_put(o, "\017", 1);
+    if (c->origin) {
+        out_printf(o, "\033[?6l");
+        o->row = o->col = 0;
+    }
+} /* out_unset */
+
+/* save the cursor as ?1049h does, going to the alternate screen
+ * (in the region of to), with the one to saved, and come back to
+ * the main screen at once if leave is set */
+static void
+out_saved_alt(
+        struct scr_out         *o,
+        const struct screen    *to,
+        int                     leave)
+{
+    const struct scr_cursor *sa = &to->saved_alt;
+    int out = sa->origin && (sa->row < to->top || sa->row > to->bot);
+
+    if (out) /* saved in another region */
+        out_printf(o, "\033[r");
+    out_cursor(o, out ? 0 : to->top, sa);
+    out_state(o, sa);
+    out_printf(o, leave ? "\033[?1049h\033[?47l" : "\033[?1049h");
+    out_unset(o, sa);
+    if (out)
+        out_region(o, to);
+} /* out_saved_alt */
+
+/* the cells from c to the end of the line are erased */
+static int
+out_erased(
+        const struct scr_cell  *line,
+        int                     c,
+        int                     cols)
+{
+    for (int k = c; k < cols; k++)
+        if (       line[k].ch != ' '
+                || line[k].a.flags
+                || line[k].a.fg != SCR_DEFAULT
+                || line[k].a.bg != line[c].a.bg)
+            return 0;
+    return 1;
+} /* out_erased */
+
+/* write the cells that changed in a screen.
+ * @param g the cells to show.
+ * @param fg the cells shown, NULL if it's blank. */
+static void
+out_cells(
+        struct scr_out         *o,
+        const struct screen    *to,
+        const struct scr_cell  *g,
+        const struct scr_cell  *fg,
+        int                     bad_r,
+        int                     bad_c)
+{
+    int cols = to->cols;
+
+    for (int r = 0; r < to->rows; r++) {
+        const struct scr_cell *tl = g + (size_t) r * cols,
+                              *fl = fg ? fg + (size_t) r * cols : NULL;
+
+        for (int c = 0; c < cols; c++) {
+            const struct scr_cell *t = tl + c,
+                                  *f = fl ? fl + c : &scr_empty;
+            int w = c + 1 < cols && t[1].ch == SCR_WIDE ? 2 : 1;
+
+            if (t->ch == SCR_WIDE)
+                continue; /* its left half was cut */
+            if (       memcmp(t, f, sizeof *t) == 0
+                    && (w == 1 || memcmp(t + 1, fl ? f + 1 : &scr_empty,
+                                    sizeof *t) == 0)
+                    && !(r == bad_r && c <= bad_c + 1 && c + w > bad_c))
+                continue;
+            if (cols - c > 4 && out_erased(tl, c, cols)) {
+                out_goto(o, to, r, c, tl);
+                out_attr(o, &t->a);
+                out_printf(o, "\033[K");
+                break;
+            }
+            out_goto(o, to, r, c, tl);
+            out_attr(o, &t->a);
+            out_ch(o, t->ch, w);
+            o->col += w;
+            if (o->col >= cols)
+                o->col = -1; /* the wrap is pending */
+            c += w - 1;
+        }
+    }
+} /* out_cells */
+
+int
+scr_diff(
+        struct screen  *from,
+        struct screen  *to,
+        struct scr_buf *b)
+{
+    struct scr_out         o    = { b, 0, -1, -1, from->cur.a, 1, 0,
+                                    from->cur.g[1], from->rep,
+                                    from->rep_w };
+    int                    cols = to->cols,
+                           same = from->rows == to->rows
+                               && from->cols == to->cols,
+                           bad_r = -1, bad_c = -1;
+    size_t                 n    = (size_t) to->rows * cols;
+
+    /* the terminal can be in the middle of a sequence, or a char
+     * it will write as a replacement char */
+    if (!scr_ground(from)) {
+        out_put(&o, "\030", 1);
+        if (from->u8_len) {
+            bad_r   = from->cur.row;
+            bad_c   = from->cur.col;
+            o.rep   = REPLACEMENT; /* what REP writes now */
+            o.rep_w = 1;
+        }
+    } else if (!from->cur.wrap) {
+        o.row = from->cur.row;
+        o.col = from->cur.col;
+    }
+    if (from->cur.shift)
+        out_put(&o, "\017", 1);
+    o.acs = from->cur.g[0] == '0' ? 1 : from->cur.g[0] == 'B' ? 0 : -1;
+    if (from->cur.origin) {
+        out_printf(&o, "\033[?6l");
+        o.row = o.col = 0;
+    }
+    if (from->irm)
+        out_printf(&o, "\033[4l");
+    if (to->awm != from->awm) /* the wrap pending at the end */
+        out_printf(&o, to->awm ? "\033[?7h" : "\033[?7l");
+
+    /* the cursor saved, with DECSC (in the region when it was
+     * saved, if in origin mode) */
+    int top = from->top, bot = from->bot;
+    if (memcmp(&from->saved, &to->saved, sizeof to->saved) != 0) {
+        if (       to->saved.origin
+                && (!same || to->saved.row < top || to->saved.row > bot)) {
+            out_printf(&o, "\033[r");
+            top = 0;
+            bot = -1;
+        }
+        out_cursor(&o, top, &to->saved);
+        out_state(&o, &to->saved);
+        out_printf(&o, "\0337");
+        out_unset(&o, &to->saved);
+    }
+
+    /* the region, as the moves depend on it */
+    if (!same || top != to->top || bot != to->bot)
+        out_region(&o, to);
+
+    /* the screen shown, and the one that gets hidden (it will be
+     * seen again) */
+    int vis    = to->alt,
+        hid    = !vis,
+        broken = from->u8_len                   /* it can scroll, or */
+              && (from->cur.wrap || from->irm), /* shift the line */
+        stale  = !same || from->stale[vis] || (broken && from->alt == vis);
+    const struct scr_cell *fg = same ? from->g[vis] : NULL;
+    int hid_stale = !same || from->stale[hid]
+             || (bad_r >= 0 && from->alt == hid)
+             || memcmp(from->g[hid], to->g[hid], n * sizeof *fg) != 0;
+    int alt     = from->alt,
+        sa_diff = memcmp(&from->saved_alt, &to->saved_alt,
+                sizeof to->saved_alt) != 0;
+    if (alt && vis && sa_diff) {
+        /* it left the alternate screen and entered it again */
+        out_printf(&o, "\033[?1049l\017\033[?6l");
+        alt = 0;
+        o.row = o.acs = -1;
+        o.a_known = 0;
+        o.g1      = 0;
+    }
+    if (alt != vis) {
+        if (       hid_stale && same && !from->stale[hid] && !broken
+                && !(!vis && sa_diff)) { /* cleared below */
+            out_cells(&o, to, to->g[hid], from->g[hid], bad_r, bad_c);
+            hid_stale = 0;
+        }
+        if (vis) { /* the cursor is saved, and the screen cleared */
+            out_saved_alt(&o, to, 0);
+            fg    = NULL;
+            stale = 0;
+        } else { /* the cursor saved is restored */
+            out_printf(&o, "\033[?1049l\017\033[?6l");
+            o.row = o.acs = -1;
+            o.a_known = 0;
+            o.g1      = 0;
+        }
+        bad_r = -1;
+    }
+    if (!vis && sa_diff) {
+        /* the cursor ?1049l restores is not the one the terminal
+         * saved (the alternate screen was entered and left), it
+         * is saved going there, and coming back at once */
+        out_saved_alt(&o, to, 1);
+        hid_stale = 1;
+    }
+    if (stale) {
+        static const struct scr_attr none = { 0, SCR_DEFAULT, SCR_DEFAULT };
+        out_attr(&o, &none);
+        out_printf(&o, "\033[H\033[2J");
+        o.row = o.col = 0;
+        fg    = NULL;
+    }
+
+    /* the cells changed */
+    out_cells(&o, to, to->g[vis], fg, bad_r, bad_c);
+
+    /* the cursor, and the modes */
+    if (to->cur.wrap) {
+        /* write the last char again, so the wrap is pending */
+        const struct scr_cell *tl = to->g[vis]
+                                  + (size_t) to->cur.row * cols;
+        int lc = cols > 1 && tl[cols - 1].ch == SCR_WIDE ? cols - 2
+                                                         : cols - 1;
+        if (to->cur.origin)
+            out_printf(&o, "\033[?6h");
+        out_cup(&o, to->cur.row - (to->cur.origin ? to->top : 0), lc);
+        out_attr(&o, &tl[lc].a);
+        out_ch(&o, tl[lc].ch, cols - lc);
+    } else {
+        out_cursor(&o, to->top, &to->cur);
+    }
+    out_state(&o, &to->cur);
+    if (to->irm)
+        out_printf(&o, "\033[4h");
+    if (to->hide != from->hide)
+        out_printf(&o, to->hide ? "\033[?25l" : "\033[?25h");
+
+    /* the sequences kept, but a string not complete */
+    if (to->st == S_STR || to->st == S_STR_ESC) {
+        out_put(&o, to->pass, to->pass_mark);
+        memmove(to->pass, to->pass + to->pass_mark,
+            to->pass_len - to->pass_mark);
+        to->pass_len -= to->pass_mark;
+        to->pass_mark = 0;
+    } else {
+        out_put(&o, to->pass, to->pass_len);
+        to->pass_len = to->pass_mark = 0;
+    }
+
+    /* REP repeats what the terminal wrote last */
+    to->rep   = o.rep;
+    to->rep_w = o.rep_w;
+
+    /* what the terminal has on the screen not shown */
+    to->stale[hid] = hid_stale;
+    to->stale[vis] = 0;
+    if (o.err || scr_copy(from, to) < 0) {
+        errno = ENOMEM;
+        return -1;
+    }
+    /* the terminal didn't get the sequence not complete */
+    from->st       = S_TEXT;
+    from->seq_len  = 0;
+    from->u8_len   = 0;
+    from->pass_len = from->pass_mark = 0;
+    return 0;
+} /* scr_diff */
@@ -0,0 +1,202 @@
+/* screen.h -- model of the screen of a terminal.  It follows the
+ * output to a VT100/xterm terminal, and keeps the cells of its
+ * screen with their attributes, the cursor and the modes that
+ * change how the output is shown, so the output of a program can
+ * be replaced by the changes from a screen to another (see
+ * scr_diff()), as mosh(1) does.
+ * Author: Luis Colorado <luiscoloradourcola@gmail.com>
+ * Copyright: (C) 2015-2025 LUIS COLORADO.  All rights reserved.
+ * License: BSD.
+ *
+ * The model understands the text (UTF-8, with the East Asian wide
+ * chars taking two cells), the C0 controls, the cursor movements,
+ * the erase, insert, delete and scroll sequences, SGR, the scroll
+ * region, the alternate screen, the DEC special graphics charset,
+ * and the modes origin (DECOM), autowrap (DECAWM), insert (IRM)
+ * and cursor visible (DECTCEM).  The sequences it doesn't model,
+ * and the strings (OSC, DCS...), don't change the screen, so they
+ * are kept and passed as they are with the next diff.  Combining
+ * chars are not kept, the cells are written again without them.
+ */
+#ifndef _SCREEN_H
+#define _SCREEN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#define SCR_SEQ_MAX         (64)        /* longest escape sequence */
+#define SCR_PASS_MAX        (4096)      /* sequences kept to pass, at
+                                         * most, others are dropped */
+
+/* attributes of a cell */
+#define SCR_BOLD            (1 << 0)
+#define SCR_DIM             (1 << 1)
+#define SCR_ITALIC          (1 << 2)
+#define SCR_UNDERLINE       (1 << 3)
+#define SCR_BLINK           (1 << 4)
+#define SCR_REVERSE         (1 << 5)
+#define SCR_HIDDEN          (1 << 6)
+#define SCR_STRIKE          (1 << 7)
+#define SCR_ACS             (1 << 8)    /* DEC special graphics */
+
+/* colors, a palette index plus one, or these */
+#define SCR_DEFAULT         (0)
+#define SCR_RGB             (1 << 24)   /* with the rgb in the low
+                                         * 24 bits */
+
+/* chars of a cell, the bytes of its UTF-8, from the low byte */
+#define SCR_WIDE            (0)         /* right half of a wide char */
+
+struct scr_attr {
+    uint32_t        flags;      /* (no padding, cells are compared
+                                 * with memcmp()) */
+    uint32_t        fg, bg;
+};
+
+struct scr_cell {
+    uint32_t        ch;
+    struct scr_attr a;
+};
+
+/* the cursor, and what DECSC saves with it */
+struct scr_cursor {
+    int             row, col;
+    int             wrap;       /* the next char goes to the next
+                                 * line (the last column written) */
+    struct scr_attr a;          /* attributes of the next chars */
+    char            g[2];       /* charsets G0 and G1 ... */
+    int             shift;      /* ... and the one in use (SO/SI) */
+    int             origin;     /* DECOM */
+};
+
+struct screen {
+    int             rows, cols;
+    struct scr_cell*g[2];       /* main and alternate screen ... */
+    int             stale[2];   /* ... the terminal has something
+                                 * else on them */
+    int             alt;        /* the alternate is shown */
+    struct scr_cursor
+                    cur,        /* the cursor, and the ones saved
+                                 * with DECSC and ... */
+                    saved,
+                    saved_alt;  /* ... going to the alternate */
+    int             top, bot;   /* scroll region */
+    int             awm,        /* DECAWM */
+                    irm,        /* IRM */
+                    hide;       /* !DECTCEM */
+    int             onlcr;      /* LF is written as CR LF */
+
+    /* PARSER */
+    int             st;         /* state */
+    char            seq[SCR_SEQ_MAX];
+                                /* sequence being parsed ... */
+    int             seq_len;    /* ... its length */
+    char            u8[4];      /* UTF-8 char being parsed, ... */
+    int             u8_len,     /* ... its length ... */
+                    u8_need;    /* ... and the length it has */
+    uint32_t        rep;        /* last char written (for REP) ... */
+    int             rep_w;      /* ... and its width */
+
+    /* TO PASS */
+    char            pass[SCR_PASS_MAX];
+    size_t          pass_len,   /* bytes in pass, ... */
+                    pass_mark;  /* ... where the string being parsed
+                                 * begins ... */
+    int             pass_skip;  /* ... and it is dropped */
+};
+
+/* output of scr_diff() */
+struct scr_buf {
+    char           *p;
+    size_t          len,        /* bytes in p, ... */
+                    off,        /* ... already sent ... */
+                    cap;        /* ... and the size of p */
+};
+
+/* Initialize a screen, cleared, as after a reset.  As the
+ * terminal can have something else, both screens are stale.
+ *
+ * @param s the screen.
+ * @param rows the number of rows.
+ * @param cols the number of columns.
+ * @return 0 on success, -1 and errno set on error. */
+int
+scr_init(
+        struct screen  *s,
+        int             rows,
+        int             cols);
+
+/* Free the cells of a screen.
+ *
+ * @param s the screen. */
+void
+scr_destroy(
+        struct screen  *s);
+
+/* Change the size of a screen, as a terminal does when its window
+ * is resized.  The cells that fit are kept, but the screens are
+ * stale, as the terminal can have reflowed them.
+ *
+ * @param s the screen.
+ * @param rows the number of rows.
+ * @param cols the number of columns.
+ * @return 0 on success, -1 and errno set on error. */
+int
+scr_resize(
+        struct screen  *s,
+        int             rows,
+        int             cols);
+
+/* Copy a screen, with its cells.
+ *
+ * @param dst the copy, initialized with scr_init().
+ * @param src the screen to copy.
+ * @return 0 on success, -1 and errno set on error. */
+int
+scr_copy(
+        struct screen          *dst,
+        const struct screen    *src);
+
+/* Update the screen with output to the terminal.
+ *
+ * @param s the screen.
+ * @param iov the output, in pieces.
+ * @param niov the number of pieces. */
+void
+scr_feed(
+        struct screen          *s,
+        const struct iovec     *iov,
+        int                     niov);
+
+/* Forget the sequences kept to pass, as the terminal got them.
+ *
+ * @param s the screen. */
+void
+scr_passed(
+        struct screen  *s);
+
+/* Check that the screen is not in the middle of a sequence or a
+ * char, so the output that follows can be written as it is.
+ *
+ * @param s the screen.
+ * @return nonzero if so. */
+int
+scr_ground(
+        const struct screen    *s);
+
+/* Write the output that takes a terminal showing a screen to
+ * show another: the cells that changed, the cursor, the modes and
+ * the sequences kept to pass.  After it, from is a copy of to.
+ *
+ * @param from the screen shown.
+ * @param to the screen to show.
+ * @param b where to add the output.
+ * @return 0 on success, -1 and errno set on error. */
+int
+scr_diff(
+        struct screen  *from,
+        struct screen  *to,
+        struct scr_buf *b);
+
+#endif /* _SCREEN_H */
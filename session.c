@@ -0,0 +1,399 @@
+/* session.c -- a throttled session: a child process running on
+ * its own pty, and the two channels that pass data between the
+ * pty and the front end descriptors.
+ * Author: Luis Colorado <luiscoloradourcola@gmail.com>
+ * Copyright: (C) 2015-2025 LUIS COLORADO.  All rights reserved.
+ * License: BSD.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pwd.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/ttydefaults.h>
+#include <sys/types.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.h"
+
+#ifndef   UQ_HAS_PTY_H /* {{ */
+#warning  UQ_HAS_PTY_H should be defined in config.mk
+#define   UQ_HAS_PTY_H     (0)
+#endif /* UQ_HAS_PTY_H  * }} */
+
+#if UQ_HAS_PTY_H
+#include <pty.h>
+#endif
+
+#ifndef   UQ_HAS_LIBUTIL_H /* {{ */
+#warning  UQ_HAS_LIBUTIL_H should be defined in config.mk
+#define   UQ_HAS_LIBUTIL_H     (0)
+#endif /* UQ_HAS_LIBUTIL_H  * }} */
+
+#if UQ_HAS_LIBUTIL_H
+#include <libutil.h>
+#endif
+
+#ifndef   UQ_PATH_MAX /* {{ */
+#warning  UQ_PATH_MAX should be defined in config.mk
+#define   UQ_PATH_MAX (1024)
+#endif /* UQ_PATH_MAX    }} */
+
+#include "main.h"
+#include "slowtty.h"
+#include "session.h"
+
+/* the command to execute, prepared by session_cmd() */
+static const char  *cmd_file;
+static char       **cmd_argv;
+static char         cmd_login[UQ_PATH_MAX];
+static char        *cmd_shell_argv[2];
+
+static int          next_id;
+
+/* interval to check if the front end has read all the output */
+#define SESSION_DRAIN_NSEC  (100000000)
+
+void
+session_cmd(
+        int    argc,
+        char **argv)
+{
+    if (argc) {
+        int i;
+        LOG("execvp:");
+        for (i = 0; i < argc; i++) {
+            ADD(" [%s]", argv[i]);
+        }
+        ADD("\n");
+        cmd_file = argv[0];
+        cmd_argv = argv;
+    } else {
+        char *shellenv = "SHELL";
+        char *shell = getenv(shellenv);
+        if (shell) {
+            LOG("Got shell from environment variable SHELL\n");
+        } else {
+            struct passwd *u = getpwnam(getlogin());
+            if (u) {
+                shell = u->pw_shell;
+                LOG("Got shell from /etc/passwd file\n");
+            }
+        } /* if */
+        snprintf(cmd_login, sizeof cmd_login, "%s%s",
+            flags & FLAG_LOGIN
+                ? "-"
+                : "",
+            shell);
+        LOG("execlp: %s\n", cmd_login);
+        cmd_file          = shell;
+        cmd_shell_argv[0] = cmd_login;
+        cmd_shell_argv[1] = NULL;
+        cmd_argv          = cmd_shell_argv;
+    } /* if */
+} /* session_cmd */
+
+void
+session_exec(void)
+{
+    /* we could be the child of a multithreaded process, so
+     * no stdio(3) here, some other thread could have its
+     * lock when we were forked. */
+    struct sigaction sa;
+    memset(&sa, 0, sizeof sa);
+    sa.sa_handler = SIG_DFL;
+    sigaction(SIGPIPE, &sa, NULL); /* ignored in server mode */
+    execvp(cmd_file, cmd_argv);
+    dprintf(2, F("ERROR: execvp: %s" ERRNO "\r\n"),
+        cmd_file, EPMTS);
+    _exit(EXIT_FAILURE);
+} /* session_exec */
+
+void
+session_tty_defaults(
+        struct termios *t)
+{
+    memset(t, 0, sizeof *t);
+    t->c_iflag = TTYDEF_IFLAG & ~ISTRIP; /* allow utf-8 */
+    t->c_oflag = TTYDEF_OFLAG;
+    t->c_cflag = TTYDEF_CFLAG;
+    t->c_lflag = TTYDEF_LFLAG;
+    for (int i = 0; i < NCCS; i++)
+        t->c_cc[i] = _POSIX_VDISABLE;
+    t->c_cc[VEOF]   = CEOF;
+    t->c_cc[VERASE] = CERASE;
+    t->c_cc[VINTR]  = CINTR;
+    t->c_cc[VKILL]  = CKILL;
+    t->c_cc[VQUIT]  = CQUIT;
+    t->c_cc[VSUSP]  = CSUSP;
+    t->c_cc[VSTART] = CSTART;
+    t->c_cc[VSTOP]  = CSTOP;
+    t->c_cc[VMIN]   = CMIN;
+    t->c_cc[VTIME]  = CTIME;
+#ifdef VWERASE
+    t->c_cc[VWERASE]  = CWERASE;
+#endif
+#ifdef VREPRINT
+    t->c_cc[VREPRINT] = CREPRINT;
+#endif
+#ifdef VLNEXT
+    t->c_cc[VLNEXT]   = CLNEXT;
+#endif
+    cfsetispeed(t, TTYDEF_SPEED);
+    cfsetospeed(t, TTYDEF_SPEED);
+} /* session_tty_defaults */
+
+int
+set_nonblock(
+        int fd)
+{
+    int res = fcntl(fd, F_GETFL);
+    if (res < 0)
+        return res;
+    return fcntl(fd, F_SETFL, res | O_NONBLOCK);
+} /* set_nonblock */
+
+struct session *
+session_new(
+        int                     front_in,
+        int                     front_out,
+        const struct termios   *t,
+        const struct winsize   *ws)
+{
+    struct session *s = calloc(1, sizeof *s);
+    if (!s)
+        return NULL;
+
+    s->id        = __atomic_add_fetch(&next_id, 1, __ATOMIC_RELAXED);
+    s->front_in  = front_in;
+    s->front_out = front_out;
+    s->front_aux = -1;
+
+    s->pid = forkpty(&s->ptym, NULL, t, ws);
+    if (s->pid < 0) {
+        int saved_errno = errno;
+        free(s);
+        errno = saved_errno;
+        return NULL;
+    } else if (s->pid == 0) {
+        /* child process */
+        sigset_t none;
+        sigemptyset(&none);
+        sigprocmask(SIG_SETMASK, &none, NULL);
+        session_exec();
+        /* NOTREACHED */
+    }
+
+    /* PARENT */
+    int one = 1;
+    if (       set_nonblock(s->ptym) < 0
+            || ioctl(s->ptym, TIOCPKT, &one) < 0)
+    {
+        int saved_errno = errno;
+        close(s->ptym);
+        kill(s->pid, SIGHUP);
+        free(s);
+        errno = saved_errno;
+        return NULL;
+    }
+    fcntl(s->ptym, F_SETFD, FD_CLOEXEC);
+
+    s->in.from_fd   = front_in;
+    s->in.to_fd     = s->ptym;
+    s->in.line_fd   = s->ptym;
+    s->in.name      = "IN";
+    s->in.other     = &s->out;
+    s->in.flags     = PIFLG_INTR;
+    s->in.data      = s;
+    rb_init(&s->in.b);
+    lag_init(&s->in.lag, &lag_in);
+
+    s->out.from_fd  = s->ptym;
+    s->out.to_fd    = front_out;
+    s->out.line_fd  = s->ptym;
+    s->out.name     = "OUT";
+    s->out.other    = &s->in;
+    s->out.flags    = PIFLG_PKT;
+    s->out.data     = s;
+    rb_init(&s->out.b);
+    lag_init(&s->out.lag, &lag_out);
+
+    LOG("session %d: pid=%d, ptym=%d, front_in=%d, front_out=%d\n",
+        s->id, s->pid, s->ptym, front_in, front_out);
+
+    return s;
+} /* session_new */
+
+/* arm the drain timer for the next check */
+static void
+session_drain_arm(
+        struct session *s)
+{
+    struct timespec when;
+
+    clock_gettime(LOOP_CLOCK, &when);
+    when.tv_nsec += SESSION_DRAIN_NSEC;
+    if (when.tv_nsec >= 1000000000) {
+        when.tv_nsec -= 1000000000;
+        when.tv_sec++;
+    }
+    loop_timer_arm(s->out.loop, &s->drain, &when);
+} /* session_drain_arm */
+
+/* check if the front end has read all the output, as closing
+ * the front end discards it. */
+static void
+session_drain(
+        struct loop_timer *t)
+{
+    struct session *s = t->data;
+    int pending = 0;
+
+    if (       s->front_aux >= 0
+            && ioctl(s->front_aux, FIONREAD, &pending) == 0
+            && pending > 0)
+    {
+        session_drain_arm(s);
+        return;
+    }
+    s->on_done(s);
+} /* session_drain */
+
+static void
+session_chan_done(
+        struct pthread_info *pi)
+{
+    struct session *s = pi->data;
+
+    if (s->done)
+        return; /* the other channel */
+    s->done = TRUE;
+    LOG("session %d: channel %s done\n", s->id, pi->name);
+
+    /* the last data written could still be on its way to the
+     * front end, and not counted by FIONREAD, so we always
+     * wait at least one interval. */
+    if (s->front_aux >= 0)
+        session_drain_arm(s);
+    else
+        s->on_done(s);
+} /* session_chan_done */
+
+void
+session_start(
+        struct session  *s,
+        struct loop     *l,
+        struct loop     *in_l,
+        void           (*on_done)(struct session *s))
+{
+    s->on_done      = on_done;
+    s->drain.cb     = session_drain;
+    s->drain.data   = s;
+    s->in.loop      = s->out.loop    = l;
+    s->in.in_loop   = s->out.in_loop = in_l ? in_l : l;
+    s->in.on_done   = s->out.on_done = session_chan_done;
+    s->in.st        = stats_attach(s->in.name,  s->id);
+    s->out.st       = stats_attach(s->out.name, s->id);
+    pi_start(&s->in);
+    pi_start(&s->out);
+
+    if (ctl_path) {
+        /* a socket for each session, ctl_path.id */
+        char path[SESSION_NAME_MAX + 256];
+
+        snprintf(path, sizeof path, "%s.%d", ctl_path, s->id);
+        if (ctl_open(&s->ctl, path, l, &s->in, &s->out) < 0) {
+            WARN("session %d: %s: control socket" ERRNO "\n",
+                s->id, path, EPMTS);
+        }
+    }
+} /* session_start */
+
+/* back on the emitter loop, nothing refers to the session */
+static void
+session_detached(
+        struct loop_post *p)
+{
+    struct session *s = p->data;
+
+    s->on_released(s);
+} /* session_detached */
+
+/* on the ingestion loop, unregister the channel sources.  The
+ * posts made to it before the release are already done, and no
+ * more are made. */
+static void
+session_detach(
+        struct loop_post *p)
+{
+    struct session *s = p->data;
+
+    loop_del(s->in.in_loop,  &s->in.src);
+    loop_del(s->out.in_loop, &s->out.src);
+    loop_post(s->out.loop, &s->detached);
+} /* session_detach */
+
+void
+session_release(
+        struct session  *s,
+        void           (*on_released)(struct session *s))
+{
+    struct pthread_info *pis[] = { &s->in, &s->out };
+
+    /* the emitters are stopped, they don't post anything to
+     * the ingestion loop anymore. */
+    for (int i = 0; i < sizeof pis / sizeof pis[0]; i++) {
+        PI_SET(pis[i], PIFLG_DONE);
+        loop_timer_disarm(pis[i]->loop, &pis[i]->tim);
+        loop_timer_disarm(pis[i]->loop, &pis[i]->lag_tim);
+    }
+    loop_timer_disarm(s->out.loop, &s->drain);
+    ctl_close(&s->ctl);
+
+    s->on_released   = on_released;
+    s->detach.cb     = session_detach;
+    s->detach.data   = s;
+    s->detached.cb   = session_detached;
+    s->detached.data = s;
+    loop_post(s->out.in_loop, &s->detach);
+} /* session_release */
+
+void
+session_free(
+        struct session *s)
+{
+    LOG("session %d: end\n", s->id);
+    if (stats_enabled() && s->in.st) { /* started */
+        fprintf(stderr, "session %d: %s\n", s->id, s->name);
+        stats_report(stderr, s->in.st,  "\n");
+        stats_report(stderr, s->out.st, "\n");
+    }
+    stats_detach(s->in.st);
+    stats_detach(s->out.st);
+    rb_destroy(&s->in.b);
+    rb_destroy(&s->out.b);
+    lag_destroy(&s->in.lag);
+    lag_destroy(&s->out.lag);
+    free(s->out.opt);
+    if (s->out.scr) {
+        scr_destroy(s->out.scr);
+        scr_destroy(s->out.shown);
+        free(s->out.scr);
+    }
+    free(s->out.scr_out.p);
+    /* closing the master makes the kernel to hang up the
+     * child's pty. */
+    close(s->ptym);
+    close(s->front_in);
+    if (s->front_out != s->front_in)
+        close(s->front_out);
+    if (s->front_aux >= 0)
+        close(s->front_aux);
+    free(s);
+} /* session_free */
@@ -0,0 +1,140 @@
+/* session.h -- a throttled session: a child process running on
+ * its own pty, and the two channels that pass data between the
+ * pty and the front end descriptors.
+ * Author: Luis Colorado <luiscoloradourcola@gmail.com>
+ * Copyright: (C) 2015-2025 LUIS COLORADO.  All rights reserved.
+ * License: BSD.
+ */
+#ifndef _SESSION_H
+#define _SESSION_H
+
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+
+#include "ctl.h"
+#include "slowtty.h"
+
+#define SESSION_NAME_MAX    (64)
+
+struct worker;
+
+struct session {
+    int              id;        /* session number */
+    pid_t            pid;       /* child process */
+    int              ptym;      /* master side of the child's pty */
+    int              front_in,  /* front end descriptors */
+                     front_out,
+                     front_aux; /* descriptor to close with the
+                                 * session (or -1) */
+    char             name[SESSION_NAME_MAX];
+                                /* name of the front end */
+
+    struct pthread_info
+                     in,        /* front_in -> ptym */
+                     out;       /* ptym -> front_out */
+
+    void           (*on_done)(struct session *s);
+    int              done;      /* on_done already called */
+    struct loop_timer
+                     drain;     /* to wait for the front end to
+                                 * read the last output */
+    struct ctl       ctl;       /* control socket (-C), see ctl.h */
+    void           (*on_released)(struct session *s);
+    struct loop_post detach,    /* to the ingestion loop */
+                     detached;  /* back to the emitter loop */
+
+    struct worker   *worker;    /* worker the session runs on */
+    struct session  *next;      /* to link sessions in lists */
+};
+
+/* Prepare the command to execute in the child processes.  This
+ * is done once, before any session is created, as the child side
+ * of a fork(2) in a multithreaded process cannot do much more
+ * than calling execve(2).
+ *
+ * @param argc number of arguments of the command (zero to use
+ *        the user's shell).
+ * @param argv the command and its arguments. */
+void
+session_cmd(
+        int    argc,
+        char **argv);
+
+/* Execute the command prepared with session_cmd() in the child
+ * process.  Never returns.  */
+void
+session_exec(void);
+
+/* Fill a termios structure with the system default settings,
+ * for the sessions that don't have a terminal on the front end
+ * to take them from.
+ *
+ * @param t the structure to fill. */
+void
+session_tty_defaults(
+        struct termios *t);
+
+/* Set the O_NONBLOCK flag on a descriptor.
+ *
+ * @param fd the descriptor.
+ * @return 0 on success, -1 and errno set on error. */
+int
+set_nonblock(
+        int fd);
+
+/* Create a new session, forking a child process on a new pty,
+ * with the front end descriptors passed.  The session doesn't
+ * transfer any data until started with session_start().
+ *
+ * @param front_in descriptor to read the input of the child from.
+ * @param front_out descriptor to write the output of the child to.
+ * @param t the initial termios settings of the child's pty.
+ * @param ws the initial window size of the child's pty (or NULL).
+ * @return the session, or NULL and errno set on error. */
+struct session *
+session_new(
+        int                     front_in,
+        int                     front_out,
+        const struct termios   *t,
+        const struct winsize   *ws);
+
+/* Start passing data on the session channels, in the loops
+ * passed (see pi_start()).  on_done is called (once) from the
+ * emitter loop when any of both channels is done (the child
+ * closed its pty or the front end was closed) and the front end
+ * has read all the output.
+ *
+ * @param s the session.
+ * @param l the emitter loop the session runs in.
+ * @param in_l the ingestion loop (or NULL to use l).
+ * @param on_done the callback. */
+void
+session_start(
+        struct session  *s,
+        struct loop     *l,
+        struct loop     *in_l,
+        void           (*on_done)(struct session *s));
+
+/* Stop the session channels, and unregister them from their
+ * loops.  As the ingestion loop can be running on other thread,
+ * this is not done at once, and on_released is called from the
+ * emitter loop when done.  Then the session can be freed.
+ *
+ * @param s the session, already started.
+ * @param on_released the callback. */
+void
+session_release(
+        struct session  *s,
+        void           (*on_released)(struct session *s));
+
+/* Close all the descriptors of a session and free it.  The
+ * child is not waited for.  A session started has to be
+ * released first (see session_release()).
+ *
+ * @param s the session. */
+void
+session_free(
+        struct session *s);
+
+#endif /* _SESSION_H */
@@ -0,0 +1,531 @@
+/* slowbench.c -- end to end benchmark of slowtty.  slowtty is
+ * run on a pty, with a synthetic producer as its command (this
+ * same program, with -P), for each combination of producer, line
+ * speed and frame format asked for, and one line of CSV is
+ * printed for each, with the throughput achieved against the
+ * nominal one, the latency of the keystrokes echoed back (or
+ * the time to draw each screen, for tui), the wakeups per
+ * second of the pacing timers (from the stats file, see
+ * stats.h) and the cpu time used by slowtty.
+ * Author: Luis Colorado <luiscoloradourcola@gmail.com>
+ * Copyright: (C) 2015-2025 LUIS COLORADO.  All rights reserved.
+ * License: BSD.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.h"
+
+#ifndef   UQ_HAS_PTY_H /* {{ */
+#warning  UQ_HAS_PTY_H should be defined in config.mk
+#define   UQ_HAS_PTY_H     (0)
+#endif /* UQ_HAS_PTY_H  * }} */
+
+#if UQ_HAS_PTY_H
+#include <pty.h>
+#endif
+
+#ifndef   UQ_HAS_LIBUTIL_H /* {{ */
+#warning  UQ_HAS_LIBUTIL_H should be defined in config.mk
+#define   UQ_HAS_LIBUTIL_H     (0)
+#endif /* UQ_HAS_LIBUTIL_H  * }} */
+
+#if UQ_HAS_LIBUTIL_H
+#include <libutil.h>
+#endif
+
+#include "stats.h"
+
+#define F(_fmt) "%s:%d: " _fmt, __FILE__, __LINE__
+
+#define ERR(_fmt, args...) do {                             \
+        fprintf(stderr, F("ERROR: " _fmt), ##args);         \
+        exit(EXIT_FAILURE);                                 \
+    } while (0)
+
+#define ERRNO ": ERROR %d: %s"
+#define EPMTS errno, strerror(errno)
+
+#define DEFAULT_BAUDS       "1200,9600,38400,115200"
+#define DEFAULT_FRAMES      "8N1,7E1"
+#define DEFAULT_PRODUCERS   "bulk,echo,tui"
+
+#define BULK_SECS           (2)     /* of data at the line speed */
+#define ECHO_KEYS           (20)    /* keystrokes to echo */
+#define ECHO_GAP_MSEC       (50)    /* between keystrokes */
+#define TUI_FRAMES          (10)    /* redraws */
+#define TUI_PERIOD_MSEC     (100)   /* between redraws */
+#define TIMEOUT_MSEC        (30000) /* without output, per case */
+
+/* the result of a case */
+struct result {
+    double          nominal,    /* chars/s */
+                    achieved;   /* chars/s, or < 0 if n/a */
+    double          lat[3];     /* p50, p90, p99, msecs, or < 0 */
+    double          wakeups;    /* per second */
+    double          cpu_ms;     /* of slowtty */
+    double          wall_ms;
+};
+
+static const char *slowtty = "./slowtty";
+static const char *self;
+
+static double
+now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+} /* now_ms */
+
+/* bits per char of a frame format like 8N1, and its cflag */
+static int
+frame_bits(
+        const char  *frame,
+        tcflag_t    *cflag)
+{
+    static const tcflag_t sizes[] = { CS5, CS6, CS7, CS8 };
+
+    if (       strlen(frame) != 3
+            || frame[0] < '5' || frame[0] > '8'
+            || !strchr("NEOneo", frame[1])
+            || frame[2] < '1' || frame[2] > '2')
+        return -1;
+    *cflag = sizes[frame[0] - '5'];
+    if (frame[1] != 'N' && frame[1] != 'n')
+        *cflag |= PARENB;
+    if (frame[1] == 'O' || frame[1] == 'o')
+        *cflag |= PARODD;
+    if (frame[2] == '2')
+        *cflag |= CSTOPB;
+    return 1 + (frame[0] - '0')
+             + (frame[1] != 'N' && frame[1] != 'n')
+             + (frame[2] - '0');
+} /* frame_bits */
+
+static int
+by_value(
+        const void *a,
+        const void *b)
+{
+    double da = *(const double *) a,
+           db = *(const double *) b;
+
+    return da < db ? -1 : da > db;
+} /* by_value */
+
+/* PRODUCERS.  They run as the command of slowtty, with the
+ * pty in raw mode but the frame format untouched, as slowtty
+ * paces with it. */
+
+static void
+producer_raw(void)
+{
+    struct termios t;
+
+    if (tcgetattr(0, &t) < 0)
+        return;
+    t.c_iflag &= ~(ICRNL | INLCR | IGNCR | IXON | ISTRIP);
+    t.c_oflag &= ~OPOST;
+    t.c_lflag &= ~(ICANON | ECHO | ISIG | IEXTEN);
+    t.c_cc[VMIN]  = 1;
+    t.c_cc[VTIME] = 0;
+    tcsetattr(0, TCSANOW, &t);
+} /* producer_raw */
+
+static void
+write_all(
+        int         fd,
+        const char *p,
+        size_t      n)
+{
+    while (n > 0) {
+        ssize_t res = write(fd, p, n);
+        if (res < 0) {
+            if (errno == EINTR)
+                continue;
+            _exit(EXIT_FAILURE);
+        }
+        p += res;
+        n -= res;
+    }
+} /* write_all */
+
+/* bulk text, n bytes, as lines of 80 chars */
+static void
+produce_bulk(
+        long n)
+{
+    char line[80];
+
+    for (int i = 0; i < sizeof line - 1; i++)
+        line[i] = ' ' + i % 95;
+    line[sizeof line - 1] = '\n';
+    while (n > 0) {
+        size_t k = n < sizeof line ? n : sizeof line;
+        write_all(1, line, k);
+        n -= k;
+    }
+} /* produce_bulk */
+
+/* echo n keystrokes, after a ready mark */
+static void
+produce_echo(
+        long n)
+{
+    char c;
+
+    write_all(1, "R", 1);
+    while (n > 0 && read(0, &c, 1) == 1) {
+        write_all(1, &c, 1);
+        n--;
+    }
+} /* produce_echo */
+
+/* n redraws of size bytes of a full screen, with cursor
+ * positioning and attribute changes, every period msecs */
+static void
+produce_tui(
+        long n,
+        long size)
+{
+    char  *buf = malloc(size);
+    size_t len = 0;
+
+    if (!buf)
+        _exit(EXIT_FAILURE);
+    for (int row = 1; len < size; row = row % 24 + 1) {
+        char seq[32];
+        int  k = snprintf(seq, sizeof seq, "\033[%d;1H\033[1;3%dm",
+                row, row % 8);
+        for (int i = 0; i < k && len < size; i++)
+            buf[len++] = seq[i];
+        for (int i = 0; i < 40 && len < size; i++)
+            buf[len++] = 'a' + (row + i) % 26;
+    }
+    while (n-- > 0) {
+        write_all(1, buf, size);
+        usleep(TUI_PERIOD_MSEC * 1000);
+    }
+    free(buf);
+} /* produce_tui */
+
+static int
+producer(
+        int    argc,
+        char **argv)
+{
+    producer_raw();
+    if (argc >= 2 && strcmp(argv[0], "bulk") == 0)
+        produce_bulk(atol(argv[1]));
+    else if (argc >= 2 && strcmp(argv[0], "echo") == 0)
+        produce_echo(atol(argv[1]));
+    else if (argc >= 3 && strcmp(argv[0], "tui") == 0)
+        produce_tui(atol(argv[1]), atol(argv[2]));
+    else
+        return EXIT_FAILURE;
+    /* let the pty drain before closing it */
+    tcdrain(1);
+    return EXIT_SUCCESS;
+} /* producer */
+
+/* CASES */
+
+/* wait for output on the pty, up to msecs.
+ * @return bytes read, 0 on timeout, -1 on EOF. */
+static ssize_t
+pty_read(
+        int     fd,
+        char   *buf,
+        size_t  n,
+        int     msecs)
+{
+    struct pollfd p = { .fd = fd, .events = POLLIN };
+
+    if (poll(&p, 1, msecs) <= 0)
+        return 0;
+    ssize_t res = read(fd, buf, n);
+    return res > 0 ? res : -1;
+} /* pty_read */
+
+/* sum the wakeups of all the channels in the stats file */
+static double
+stats_wakeups(
+        const char *path)
+{
+    struct stat st;
+    double      n = 0;
+    int         fd = open(path, O_RDONLY);
+
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &st) < 0 || st.st_size < sizeof (struct stats_hdr)) {
+        close(fd);
+        return -1;
+    }
+    const struct stats_hdr *h = mmap(NULL, st.st_size, PROT_READ,
+            MAP_SHARED, fd, 0);
+    close(fd);
+    if (h == MAP_FAILED)
+        return -1;
+    if (memcmp(h->magic, STATS_MAGIC, sizeof h->magic) == 0) {
+        const struct stats_chan *c = (const struct stats_chan *)(h + 1);
+        for (uint32_t i = 0; i < h->n_chans; i++)
+            if (c[i].in_use)
+                n += c[i].ticks + c[i].retries;
+    }
+    munmap((void *) h, st.st_size);
+    return n;
+} /* stats_wakeups */
+
+static void
+run_case(
+        const char     *prod,
+        unsigned long   baud,
+        const char     *frame,
+        struct result  *r)
+{
+    tcflag_t    cflag;
+    int         bits = frame_bits(frame, &cflag);
+    double      cps  = (double) baud / bits;
+    char        stats[] = "/tmp/slowbench.XXXXXX";
+    char        sbaud[32], a1[32], a2[32];
+    long        total;  /* bytes of output expected */
+    long        size = 0;/* of a tui screen */
+    int         fd;
+
+    memset(r, 0, sizeof *r);
+    r->nominal  = cps;
+    r->achieved = r->lat[0] = r->lat[1] = r->lat[2] = -1;
+
+    int sfd = mkstemp(stats);
+    if (sfd < 0)
+        ERR("mkstemp" ERRNO "\n", EPMTS);
+    close(sfd);
+
+    snprintf(sbaud, sizeof sbaud, "%lu", baud);
+    if (strcmp(prod, "bulk") == 0) {
+        total = cps * BULK_SECS;
+        if (total < 64)
+            total = 64;
+        snprintf(a1, sizeof a1, "%ld", total);
+        a2[0] = '\0';
+    } else if (strcmp(prod, "echo") == 0) {
+        total = 1 + ECHO_KEYS;
+        snprintf(a1, sizeof a1, "%d", ECHO_KEYS);
+        a2[0] = '\0';
+    } else {
+        /* screens of half a second at the line speed, so the
+         * link is busy half of the time */
+        size = cps / 2;
+        if (size < 64)
+            size = 64;
+        total = TUI_FRAMES * size;
+        snprintf(a1, sizeof a1, "%d", TUI_FRAMES);
+        snprintf(a2, sizeof a2, "%ld", size);
+    }
+
+    struct winsize ws = { .ws_row = 24, .ws_col = 80 };
+    struct termios t;
+
+    /* the settings slowtty gives to the pty of its command */
+    memset(&t, 0, sizeof t);
+    cfmakeraw(&t);
+    t.c_cflag = (t.c_cflag & ~(CSIZE | PARENB | PARODD | CSTOPB))
+              | cflag | CREAD | CLOCAL;
+    cfsetispeed(&t, B9600);
+    cfsetospeed(&t, B9600);
+
+    double start = now_ms();
+    pid_t pid = forkpty(&fd, NULL, &t, &ws);
+    if (pid < 0)
+        ERR("forkpty" ERRNO "\n", EPMTS);
+    if (pid == 0) {
+        execl(slowtty, slowtty, "-r", sbaud, "-S", stats, "--",
+            self, "-P", prod, a1, a2[0] ? a2 : NULL, (char *) NULL);
+        dprintf(2, "%s: execl" ERRNO "\n", slowtty, EPMTS);
+        _exit(EXIT_FAILURE);
+    }
+
+    char    buf[4096];
+    long    got = 0;
+    double  first = 0, last = 0;
+    double *lat = NULL;
+    int     n_lat = 0;
+
+    if (strcmp(prod, "echo") == 0) {
+        /* wait for the ready mark, then send the keystrokes one
+         * by one, timing their echo */
+        lat = calloc(ECHO_KEYS, sizeof *lat);
+        while (got < 1) {
+            ssize_t res = pty_read(fd, buf, 1, TIMEOUT_MSEC);
+            if (res <= 0)
+                break;
+            got += res;
+        }
+        for (int i = 0; got > 0 && i < ECHO_KEYS; i++) {
+            char   c = 'a' + i % 26;
+            double t0;
+
+            usleep(ECHO_GAP_MSEC * 1000);
+            t0 = now_ms();
+            write(fd, &c, 1);
+            ssize_t res = pty_read(fd, buf, 1, TIMEOUT_MSEC);
+            if (res <= 0)
+                break;
+            lat[n_lat++] = now_ms() - t0;
+            got += res;
+        }
+    } else {
+        double drawing = 0; /* when the screen began to arrive */
+
+        if (size)
+            lat = calloc(TUI_FRAMES, sizeof *lat);
+        while (got < total) {
+            ssize_t res = pty_read(fd, buf, sizeof buf, TIMEOUT_MSEC);
+            if (res <= 0)
+                break;
+            last = now_ms();
+            if (got == 0)
+                first = last;
+            if (size && got % size == 0)
+                drawing = last;
+            got += res;
+            if (size && got / size > n_lat)
+                lat[n_lat++] = last - drawing;
+        }
+        if (got > 1 && last > first)
+            r->achieved = (got - 1) * 1e3 / (last - first);
+    }
+
+    /* slowtty exits with its command, we drain what's left */
+    while (pty_read(fd, buf, sizeof buf, 1000) > 0)
+        continue;
+
+    struct rusage ru;
+    int           status;
+    while (wait4(pid, &status, 0, &ru) < 0 && errno == EINTR)
+        continue;
+    close(fd);
+    r->wall_ms = now_ms() - start;
+    r->cpu_ms  = ru.ru_utime.tv_sec * 1e3 + ru.ru_utime.tv_usec / 1e3
+               + ru.ru_stime.tv_sec * 1e3 + ru.ru_stime.tv_usec / 1e3;
+    double w = stats_wakeups(stats);
+    r->wakeups = w >= 0 && r->wall_ms > 0 ? w * 1e3 / r->wall_ms : -1;
+    unlink(stats);
+
+    if (got < total)
+        fprintf(stderr, "%s/%lu/%s: got %ld bytes of %ld\n",
+            prod, baud, frame, got, total);
+    if (n_lat > 0) {
+        qsort(lat, n_lat, sizeof *lat, by_value);
+        r->lat[0] = lat[(n_lat - 1) * 50 / 100];
+        r->lat[1] = lat[(n_lat - 1) * 90 / 100];
+        r->lat[2] = lat[(n_lat - 1) * 99 / 100];
+    }
+    free(lat);
+} /* run_case */
+
+/* print a value, or nothing if not available */
+static void
+csv(
+        double      v,
+        const char *sep)
+{
+    if (v >= 0)
+        printf("%.3f", v);
+    printf("%s", sep);
+} /* csv */
+
+int main(int argc, char **argv)
+{
+    int   opt;
+    char *bauds  = DEFAULT_BAUDS,
+         *frames = DEFAULT_FRAMES,
+         *prods  = DEFAULT_PRODUCERS;
+
+    self = argv[0];
+    while ((opt = getopt(argc, argv, "+b:c:Pp:x:")) != EOF) {
+        switch (opt) {
+        case 'b': bauds   = optarg; break;
+        case 'c': frames  = optarg; break;
+        case 'p': prods   = optarg; break;
+        case 'x': slowtty = optarg; break;
+        case 'P': return producer(argc - optind, argv + optind);
+        default:
+            fprintf(stderr, "usage: %s [-b baud,...] [-c frame,...]"
+                " [-p bulk,echo,tui] [-x slowtty]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        } /* switch */
+    } /* while */
+
+    /* we run ourselves as the producer, with a full path, as
+     * slowtty runs it with execvp(3) */
+    static char path[4096];
+    if (!strchr(self, '/') || !realpath(self, path))
+        ERR("%s: run me with a path (e.g. ./slowbench)\n", self);
+    self = path;
+
+    signal(SIGPIPE, SIG_IGN);
+    printf("producer,baud,frame,nominal_cps,achieved_cps,ratio,"
+        "lat_p50_ms,lat_p90_ms,lat_p99_ms,wakeups_per_s,"
+        "cpu_ms,wall_ms\n");
+    fflush(stdout);
+
+    char *pl = strdup(prods);
+    for (char *prod = strtok(pl, ","); prod; prod = strtok(NULL, ",")) {
+        if (       strcmp(prod, "bulk") != 0
+                && strcmp(prod, "echo") != 0
+                && strcmp(prod, "tui")  != 0)
+            ERR("%s: unknown producer\n", prod);
+
+        char *bl = strdup(bauds), *bs;
+        for (char *b = strtok_r(bl, ",", &bs); b; b = strtok_r(NULL, ",", &bs)) {
+            char *fl = strdup(frames), *fs;
+            for (char *f = strtok_r(fl, ",", &fs); f; f = strtok_r(NULL, ",", &fs)) {
+                struct result r;
+                tcflag_t      cflag;
+                unsigned long baud = strtoul(b, NULL, 10);
+
+                if (baud == 0)
+                    ERR("%s: invalid baudrate\n", b);
+                if (frame_bits(f, &cflag) < 0)
+                    ERR("%s: invalid frame format\n", f);
+
+                run_case(prod, baud, f, &r);
+                printf("%s,%lu,%s,", prod, baud, f);
+                csv(r.nominal, ",");
+                csv(r.achieved, ",");
+                csv(r.achieved >= 0 ? r.achieved / r.nominal : -1, ",");
+                csv(r.lat[0], ",");
+                csv(r.lat[1], ",");
+                csv(r.lat[2], ",");
+                csv(r.wakeups, ",");
+                csv(r.cpu_ms, ",");
+                csv(r.wall_ms, "\n");
+                fflush(stdout);
+            }
+            free(fl);
+        }
+        free(bl);
+    }
+    free(pl);
+    return EXIT_SUCCESS;
+} /* main */
@@ -0,0 +1,169 @@
+/* slowtrace.c -- decode the binary trace written by slowtty -T
+ * into text.  The events of all the threads are printed in time
+ * order, with the time relative to the first one.
+ * Author: Luis Colorado <luiscoloradourcola@gmail.com>
+ * Copyright: (C) 2015-2025 LUIS COLORADO.  All rights reserved.
+ * License: BSD.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+#define F(_fmt) "%s:%d: " _fmt, __FILE__, __LINE__
+
+static const char *names[] = {
+#define X(_ev, _fmt) #_ev,
+    TRACE_EVENTS
+#undef X
+};
+
+static const char *fmts[] = {
+#define X(_ev, _fmt) _fmt,
+    TRACE_EVENTS
+#undef X
+};
+
+/* an event, and the thread it comes from */
+struct event {
+    const struct trace_rec *r;
+    int                     thr;
+};
+
+/* names of the channels, from the TRC_CHAN events */
+struct chan {
+    uint64_t    chan;
+    char        name[9];
+};
+
+static struct chan *chans;
+static size_t       n_chans;
+
+static int
+by_time(
+        const void *a,
+        const void *b)
+{
+    const struct event *ea = a,
+                       *eb = b;
+
+    if (ea->r->ts != eb->r->ts)
+        return ea->r->ts < eb->r->ts ? -1 : 1;
+    return ea->thr - eb->thr;
+} /* by_time */
+
+static const char *
+chan_name(
+        uint64_t chan)
+{
+    static char buf[24];
+
+    for (size_t i = n_chans; i-- > 0;)
+        if (chans[i].chan == chan)
+            return chans[i].name;
+    snprintf(buf, sizeof buf, "%#llx", (unsigned long long) chan);
+    return buf;
+} /* chan_name */
+
+int main(int argc, char **argv)
+{
+    struct stat st;
+
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s tracefile\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    int fd = open(argv[1], O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        fprintf(stderr, F("%s: ERROR %d: %s\n"),
+            argv[1], errno, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    if (st.st_size < sizeof (struct trace_hdr)) {
+        fprintf(stderr, F("%s: not a trace file\n"), argv[1]);
+        exit(EXIT_FAILURE);
+    }
+    const char *base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED,
+            fd, 0);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, F("%s: mmap: ERROR %d: %s\n"),
+            argv[1], errno, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    const struct trace_hdr *h = (const struct trace_hdr *) base;
+    if (       memcmp(h->magic, TRACE_MAGIC, sizeof h->magic) != 0
+            || h->version != TRACE_VERSION
+            || h->ring    != TRACE_RING)
+    {
+        fprintf(stderr, F("%s: not a trace file, or of other "
+            "version\n"), argv[1]);
+        exit(EXIT_FAILURE);
+    }
+
+    /* the file can still be growing, only the slots we see */
+    uint32_t n_threads = h->n_threads;
+    if (h->hdr_size + (off_t) n_threads * h->slot_size > st.st_size)
+        n_threads = (st.st_size - h->hdr_size) / h->slot_size;
+
+    struct event *evs = calloc((size_t) n_threads * TRACE_RING + 1,
+            sizeof *evs);
+    size_t        n   = 0;
+    if (!evs) {
+        fprintf(stderr, F("calloc: ERROR %d: %s\n"),
+            errno, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    for (uint32_t t = 0; t < n_threads; t++) {
+        const struct trace_slot *s = (const struct trace_slot *)
+            (base + h->hdr_size + (off_t) t * h->slot_size);
+        uint64_t head  = s->head,
+                 first = head > TRACE_RING ? head - TRACE_RING : 0;
+
+        for (uint64_t i = first; i < head; i++) {
+            const struct trace_rec *r = s->rec + i % TRACE_RING;
+
+            /* overwritten while we were reading */
+            if (r->seq != (uint32_t) i || r->ev >= TRC_N)
+                continue;
+            evs[n].r   = r;
+            evs[n].thr = t;
+            n++;
+        }
+    }
+    qsort(evs, n, sizeof *evs, by_time);
+
+    for (size_t i = 0; i < n; i++) {
+        const struct trace_rec *r = evs[i].r;
+        uint64_t dt = r->ts - evs[0].r->ts;
+
+        if (r->ev == TRC_CHAN) {
+            struct chan *p = realloc(chans, (n_chans + 1) * sizeof *p);
+            if (p) {
+                chans = p;
+                p += n_chans++;
+                p->chan = r->chan;
+                memcpy(p->name, &r->a[0], 8);
+                p->name[8] = '\0';
+            }
+        }
+        printf("%5llu.%09llu T%d %-10s %s: ",
+            (unsigned long long) dt / 1000000000,
+            (unsigned long long) dt % 1000000000,
+            evs[i].thr, names[r->ev], chan_name(r->chan));
+        if (r->ev == TRC_CHAN)
+            printf(fmts[r->ev], (const char *) &r->a[0]);
+        else
+            printf(fmts[r->ev],
+                (long long) r->a[0],
+                (long long) r->a[1],
+                (long long) r->a[2]);
+        printf("\n");
+    }
+    return EXIT_SUCCESS;
+} /* main */
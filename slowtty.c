@@ -15,7 +15,6 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
-#include <pthread.h>
 #include <pwd.h>
 #include <signal.h>
 #include <stdio.h>
@@ -34,9 +33,42 @@
 #include "ring.h"
 #include "slowtty.h"
 #include "delay.h"
+#include "rec.h"
+#include "speed.h"
+#include "scan.h"
+#include "trace.h"
 
 
-#define MIN_BUFFER      8
+#define DO_FINISH_ITER  6 /* six ticks without data */
+
+/* As we cannot be notified of all the changes to the line
+ * parameters of the slave, we recheck them with this period (in
+ * seconds) while the channel is active (never while it is
+ * idle) */
+#define LINE_RECHECK_SECS   (1)
+
+/* retries to write the rest of a window the destination didn't
+ * accept, in a tic, and minimum interval between them. */
+#define RETRY_PER_TIC       (4)
+#define RETRY_MIN_NSEC      (1000000)
+
+/* bytes buffered at most while the screen is diffed (see
+ * pi_screen()), as many as the source writes in a tick */
+#define SCREEN_IN_MAX       (1 << 16)
+
+/* the settings of the pty pi_scan() needs, packed in a word
+ * (see pi_scan_pack()), so they are passed atomically from the
+ * emitter to the ingestion side: the chars, 8 bits each, ... */
+#define SCAN_START          (0)
+#define SCAN_STOP           (1)
+#define SCAN_NCC            (5)     /* with VINTR, VQUIT and VSUSP */
+#define SCAN_CHAR(_k, _i)   ((unsigned char) ((_k) >> ((_i) * 8)))
+#define SCAN_HAS(_i)        (1ULL << (40 + (_i)))
+                                    /* ... if they are acted upon ... */
+#define SCAN_IXON           (1ULL << 45)
+                                    /* ... and the flags */
+#define SCAN_IXANY          (1ULL << 46)
+#define SCAN_FLUSH          (1ULL << 47)    /* ISIG and not NOFLSH */
 
 #define MIN(_a, _b) ((_a)<(_b) ? (_a) : (_b))
 
@@ -44,156 +76,1335 @@ int ptym, ptys;
 
 /* to recover at the end and pass config to slave at beginning */
 
-/**
- * this routine is called on each thread to pass the data up or
- * down the channel.  The thread goes in a loop until it is
- * cancelled from main() in which a delay of 1/25th s. is
- * scheduled and the number of chars allowed to pass in such
- * interval is calculated.  This is the window of the tick
- * interval.  If the window is zero, we cannot pass any data on
- * this tick and so, nothing is done on this pass.
- *
- * if the window is greater than zero, a number or characters not
- * less than MIN_BUFFER and no more of one of the buffer capacity
- * less the buffer size of two windows is read (this is made to
- * buffer a small amount of characters in order to process
- * interrupt as fast as possible, and send a XOFF back to the
- * origin if more than two windows are buffered for output.
- * In case the buffer size descends below the window size, an
- * XON character is written back to the source in order to
- * restart the flow of characters from the source.
- * A number of characters (the buffer size or the window, which
- * is less) is written to the output side of the channel, so at
- * maximum, window chars are output per tick.
- *
- * @param pi is a reference to the thread global data to use.
- */
+/* INGESTION SIDE.  These routines run on pi->in_loop. */
+
+/* Tell the emitter to discard all the data read so far, as the
+ * pty discarded it.  The channels of a pty share the ingestion
+ * loop, so this can be done on both.
+ *
+ * @param pi is a reference to the channel. */
+static void
+pi_flush(
+        struct pthread_info *pi)
+{
+    __atomic_store_n(&pi->flush_to, pi->in_total, __ATOMIC_RELAXED);
+    __atomic_store_n(&pi->flush, TRUE, __ATOMIC_RELEASE);
+    loop_post(pi->loop, &pi->wake);
+} /* pi_flush */
+
+/* What the line discipline of the pty does with the user input
+ * (see pi_scan()), as pi_scan_init() gets it from the settings
+ * published by the emitter (see pi_scan_pack()). */
+struct pi_scan {
+    struct pthread_info
+                   *pi;
+    const struct scan_set
+                   *set;        /* the chars acted upon */
+    int             start,      /* VSTART and VSTOP, -1 if not IXON */
+                    stop;
+    int             ixon,       /* IXON ... */
+                    ixany;      /* ... and any char restarts the
+                                 * output */
+    int             intr;       /* an interrupt char was found ... */
+    int             flush;      /* ... and the output is flushed */
+};
+
+/* Get the settings of the pty for pi_scan().  They are not taken
+ * from the pty here, that would be a syscall on each read, but
+ * from the last ones the emitter saw, which rechecks them as it
+ * does with the line parameters (see pi_line_reload()).  The set
+ * of chars is only built again when they change.
+ *
+ * @param pi is a reference to the channel.
+ * @param sc where to store them.
+ * @return nonzero if there are chars to look for. */
+static int
+pi_scan_init(
+        struct pthread_info *pi,
+        struct pi_scan      *sc)
+{
+    uint64_t k = __atomic_load_n(&pi->line_scan, __ATOMIC_ACQUIRE);
+
+    if (k != pi->scan_key) {
+        scan_init(&pi->scan);
+        for (int i = 0; i < SCAN_NCC; i++)
+            if (k & SCAN_HAS(i))
+                scan_add(&pi->scan, SCAN_CHAR(k, i));
+        pi->scan_key = k;
+    }
+    memset(sc, 0, sizeof *sc);
+    sc->pi    = pi;
+    sc->set   = &pi->scan;
+    sc->start = k & SCAN_HAS(SCAN_START) ? SCAN_CHAR(k, SCAN_START) : -1;
+    sc->stop  = k & SCAN_HAS(SCAN_STOP)  ? SCAN_CHAR(k, SCAN_STOP)  : -1;
+    sc->ixon  = (k & SCAN_IXON)  != 0;
+    sc->ixany = (k & SCAN_IXANY) != 0;
+    sc->flush = (k & SCAN_FLUSH) != 0;
+    return pi->scan.n > 0;
+} /* pi_scan_init */
+
+/* The output of the other channel is stopped, or restarted, by
+ * the user (VSTOP and VSTART), as a tty does with IXON set */
+static void
+pi_xoff(
+        struct pthread_info *pi,
+        int                  stop)
+{
+    struct pthread_info *out = pi->other;
+
+    if (stop == !!PI_TST(out, PIFLG_XOFF))
+        return;
+    LOG("%s: %s %s\r\n", pi->name,
+        stop ? "stopping" : "restarting", out->name);
+    if (stop) {
+        PI_SET(out, PIFLG_XOFF);
+    } else {
+        PI_CLR(out, PIFLG_XOFF);
+        loop_post(out->loop, &out->wake);
+    }
+} /* pi_xoff */
+
+/* Filter of the user input (see rb_read_filter()), before the
+ * emitter can see it.  VSTART and VSTOP are taken out of it, as
+ * the tty does when IXON is set, and the output is restarted or
+ * stopped here, instead of when they get through the line.  The
+ * interrupt chars are left in it, the pty sends the signal.
+ * Most reads have none of them, so the chars are searched with
+ * scan(). */
+static size_t
+pi_scan(
+        char                *p,
+        size_t               n,
+        void                *arg)
+{
+    struct pi_scan      *sc  = arg;
+    char                *w   = p;
+    const char          *q   = p,
+                        *end = p + n;
+
+    while (q < end) {
+        size_t k = scan(sc->set, q, end - q);
+
+        if (k > 0 && sc->ixany)
+            pi_xoff(sc->pi, FALSE);
+        if (w != q)
+            memmove(w, q, k);
+        w += k;
+        q += k;
+        if (q == end)
+            break;
+
+        int c = (unsigned char) *q++;
+        if (c == sc->stop
+                && (c != sc->start
+                    || !PI_TST(sc->pi->other, PIFLG_XOFF)))
+        {
+            pi_xoff(sc->pi, TRUE);
+        } else if (c == sc->start) {
+            pi_xoff(sc->pi, FALSE);
+        } else {
+            /* an interrupt char, it restarts the output too */
+            sc->intr = TRUE;
+            if (sc->ixon)
+                pi_xoff(sc->pi, FALSE);
+            *w++ = c;
+        }
+    }
+    return w - p;
+} /* pi_scan */
+
+/* Read from the source of the channel into the ring buffer.
+ * Sources in packet mode get status information in *ctl, and
+ * the emitter side is told what the child did: reload the line
+ * parameters, discard the data buffered (tcflush(3)) or
+ * stop/restart the output (tcflow(3)).
+ *
+ * @param pi is a reference to the channel.
+ * @param n is the number of bytes to read.
+ * @param sc the user input filter (see pi_scan()), or NULL.
+ * @param kept where to store the bytes stored in the ring buffer,
+ *        fewer than those read if sc took some out.
+ * @return the result of rb_read(), but EOF is returned as -1
+ *         with errno set to EIO, and status information
+ *         without data as -1 and errno EAGAIN. */
+static ssize_t
+pi_read(
+        struct pthread_info *pi,
+        size_t               n,
+        struct pi_scan      *sc,
+        size_t              *kept)
+{
+    unsigned char ctl = 0;
+    ssize_t res = pi->flags & PIFLG_PKT
+        ? rb_read_pkt(&pi->b, pi->from_fd, n, &ctl)
+        : sc
+        ? rb_read_filter(&pi->b, pi->from_fd, n, pi_scan, sc, kept)
+        : rb_read(&pi->b, pi->from_fd, n);
+
+    if (!sc)
+        *kept = res > 0 ? res : 0;
+
+    if (res == 0) {
+        if (ctl == 0) {
+            errno = EIO; /* EOF */
+            return -1;
+        }
+        /* only status, something changed on the slave side */
+        TRACE(TRC_STATUS, pi, ctl, 0, 0);
+        if (ctl & TIOCPKT_FLUSHWRITE)
+            pi_flush(pi); /* the output of the child */
+        if (ctl & TIOCPKT_FLUSHREAD && pi->other)
+            pi_flush(pi->other); /* the input typed ahead */
+        if (ctl & TIOCPKT_STOP)
+            PI_SET(pi, PIFLG_OSTOP);
+        if (ctl & TIOCPKT_START)
+            PI_CLR(pi, PIFLG_OSTOP);
+        __atomic_store_n(&pi->line_dirty, TRUE, __ATOMIC_RELEASE);
+        loop_post(pi->loop, &pi->wake);
+        errno = EAGAIN;
+        return -1;
+    }
+    return res;
+} /* pi_read */
+
+/* Room left in the buffer.  No more than the burst and a window
+ * are buffered (see delay()), the rest of the data stays in the
+ * source, so the kernel blocks the writer on the other side
+ * until we read again.  That's all the flow control we do. */
+static size_t
+pi_room(
+        struct pthread_info *pi)
+{
+    size_t max  = __atomic_load_n(&pi->in_max, __ATOMIC_SEQ_CST);
+    size_t size = RB_SIZE(&pi->b);
+
+    if (max == 0 || max > pi->b.rb_cap)
+        max = pi->b.rb_cap;
+    return size < max ? max - size : 0;
+} /* pi_room */
+
+/* There's no room in the buffer, stop reading until the
+ * emitter makes some (see pi_resume()) */
+static void
+pi_stall(
+        struct pthread_info *pi)
+{
+    loop_mod(pi->in_loop, &pi->src, 0);
+    __atomic_store_n(&pi->stalled, TRUE, __ATOMIC_SEQ_CST);
+    STATS_ADD(pi->st, stalls, 1);
+    TRACE(TRC_STALL, pi, RB_SIZE(&pi->b), 0, 0);
+
+    /* while the buffer has data, the emitter is active and sees
+     * stalled on its next write, but it could have written
+     * before we set it. */
+    if (       pi_room(pi) > 0
+            && __atomic_exchange_n(&pi->stalled, FALSE,
+                    __ATOMIC_SEQ_CST))
+        loop_mod(pi->in_loop, &pi->src, LOOP_IN);
+} /* pi_stall */
+
+/* The user has typed an interrupt char, so the output of the
+ * other channel is discarded, as a real tty does (unless NOFLSH
+ * is set), instead of pacing out what was buffered before it.
+ * The data still in the pty is flushed here, and the data in
+ * the ring buffer by its emitter, before the interrupt char is
+ * written, as the wake of the other channel is posted first. */
+static void
+pi_interrupt(
+        struct pthread_info *pi)
+{
+    struct pthread_info *out = pi->other;
+
+    LOG("%s: interrupt char, flushing %s\r\n", pi->name, out->name);
+    if (tcflush(out->from_fd, TCIFLUSH) < 0) {
+        LOG("%s: tcflush" ERRNO "\r\n", out->name, EPMTS);
+    }
+    pi_flush(out);
+} /* pi_interrupt */
+
+/* Data is available on from_fd.  We read as much as the
+ * buffer allows, and wake the emitter up if it was idle. */
+static void
+pi_readable(
+        struct loop_src *src,
+        int              events)
+{
+    struct pthread_info *pi = src->data;
+    size_t room = pi_room(pi);
+    struct pi_scan sc;
+    size_t kept;
+
+    if (room == 0) {
+        /* buffer full, stop reading until we have room, or we
+         * would take the zero bytes read as an EOF */
+        pi_stall(pi);
+        return;
+    }
+
+    ssize_t res = pi_read(pi, room,
+            pi->flags & PIFLG_INTR && pi_scan_init(pi, &sc)
+                ? &sc
+                : NULL,
+            &kept);
+
+    if (res < 0 && (errno == EIO || errno == ECONNRESET)) {
+        /* EIO is what we get from the master side of the pty
+         * once the slave side has been closed by all processes
+         * (ECONNRESET from a network peer that aborted) */
+        LOG("%s: rb_read: EOF on input\r\n", pi->name);
+        loop_del(pi->in_loop, &pi->src);
+        PI_CLR(pi, PIFLG_OSTOP); /* nobody is going to restart it */
+        if (pi->flags & PIFLG_INTR)
+            pi_xoff(pi, FALSE);  /* nor the user, without input */
+        PI_SET(pi, PIFLG_EOF);
+        loop_post(pi->loop, &pi->wake);
+        return;
+    } else if (res < 0 && errno == ENOSPC) {
+        pi_stall(pi); /* see rb_read() */
+        return;
+    } else if (res < 0) {
+        if (errno == EAGAIN) {
+            STATS_ADD(pi->st, rd_eagain, 1);
+        } else if (errno != EINTR) {
+            ERR("%s: rb_read" ERRNO "\r\n", pi->name, EPMTS);
+        }
+        return;
+    }
+
+    /* good read */
+    TRACE(TRC_READ, pi, res, room, RB_SIZE(&pi->b));
+    pi->in_total += kept; /* what the emitter gets (see pi_flush()) */
+    STATS_ADD(pi->st, bytes_in, kept);
+    STATS_MAX(pi->st, buf_hiwat, RB_SIZE(&pi->b));
+
+    if (pi->flags & PIFLG_INTR && sc.intr && sc.flush)
+        pi_interrupt(pi);
+
+    /* the emitter clears PIFLG_ACTIVE before checking for more
+     * data (see pi_idle()), so one of both sees the other. */
+    if (!PI_TST(pi, PIFLG_ACTIVE))
+        loop_post(pi->loop, &pi->wake);
+
+    /* buffer full, stop reading until we have room */
+    if (pi_room(pi) == 0)
+        pi_stall(pi);
+} /* pi_readable */
+
+/* the emitter has made room in the buffer, or needs rb_sync() */
+static void
+pi_resume(
+        struct loop_post *p)
+{
+    struct pthread_info *pi = p->data;
+
+    TRACE(TRC_RESUME, pi, 0, 0, 0);
+    rb_sync(&pi->b);
+    if (!PI_TST(pi, PIFLG_EOF))
+        loop_mod(pi->in_loop, &pi->src, LOOP_IN);
+} /* pi_resume */
+
+static void
+pi_register(
+        struct loop_post *p)
+{
+    struct pthread_info *pi = p->data;
+
+    if (loop_add(pi->in_loop, &pi->src) < 0) {
+        ERR("%s: loop_add" ERRNO "\r\n", pi->name, EPMTS);
+    }
+} /* pi_register */
+
+/* EMITTER SIDE.  These routines run on pi->loop. */
+
+/* the frame bits of cflag */
+#define FRAME_CFLAG (CSIZE | PARENB | PARODD | CSTOPB)
+
+/* apply the parameters set from the control socket */
+static void
+pi_line_ovr(
+        struct pthread_info *pi)
+{
+    if (pi->ovr_baud)
+        pi->line.baud  = pi->ovr_baud;
+    if (pi->ovr_cflag)
+        pi->line.cflag = (pi->line.cflag & ~FRAME_CFLAG)
+                       | (pi->ovr_cflag  &  FRAME_CFLAG);
+} /* pi_line_ovr */
+
+/* set the line parameters of a channel, at the speed of its
+ * direction: the input (the user input, PIFLG_INTR) goes at the
+ * input speed of the line, the output at the output speed. */
+static void
+pi_line_set(
+        struct pthread_info    *pi,
+        const struct termios   *t,
+        const unsigned long    *speeds, /* input, output, or NULL */
+        time_t                  chk)
+{
+    int input = PI_TST(pi, PIFLG_INTR) != 0;
+    unsigned long override = input ? ibaud_override : baud_override;
+
+    delay_line(&pi->line, t, input);
+    if (speeds) /* speeds without a Bxxx constant */
+        pi->line.baud = speeds[input ? 0 : 1];
+    if (override)
+        pi->line.baud = override;
+    pi_line_ovr(pi);
+    pi->line_chk = chk;
+} /* pi_line_set */
+
+/* Get the size of the terminal the channel writes to, the one
+ * of the pty, if there's one.
+ *
+ * @param pi the channel.
+ * @param ws where to return it, zero if not known. */
+static void
+pi_winsize(
+        struct pthread_info *pi,
+        struct winsize      *ws)
+{
+    int fd = pi->line_fd >= 0 ? pi->line_fd : pi->to_fd;
+
+    if (ioctl(fd, TIOCGWINSZ, ws) < 0)
+        ws->ws_row = ws->ws_col = 0;
+} /* pi_winsize */
+
+/* Get the size of the terminal the channel writes to, for the
+ * optimizer and the screen, and for the latter whether LF is
+ * written as CR LF.  They are not read on each tick, but with
+ * the line parameters and when the window is resized (see
+ * pi_resize()).
+ *
+ * @param pi the channel. */
+static void
+pi_term_reload(
+        struct pthread_info *pi)
+{
+    struct winsize ws;
+    struct termios t;
+
+    if (!pi->opt && !pi->scr)
+        return;
+    pi_winsize(pi, &ws);
+    if (pi->opt)
+        opt_size(pi->opt, ws.ws_row, ws.ws_col);
+    if (!pi->scr)
+        return;
+    if (       ws.ws_row > 0 && ws.ws_col > 0
+            && (ws.ws_row != pi->scr->rows || ws.ws_col != pi->scr->cols)
+            && scr_resize(pi->scr, ws.ws_row, ws.ws_col) < 0)
+    {
+        WARN("%s: screen" ERRNO "\r\n", pi->name, EPMTS);
+    }
+    if (tcgetattr(pi->to_fd, &t) == 0)
+        pi->scr->onlcr = pi->shown->onlcr
+                       = (t.c_oflag & (OPOST | ONLCR)) == (OPOST | ONLCR);
+} /* pi_term_reload */
+
+/* pack the settings of the pty for pi_scan_init() */
+static uint64_t
+pi_scan_pack(
+        const struct termios   *t)
+{
+    static const int cc[SCAN_NCC] = {
+        [SCAN_START] = VSTART, [SCAN_STOP] = VSTOP,
+        VINTR, VQUIT, VSUSP,
+    };
+    uint64_t k = 0;
+
+    for (int i = 0; i < SCAN_NCC; i++) {
+        int on = i == SCAN_START || i == SCAN_STOP
+            ? (t->c_iflag & IXON) != 0
+            : (t->c_lflag & ISIG) != 0;
+
+        if (on && t->c_cc[cc[i]] != _POSIX_VDISABLE)
+            k |= (uint64_t) t->c_cc[cc[i]] << (i * 8) | SCAN_HAS(i);
+    }
+    if (t->c_iflag & IXON)
+        k |= SCAN_IXON;
+    if (t->c_iflag & IXON && t->c_iflag & IXANY)
+        k |= SCAN_IXANY;
+    if (t->c_lflag & ISIG && !(t->c_lflag & NOFLSH))
+        k |= SCAN_FLUSH;
+    return k;
+} /* pi_scan_pack */
+
 void
-pass_data(
+pi_line_reload(
         struct pthread_info *pi)
 {
-    LOG("%s: START\n", pi->name);
-    for (;;) {
-
-        /* window is the number of characters we can write
-         * in this loop pass. */
-        int window = delay(pi); /* do the delay. */
-
-        LOG("%s: window = %d\r\n", pi->name, window);
-
-        if (window == 0) {
-            /* nothing to do, wait until we have some window */
-            continue;
-        }
-
-        /* we try to fill the full buffer every time. */
-
-        /* READ TO FILL THE BUFFER UP TO TWO COMPLETE
-         * WINDOWS, OR AT LEAST MIN_BUFFER CHARS. */
-        ssize_t to_read = 2 * window;
-        if (to_read < MIN_BUFFER)
-            to_read = MIN_BUFFER;
-        if (to_read > RB_BUFFER_SIZE)
-            to_read = RB_BUFFER_SIZE;
-        to_read -= pi->b.rb_size;
-        if (to_read < 0)
-            to_read = 0;
-        if (to_read > 0) {
-            ssize_t res = rb_read(&pi->b,
-                    pi->from_fd, RB_BUFFER_SIZE);
-
-            if (res == 0) {
-                LOG("%s: rb_read: EOF on input\n", pi->name);
-                break;
-            } else if (res < 0) {
-                if (errno != EAGAIN && errno != EINTR) {
-                    ERR("%s: rb_read" ERRNO "\n", pi->name, EPMTS);
-                    break;
-                }
-                res = 0;
-            }
+    struct termios t;
+    unsigned long  speeds[2];
+    int            have_speeds;
+
+    pi_term_reload(pi);
+    if (pi->line_fd < 0)
+        return; /* fixed parameters, no tty */
+
+    if (tcgetattr(pi->line_fd, &t) < 0) {
+        WARN("%s: tcgetattr" ERRNO "\r\n", pi->name, EPMTS);
+        return;
+    }
+    have_speeds = tty_speeds(pi->line_fd, &speeds[0], &speeds[1]) == 0;
+
+    pi_line_set(pi, &t, have_speeds ? speeds : NULL, pi->tic.tv_sec);
+    if (pi->other && pi->other->line_fd == pi->line_fd)
+        pi_line_set(pi->other, &t, have_speeds ? speeds : NULL,
+            pi->tic.tv_sec);
+
+    /* and what the user input has to be scanned for.  The output
+     * channel gets here too, so a program that changes them (an
+     * editor switching to raw mode) and writes something has them
+     * passed to the input at once, even if the user is idle. */
+    struct pthread_info *in = PI_TST(pi, PIFLG_INTR) ? pi : pi->other;
+    if (in && PI_TST(in, PIFLG_INTR) && in->line_fd == pi->line_fd)
+        __atomic_store_n(&in->line_scan, pi_scan_pack(&t),
+            __ATOMIC_RELEASE);
+} /* pi_line_reload */
+
+void
+pi_override(
+        struct pthread_info *pi,
+        unsigned long        baud,
+        tcflag_t             cflag)
+{
+    if (baud)
+        pi->ovr_baud  = baud;
+    if (cflag)
+        pi->ovr_cflag = cflag;
+    pi_line_ovr(pi); /* delay() gets it on the next tick */
+    LOG("%s: override baud=%lu, cflag=%#lx\r\n",
+        pi->name, pi->line.baud, (unsigned long) pi->line.cflag);
+} /* pi_override */
+
+void
+pi_pause(
+        struct pthread_info *pi,
+        int                  pause)
+{
+    if (pause) {
+        PI_SET(pi, PIFLG_PAUSE); /* pass_data() stops */
+    } else if (PI_TST(pi, PIFLG_PAUSE)) {
+        PI_CLR(pi, PIFLG_PAUSE);
+        loop_post(pi->loop, &pi->wake);
+    }
+} /* pi_pause */
 
-            /* good read */
-            LOG("%s: rb_read(&pi->b, pi->from_fd=%d, "
-                    "to_fill=%u) => %zd\r\n",
-                pi->name, pi->from_fd, RB_BUFFER_SIZE, res);
+void
+pi_resize(
+        struct pthread_info *pi)
+{
+    pi_term_reload(pi);
+} /* pi_resize */
+
+/* discard the output of the optimizer, with the data */
+static size_t
+pi_opt_discard(
+        struct pthread_info *pi)
+{
+    struct iovec iov;
+    size_t       n = 0;
+
+    if (pi->opt) {
+        n = opt_peek(pi->opt, &iov);
+        opt_discard(pi->opt);
+    }
+    return n;
+} /* pi_opt_discard */
+
+size_t
+pi_discard(
+        struct pthread_info *pi)
+{
+    size_t n = rb_discard(&pi->b, RB_SIZE(&pi->b));
+
+    pi->out_total += n;
+    n += pi_opt_discard(pi);
+    STATS_ADD(pi->st, bytes_flushed, n);
+    TRACE(TRC_FLUSH, pi, n, 0, 0);
+    if (       n > 0
+            && __atomic_exchange_n(&pi->stalled, FALSE,
+                    __ATOMIC_SEQ_CST))
+        loop_post(pi->in_loop, &pi->resume);
+    return n;
+} /* pi_discard */
+
+/* The first n chars of iov leave the buffer to the terminal, the
+ * screen followed gets them.
+ *
+ * @param pi the channel.
+ * @param iov the chars, in one or two pieces.
+ * @param niov the number of pieces.
+ * @param n the number of chars. */
+static void
+pi_screen_feed(
+        struct pthread_info    *pi,
+        const struct iovec     *iov,
+        int                     niov,
+        size_t                  n)
+{
+    struct iovec v[2];
+
+    v[0] = iov[0];
+    if (n <= v[0].iov_len) {
+        v[0].iov_len = n;
+        niov = 1;
+    } else {
+        v[1] = iov[1];
+        v[1].iov_len = n - v[0].iov_len;
+    }
+    scr_feed(pi->scr, v, niov);
+} /* pi_screen_feed */
+
+/* The chars still to send, buffered, in the optimizer or in the
+ * diff of the screen (or a diff to make).  If no more data is
+ * coming, what the optimizer holds is written.
+ *
+ * @param pi the channel.
+ * @return the number of chars, not zero if something is held. */
+static size_t
+pi_pending(
+        struct pthread_info *pi)
+{
+    size_t n = RB_SIZE(&pi->b);
+
+    if (pi->opt) {
+        if (n == 0 && (PI_TST(pi, PIFLG_EOF) || pi->do_finish))
+            opt_flush(pi->opt, TRUE);
+        n += opt_pending(pi->opt);
+    }
+    if (pi->scr) {
+        n += pi->scr_out.len - pi->scr_out.off;
+        if (PI_TST(pi, PIFLG_DIFF) && pi->scr_fed > 0)
+            n++;
+    }
+    return n;
+} /* pi_pending */
+
+/* the channel has finished */
+static void
+pi_done(
+        struct pthread_info *pi)
+{
+    PI_CLR(pi, PIFLG_ACTIVE);
+    PI_SET(pi, PIFLG_DONE);
+    if (pi->on_done)
+        pi->on_done(pi);
+} /* pi_done */
+
+/* Called when the ring buffer gets empty.  The pacing timer
+ * is not rearmed, so an idle channel doesn't wake up at all,
+ * until the ingestion side gets some data from from_fd.
+ *
+ * @param pi is a reference to the channel. */
+static void
+pi_idle(
+        struct pthread_info *pi)
+{
+    TRACE(TRC_IDLE, pi, 0, 0, 0);
+    PI_CLR(pi, PIFLG_ACTIVE);
+
+    if (pi_pending(pi) > 0) {
+        /* data arrived after our last write, and the ingestion
+         * side saw us active, so it didn't wake us up. */
+        PI_SET(pi, PIFLG_ACTIVE);
+        loop_timer_arm(pi->loop, &pi->tim, &pi->tic);
+        return;
+    }
+    if (       pi->do_finish
+            && !PI_TST(pi, PIFLG_EOF)
+            && --pi->do_finish)
+    {
+        /* the source can be blocked (we could have just made
+         * room for it) so we wait some ticks for data before
+         * finishing. */
+        LOG("%s: do_finish, %d ticks to go\r\n",
+            pi->name, pi->do_finish);
+        PI_SET(pi, PIFLG_ACTIVE);
+        loop_timer_arm(pi->loop, &pi->tim, &pi->tic);
+        return;
+    }
+    if (pi->do_finish || PI_TST(pi, PIFLG_EOF)) {
+        if (pi->lag.len > 0)
+            return; /* pi_arrive() finishes it */
+        LOG("%s: do_finish && b.rb_size == 0 "
+            "=> FINISH\r\n",
+            pi->name);
+        pi_done(pi);
+    }
+} /* pi_idle */
+
+/* Write chars to to_fd, or send them through a line with
+ * latency.  In the latter case they are written to to_fd when
+ * they get there (see pi_arrive()), and no more than the chars
+ * the line sends in its latency (and a burst) can be in flight.
+ *
+ * @param pi the channel.
+ * @param iov the chars, in one or two pieces (they can be cut).
+ * @param niov the number of pieces.
+ * @param now the time they are sent.
+ * @return the number of chars written or sent, or -1 and errno
+ *         set (EAGAIN if there are too many in flight). */
+static ssize_t
+pi_emit(
+        struct pthread_info    *pi,
+        struct iovec           *iov,
+        int                     niov,
+        const struct timespec  *now)
+{
+    size_t n = iov[0].iov_len + (niov > 1 ? iov[1].iov_len : 0);
+
+    if (!pi->lag.lat_ns && !pi->lag.jit_ns) {
+        long    ev  = pi->rec_ev ? rec_begin(pi->rec_ev, iov, niov) : -1;
+        ssize_t res = writev(pi->to_fd, iov, niov);
+        if (pi->rec_ev)
+            rec_end(ev, res > 0 ? res : 0);
+        return res;
+    }
+
+    unsigned long long cps = pi->line.baud / delay_bits(&pi->line);
+    size_t             max = __atomic_load_n(&pi->in_max, __ATOMIC_SEQ_CST)
+                           + cps * (pi->lag.lat_ns + pi->lag.jit_ns)
+                             / 1000000000;
+
+    if (pi->lag.len >= max) {
+        errno = EAGAIN;
+        return -1;
+    }
+    if (n > max - pi->lag.len) {
+        n = max - pi->lag.len;
+        if (n <= iov[0].iov_len) {
+            iov[0].iov_len = n;
+            niov = 1;
+        } else {
+            iov[1].iov_len = n - iov[0].iov_len;
         }
+    }
+    if (lag_put(&pi->lag, iov, niov, now) < 0) {
+        ERR("%s: lag" ERRNO "\r\n", pi->name, EPMTS);
+    }
+    if (!pi->lag_tim.heap_ix) /* not waiting for other chars */
+        loop_timer_arm(pi->loop, &pi->lag_tim, lag_next(&pi->lag));
+    return n;
+} /* pi_emit */
 
-        clock_gettime(CLOCK_REALTIME, &pi->tic);
+/* Send chars of the buffer through a line with latency, they
+ * leave the buffer now, as they are sent (see pi_emit()), and the
+ * screen followed gets them.
+ *
+ * @param pi the channel.
+ * @param n the number of chars to send.
+ * @param now the time they are sent.
+ * @return the number of chars sent, or -1 and errno set. */
+static ssize_t
+pi_send(
+        struct pthread_info    *pi,
+        size_t                  n,
+        const struct timespec  *now)
+{
+    struct iovec iov[2];
+    int          niov = rb_peekv(&pi->b, iov, n);
+    ssize_t      res  = pi_emit(pi, iov, niov, now);
 
-        if (   pi->do_finish
-            && pi->b.rb_size == 0
-            && !--pi->do_finish)
-        {
-            LOG("%s: do_finish && b.rb_size == 0 "
-                "=> FINISH\r\n",
-                pi->name);
-            break;
+    if (res > 0) {
+        if (pi->scr)
+            pi_screen_feed(pi, iov, niov, res);
+        rb_discard(&pi->b, res);
+    }
+    return res;
+} /* pi_send */
+
+/* Pass the data buffered through the optimizer of the output (see
+ * opt.h), no more than the line can send in this tick, so it
+ * doesn't look further than the data that would be sent anyway.
+ * What it holds is written when the buffer gets empty.
+ *
+ * @param pi the channel. */
+static void
+pi_optimize(
+        struct pthread_info *pi)
+{
+    struct iovec   iov[2];
+    size_t         size = RB_SIZE(&pi->b),
+                   out  = opt_peek(pi->opt, iov);
+
+    if (size > 0 && out < pi->tokens) {
+        int    niov = rb_peekv(&pi->b, iov, MIN(size, pi->tokens - out));
+        size_t n    = opt_feed(pi->opt, iov, niov);
+
+        if (pi->scr && n > 0)
+            pi_screen_feed(pi, iov, niov, n);
+        rb_discard(&pi->b, n);
+        pi->out_total += n;
+        size          -= n;
+        if (       n > 0
+                && __atomic_load_n(&pi->stalled, __ATOMIC_SEQ_CST)
+                && __atomic_exchange_n(&pi->stalled, FALSE,
+                        __ATOMIC_SEQ_CST))
+            loop_post(pi->in_loop, &pi->resume);
+    }
+    if (size == 0)
+        opt_flush(pi->opt, PI_TST(pi, PIFLG_EOF) || pi->do_finish);
+    STATS_SET(pi->st, opt_saved, pi->opt->saved);
+} /* pi_optimize */
+
+/* The backlog over which the output is sent as diffs of the
+ * screen: the chars the line sends in screen_msecs.
+ *
+ * @param pi the channel.
+ * @return the number of chars. */
+static size_t
+pi_screen_max(
+        struct pthread_info *pi)
+{
+    return (unsigned long long) pi->line.baud * screen_msecs
+         / (delay_bits(&pi->line) * 1000ULL);
+} /* pi_screen_max */
+
+/* Set the bytes buffered at most: the burst and a window of the
+ * line (see delay()), but, if the screen is followed, no less
+ * than the backlog of pi_screen_max() and a window, so it can be
+ * seen in the buffer, and, while the screen is diffed, all that
+ * the source writes in a tick, so it is not stopped.
+ *
+ * @param pi the channel. */
+static void
+pi_in_max(
+        struct pthread_info *pi)
+{
+    size_t max;
+
+    if (pi->den == 0)
+        return; /* delay() sets it */
+    max = pi->burst;
+    if (pi->scr && max < pi_screen_max(pi))
+        max = pi_screen_max(pi);
+    max += (pi->num + pi->den - 1) / pi->den;
+    if (max > RB_MAX_SIZE)
+        max = RB_MAX_SIZE;
+    if (PI_TST(pi, PIFLG_DIFF) && max < SCREEN_IN_MAX)
+        max = SCREEN_IN_MAX;
+    if (__atomic_load_n(&pi->in_max, __ATOMIC_SEQ_CST) != max) {
+        rb_want(&pi->b, max);
+        __atomic_store_n(&pi->in_max, max, __ATOMIC_SEQ_CST);
+    }
+} /* pi_in_max */
+
+/* Send the output as diffs of the screen (see scr_diff()) while
+ * the backlog is more than the line sends in screen_msecs, what
+ * is buffered, or the buffer is full.  Meanwhile, all the output
+ * is taken
+ * as it arrives, and a diff from the screen shown to the last one
+ * is made as soon as the one before is sent, so the terminal
+ * skips the screens it had no time to show.  When the backlog is
+ * under that again, and the terminal shows the last screen, the
+ * output is sent as it is.
+ *
+ * @param pi the channel. */
+static void
+pi_screen(
+        struct pthread_info *pi)
+{
+    struct scr_buf *b    = &pi->scr_out;
+    size_t          size = RB_SIZE(&pi->b),
+                    max  = pi_screen_max(pi);
+
+    /* the model gets the size and the settings of the terminal
+     * from pi_term_reload(), and the buffer has to hold the
+     * backlog, delay() doesn't know (see pi_in_max()) */
+    pi_in_max(pi);
+
+    /* the backlog is what is buffered, or more if the source is
+     * not read, the buffer full */
+    int behind  = size > 0
+               && (size >= max
+                || __atomic_load_n(&pi->stalled, __ATOMIC_SEQ_CST)),
+        drained = b->off == b->len;
+
+    if (!PI_TST(pi, PIFLG_DIFF)) {
+        if (!behind)
+            return;
+        /* what the optimizer holds is sent before the diffs */
+        if (pi->opt)
+            opt_flush(pi->opt, TRUE);
+        scr_passed(pi->scr);
+        if (scr_copy(pi->shown, pi->scr) < 0) {
+            WARN("%s: screen" ERRNO "\r\n", pi->name, EPMTS);
+            return;
         }
+        PI_SET(pi, PIFLG_DIFF);
+        pi_in_max(pi);
+        pi->scr_fed = 0;
+        LOG("%s: %zu bytes behind, sending the screen\r\n",
+            pi->name, size);
+    } else if (!behind && drained && pi->scr_fed == 0
+            && scr_ground(pi->scr))
+    {
+        /* the terminal shows the last screen */
+        PI_CLR(pi, PIFLG_DIFF);
+        pi_in_max(pi);
+        if (pi->opt)
+            opt_discard(pi->opt); /* it doesn't know the terminal */
+        LOG("%s: sending the output again\r\n", pi->name);
+        return;
+    }
+
+    /* take the output, it won't be sent */
+    if (behind || (drained && pi->scr_fed == 0)) {
+        struct iovec iov[2];
+        size_t       n = RB_SIZE(&pi->b);
+
+        if (n > 0) {
+            int niov = rb_peekv(&pi->b, iov, n);
+
+            scr_feed(pi->scr, iov, niov);
+            rb_discard(&pi->b, n);
+            pi->out_total += n;
+            pi->scr_fed   += n;
+            STATS_ADD(pi->st, scr_bytes, n);
+            if (       __atomic_load_n(&pi->stalled, __ATOMIC_SEQ_CST)
+                    && __atomic_exchange_n(&pi->stalled, FALSE,
+                            __ATOMIC_SEQ_CST))
+                loop_post(pi->in_loop, &pi->resume);
+        }
+    }
+    if (drained && pi->scr_fed > 0) {
+        b->len = b->off = 0;
+        if (scr_diff(pi->shown, pi->scr, b) < 0) {
+            /* it is redrawn with the next one */
+            WARN("%s: screen diff" ERRNO "\r\n", pi->name, EPMTS);
+            b->len = 0;
+            pi->shown->stale[0] = pi->shown->stale[1] = 1;
+        }
+        TRACE(TRC_DIFF, pi, b->len, pi->scr_fed, RB_SIZE(&pi->b));
+        STATS_ADD(pi->st, scr_diffs, 1);
+        pi->scr_fed = 0;
+    }
+} /* pi_screen */
+
+/* The first chars in flight (see pi_send()) get to the
+ * destination, they are written. */
+static void
+pi_arrive(
+        struct loop_timer *tim)
+{
+    struct pthread_info *pi = tim->data;
+    struct iovec         iov[2];
+    int                  niov = lag_due(&pi->lag, &pi->loop->now, iov);
 
-        size_t to_write = MIN(pi->b.rb_size, window);
+    if (niov > 0) {
+        size_t n = iov[0].iov_len + (niov > 1 ? iov[1].iov_len : 0);
 
-        if (to_write > 0) {
-            ssize_t res = rb_write(&pi->b, pi->to_fd, to_write);
-            if (res < 0) {
+        long    ev  = pi->rec_ev ? rec_begin(pi->rec_ev, iov, niov) : -1;
+        ssize_t res = writev(pi->to_fd, iov, niov);
+        if (pi->rec_ev)
+            rec_end(ev, res > 0 ? res : 0);
+        if (res < 0 && (errno == EPIPE || errno == ECONNRESET
+                     || errno == EIO))
+        {
+            LOG("%s: write" ERRNO ", finishing\r\n",
+                pi->name, EPMTS);
+            pi_done(pi);
+            return;
+        } else if (res < 0) {
+            if (errno != EAGAIN && errno != EINTR) {
                 ERR("%s: write" ERRNO "\n", pi->name, EPMTS);
-                break;
             }
-            LOG("%s: rb_write(&pi->b, pi->to_fd=%d, "
-                    "to_write=%lu) => %zd\r\n",
-                pi->name, pi->to_fd, to_write, res);
+            res = 0;
         }
+        TRACE(TRC_WRITE, pi, res, n, pi->lag.len);
+        lag_consume(&pi->lag, res);
+        if (res < n) {
+            /* the destination is not ready */
+            struct timespec when = pi->loop->now;
 
-        /* check if we have to start/stop the channel */
-        if (pi->flags & PIFLG_STOPPED && pi->b.rb_size < window) {
+            STATS_ADD(pi->st, wr_eagain, 1);
+            when.tv_nsec += RETRY_MIN_NSEC;
+            if (when.tv_nsec >= 1000000000) {
+                when.tv_nsec -= 1000000000;
+                when.tv_sec++;
+            }
+            loop_timer_arm(pi->loop, tim, &when);
+            return;
+        }
+    }
+    if (lag_next(&pi->lag)) {
+        loop_timer_arm(pi->loop, tim, lag_next(&pi->lag));
+    } else if (!PI_TST(pi, PIFLG_ACTIVE | PIFLG_DONE)) {
+        pi_idle(pi); /* it could be waiting for us to finish */
+    }
+} /* pi_arrive */
+
+/* Account the time the line has been busy, from the first tick
+ * credited (see delay()) or the last write, up to a write.  The
+ * achieved rate of the stats is the bytes written over it.
+ *
+ * @param pi the channel.
+ * @param now the time of the write. */
+static void
+pi_busy(
+        struct pthread_info    *pi,
+        const struct timespec  *now)
+{
+    long long ns = (now->tv_sec  - pi->busy_at.tv_sec) * 1000000000LL
+                 +  now->tv_nsec - pi->busy_at.tv_nsec;
 
-            /* THIS WRITE WILL GO INTERSPERSED BETWEEN THE CALLS
-             * OF THE OTHER THREAD, AS THE INODE IS LOCKED BY THE
-             * SYSTEM, NO TWO THREADS CAN EXECUTE IN PARALLEL TWO
-             * WRITES TO THE SAME FILE AT THE SAME TIME.   THE
-             * WRITE BELOW HAS EXACTLY THE SAME ISSUE*/
-            write(pi->other->to_fd, "\021", 1); /* XON, ASCII DC1 */
+    if (!pi->busy || ns <= 0)
+        return;
+    STATS_ADD(pi->st, busy_ns, ns);
+    pi->busy_at = *now;
+} /* pi_busy */
 
-            LOG("%s: automatic XON on pi->b.rb_size=%zu"
-                " < window=%d\n",
-                pi->name, pi->b.rb_size, window);
-            pi->flags &= ~PIFLG_STOPPED;
+/**
+ * this routine is called on each tick of the pacing timer of
+ * a channel, to pass the data down the channel.  The line is a
+ * token bucket: delay() credits it with the window of chars of
+ * each tick passed, measured on the monotonic clock, so the
+ * ticks we are woken up late for, and the chars the destination
+ * didn't accept, are not lost, up to the burst of the line.  In
+ * the long run, exactly the nominal rate of chars is sent.
+ *
+ * Data is read from the source as soon as it is available (see
+ * pi_readable() above), but no more than the burst and a window
+ * get buffered for output, the writer to the source is throttled
+ * by the kernel while we don't read.
+ * A number of characters (the buffer size or the tokens, which
+ * is less) is written to the output side of the channel.  What
+ * the destination doesn't accept is retried a few times before
+ * the next tick.
+ *
+ * The timer is rearmed only if there's data still to write.
+ *
+ * @param pi is a reference to the channel data to use.
+ * @param now is the time we have been called at.
+ */
+static void
+pass_data(
+        struct pthread_info    *pi,
+        const struct timespec  *now)
+{
+    int    retry = PI_TST(pi, PIFLG_RETRY);
+    size_t to_write;
 
-        } else if (!(pi->flags & PIFLG_STOPPED)
-                && pi->b.rb_size >= 2 * window)
+    PI_CLR(pi, PIFLG_RETRY);
+    if (PI_TST(pi, PIFLG_OSTOP | PIFLG_XOFF | PIFLG_PAUSE)) {
+        /* the child or the user stopped the output (or it was
+         * paused), we wait for it to be restarted (see pi_wake()) */
+        TRACE(TRC_OSTOP, pi, 0, 0, 0);
+        PI_CLR(pi, PIFLG_ACTIVE);
+        pi->busy = FALSE;
+        return;
+    }
+    if (retry) {
+        /* not a tick, just the rest of the tokens that the
+         * destination didn't accept. */
+        STATS_ADD(pi->st, retries, 1);
+        TRACE(TRC_RETRY, pi, pi->tokens, 0, 0);
+    } else {
+        /* line parameters can change while we are transmitting */
+        if (pi->tic.tv_sec - pi->line_chk >= LINE_RECHECK_SECS)
+            pi_line_reload(pi);
+
+        /* credit the tokens of the ticks passed */
+        unsigned long credit = delay(pi, now);
+        STATS_ADD(pi->st, ticks, 1);
+        STATS_ADD(pi->st, budget, credit);
+        TRACE(TRC_TICK, pi, pi->tokens, 0, 0);
+
+        if (pi->scr)
+            pi_screen(pi);
+    }
+    if (pi->opt && !PI_TST(pi, PIFLG_DIFF))
+        pi_optimize(pi);
+
+    /* the output of the optimizer goes first, then the diff of
+     * the screen, both out of the buffer */
+    struct iovec out     = { NULL, 0 };
+    int          out_opt = pi->opt && opt_peek(pi->opt, &out) > 0;
+
+    if (!out_opt && pi->scr && pi->scr_out.off < pi->scr_out.len) {
+        out.iov_base = pi->scr_out.p   + pi->scr_out.off;
+        out.iov_len  = pi->scr_out.len - pi->scr_out.off;
+    } else if (!out_opt) {
+        out.iov_len  = 0;
+    }
+    if (out.iov_len > 0 || pi->opt || PI_TST(pi, PIFLG_DIFF))
+        to_write = MIN(out.iov_len, pi->tokens);
+    else
+        to_write = MIN(RB_SIZE(&pi->b), pi->tokens);
+
+    int blocked = FALSE; /* the destination is not ready */
+    if (to_write > 0) {
+        ssize_t res;
+
+        if (out.iov_len > 0) {
+            /* the data left the buffer as it was optimized, or
+             * taken by the screen */
+            out.iov_len = to_write;
+            res = pi_emit(pi, &out, 1, now);
+            if (res > 0 && out_opt)
+                opt_consume(pi->opt, res);
+            else if (res > 0)
+                pi->scr_out.off += res;
+        } else if (pi->lag.lat_ns || pi->lag.jit_ns || pi->scr) {
+            /* the screen gets what is written */
+            res = pi_send(pi, to_write, now);
+        } else {
+            long ev = -1;
+            if (pi->rec_ev) {
+                /* the data is copied before it leaves the buffer,
+                 * but only the part written is recorded */
+                struct iovec iov[2];
+                int niov = rb_peekv(&pi->b, iov, to_write);
+                ev = rec_begin(pi->rec_ev, iov, niov);
+            }
+            res = rb_write(&pi->b, pi->to_fd, to_write);
+            if (pi->rec_ev)
+                rec_end(ev, res > 0 ? res : 0);
+        }
+        if (res < 0 && (errno == EPIPE || errno == ECONNRESET
+                     || errno == EIO))
         {
-            /* SEE COMMENT ON WRITE ABOVE */
-            write(pi->other->to_fd, "\023", 1); /* XOFF, ASCII DC3 */
+            /* the destination has gone (e.g. a network peer
+             * closed the connection), the data we have cannot
+             * be delivered. */
+            LOG("%s: write" ERRNO ", finishing\r\n",
+                pi->name, EPMTS);
+            pi_done(pi);
+            return;
+        } else if (res < 0) {
+            if (errno == ENOSPC) {
+                /* the ingestion side has to rb_sync() */
+                loop_post(pi->in_loop, &pi->resume);
+            } else if (errno != EAGAIN && errno != EINTR) {
+                ERR("%s: write" ERRNO "\n", pi->name, EPMTS);
+            }
+            res = 0; /* try again later */
+        }
+        TRACE(TRC_WRITE, pi, res, to_write, RB_SIZE(&pi->b));
+        if (out.iov_len == 0)
+            pi->out_total += res;
+        pi->tokens -= res;
+        STATS_ADD(pi->st, bytes_out, res);
+        if (res > 0)
+            pi_busy(pi, now);
+        if (res < to_write) {
+            blocked = TRUE;
+            STATS_ADD(pi->st, wr_eagain, 1);
+        }
+        if (res > 0 && pi->do_finish)
+            pi->do_finish = DO_FINISH_ITER;
+
+        /* we have made room in the buffer, the ingestion side
+         * can continue reading */
+        if (       res > 0
+                && __atomic_load_n(&pi->stalled, __ATOMIC_SEQ_CST)
+                && __atomic_exchange_n(&pi->stalled, FALSE,
+                        __ATOMIC_SEQ_CST))
+            loop_post(pi->in_loop, &pi->resume);
+    }
 
-            LOG("%s: automatic XOFF on pi->b.rb_size=%zu "
-                ">= 2 * window=%d\n",
-                pi->name, pi->b.rb_size, window);
-            pi->flags |= PIFLG_STOPPED;
+    size_t size = pi_pending(pi);
+    if (size > 0) {
+        struct timespec when = pi->tic;
+
+        if (blocked) {
+            /* the destination was not ready, retry some times
+             * before the next tick, so fast lines don't depend
+             * on the burst to get their windows written on
+             * destinations with small buffers. */
+            struct timespec retry_at;
+            unsigned long long nsec = pi->tic_q / RETRY_PER_TIC;
+
+            if (nsec < RETRY_MIN_NSEC)
+                nsec = RETRY_MIN_NSEC;
+            clock_gettime(LOOP_CLOCK, &retry_at);
+            nsec += retry_at.tv_nsec;
+            retry_at.tv_sec  += nsec / 1000000000;
+            retry_at.tv_nsec  = nsec % 1000000000;
+            if (loop_ts_cmp(&retry_at, &when) < 0) {
+                when = retry_at;
+                PI_SET(pi, PIFLG_RETRY);
+            }
         }
-    } /* for */
-    LOG("%s: END\n", pi->name);
+        loop_timer_arm(pi->loop, &pi->tim, &when);
+    } else {
+        /* the line gets idle, the time it has no data to send
+         * is not credited (see pi_wake()), nor counted as
+         * busy */
+        pi->tokens = 0;
+        pi->busy   = FALSE;
+        pi_idle(pi);
+    }
 } /* pass_data */
 
-void *
-pthread_body_writer(
-        void *_pi)
+static void
+pi_tick(
+        struct loop_timer *tim)
 {
-    struct pthread_info *pi = _pi;
+    struct pthread_info *pi = tim->data;
+
+    /* how late we have been woken up, with the time the loop
+     * got to check the timers. */
+    stats_late(pi->st,
+          (pi->loop->now.tv_sec  - tim->when.tv_sec) * 1000000000ULL
+        +  pi->loop->now.tv_nsec - tim->when.tv_nsec);
+    pass_data(pi, &pi->loop->now);
+} /* pi_tick */
+
+/* The ingestion side has something for us: data for an idle
+ * channel (we start the pacing timer), EOF, packet status, or
+ * data to discard (see pi_flush()). */
+static void
+pi_wake(
+        struct loop_post *p)
+{
+    struct pthread_info *pi = p->data;
+
+    if (PI_TST(pi, PIFLG_DONE))
+        return;
+    if (__atomic_exchange_n(&pi->line_dirty, FALSE, __ATOMIC_ACQ_REL))
+        pi_line_reload(pi);
+    if (__atomic_exchange_n(&pi->flush, FALSE, __ATOMIC_ACQ_REL)) {
+        size_t n = __atomic_load_n(&pi->flush_to, __ATOMIC_RELAXED)
+                 - pi->out_total;
 
-    LOG("%s: id=%p, from_fd=%d, to_fd=%d, name=%s\r\n",
-            pi->name, pi->id, pi->from_fd, pi->to_fd, pi->name);
-    pass_data(pi);
-    return pi;
-} /* pthread_body_writer */
+        n = rb_discard(&pi->b, n);
+        pi->out_total += n;
+        n += pi_opt_discard(pi);
+        STATS_ADD(pi->st, bytes_flushed, n);
+        TRACE(TRC_FLUSH, pi, n, 0, 0);
+        LOG("%s: %zu bytes discarded\r\n", pi->name, n);
+        if (       n > 0
+                && __atomic_exchange_n(&pi->stalled, FALSE,
+                        __ATOMIC_SEQ_CST))
+            loop_post(pi->in_loop, &pi->resume);
+    }
+    if (PI_TST(pi, PIFLG_ACTIVE))
+        return; /* the pacing timer will get it */
+    if (PI_TST(pi, PIFLG_OSTOP | PIFLG_XOFF | PIFLG_PAUSE))
+        return; /* until the output is restarted */
 
-void *
-pthread_body_reader(
-        void *_pi)
+    if (pi_pending(pi) == 0) {
+        if (PI_TST(pi, PIFLG_EOF))
+            pi_idle(pi);
+        return;
+    }
+
+    /* the channel was idle, so we can write the first window
+     * right now, if the next tick has already passed. */
+    struct timespec now;
+
+    PI_SET(pi, PIFLG_ACTIVE);
+    clock_gettime(LOOP_CLOCK, &now);
+
+    /* the parameters could have been changed while we were
+     * idle (e.g. with stty(1)) */
+    pi->line_chk = now.tv_sec - LINE_RECHECK_SECS;
+    if (loop_ts_cmp(&now, &pi->tic) >= 0) {
+        pi->tic = now;
+        pass_data(pi, &now);
+    } else {
+        loop_timer_arm(pi->loop, &pi->tim, &pi->tic);
+    }
+} /* pi_wake */
+
+void
+pi_start(
+        struct pthread_info *pi)
 {
-    struct pthread_info *pi = _pi;
+    LOG("%s: from_fd=%d, to_fd=%d\r\n",
+            pi->name, pi->from_fd, pi->to_fd);
 
-    LOG("%s: id=%p, from_fd=%d, to_fd=%d, name=%s\r\n",
-            pi->name, pi->id, pi->from_fd, pi->to_fd, pi->name);
-    pass_data(pi);
-    return pi;
-} /* pthread_body_reader */
+    if (!pi->in_loop)
+        pi->in_loop = pi->loop;
+    if (!pi->st && !(pi->st = stats_attach(pi->name, 0)))
+        pi->st = &pi->st_own;
+    if (pi->st == &pi->st_own) /* for the control socket */
+        strncpy(pi->st_own.name, pi->name, STATS_NAME_MAX - 1);
+    trace_chan(pi, pi->name);
+    trace_chan(&pi->b, pi->name); /* for the io of the buffer */
+    pi->src.fd      = pi->from_fd;
+    pi->src.events  = LOOP_IN;
+    pi->src.cb      = pi_readable;
+    pi->src.data    = pi;
+    pi->tim.cb      = pi_tick;
+    pi->tim.data    = pi;
+    pi->start.cb    = pi_register;
+    pi->start.data  = pi;
+    pi->wake.cb     = pi_wake;
+    pi->wake.data   = pi;
+    pi->resume.cb   = pi_resume;
+    pi->resume.data = pi;
+    pi->lag_tim.cb  = pi_arrive;
+    pi->lag_tim.data= pi;
+
+    /* the output to the terminal can be optimized (-O) */
+    if (       (flags & FLAG_OPTIMIZE)
+            && !PI_TST(pi, PIFLG_INTR)
+            && !pi->opt)
+    {
+        if ((pi->opt = malloc(sizeof *pi->opt)) != NULL) {
+            opt_init(pi->opt);
+        } else {
+            WARN("%s: cannot optimize" ERRNO "\r\n", pi->name, EPMTS);
+        }
+    }
+
+    /* the screen of the terminal is followed, to send its diffs
+     * when the output gets behind (-u) */
+    if (       screen_msecs
+            && !PI_TST(pi, PIFLG_INTR)
+            && !pi->scr)
+    {
+        struct winsize ws;
+
+        pi_winsize(pi, &ws);
+        if (ws.ws_row == 0 || ws.ws_col == 0) {
+            LOG("%s: no window size, no screen diffs\r\n", pi->name);
+        } else if (       (pi->scr = calloc(2, sizeof *pi->scr)) == NULL
+                || scr_init(pi->scr,     ws.ws_row, ws.ws_col) < 0
+                || scr_init(pi->scr + 1, ws.ws_row, ws.ws_col) < 0)
+        {
+            WARN("%s: cannot follow the screen" ERRNO "\r\n",
+                pi->name, EPMTS);
+            if (pi->scr) {
+                scr_destroy(pi->scr);
+                scr_destroy(pi->scr + 1);
+                free(pi->scr);
+                pi->scr = NULL;
+            }
+        } else {
+            pi->shown = pi->scr + 1;
+        }
+    }
+
+    /* data read in packet mode comes after a control byte, so it
+     * cannot be spliced, the input has to be scanned for the
+     * interrupt chars, and recorded, delayed, optimized or
+     * followed data has to be seen. */
+    if (       !(pi->flags & (PIFLG_PKT | PIFLG_INTR))
+            && !pi->rec_ev && !pi->opt && !pi->scr
+            && !pi->lag.lat_ns && !pi->lag.jit_ns)
+    {
+        if (rb_splice(&pi->b) < 0) {
+            LOG("%s: no splice" ERRNO "\r\n", pi->name, EPMTS);
+        } else {
+            LOG("%s: using splice\r\n", pi->name);
+        }
+    }
+    /* no tokens are credited for the time before we start */
+    clock_gettime(LOOP_CLOCK, &pi->tic);
+    pi_line_reload(pi);
+    loop_post(pi->in_loop, &pi->start);
+} /* pi_start */
+
+void
+pi_finish(
+        struct pthread_info *pi)
+{
+    LOG("%s: finishing\r\n", pi->name);
+    pi->do_finish = DO_FINISH_ITER;
+    if (!PI_TST(pi, PIFLG_ACTIVE))
+        pi_idle(pi);
+} /* pi_finish */
@@ -8,20 +8,24 @@
 #ifndef _SLOWTTY_H
 #define _SLOWTTY_H
 
+#include <stdint.h>
 #include <termios.h>
 
+#include "lag.h"
+#include "loop.h"
+#include "opt.h"
 #include "ring.h"
+#include "scan.h"
+#include "screen.h"
+#include "stats.h"
 
 #ifndef FALSE
 #define FALSE   (0)
 #define TRUE    (!FALSE)
 #endif
 
-#ifndef TIC_DELAY  /* so we can change the value on the Makefile */
-#define TIC_DELAY       (40000000) /* nsecs.  = 0.04s. */
-#endif
-#ifndef TICS_PER_SEC
-#define TICS_PER_SEC    (25)
+#ifndef TICS_PER_SEC /* so we can change the value on the Makefile */
+#define TICS_PER_SEC    (25) /* for the fixed scheduler */
 #endif
 
 #define F(X) "%s:%d: %s: " X, __FILE__, __LINE__, __func__
@@ -52,25 +56,98 @@
         }                                             \
     } while (0)
 
-#define PIFLG_STOPPED   (1 << 0)
+#define PIFLG_ACTIVE    (1 << 1)    /* pacing timer is running */
+#define PIFLG_EOF       (1 << 2)    /* EOF read from from_fd */
+#define PIFLG_DONE      (1 << 3)    /* EOF and all data written */
+#define PIFLG_PKT       (1 << 4)    /* from_fd in packet mode */
+#define PIFLG_RETRY     (1 << 5)    /* timer armed to retry a write
+                                     * the destination didn't accept */
+#define PIFLG_INTR      (1 << 6)    /* from_fd is the user input, the
+                                     * other channel output is flushed
+                                     * on its interrupt chars */
+#define PIFLG_OSTOP     (1 << 7)    /* output stopped by the child
+                                     * (see tcflow(3)) */
+#define PIFLG_PAUSE     (1 << 8)    /* paused from the control socket
+                                     * (see ctl.h) */
+#define PIFLG_DIFF      (1 << 9)    /* the output is sent as diffs of
+                                     * the screen (see -u) */
+#define PIFLG_XOFF      (1 << 10)   /* output stopped by the user
+                                     * (VSTOP, see pi_scan()) */
 
-struct pthread_info {
-    pthread_t       id;         /* id of pthread */
+/* flags are changed from both sides of the channel (see
+ * pi_start()), so they are always changed atomically */
+#define PI_SET(_pi, _f) __atomic_or_fetch(&(_pi)->flags, (_f), __ATOMIC_SEQ_CST)
+#define PI_CLR(_pi, _f) __atomic_and_fetch(&(_pi)->flags, ~(_f), __ATOMIC_SEQ_CST)
+#define PI_TST(_pi, _f) (__atomic_load_n(&(_pi)->flags, __ATOMIC_SEQ_CST) & (_f))
+
+/* line parameters, as they are in the slave pty. */
+struct line_params {
+    unsigned long   baud;       /* bits per second */
+    tcflag_t        iflag,      /* termios flags */
+                    cflag,
+                    lflag;
+    cc_t            cc[NCCS];   /* special chars */
+};
 
+struct pthread_info {
     /* FILE DESCRIPTORS */
     int             from_fd,    /* descriptor we must read from */
                     to_fd;      /* descriptor we must write to */
 
     int             flags;      /* flags of the communication
                                  * channel */
-    volatile int    do_finish;  /* to tell thread when it's time
-                                 * to finish. */
+    int             do_finish;  /* ticks without data to wait
+                                 * before finishing the channel */
+
+    /* EVENT LOOPS */
+    struct loop    *loop;       /* loop of the emitter side */
+    struct loop    *in_loop;    /* loop of the ingestion side */
+    struct loop_src src;        /* to wait for from_fd data */
+    struct loop_timer
+                    tim;        /* pacing timer */
+    struct loop_post
+                    start,      /* to register src on in_loop */
+                    wake,       /* to the emitter: data, EOF or
+                                 * packet status arrived */
+                    resume;     /* to the ingestion side: room
+                                 * made in the buffer */
+    int             stalled;    /* the ingestion side waits for
+                                 * room in the buffer (atomic) */
+    int             line_dirty; /* packet status arrived, line
+                                 * parameters to reload (atomic) */
+    uint64_t        line_scan;  /* settings of the pty to scan the
+                                 * user input (see pi_scan_init(),
+                                 * atomic) */
+    int             flush;      /* the data buffered has to be
+                                 * discarded (atomic) ... */
+    size_t          flush_to;   /* ... up to this in_total
+                                 * (atomic) */
+    size_t          in_max;     /* bytes buffered at most, the
+                                 * burst and a window (atomic) */
+    size_t          in_total,   /* bytes stored in the ring buffer
+                                 * (the user input filtered, see
+                                 * pi_scan()), ingestion side */
+                    out_total;  /* bytes written or discarded,
+                                 * emitter side */
+    uint64_t        scan_key;   /* line_scan scan was built for, ... */
+    struct scan_set scan;       /* ... the chars of the user input
+                                 * acted upon, ingestion side */
 
     /* RING BUFFER */
     char           *name;
     struct ring_buffer
                     b;          /* ring buffer */
 
+    /* CHANNEL CONFIG */
+    int             line_fd;    /* pty to get the line parameters
+                                 * from (or -1 if they are fixed) */
+    time_t          line_chk;   /* when they were checked */
+    struct line_params
+                    line;       /* copy of the line parameters */
+    unsigned long   ovr_baud;   /* speed and ... */
+    tcflag_t        ovr_cflag;  /* ... frame set from the control
+                                 * socket (see ctl.h), or 0 */
+
     /* CHANNEL SAVED CONFIG */
     speed_t         svd_bauds;  /* saved baudrate */
     tcflag_t        svd_cflag;  /* saved cflag */
@@ -81,20 +158,136 @@ struct pthread_info {
                                  * to pass */
     unsigned long   acc;        /* fractional part of char to pass. */
     unsigned long   ctw;        /* whole chars to write */
+    unsigned long   tokens;     /* chars the line can send now,
+                                 * credited by delay() for each
+                                 * tic passed ... */
+    unsigned long   burst;      /* ... up to this */
 
-    struct timespec tic;
+    struct timespec tic;        /* time of the next tick */
+    unsigned long   tic_q,      /* whole nsecs in a tic */
+                    tic_r,      /* fraction of nsec in a tic */
+                    tic_d,      /*  ... (over tic_d) */
+                    tic_acc;    /* accumulated fraction of nsec */
+    struct timespec busy_at;    /* time accounted as busy up to
+                                 * (see pi_busy()) ... */
+    int             busy;       /* ... while the line is active */
 
-    /* THE OTHER THREAD INFO (IN OPPOSITE DIRECTION) */
-    struct pthread_info *other; /* the info of the other thread */
+    /* PROPAGATION DELAY */
+    struct lag      lag;        /* chars in flight (see lag.h) */
+    struct loop_timer
+                    lag_tim;    /* the first of them gets to to_fd */
 
-}; /* struct pthread_info */
+    /* OPTIMIZER */
+    struct opt     *opt;        /* of the output, rewritten shorter
+                                 * (see opt.h), or NULL */
+
+    /* SCREEN DIFFS */
+    struct screen  *scr,        /* the screen the output leaves on
+                                 * the terminal (see screen.h), or
+                                 * NULL, ... */
+                   *shown;      /* ... and the one it shows, while
+                                 * the diffs are sent */
+    struct scr_buf  scr_out;    /* diff being sent */
+    size_t          scr_fed;    /* bytes of output not diffed yet */
+
+    /* RECORDING */
+    int             rec_ev;     /* type of the events the data
+                                 * written is recorded as (see
+                                 * rec.h), or 0 */
+
+    /* STATISTICS */
+    struct stats_chan
+                   *st,         /* counters of the channel, in the
+                                 * stats file (see stats.h) or ... */
+                    st_own;     /* ... here, if there's none */
 
-extern struct termios saved_tty;
+    /* THE OTHER CHANNEL INFO (IN OPPOSITE DIRECTION) */
+    struct pthread_info *other; /* the info of the other channel */
+
+    void          (*on_done)(   /* called when PIFLG_DONE gets set */
+                        struct pthread_info *pi);
+    void           *data;       /* user data */
+
+}; /* struct pthread_info */
 
 extern struct winsize saved_window_size;
 
-void *pthread_body_writer(void *_pi),
-     *pthread_body_reader(void *_pi);
+/* Register the channel in its loops, so it begins to pass
+ * data from from_fd to to_fd as soon as it is available.  The
+ * channel is split in two sides, connected by the ring buffer
+ * (see ring.h): the ingestion side reads from_fd as soon as it
+ * is readable, in pi->in_loop, and the emitter side writes the
+ * data to to_fd at the line pace, in pi->loop.  Each loop can
+ * run on its own thread, so reading never waits for the pacing
+ * of the writes.  If pi->in_loop is NULL, pi->loop is used for
+ * both.  The other routines of the channel must be called from
+ * the thread of pi->loop.
+ *
+ * @param pi the channel to start. */
+void
+pi_start(
+        struct pthread_info *pi);
+
+/* Read again the line parameters of the channel from the
+ * pty, and pass a copy of them to the channel and to the one
+ * in the opposite direction.  Each one gets the speed of its
+ * direction (see ispeed and ospeed in stty(1)), or the one
+ * overriden with -r.
+ *
+ * @param pi the channel. */
+void
+pi_line_reload(
+        struct pthread_info *pi);
+
+/* Set the speed and the frame format of the channel, over the
+ * ones of the pty and -r, from the next tick on.  Must be called
+ * from the thread of pi->loop, as the rest of the routines below.
+ *
+ * @param pi the channel.
+ * @param baud the speed, or 0 to leave it as is.
+ * @param cflag the frame (CSIZE, PARENB, PARODD and CSTOPB, as
+ *        delay_frame() sets them), or 0 to leave it as is. */
+void
+pi_override(
+        struct pthread_info *pi,
+        unsigned long        baud,
+        tcflag_t             cflag);
+
+/* Stop or restart passing data on the channel, as the child does
+ * with tcflow(3).  The ingestion side goes on reading until the
+ * buffer is full.
+ *
+ * @param pi the channel.
+ * @param pause TRUE to stop, FALSE to restart. */
+void
+pi_pause(
+        struct pthread_info *pi,
+        int                  pause);
+
+/* Get the size of the terminal again, after the window has been
+ * resized (SIGWINCH).
+ *
+ * @param pi the channel. */
+void
+pi_resize(
+        struct pthread_info *pi);
+
+/* Discard the data buffered in the channel, not yet sent.
+ *
+ * @param pi the channel.
+ * @return the number of bytes discarded. */
+size_t
+pi_discard(
+        struct pthread_info *pi);
+
+/* Tell the channel to finish.  It will be flagged with
+ * PIFLG_DONE as soon as all the data available on from_fd
+ * has been passed to to_fd.
+ *
+ * @param pi the channel to finish. */
+void
+pi_finish(
+        struct pthread_info *pi);
 
 extern int ptym, ptys;
 
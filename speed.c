@@ -0,0 +1,46 @@
+/* speed.c -- get the real line speeds of a tty, including those
+ * that have no Bxxx constant.  This is a separate module, as the
+ * kernel definitions of termios2 conflict with <termios.h>.
+ * Author: Luis Colorado <luiscoloradourcola@gmail.com>
+ * Copyright: (C) 2015-2025 LUIS COLORADO.  All rights reserved.
+ * License: BSD.
+ */
+
+#include <errno.h>
+
+#include "config.h"
+
+#ifndef   UQ_HAS_TERMIOS2 /* {{ */
+#warning  UQ_HAS_TERMIOS2 should be defined in config.mk
+#define   UQ_HAS_TERMIOS2   (0)
+#endif /* UQ_HAS_TERMIOS2  * }} */
+
+#if UQ_HAS_TERMIOS2
+#include <asm/termbits.h>
+#include <sys/ioctl.h>
+#endif
+
+#include "speed.h"
+
+int
+tty_speeds(
+        int            fd,
+        unsigned long *ispeed,
+        unsigned long *ospeed)
+{
+#if UQ_HAS_TERMIOS2 /* {{ */
+    struct termios2 t;
+
+    if (ioctl(fd, TCGETS2, &t) < 0)
+        return -1;
+    if (ispeed)
+        /* zero input speed means the same as output */
+        *ispeed = t.c_ispeed ? t.c_ispeed : t.c_ospeed;
+    if (ospeed)
+        *ospeed = t.c_ospeed;
+    return 0;
+#else /* UQ_HAS_TERMIOS2 }{ */
+    errno = ENOSYS;
+    return -1;
+#endif /* UQ_HAS_TERMIOS2 }} */
+} /* tty_speeds */
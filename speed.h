@@ -0,0 +1,26 @@
+/* speed.h -- get the real line speeds of a tty, including those
+ * that have no Bxxx constant.
+ * Author: Luis Colorado <luiscoloradourcola@gmail.com>
+ * Copyright: (C) 2015-2025 LUIS COLORADO.  All rights reserved.
+ * License: BSD.
+ */
+#ifndef _SPEED_H
+#define _SPEED_H
+
+/* Get the input and output speeds of a tty, in bits per second.
+ * On linux, with termios2 (UQ_HAS_TERMIOS2), this gets any
+ * integer speed (BOTHER), that cfgetospeed(3) cannot return.
+ *
+ * @param fd the tty.
+ * @param ispeed where to store the input speed (or NULL).
+ * @param ospeed where to store the output speed (or NULL).
+ * @return 0 on success, -1 and errno set on error, or if the
+ *          speeds cannot be got this way (the caller must use
+ *          cfgetospeed(3) then). */
+int
+tty_speeds(
+        int            fd,
+        unsigned long *ispeed,
+        unsigned long *ospeed);
+
+#endif /* _SPEED_H */
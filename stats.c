@@ -0,0 +1,176 @@
+/* stats.c -- pacing and throughput counters of the channels,
+ * published in a memory mapped file.  The counters are updated
+ * by the channels with plain stores in the mapped memory, so
+ * keeping them costs no system calls at all, and the kernel
+ * writes the pages back to the file when it sees fit.
+ * Author: Luis Colorado <luiscoloradourcola@gmail.com>
+ * Copyright: (C) 2015-2025 LUIS COLORADO.  All rights reserved.
+ * License: BSD.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "stats.h"
+
+static struct stats_hdr  *stats_hdr;    /* the mapping, or NULL */
+static struct stats_chan *stats_chans;  /* the slots in it */
+
+int
+stats_open(
+        const char *path)
+{
+    size_t sz = sizeof *stats_hdr
+              + STATS_MAX_CHANS * sizeof *stats_chans;
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if (fd < 0)
+        return -1;
+    if (ftruncate(fd, sz) < 0) {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return -1;
+    }
+    void *p = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    int saved_errno = errno;
+    close(fd); /* the mapping stays */
+    if (p == MAP_FAILED) {
+        errno = saved_errno;
+        return -1;
+    }
+
+    /* the file is all zeros, as it has just been truncated */
+    stats_hdr   = p;
+    stats_chans = (struct stats_chan *)(stats_hdr + 1);
+    stats_hdr->version = STATS_VERSION;
+    stats_hdr->n_chans = STATS_MAX_CHANS;
+    stats_hdr->pid     = getpid();
+    stats_hdr->start   = time(NULL);
+    /* the magic goes last, so a reader doesn't see a file that
+     * is not filled yet */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(stats_hdr->magic, STATS_MAGIC, sizeof stats_hdr->magic);
+
+    return 0;
+} /* stats_open */
+
+struct stats_chan *
+stats_attach(
+        const char *name,
+        int         session)
+{
+    if (!stats_hdr)
+        return NULL;
+
+    /* channels are created from several threads in the server
+     * modes */
+    for (int i = 0; i < STATS_MAX_CHANS; i++) {
+        struct stats_chan *st = stats_chans + i;
+        uint32_t unused = 0;
+
+        if (__atomic_compare_exchange_n(&st->in_use, &unused, 1,
+                0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+        {
+            /* a reader could see the old counters for a moment */
+            memset((char *)st + sizeof st->in_use, 0,
+                sizeof *st - sizeof st->in_use);
+            st->session = session;
+            snprintf(st->name, sizeof st->name, "%s", name);
+            return st;
+        }
+    }
+    return NULL;
+} /* stats_attach */
+
+void
+stats_detach(
+        struct stats_chan *st)
+{
+    if (       stats_hdr
+            && st >= stats_chans
+            && st <  stats_chans + STATS_MAX_CHANS)
+        __atomic_store_n(&st->in_use, 0, __ATOMIC_RELEASE);
+} /* stats_detach */
+
+void
+stats_late(
+        struct stats_chan *st,
+        uint64_t           ns)
+{
+    uint64_t lim = 10000; /* 10us */
+    int      i;
+
+    for (i = 0; i < STATS_LATE_N - 1 && ns >= lim; i++)
+        lim *= 10;
+    STATS_ADD(st, late_hist[i], 1);
+    STATS_ADD(st, late_sum_ns, ns);
+    STATS_MAX(st, late_max_ns, ns);
+} /* stats_late */
+
+int
+stats_enabled(void)
+{
+    return stats_hdr != NULL;
+} /* stats_enabled */
+
+void
+stats_report(
+        FILE                    *f,
+        const struct stats_chan *st,
+        const char              *eol)
+{
+    static const char *late_names[STATS_LATE_N] = {
+        "<10us", "<100us", "<1ms", "<10ms", "<100ms", ">=100ms",
+    };
+    double   nominal  = st->bits    ? (double) st->baud / st->bits : 0;
+    double   achieved = st->busy_ns ? st->bytes_out * 1e9 / st->busy_ns
+                                    : 0;
+    uint64_t wakeups  = st->ticks + st->retries;
+
+    fprintf(f, "%s: in=%llu out=%llu flushed=%llu hiwat=%llu%s",
+        st->name,
+        (unsigned long long) st->bytes_in,
+        (unsigned long long) st->bytes_out,
+        (unsigned long long) st->bytes_flushed,
+        (unsigned long long) st->buf_hiwat,
+        eol);
+    fprintf(f, "%s: ticks=%llu retries=%llu budget=%llu"
+            " cps=%.3f/%.3f%s",
+        st->name,
+        (unsigned long long) st->ticks,
+        (unsigned long long) st->retries,
+        (unsigned long long) st->budget,
+        achieved, nominal,
+        eol);
+    fprintf(f, "%s: eagain rd=%llu wr=%llu, stalls=%llu%s",
+        st->name,
+        (unsigned long long) st->rd_eagain,
+        (unsigned long long) st->wr_eagain,
+        (unsigned long long) st->stalls,
+        eol);
+    if (st->opt_saved)
+        fprintf(f, "%s: optimized saved=%llu%s",
+            st->name,
+            (unsigned long long) st->opt_saved,
+            eol);
+    if (st->scr_diffs)
+        fprintf(f, "%s: screen diffs=%llu replaced=%llu%s",
+            st->name,
+            (unsigned long long) st->scr_diffs,
+            (unsigned long long) st->scr_bytes,
+            eol);
+    fprintf(f, "%s: late avg=%lluns max=%lluns:",
+        st->name,
+        (unsigned long long) (wakeups ? st->late_sum_ns / wakeups : 0),
+        (unsigned long long) st->late_max_ns);
+    for (int i = 0; i < STATS_LATE_N; i++)
+        fprintf(f, " %s=%llu", late_names[i],
+            (unsigned long long) st->late_hist[i]);
+    fprintf(f, "%s", eol);
+} /* stats_report */
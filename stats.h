@@ -0,0 +1,147 @@
+/* stats.h -- pacing and throughput counters of the channels,
+ * published in a memory mapped file, so they can be read by
+ * other programs while the sessions are running.
+ * Author: Luis Colorado <luiscoloradourcola@gmail.com>
+ * Copyright: (C) 2015-2025 LUIS COLORADO.  All rights reserved.
+ * License: BSD.
+ */
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define STATS_MAGIC         "SLOWSTAT"
+#define STATS_VERSION       (3)
+#define STATS_MAX_CHANS     (256)   /* slots in the file */
+#define STATS_NAME_MAX      (16)
+
+/* buckets of the histogram of the lateness of the pacing
+ * timer wakeups: below 10us, 100us, 1ms, 10ms, 100ms, and the
+ * rest. */
+#define STATS_LATE_N        (6)
+
+/* Layout of the file.  A struct stats_hdr at offset zero,
+ * followed by n_chans struct stats_chan.  All the fields are
+ * in the byte order of the host, and each counter is written by
+ * only one thread, with a single store, so a reader gets a
+ * consistent value of each counter (but not of all of them at
+ * the same time).  Slots with in_use zero are free, and can be
+ * reused by a new channel. */
+struct stats_hdr {
+    char            magic[8];   /* STATS_MAGIC, not nul ended */
+    uint32_t        version;    /* STATS_VERSION */
+    uint32_t        n_chans;    /* slots that follow */
+    uint64_t        pid;        /* of the slowtty process */
+    uint64_t        start;      /* time(2) it started */
+};
+
+struct stats_chan {
+    uint32_t        in_use;     /* slot in use */
+    uint32_t        session;    /* session number, 0 if none */
+    char            name[STATS_NAME_MAX];
+                                /* name of the channel */
+
+    /* INGESTION SIDE */
+    uint64_t        bytes_in;   /* bytes read from the source */
+    uint64_t        rd_eagain;  /* reads that got nothing */
+    uint64_t        stalls;     /* times the source was left
+                                 * unread, the buffer full */
+    uint64_t        buf_hiwat;  /* most bytes ever buffered */
+
+    /* EMITTER SIDE */
+    uint64_t        baud;       /* line parameters in use */
+    uint64_t        bits;       /* bits per char frame */
+    uint64_t        bytes_out;  /* bytes written */
+    uint64_t        bytes_flushed;
+                                /* bytes discarded (tcflush(3),
+                                 * interrupt chars) */
+    uint64_t        wr_eagain;  /* writes the destination didn't
+                                 * accept all */
+    uint64_t        ticks;      /* pacing ticks */
+    uint64_t        retries;    /* retries between ticks */
+    uint64_t        budget;     /* chars allowed by the ticks */
+    uint64_t        busy_ns;    /* time the line was active, from
+                                 * the first tick credited to the
+                                 * last write */
+    uint64_t        late_hist[STATS_LATE_N];
+                                /* lateness of the wakeups */
+    uint64_t        late_sum_ns,/* ... its sum */
+                    late_max_ns;/* ... and maximum */
+    uint64_t        opt_saved;  /* bytes saved by the optimizer
+                                 * of the output (see opt.h) */
+    uint64_t        scr_diffs;  /* diffs of the screen sent ... */
+    uint64_t        scr_bytes;  /* ... and the bytes of output they
+                                 * replaced (see -u) */
+};
+
+/* Update a counter.  Each counter has only one writer, so we
+ * don't need an atomic read-modify-write, just that the store
+ * is seen whole by the readers. */
+#define STATS_ADD(_st, _f, _n) \
+    __atomic_store_n(&(_st)->_f, (_st)->_f + (_n), __ATOMIC_RELAXED)
+#define STATS_SET(_st, _f, _v) \
+    __atomic_store_n(&(_st)->_f, (_v), __ATOMIC_RELAXED)
+#define STATS_MAX(_st, _f, _v) do {                   \
+        if ((_v) > (_st)->_f)                         \
+            STATS_SET(_st, _f, _v);                   \
+    } while (0)
+
+/* Create the stats file and map it.  The channels created
+ * after this get a slot in it (see stats_attach()).
+ *
+ * @param path the file to create (it is truncated if it
+ *        exists).
+ * @return 0 on success, -1 and errno set on error. */
+int
+stats_open(
+        const char *path);
+
+/* Get a free slot of the stats file for a channel.
+ *
+ * @param name the name of the channel.
+ * @param session the session it belongs to (or 0).
+ * @return the slot, zeroed, or NULL if there's no stats file
+ *         or no slot free (the caller has to use its own
+ *         memory then). */
+struct stats_chan *
+stats_attach(
+        const char *name,
+        int         session);
+
+/* Free a slot got with stats_attach().  Nothing is done with
+ * NULL, or with a pointer that is not a slot of the file.
+ *
+ * @param st the slot. */
+void
+stats_detach(
+        struct stats_chan *st);
+
+/* Account the lateness of a timer wakeup.
+ *
+ * @param st the counters of the channel.
+ * @param ns nanoseconds late. */
+void
+stats_late(
+        struct stats_chan *st,
+        uint64_t           ns);
+
+/* Check if the stats are being published.
+ *
+ * @return nonzero if stats_open() was called successfully. */
+int
+stats_enabled(void);
+
+/* Print a summary of the counters of a channel.
+ *
+ * @param f where to print it.
+ * @param st the counters.
+ * @param eol the line end to use ("\r\n" with the tty in raw
+ *        mode). */
+void
+stats_report(
+        FILE                    *f,
+        const struct stats_chan *st,
+        const char              *eol);
+
+#endif /* _STATS_H */
@@ -20,9 +20,13 @@ volatile int flags = 0;
 int main(int argc, char **argv)
 {
     int opt;
+    size_t cap = 0;
 
-    while ((opt = getopt(argc, argv, "s:S")) != EOF) {
+    while ((opt = getopt(argc, argv, "c:s:S")) != EOF) {
         switch(opt) {
+        case 'c': cap = atoi(optarg);
+                printf(F("cap = %zu\n"), cap);
+                break;
         case 's': { int seed = atoi(optarg);
                 printf(F("seed = %d\n"), seed);
                 srandom(seed); break;
@@ -39,11 +43,18 @@ int main(int argc, char **argv)
     struct ring_buffer b;
 
     rb_init(&b);
+    if (cap && rb_resize(&b, cap) < 0) {
+        fprintf(stderr, F("rb_resize: ERROR %d: %s\n"),
+            errno, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    printf(F("b.rb_cap = %zu, b.rb_mirror = %d\n"),
+        b.rb_cap, b.rb_mirror);
 
     for (;;) {
-        if (b.rb_size < RB_BUFFER_SIZE) {
+        if (b.rb_size < b.rb_cap) {
             size_t to_read = random()
-                % (RB_BUFFER_SIZE - b.rb_size) + 1;
+                % (b.rb_cap - b.rb_size) + 1;
             printf(F("b.rb_size = %zu; to_read = %zu\n"),
                 b.rb_size, to_read);
             if (to_read) {
@@ -0,0 +1,368 @@
+/* test_screen.c -- program to test modules screen.c and opt.c
+ * Author: Luis Colorado <luiscoloradourcola@gmail.com>
+ * Copyright: (C) 2015-2025 LUIS COLORADO.  All rights reserved.
+ * License: BSD.
+ *
+ * Random output is fed to a screen as it is, and sent to another
+ * screen, the terminal, as slowtty sends it:
+ *
+ *  - as diffs from time to time (see scr_diff()), as with -u.
+ *  - through the optimizer (see opt.h), in chunks flushed from
+ *    time to time, as with -O (option -O here).  At the end, the
+ *    bytes it says it saved have to be the difference between what
+ *    it got and what it wrote.
+ *
+ * When all is sent, the terminal has to show the same cells,
+ * cursor, attributes and modes.
+ */
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "opt.h"
+#include "screen.h"
+
+#define F(_fmt) "%s:%d: " _fmt, __FILE__, __LINE__
+
+#define PIECES      (500)   /* pieces of output of a case */
+#define CHUNK_MAX   (200)   /* bytes fed at once, at most */
+
+static int verbose = 0;
+
+static const char *const pick_sgr[] = {
+    "", "0", "1", "1;31", "33", "38;2;1;2;3", "48;5;9", "7", "0;4",
+    "22", "41", "38:2::4:5:6", "100", "27", "38;5", "0;1",
+};
+static const char *const pick_erase[] = {
+    "\033[K", "\033[1K", "\033[2K", "\033[J", "\033[1J", "\033[2J",
+};
+static const char *const pick_alt[] = {
+    "\033[?1049h", "\033[?1049l", "\033[?47h", "\033[?47l",
+    "\033[?1047h", "\033[?1047l", "\033[?1048h", "\033[?1048l",
+    "\033[?6;1049h",
+};
+static const char *const pick_mode[] = {
+    "\033[4h", "\033[4l", "\033[?6h", "\033[?6l", "\033[?7l",
+    "\033[?7h", "\033[?25l", "\033[?25h", "\033[?1000;7h",
+    "\033[?1000l", "\033[20;4h",
+};
+static const char *const pick_esc[] = {
+    "\0337", "\0338", "\033[s", "\033[u", "\033D", "\033E", "\033M",
+    "\033(0", "\033(B", "\033)0", "\016", "\017", "\033=", "\033>",
+    "\033[!p", "\033c", "\033( c",
+};
+static const char *const pick_str[] = {
+    "\033]0;title\007", "\033]2;abc\033\\", "\033P1$r\033\\",
+    "\033]8;;http://x\007",
+};
+static const char *const pick_ctl[] = {
+    "\t", "\r", "\n", "\b", "\a", "\v", "\r\n", "\b\b",
+};
+static const char *const pick_char[] = {
+    "a", "b", "q", "x", "l", " ",
+    "\xc3\xa9",             /* e acute */
+    "\xe6\xbc\xa2",         /* wide */
+    "\xe2\x82\xac",         /* euro */
+    "\xf0\x9f\x98\x80",     /* wide, four bytes */
+    "\xcc\x81",             /* combining */
+};
+static const char *const pick_broken[] = {
+    "\xc3", "\xe6\xbc", "\033[1;", "\033]0;x", "\033[?", "\033[",
+    "\033", "\033(",
+};
+
+#define PICK(_t) ((_t)[random() % (sizeof (_t) / sizeof (_t)[0])])
+#define R(_a, _b) ((int) ((_a) + random() % ((_b) - (_a) + 1)))
+
+/* add a random piece of output to buf, return its length */
+static int
+piece(
+        char   *buf)
+{
+    static const int weight[] = {
+        5, 1, 2, 3, 4, 1, 1, 1, 1, 1, 2, 1, 3, 3, 5, 1, 1,
+    };
+    int total = 0, n = 0;
+
+    for (int i = 0; i < sizeof weight / sizeof weight[0]; i++)
+        total += weight[i];
+    int w = random() % total, kind = 0;
+    while (w >= weight[kind])
+        w -= weight[kind++];
+
+    switch (kind) {
+    case 0:  return sprintf(buf, "\033[%d;%dH", R(0, 32), R(0, 90));
+    case 1:  return sprintf(buf, "\033[%dd", R(0, 32));
+    case 2:  return sprintf(buf, "\033[;%d%c", R(0, 90), "Hf"[R(0, 1)]);
+    case 3:  return sprintf(buf, "\033[%sm", PICK(pick_sgr));
+    case 4:  return sprintf(buf, "\033[%d%c", R(0, 5),
+                 "ABCDEFGaeb`@PXLMST"[random() % 18]);
+    case 5:  return sprintf(buf, "%s", PICK(pick_erase));
+    case 6:  return sprintf(buf, "\033[%d;%dr", R(0, 32), R(0, 32));
+    case 7:  return sprintf(buf, "\033[r");
+    case 8:  return sprintf(buf, "%s", PICK(pick_alt));
+    case 9:  return sprintf(buf, "%s", PICK(pick_mode));
+    case 10: return sprintf(buf, "%s", PICK(pick_esc));
+    case 11: return sprintf(buf, "%s", PICK(pick_str));
+    case 12: return sprintf(buf, "%s", PICK(pick_ctl));
+    case 13:
+        for (int i = R(1, 40); i > 0; i--)
+            n += sprintf(buf + n, "%s", PICK(pick_char));
+        return n;
+    case 14:
+        for (int i = R(1, 90); i > 0; i--)
+            buf[n++] = "abcdefgh "[random() % 9];
+        return n;
+    case 15: return sprintf(buf, "%s", PICK(pick_broken));
+    default: return sprintf(buf, "\033[%d q", R(0, 6)); /* DECSCUSR */
+    }
+} /* piece */
+
+/* compare what the terminal shows with the screen it should
+ * show.  @return the number of differences */
+static int
+check(
+        const struct screen    *t,
+        const struct screen    *s,
+        int                     seed,
+        size_t                  at)
+{
+    int bad = 0;
+
+    for (int r = 0; r < s->rows; r++) {
+        for (int c = 0; c < s->cols; c++) {
+            const struct scr_cell *x = t->g[t->alt] + r * s->cols + c,
+                                  *y = s->g[s->alt] + r * s->cols + c;
+            if (memcmp(x, y, sizeof *x) && bad++ < 5)
+                printf(F("seed %d, at %zu: cell %d,%d: %x/%x, attrs "
+                        "%x,%x,%x/%x,%x,%x\n"), seed, at, r, c,
+                    x->ch, y->ch, x->a.flags, x->a.fg, x->a.bg,
+                    y->a.flags, y->a.fg, y->a.bg);
+        }
+    }
+    if (       t->cur.row  != s->cur.row
+            || t->cur.col  != s->cur.col
+            || t->cur.wrap != s->cur.wrap)
+    {
+        bad++;
+        printf(F("seed %d, at %zu: cursor %d,%d,%d/%d,%d,%d\n"), seed, at,
+            t->cur.row, t->cur.col, t->cur.wrap,
+            s->cur.row, s->cur.col, s->cur.wrap);
+    }
+    if (       memcmp(&t->cur.a, &s->cur.a, sizeof t->cur.a)
+            || t->cur.g[0]   != s->cur.g[0]
+            || t->cur.g[1]   != s->cur.g[1]
+            || t->cur.shift  != s->cur.shift
+            || t->cur.origin != s->cur.origin
+            || memcmp(&t->saved, &s->saved, sizeof t->saved)
+            || memcmp(&t->saved_alt, &s->saved_alt, sizeof t->saved_alt))
+    {
+        bad++;
+        printf(F("seed %d, at %zu: attributes or charsets\n"), seed, at);
+    }
+    if (       t->alt  != s->alt
+            || t->top  != s->top  || t->bot != s->bot
+            || t->awm  != s->awm  || t->irm != s->irm
+            || t->hide != s->hide)
+    {
+        bad++;
+        printf(F("seed %d, at %zu: modes\n"), seed, at);
+    }
+    return bad;
+} /* check */
+
+/* send the output as diffs from time to time.
+ * @return the number of differences */
+static int
+by_diffs(
+        struct screen  *term,
+        struct screen  *scr,
+        const char     *out,
+        size_t          len,
+        int             seed)
+{
+    struct screen  shown;
+    struct scr_buf b    = { 0 };
+    int            diff = 0,
+                   bad  = 0;
+
+    if (scr_init(&shown, scr->rows, scr->cols) < 0) {
+        perror("scr_init");
+        exit(EXIT_FAILURE);
+    }
+    shown.onlcr = scr->onlcr;
+
+    for (size_t i = 0; i < len && !bad;) {
+        size_t n = 1 + random() % CHUNK_MAX;
+        if (n > len - i)
+            n = len - i;
+        struct iovec v = { (char *) out + i, n };
+        i += n;
+
+        scr_feed(scr, &v, 1);
+        if (!diff) {
+            /* the output is sent as it is */
+            scr_feed(term, &v, 1);
+            if (       scr_ground(scr) && !scr->stale[scr->alt]
+                    && check(term, scr, seed, i))
+                bad++;
+            if (random() % 3 == 0) {
+                scr_passed(scr);
+                scr_copy(&shown, scr);
+                diff = 1;
+            }
+        } else {
+            b.len = 0;
+            if (scr_diff(&shown, scr, &b) < 0) {
+                perror("scr_diff");
+                exit(EXIT_FAILURE);
+            }
+            struct iovec d = { b.p, b.len };
+            scr_feed(term, &d, 1);
+            if (verbose)
+                printf(F("seed %d: %zu bytes, diff of %zu\n"),
+                    seed, n, b.len);
+            if (check(term, scr, seed, i))
+                bad++;
+            if (       scr_ground(scr) && !scr->stale[!scr->alt]
+                    && random() % 2)
+                diff = 0;
+        }
+    }
+
+    scr_destroy(&shown);
+    free(b.p);
+    return bad;
+} /* by_diffs */
+
+/* send what the optimizer wrote to the terminal, in pieces.
+ * @return the number of bytes */
+static size_t
+drain(
+        struct opt     *o,
+        struct screen  *term)
+{
+    struct iovec v;
+    size_t       sent = 0;
+
+    while (opt_peek(o, &v) > 0) {
+        v.iov_len = 1 + random() % v.iov_len;
+        scr_feed(term, &v, 1);
+        opt_consume(o, v.iov_len);
+        sent += v.iov_len;
+    }
+    return sent;
+} /* drain */
+
+/* send the output through the optimizer.
+ * @return the number of differences */
+static int
+by_opt(
+        struct screen  *term,
+        struct screen  *scr,
+        const char     *out,
+        size_t          len,
+        int             seed)
+{
+    static struct opt o;
+    size_t            sent = 0;
+    int               bad  = 0;
+
+    opt_init(&o);
+    if (random() % 4) /* else, the size is not known */
+        opt_size(&o, scr->rows, scr->cols);
+
+    for (size_t i = 0; i < len && !bad;) {
+        size_t n = 1 + random() % CHUNK_MAX;
+        if (n > len - i)
+            n = len - i;
+        struct iovec v = { (char *) out + i, n };
+        i += n;
+
+        scr_feed(scr, &v, 1);
+        while (v.iov_len > 0) {
+            size_t used = opt_feed(&o, &v, 1);
+            v.iov_base = (char *) v.iov_base + used;
+            v.iov_len -= used;
+            sent += drain(&o, term);
+        }
+        if (random() % 2)
+            continue; /* more data in the same tick */
+        opt_flush(&o, 0);
+        sent += drain(&o, term);
+        if (verbose)
+            printf(F("seed %d: %zu bytes in, %zu out\n"), seed, i, sent);
+        if (scr_ground(scr) && check(term, scr, seed, i))
+            bad++;
+    }
+
+    opt_flush(&o, 1);
+    sent += drain(&o, term);
+    if (!bad && o.saved != len - sent) {
+        bad++;
+        printf(F("seed %d: saved %llu bytes, %zu in, %zu out\n"), seed,
+            (unsigned long long) o.saved, len, sent);
+    }
+    return bad;
+} /* by_opt */
+
+/* one case, with its own seed.  @return 0 if it passes */
+static int
+one(
+        int     seed,
+        int   (*by)(struct screen *, struct screen *, const char *,
+                    size_t, int))
+{
+    struct screen  term, scr;
+    static char    out[PIECES * 200];
+    size_t         len  = 0;
+
+    srandom(seed);
+    int rows = R(3, 30), cols = R(10, 100);
+    for (int i = 0; i < PIECES; i++)
+        len += piece(out + len);
+
+    if (       scr_init(&term, rows, cols) < 0
+            || scr_init(&scr, rows, cols)  < 0)
+    {
+        perror("scr_init");
+        exit(EXIT_FAILURE);
+    }
+    term.onlcr = scr.onlcr = random() % 2;
+
+    int bad = by(&term, &scr, out, len, seed);
+
+    scr_destroy(&term);
+    scr_destroy(&scr);
+    return bad;
+} /* one */
+
+int main(int argc, char **argv)
+{
+    int opt, seed = 1, cases = 2000, failed = 0, optimize = 0;
+
+    while ((opt = getopt(argc, argv, "n:Os:Sv")) != EOF) {
+        switch(opt) {
+        case 'n': cases = atoi(optarg); break;
+        case 'O': optimize = 1; break;
+        case 's': seed = atoi(optarg); break;
+        case 'S': seed = time(NULL); break;
+        case 'v': verbose = 1; break;
+        default:
+            fprintf(stderr,
+                "usage: %s [-O] [-n cases] [-s seed|-S] [-v]\n",
+                argv[0]);
+            exit(EXIT_FAILURE);
+        } /* switch */
+    } /* while */
+
+    printf(F("seed = %d, cases = %d, %s\n"), seed, cases,
+        optimize ? "optimized" : "diffs");
+    for (int i = 0; i < cases; i++)
+        if (one(seed + i, optimize ? by_opt : by_diffs))
+            failed++;
+    printf(F("%d cases, %d failed\n"), cases, failed);
+    exit(failed ? EXIT_FAILURE : EXIT_SUCCESS);
+} /* main */
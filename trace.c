@@ -0,0 +1,145 @@
+/* trace.c -- binary trace of the events of the channels.  The
+ * file grows by one slot for each thread that writes events,
+ * and the slot is mapped in memory, so writing an event is just
+ * filling a record and incrementing the head of the ring.  The
+ * kernel writes the pages back to the file.
+ * Author: Luis Colorado <luiscoloradourcola@gmail.com>
+ * Copyright: (C) 2015-2025 LUIS COLORADO.  All rights reserved.
+ * License: BSD.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+int trace_on;
+
+static struct trace_hdr *trace_hdr;
+static int               trace_fd = -1;
+static pthread_mutex_t   trace_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread struct trace_slot
+                        *trace_self;    /* ring of the thread */
+static __thread int      trace_none;    /* none left for us */
+
+/* round up to a multiple of the page size */
+static uint32_t
+trace_pages(
+        size_t n)
+{
+    size_t pg = sysconf(_SC_PAGESIZE);
+
+    return (n + pg - 1) / pg * pg;
+} /* trace_pages */
+
+int
+trace_open(
+        const char *path)
+{
+    uint32_t hdr_size = trace_pages(sizeof *trace_hdr);
+
+    trace_fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (trace_fd < 0)
+        return -1;
+
+    void *p = MAP_FAILED;
+    if (ftruncate(trace_fd, hdr_size) == 0)
+        p = mmap(NULL, hdr_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                trace_fd, 0);
+    if (p == MAP_FAILED) {
+        int saved_errno = errno;
+        close(trace_fd);
+        trace_fd = -1;
+        errno = saved_errno;
+        return -1;
+    }
+
+    trace_hdr            = p;
+    trace_hdr->version   = TRACE_VERSION;
+    trace_hdr->ring      = TRACE_RING;
+    trace_hdr->hdr_size  = hdr_size;
+    trace_hdr->slot_size = trace_pages(sizeof *trace_self);
+    trace_hdr->pid       = getpid();
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(trace_hdr->magic, TRACE_MAGIC, sizeof trace_hdr->magic);
+
+    trace_on = 1;
+    return 0;
+} /* trace_open */
+
+/* get a new slot for the calling thread */
+static struct trace_slot *
+trace_claim(void)
+{
+    struct trace_slot *s = NULL;
+
+    pthread_mutex_lock(&trace_mtx);
+    uint32_t n   = trace_hdr->n_threads;
+    off_t    off = trace_hdr->hdr_size
+                 + (off_t) n * trace_hdr->slot_size;
+
+    if (       n < TRACE_MAX_THREADS
+            && ftruncate(trace_fd, off + trace_hdr->slot_size) == 0)
+    {
+        void *p = mmap(NULL, trace_hdr->slot_size,
+                PROT_READ | PROT_WRITE, MAP_SHARED, trace_fd, off);
+        if (p != MAP_FAILED) {
+            s      = p;
+            s->tid = (uintptr_t) pthread_self();
+            __atomic_store_n(&trace_hdr->n_threads, n + 1,
+                __ATOMIC_RELEASE);
+        }
+    }
+    pthread_mutex_unlock(&trace_mtx);
+
+    return s;
+} /* trace_claim */
+
+void
+trace_put(
+        enum trace_event    ev,
+        uint64_t            chan,
+        uint64_t            a,
+        uint64_t            b,
+        uint64_t            c)
+{
+    struct trace_slot *s = trace_self;
+
+    if (!s) {
+        if (trace_none || !(s = trace_self = trace_claim())) {
+            trace_none = 1;
+            return;
+        }
+    }
+
+    struct timespec   now;
+    uint64_t          n = s->head;
+    struct trace_rec *r = s->rec + n % TRACE_RING;
+
+    clock_gettime(CLOCK_MONOTONIC, &now); /* no syscall, vdso(7) */
+    r->ts   = now.tv_sec * 1000000000ULL + now.tv_nsec;
+    r->ev   = ev;
+    r->seq  = n;
+    r->chan = chan;
+    r->a[0] = a;
+    r->a[1] = b;
+    r->a[2] = c;
+    __atomic_store_n(&s->head, n + 1, __ATOMIC_RELEASE);
+} /* trace_put */
+
+void
+trace_chan(
+        const void *chan,
+        const char *name)
+{
+    uint64_t packed = 0;
+
+    memcpy(&packed, name, strnlen(name, sizeof packed));
+    TRACE(TRC_CHAN, chan, packed, 0, 0);
+} /* trace_chan */
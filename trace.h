@@ -0,0 +1,127 @@
+/* trace.h -- binary trace of the events of the channels, cheap
+ * enough to leave it on in production.  Each thread writes its
+ * events in its own ring, with no locks and no system calls, and
+ * the rings are mapped from a file, so the trace is there even
+ * if the process is killed.  slowtrace(1) decodes it.
+ * Author: Luis Colorado <luiscoloradourcola@gmail.com>
+ * Copyright: (C) 2015-2025 LUIS COLORADO.  All rights reserved.
+ * License: BSD.
+ */
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <stdint.h>
+
+#define TRACE_MAGIC         "SLOWTRC"
+#define TRACE_VERSION       (1)
+#define TRACE_MAX_THREADS   (256)
+#define TRACE_RING          (1 << 13) /* events per thread, a
+                                       * power of two */
+
+/* The events, with the format slowtrace uses to print their
+ * three arguments (always as long long).  TRC_CHAN gives the
+ * name of a channel, packed in its first argument, as the
+ * events only have the address of the channel. */
+#define TRACE_EVENTS                                                 \
+    X(TRC_CHAN,   "channel %.8s")                                    \
+    X(TRC_IO,     "io fd=%lld niov=%lld => %lld")                    \
+    X(TRC_READ,   "read %lld bytes of %lld, %lld buffered")          \
+    X(TRC_STATUS, "packet status 0x%02llx")                          \
+    X(TRC_STALL,  "stalled, %lld buffered")                          \
+    X(TRC_RESUME, "resumed")                                         \
+    X(TRC_DELAY,  "delay credit=%lld tokens=%lld burst=%lld")        \
+    X(TRC_TICK,   "tick tokens=%lld")                                \
+    X(TRC_RETRY,  "retry tokens=%lld")                               \
+    X(TRC_WRITE,  "wrote %lld bytes of %lld, %lld buffered")         \
+    X(TRC_OSTOP,  "output stopped")                                  \
+    X(TRC_IDLE,   "idle")                                            \
+    X(TRC_FLUSH,  "%lld bytes discarded")                           \
+    X(TRC_DIFF,   "screen diff %lld bytes, of %lld, %lld buffered")
+
+enum trace_event {
+#define X(_ev, _fmt) _ev,
+    TRACE_EVENTS
+#undef X
+    TRC_N
+};
+
+/* Layout of the file.  A struct trace_hdr, padded to hdr_size
+ * bytes, and n_threads struct trace_slot, slot_size bytes each
+ * (both sizes are multiples of the page size).  All in host
+ * byte order. */
+struct trace_hdr {
+    char            magic[8];   /* TRACE_MAGIC, nul ended */
+    uint32_t        version;    /* TRACE_VERSION */
+    uint32_t        ring;       /* TRACE_RING */
+    uint32_t        hdr_size,
+                    slot_size;
+    uint32_t        n_threads;  /* slots in use (atomic) */
+    uint32_t        pad;
+    uint64_t        pid;        /* of the slowtty process */
+};
+
+struct trace_rec {
+    uint64_t        ts;         /* CLOCK_MONOTONIC, nsecs */
+    uint32_t        ev;         /* enum trace_event */
+    uint32_t        seq;        /* low bits of the event number
+                                 * in the thread */
+    uint64_t        chan;       /* address of the channel */
+    uint64_t        a[3];       /* arguments */
+};
+
+/* The ring of a thread.  head is the number of events ever
+ * written, the last TRACE_RING of them are in rec[], event n at
+ * rec[n % TRACE_RING]. */
+struct trace_slot {
+    uint64_t        head;       /* (atomic) */
+    uint64_t        tid;        /* the thread, as a number */
+    uint64_t        pad[4];
+    struct trace_rec
+                    rec[TRACE_RING];
+};
+
+extern int trace_on;
+
+/* Add an event to the trace of the calling thread.  This costs
+ * a test when the trace is off. */
+#define TRACE(_ev, _chan, _a, _b, _c) do {                      \
+        if (trace_on)                                           \
+            trace_put((_ev), (uintptr_t)(_chan),                \
+                (_a), (_b), (_c));                              \
+    } while (0)
+
+/* Create the trace file and start tracing.  Call before
+ * creating any thread.
+ *
+ * @param path the file to create (it is truncated if it
+ *        exists).
+ * @return 0 on success, -1 and errno set on error. */
+int
+trace_open(
+        const char *path);
+
+/* Add an event to the trace of the calling thread (use the
+ * TRACE() macro instead).  Threads get their ring on their first
+ * event, and if there's none left, their events are lost.
+ *
+ * @param ev the event.
+ * @param chan the channel (or other object) of the event.
+ * @param a, b, c the arguments of the event. */
+void
+trace_put(
+        enum trace_event    ev,
+        uint64_t            chan,
+        uint64_t            a,
+        uint64_t            b,
+        uint64_t            c);
+
+/* Add a TRC_CHAN event with the name of a channel.
+ *
+ * @param chan the channel.
+ * @param name its name (only the first eight chars). */
+void
+trace_chan(
+        const void *chan,
+        const char *name);
+
+#endif /* _TRACE_H */